@@ -29,8 +29,11 @@ along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "About.h"
 #include "CdRom.h"
+#include "FileCache.h"
 #include "KeyBinds.h"
 #include "Hash.h"
+#include "HashReader.h"
+#include "Metrics.h"
 #include "Util.h"
 
 #include "Gl.h"
@@ -40,6 +43,7 @@ along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <assert.h>
 #include <chrono>
+#include <memory>
 #include <time.h>
 #include <math.h>
 #include <sys/stat.h>
@@ -52,8 +56,9 @@ along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
 
 #define TAG "[APP] "
 
-//#define DISPLAY_FRAMERATE 1
-//#define DEBUG_FRAMERATE 1
+/* zipped content at least this big is extracted to the disk once instead of on every load */
+#define MIN_CACHED_UNZIP_SIZE (8 * 1024 * 1024)
+#define MAX_CACHED_UNZIP_SIZE (4ULL * 1024 * 1024 * 1024)
 
 HWND g_mainWindow;
 Application app;
@@ -95,6 +100,10 @@ bool Application::init(const char* title, int width, int height)
   }
   inited = kNothingInited;
 
+  /* startup timeline, logged once everything is up */
+  const auto tStart = std::chrono::steady_clock::now();
+  std::chrono::steady_clock::time_point tConfig, tSdl, tGl, tComponents, tCores, tSettings, tRaInit;
+
   if (!_logger.init())
   {
     goto error;
@@ -116,6 +125,8 @@ bool Application::init(const char* title, int width, int height)
 
   inited = kConfigInited;
 
+  tConfig = std::chrono::steady_clock::now();
+
   if (!_allocator.init(&_logger))
   {
     _logger.error(TAG "Failed to initialize the allocator");
@@ -133,6 +144,8 @@ bool Application::init(const char* title, int width, int height)
 
   inited = kSdlInited;
 
+  tSdl = std::chrono::steady_clock::now();
+
   // Setup window
   if (SDL_GL_LoadLibrary(NULL) != 0)
   {
@@ -177,31 +190,20 @@ bool Application::init(const char* title, int width, int height)
 
   inited = kGlInited;
 
-  // Init audio
-  SDL_AudioSpec want;
-  memset(&want, 0, sizeof(want));
+  tGl = std::chrono::steady_clock::now();
 
-  want.freq = 44100;
-  want.format = AUDIO_S16SYS;
-  want.channels = 2;
-  want.samples = 1024;
-  want.callback = s_audioCallback;
-  want.userdata = this;
-
-  _audioDev = SDL_OpenAudioDevice(NULL, 0, &want, &_audioSpec, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_CHANNELS_CHANGE);
+  // Init audio
+  _lowLatencyAudio = false;
 
-  if (_audioDev == 0)
+  if (!openAudioDevice(44100, 2, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_CHANNELS_CHANGE))
   {
-    _logger.error(TAG "SDL_OpenAudioDevice: %s", SDL_GetError());
     goto error;
   }
 
-  _logger.info(TAG "Initialized audio device. %d channels@%dHz (format:%04X, silence:%d, samples:%d, padding:%d, size:%d)",
-    _audioSpec.channels, _audioSpec.freq, _audioSpec.format, _audioSpec.silence, _audioSpec.samples, _audioSpec.padding, _audioSpec.size);
-
   inited = kAudioDeviceInited;
 
-  if (!_fifo.init(_audioSpec.size * 4))
+  // sized for the normal device buffer, low latency mode only uses part of it
+  if (!_fifo.init(kAudioSamples * 4 * _audioSpec.channels * sizeof(int16_t)))
   {
     _logger.error(TAG "Error initializing the audio FIFO");
     goto error;
@@ -209,7 +211,10 @@ bool Application::init(const char* title, int width, int height)
 
   inited = kFifoInited;
 
-  SDL_PauseAudioDevice(_audioDev, 0);
+  // the device stays paused until a game runs, see updateAudioState
+  _audioRunning = false;
+  _audioCounters.calls = _audioCounters.shortCalls = 0;
+  _audioCounters.paddedBytes = 0;
 
   // Initialize the rest of the components
   if (!_audio.init(&_logger, (double)_audioSpec.freq, _audioSpec.channels, &_fifo))
@@ -217,6 +222,8 @@ bool Application::init(const char* title, int width, int height)
     goto error;
   }
 
+  _audio.setDevice(_audioSpec.samples, false);
+
   inited = kAudioInited;
 
   if (!_input.init(&_logger))
@@ -248,6 +255,8 @@ bool Application::init(const char* title, int width, int height)
 
   inited = kVideoInited;
 
+  tComponents = std::chrono::steady_clock::now();
+
   {
     SDL_SysWMinfo wminfo;
     SDL_VERSION(&wminfo.version);
@@ -272,11 +281,38 @@ bool Application::init(const char* title, int width, int height)
       goto error;
     }
 
+    tCores = std::chrono::steady_clock::now();
+
+    _keepCoresLoaded = _preloadCores = false;
+    _lateInput = _latencyTest = false;
+    _turboSpeed = 0;
+    _turboStretch = false;
+    _turbo.active = false;
+    _turbo.skipMicros = _turbo.renderMicros = 0.0;
+    _preloaded = NULL;
+
     buildSystemsMenu();
     loadConfiguration();
+    CheckMenuItem(_menu, IDM_MEMORY_SNAPSHOT, _memory.snapshot() ? MF_CHECKED : MF_UNCHECKED);
+    CheckMenuItem(_menu, IDM_KEEP_CORES_LOADED, _keepCoresLoaded ? MF_CHECKED : MF_UNCHECKED);
+    CheckMenuItem(_menu, IDM_PRELOAD_CORES, _preloadCores ? MF_CHECKED : MF_UNCHECKED);
+    setLateInput(_lateInput);
+    CheckMenuItem(_menu, IDM_LOW_LATENCY_AUDIO, _lowLatencyAudio ? MF_CHECKED : MF_UNCHECKED);
+
+    if (_lowLatencyAudio)
+      reopenAudioDevice();
+
+    _input.setPressLatched([this](uint32_t ticks) {
+      if (_latencyTest)
+        _video.flash(ticks);
+    });
+
+    tSettings = std::chrono::steady_clock::now();
 
     extern void RA_Init(HWND hwnd);
     RA_Init(g_mainWindow);
+
+    tRaInit = std::chrono::steady_clock::now();
   }
 
   if (!_memory.init(&_logger))
@@ -284,17 +320,135 @@ bool Application::init(const char* title, int width, int height)
     goto error;
   }
 
+  if (!_memorySearch.init(&_logger, &_memory))
+  {
+    goto error;
+  }
+
   if (!_states.init(&_logger, &_config, &_video))
   {
     goto error;
   }
 
+  if (!_telemetry.init(&_logger))
+  {
+    goto error;
+  }
+
+  if (!metrics::init(&_logger))
+  {
+    goto error;
+  }
+
+  _overlayGlCalls = 0;
+  _overlayFrames = 0;
+  _overlayEvents = 0;
+  _eventsProcessed = _eventsCoalesced = 0;
+  _idling = false;
+  _idleState = Fsm::State::Start;
+  memset(&_overlayInput, 0, sizeof(_overlayInput));
+
+  if (!_scheduler.init(&_logger))
+  {
+    goto error;
+  }
+
+  if (!_threads.init(&_logger))
+  {
+    goto error;
+  }
+
+  if (!_runAhead.init(&_logger, &_input))
+  {
+    goto error;
+  }
+
+  if (!_rewind.init(&_logger))
+  {
+    goto error;
+  }
+
+  if (!_movie.init(&_logger))
+  {
+    goto error;
+  }
+
+  _input.setMovie(&_movie);
+
+  if (!_netplay.init(&_logger, &_input))
+  {
+    goto error;
+  }
+
+  if (!_recorder.init(&_logger))
+  {
+    goto error;
+  }
+
+  _video.setRecorder(&_recorder);
+  _audio.setRecorder(&_recorder);
+
+  // disc images read to hash them are still cached when the core boots them, 32-bit builds
+  // keep their address space for the core
+  fileCacheInit(&_logger, sizeof(void*) > 4 ? 256 * 1024 * 1024 : 64 * 1024 * 1024);
+
+  if (!_hashCache.init(&_logger, std::string(_config.getRootFolder()) + "RALibretro.hashes"))
+  {
+    goto error;
+  }
+
+  if (!_hasher.init(&_logger, "Hasher"))
+  {
+    goto error;
+  }
+
+  _screenshotWriter.init();
+
+  if (!_screenshots.init(&_logger, "Screenshots"))
+  {
+    goto error;
+  }
+
+  if (!_saver.init(&_logger, "Saver"))
+  {
+    goto error;
+  }
+
+  if (!_downloader.init(&_logger, "Downloader"))
+  {
+    goto error;
+  }
+
+  /* the index is only needed by the Manage Cores dialog, don't wait for it */
+  refreshCoreIndex(&_config, &_logger, &_downloader);
+
+  if (!_preloader.init(&_logger, "Preloader"))
+  {
+    goto error;
+  }
+
   SDL_EventState(SDL_SYSWMEVENT, SDL_ENABLE);
   _coreName.clear();
   _validSlots = 0;
+  _rewinding = false;
+  _memoryMapVersion = 0;
+  _loadTiming = false;
   lastHardcore = hardcore();
   updateMenu();
-  updateCDMenu(NULL, 0, true);
+  updateCDMenu(true);
+  preloadCore();
+
+  {
+    const auto tEnd = std::chrono::steady_clock::now();
+    const auto ms = [](std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to) {
+      return (long long)std::chrono::duration_cast<std::chrono::milliseconds>(to - from).count();
+    };
+
+    _logger.info(TAG "Started in %lld ms (config %lld ms, SDL %lld ms, window and GL %lld ms, components %lld ms, cores %lld ms, settings %lld ms, RA_Init %lld ms, rest %lld ms)",
+      ms(tStart, tEnd), ms(tStart, tConfig), ms(tConfig, tSdl), ms(tSdl, tGl), ms(tGl, tComponents),
+      ms(tComponents, tCores), ms(tCores, tSettings), ms(tSettings, tRaInit), ms(tRaInit, tEnd));
+  }
+
   return true;
 
 error:
@@ -322,92 +476,339 @@ error:
 
 void Application::processEvents()
 {
-  SDL_Event event;
-  if (!SDL_PollEvent(&event))
-    return;
+  // lines from the audio callback and other threads
+  _logger.flush();
+  metrics::sample();
 
-  do
+  for (const auto& deferred : _deferredActions)
+    handle(deferred.first, deferred.second);
+
+  _deferredActions.clear();
+
+  SDL_PumpEvents();
+
+  SDL_Event events[kEventBatch];
+  int count = SDL_PeepEvents(events, kEventBatch, SDL_GETEVENT, SDL_FIRSTEVENT, SDL_LASTEVENT);
+
+  // no early return when the queue is empty, the workers below are polled on every call
+  while (count > 0)
   {
-    switch (event.type)
-    {
-      case SDL_QUIT:
-        _fsm.quit();
-        break;
+    // only the last motion of each axis in the batch is dispatched, sticks can send hundreds of
+    // them per frame and each one would otherwise go all the way to the input component. motions
+    // on a different side of the digital threshold than the next one kept are dispatched too, or
+    // a trigger pressed and released within the batch would never be seen as pressed
+    bool latest[kEventBatch];
+    uint32_t axes[kEventBatch];
+    int zones[kEventBatch];
+    int axisCount = 0;
 
-      case SDL_CONTROLLERDEVICEADDED:
-      case SDL_CONTROLLERDEVICEREMOVED:
-        _input.processEvent(&event, &_keybinds);
-        break;
+    for (int i = count; i-- > 0;)
+    {
+      latest[i] = true;
 
-      case SDL_CONTROLLERBUTTONUP:
-      case SDL_CONTROLLERBUTTONDOWN:
+      if (events[i].type == SDL_CONTROLLERAXISMOTION)
       {
-        unsigned extra;
-        KeyBinds::Action action = _keybinds.translate(&event.cbutton, &extra);
-        handle(action, extra);
-        break;
+        const uint32_t axis = (uint32_t)events[i].caxis.which << 8 | events[i].caxis.axis;
+        const int threshold = static_cast<int>(32767 * _input.getJoystickSensitivity(events[i].caxis.which));
+        const int zone = events[i].caxis.value > threshold ? 1 : events[i].caxis.value < -threshold ? -1 : 0;
+        int j = 0;
+
+        while (j < axisCount && axes[j] != axis)
+          j++;
+
+        if (j == axisCount)
+        {
+          axes[axisCount++] = axis;
+          zones[j] = zone;
+        }
+        else if (zones[j] != zone)
+          zones[j] = zone;
+        else
+        {
+          latest[i] = false;
+          _eventsCoalesced++;
+        }
       }
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+      if (!latest[i])
+        continue;
 
-      case SDL_CONTROLLERAXISMOTION:
+      const SDL_Event* event = &events[i];
+      _input.setEventTimestamp(event->common.timestamp);
+      _eventsProcessed++;
+
+      switch (event->type)
       {
-        KeyBinds::Action action1, action2;
-        unsigned extra1, extra2;
-        _keybinds.translate(&event.caxis, _input, &action1, &extra1, &action2, &extra2);
-        if (action1 != action2)
-          handle(action1, extra1);
-        handle(action2, extra2);
-        break;
-      }
+        case SDL_QUIT:
+          _fsm.quit();
+          break;
 
-      case SDL_MOUSEMOTION:
-        handle(&event.motion);
-        break;
+        case SDL_JOYDEVICEADDED:
+        case SDL_CONTROLLERDEVICEADDED:
+        case SDL_CONTROLLERDEVICEREMOVED:
+          _input.processEvent(event, &_keybinds);
+          break;
 
-      case SDL_MOUSEBUTTONUP:
-      case SDL_MOUSEBUTTONDOWN:
-        handle(&event.button);
-        break;
+        case SDL_CONTROLLERBUTTONUP:
+        case SDL_CONTROLLERBUTTONDOWN:
+        {
+          unsigned extra;
+          KeyBinds::Action action = _keybinds.translate(&event->cbutton, &extra);
+          handle(action, extra);
+          break;
+        }
 
-      case SDL_SYSWMEVENT:
-        handle(&event.syswm);
-        break;
+        case SDL_CONTROLLERAXISMOTION:
+        {
+          KeyBinds::Action action1, action2;
+          unsigned extra1, extra2;
+          _keybinds.translate(&event->caxis, _input, &action1, &extra1, &action2, &extra2);
+          if (action1 != action2)
+            handle(action1, extra1);
+          handle(action2, extra2);
+          break;
+        }
 
-      case SDL_KEYUP:
-      case SDL_KEYDOWN:
-      {
-        unsigned extra;
-        KeyBinds::Action action = _keybinds.translate(&event.key, &extra);
-        handle(action, extra);
-        break;
-      }
+        case SDL_MOUSEMOTION:
+          handle(&event->motion);
+          break;
 
-      case SDL_WINDOWEVENT:
-        handle(&event.window);
-        break;
+        case SDL_MOUSEBUTTONUP:
+        case SDL_MOUSEBUTTONDOWN:
+          handle(&event->button);
+          break;
+
+        case SDL_SYSWMEVENT:
+          handle(&event->syswm);
+          break;
+
+        case SDL_KEYUP:
+        case SDL_KEYDOWN:
+        {
+          unsigned extra;
+          KeyBinds::Action action = _keybinds.translate(&event->key, &extra);
+          handle(action, extra);
+          break;
+        }
+
+        case SDL_WINDOWEVENT:
+          handle(&event->window);
+          break;
+      }
     }
-  } while (SDL_PollEvent(&event));
+
+    count = SDL_PeepEvents(events, kEventBatch, SDL_GETEVENT, SDL_FIRSTEVENT, SDL_LASTEVENT);
+  }
 
   if (hardcore() != lastHardcore)
   {
     lastHardcore = hardcore();
     updateMenu();
+
+    // don't let a softcore history leak into a later session
+    if (lastHardcore)
+    {
+      _rewind.reset();
+      _netplay.stop();
+    }
+  }
+
+  _video.pollReadbacks();
+  _states.poll();
+  _hasher.poll();
+  _screenshots.poll();
+  _saver.poll();
+  _recorder.poll();
+  _downloader.poll();
+}
+
+void Application::pumpInput()
+{
+  // called from inside the core's frame, only the events that end up in its input are handled
+  // now, everything else stays in the queue for processEvents
+  SDL_PumpEvents();
+
+  SDL_Event events[32];
+  int count;
+
+  while ((count = SDL_PeepEvents(events, 32, SDL_GETEVENT, SDL_KEYDOWN, SDL_KEYUP)) > 0 ||
+         (count = SDL_PeepEvents(events, 32, SDL_GETEVENT, SDL_CONTROLLERAXISMOTION, SDL_CONTROLLERBUTTONUP)) > 0)
+  {
+    for (int i = 0; i < count; i++)
+    {
+      const SDL_Event* event = &events[i];
+      _input.setEventTimestamp(event->common.timestamp);
+
+      switch (event->type)
+      {
+        case SDL_KEYUP:
+        case SDL_KEYDOWN:
+        {
+          unsigned extra;
+          KeyBinds::Action action = _keybinds.translate(&event->key, &extra);
+          handleInput(action, extra);
+          break;
+        }
+
+        case SDL_CONTROLLERBUTTONUP:
+        case SDL_CONTROLLERBUTTONDOWN:
+        {
+          unsigned extra;
+          KeyBinds::Action action = _keybinds.translate(&event->cbutton, &extra);
+          handleInput(action, extra);
+          break;
+        }
+
+        case SDL_CONTROLLERAXISMOTION:
+        {
+          KeyBinds::Action action1, action2;
+          unsigned extra1, extra2;
+          _keybinds.translate(&event->caxis, _input, &action1, &extra1, &action2, &extra2);
+          if (action1 != action2)
+            handleInput(action1, extra1);
+          handleInput(action2, extra2);
+          break;
+        }
+      }
+    }
+  }
+}
+
+void Application::handleInput(KeyBinds::Action action, unsigned extra)
+{
+  // hotkeys can unload the game or load a state, the core is in the middle of a frame
+  if ((action >= KeyBinds::Action::kButtonUp && action <= KeyBinds::Action::kAxisRightY) || action == KeyBinds::Action::kKeyboardInput)
+    handle(action, extra);
+  else if (action != KeyBinds::Action::kNothing)
+    _deferredActions.push_back(std::make_pair(action, extra));
+}
+
+bool Application::openAudioDevice(int freq, int channels, int allowedChanges)
+{
+  SDL_AudioSpec want;
+  memset(&want, 0, sizeof(want));
+
+  want.freq = freq;
+  want.format = AUDIO_S16SYS;
+  want.channels = channels;
+  want.samples = _lowLatencyAudio ? kLowLatencyAudioSamples : kAudioSamples;
+  want.callback = s_audioCallback;
+  want.userdata = this;
+
+  _audioDev = SDL_OpenAudioDevice(NULL, 0, &want, &_audioSpec, allowedChanges);
+
+  if (_audioDev == 0)
+  {
+    _logger.error(TAG "SDL_OpenAudioDevice: %s", SDL_GetError());
+    return false;
+  }
+
+  _logger.info(TAG "Initialized audio device. %d channels@%dHz (format:%04X, silence:%d, samples:%d, padding:%d, size:%d)",
+    _audioSpec.channels, _audioSpec.freq, _audioSpec.format, _audioSpec.silence, _audioSpec.samples, _audioSpec.padding, _audioSpec.size);
+
+  return true;
+}
+
+void Application::reopenAudioDevice()
+{
+  // closing waits for the callback to return, the FIFO is ours until the new device starts
+  SDL_CloseAudioDevice(_audioDev);
+  _threads.audioDeviceClosed();
+
+  // the rest of the audio path was set up for this rate and channel count, SDL converts if needed
+  const int freq = _audioSpec.freq;
+  const int channels = _audioSpec.channels;
+
+  if (!openAudioDevice(freq, channels, 0))
+  {
+    _lowLatencyAudio = false;
+    CheckMenuItem(_menu, IDM_LOW_LATENCY_AUDIO, MF_UNCHECKED);
+
+    if (!openAudioDevice(freq, channels, 0))
+      return;
+  }
+
+  _fifo.reset();
+  _audio.setDevice(_audioSpec.samples, _lowLatencyAudio);
+
+  if (_audioRunning.load(std::memory_order_relaxed))
+    SDL_PauseAudioDevice(_audioDev, 0);
+}
+
+void Application::setLateInput(bool enabled)
+{
+  _lateInput = enabled;
+  CheckMenuItem(_menu, IDM_LATE_INPUT, _lateInput ? MF_CHECKED : MF_UNCHECKED);
+
+  if (_lateInput)
+    _input.setLatePoll([this]() { pumpInput(); });
+  else
+    _input.setLatePoll(std::function<void()>());
+}
+
+void Application::doAchievementsFrame()
+{
+  // the core told us its memory moved, or it hasn't exposed any yet
+  if (_core.getMemoryMapVersion() != _memoryMapVersion || _memory.waiting())
+    refreshMemoryMap();
+
+  // achievements read from a copy of the memory they use, taken once for the whole frame
+  _memory.beginFrame();
+  RA_DoAchievementsFrame();
+  _memory.endFrame();
+
+  if (_loadTiming)
+  {
+    const auto tFirstFrame = std::chrono::steady_clock::now();
+    _logger.info(TAG "First frame ran %lld ms after the game started loading",
+      (long long)std::chrono::duration_cast<std::chrono::milliseconds>(tFirstFrame - _loadStart).count());
+
+    _loadTiming = false;
   }
 }
 
+bool Application::netplayBlocks(const char* action)
+{
+  // both sides must run the same frames from the same state, anything that runs frames outside of
+  // Netplay::step or changes the state behind its back would desync them
+  if (!_netplay.connected())
+    return false;
+
+  _logger.warn(TAG "Can't %s during netplay", action);
+  return true;
+}
+
 void Application::runTurbo()
 {
+  if (netplayBlocks("fast forward"))
+  {
+    _config.setFastForwarding(false);
+    return;
+  }
+
+  _audio.setFastForwarding(true);
+
+  if (_turboSpeed != 0)
+  {
+    runAdaptiveTurbo();
+    return;
+  }
+
   const auto tTurboStart = std::chrono::steady_clock::now();
 
   // do four frames without video or audio
   for (int i = 0; i < 4; i++)
   {
     _core.step(false, false);
-    RA_DoAchievementsFrame();
+    doAchievementsFrame();
   }
 
   // do a final frame with video and no audio
   _core.step(true, false);
-  RA_DoAchievementsFrame();
+  doAchievementsFrame();
 
   // check for periodic SRAM flush
   _states.periodicSaveSRAM(&_core);
@@ -418,7 +819,315 @@ void Application::runTurbo()
   // throttle turbo to a maximum of 300 frames per second to simulate vsync in case its off
   if (tTurboElapsed < std::chrono::milliseconds(15))
   {
-    SDL_Delay((Uint32)((std::chrono::milliseconds(15) - tTurboElapsed).count()));
+    _scheduler.sleep(std::chrono::duration<double>(std::chrono::milliseconds(15) - tTurboElapsed).count());
+  }
+}
+
+void Application::runAdaptiveTurbo()
+{
+  const auto tTurboStart = std::chrono::steady_clock::now();
+  const double fps = _core.getSystemAVInfo()->timing.fps;
+
+  if (!_turbo.active)
+  {
+    // the frame costs are kept from the last time, they're still a better guess than nothing
+    SDL_DisplayMode mode;
+    const int refreshRate = SDL_GetWindowDisplayMode(_window, &mode) == 0 && mode.refresh_rate > 0 ? mode.refresh_rate : 60;
+
+    _turbo.active = true;
+    _turbo.period = 1.0 / refreshRate;
+    _turbo.credit = _turbo.audioCredit = 0.0;
+    _turbo.last = tTurboStart;
+
+    _audio.setTimeStretch(_turboStretch);
+  }
+
+  // the audio plays in real time, a frame of it is owed for every frame period that passed
+  double elapsed = std::chrono::duration<double>(tTurboStart - _turbo.last).count();
+  _turbo.last = tTurboStart;
+
+  if (_turboStretch)
+  {
+    _turbo.audioCredit += (elapsed < 0.1 ? elapsed : 0.1) * fps;
+
+    if (_turbo.audioCredit > 2.0)
+      _turbo.audioCredit = 2.0;
+  }
+
+  // as many frames without video as fit in a refresh along with the one that's shown
+  const unsigned kMaxFrames = 1000;
+  const double budget = _turbo.period * 1000000.0;
+  unsigned count = kMaxFrames;
+
+  if (_turbo.skipMicros > 0.0 && budget > _turbo.renderMicros)
+  {
+    const double fit = 1.0 + (budget - _turbo.renderMicros) / _turbo.skipMicros;
+    count = fit < kMaxFrames ? (unsigned)fit : kMaxFrames;
+  }
+  else if (_turbo.skipMicros > 0.0 || _turbo.renderMicros > 0.0)
+  {
+    count = 1;
+  }
+  else
+  {
+    // nothing measured yet
+    count = 2;
+  }
+
+  if (_turboSpeed > 0)
+  {
+    _turbo.credit += _turboSpeed * fps * _turbo.period;
+
+    const unsigned owed = (unsigned)_turbo.credit;
+
+    // a machine that can't reach the speed doesn't owe the frames it couldn't run, only the
+    // fraction of a frame carries over
+    if (owed < count)
+      count = owed;
+
+    _turbo.credit -= owed;
+  }
+
+  for (unsigned i = 0; i < count; i++)
+  {
+    const bool video = i == count - 1;
+    const bool audio = _turbo.audioCredit >= 1.0;
+
+    if (audio)
+      _turbo.audioCredit -= 1.0;
+
+    // the swap waits for vsync, it's not what the frame costs
+    const uint64_t swap = _videoContext.getSwapMicros();
+    const auto tFrameStart = std::chrono::steady_clock::now();
+
+    _core.step(video, audio);
+    doAchievementsFrame();
+
+    const auto tFrameEnd = std::chrono::steady_clock::now();
+    double micros = (double)std::chrono::duration_cast<std::chrono::microseconds>(tFrameEnd - tFrameStart).count();
+    micros -= (double)(_videoContext.getSwapMicros() - swap);
+
+    if (micros < 1.0)
+      micros = 1.0;
+
+    double& cost = video ? _turbo.renderMicros : _turbo.skipMicros;
+    cost = cost == 0.0 ? micros : cost + (micros - cost) * 0.1;
+  }
+
+  // check for periodic SRAM flush
+  _states.periodicSaveSRAM(&_core);
+
+  // with vsync the swap already waited for the refresh
+  const auto tTurboEnd = std::chrono::steady_clock::now();
+  const double spent = std::chrono::duration<double>(tTurboEnd - tTurboStart).count();
+
+  if (spent < _turbo.period)
+    _scheduler.sleep(_turbo.period - spent);
+}
+
+static const int s_turboSpeeds[] = { 0, 2, 3, 4, 6, 8, 16, -1 };
+
+static const char* s_getTurboSpeedOptions(int index, void* udata)
+{
+  (void)udata;
+
+  switch (index)
+  {
+    case 0: return "Classic (five frames at a time)";
+    case 1: return "2x";
+    case 2: return "3x";
+    case 3: return "4x";
+    case 4: return "6x";
+    case 5: return "8x";
+    case 6: return "16x";
+    case 7: return "Uncapped";
+    default: return NULL;
+  }
+}
+
+void Application::showTurboDialog()
+{
+  const WORD WIDTH = 200;
+  const WORD LINE = 15;
+
+  Dialog db;
+  db.init("Turbo Settings");
+
+  WORD y = 0;
+
+  int speed = 0;
+  for (unsigned i = 0; i < sizeof(s_turboSpeeds) / sizeof(s_turboSpeeds[0]); ++i)
+  {
+    if (s_turboSpeeds[i] == _turboSpeed)
+    {
+      speed = i;
+      break;
+    }
+  }
+  db.addLabel("Speed", 51201, 0, y, 60, 8);
+  db.addCombobox(51202, 65, y - 2, WIDTH - 65, 12, 120, s_getTurboSpeedOptions, NULL, &speed);
+  y += LINE;
+
+  bool stretch = _turboStretch;
+  db.addCheckbox("Play sped up audio instead of muting it", 51203, 0, y, WIDTH, 8, &stretch);
+  y += LINE;
+
+  db.addButton("OK", IDOK, WIDTH - 55 - 50, y, 50, 14, true);
+  db.addButton("Cancel", IDCANCEL, WIDTH - 50, y, 50, 14, false);
+
+  if (db.show())
+  {
+    _turboSpeed = s_turboSpeeds[speed];
+    _turboStretch = stretch;
+
+    // picked up by the next fast forwarded frame
+    _turbo.active = false;
+    _audio.setTimeStretch(false);
+  }
+}
+
+void Application::step(bool generateVideo, FrameTelemetry::Frame* frame)
+{
+  _audio.setFastForwarding(false);
+
+  if (_turbo.active)
+  {
+    _turbo.active = false;
+    _audio.setTimeStretch(false);
+  }
+
+  // the video and audio components keep running totals, whatever they grew by happened inside this frame
+  const uint64_t upload = _video.getUploadMicros();
+  const uint64_t swap = _videoContext.getSwapMicros();
+  const uint64_t audioWait = _audio.getStats().waitMicros;
+  const uint64_t cycles = _threads.threadCycles();
+
+  const auto tStepStart = std::chrono::steady_clock::now();
+
+  if (_netplay.active())
+  {
+    // netplay does its own rollback, rewinding and running ahead would fight it
+    _netplay.step(&_core, generateVideo);
+    _runAhead.invalidate();
+  }
+  else if (_rewinding && _rewind.enabled(hardcore()))
+  {
+    // go back one snapshot and run a frame from there to show it, its audio would play forward
+    if (_rewind.pop(&_core))
+      _core.step(generateVideo, false);
+
+    _runAhead.invalidate();
+  }
+  else
+  {
+    if (_runAhead.enabled(hardcore()))
+    {
+      _runAhead.step(&_core, generateVideo);
+    }
+    else
+    {
+      // frames ran without run-ahead make the saved states useless
+      _runAhead.invalidate();
+      _core.step(generateVideo, true);
+    }
+
+    if (_rewind.enabled(hardcore()))
+      _rewind.capture(&_core);
+  }
+
+  const auto tStepEnd = std::chrono::steady_clock::now();
+
+  // a duped frame skips the upload and the swap, the time goes to the audio wait instead
+  if (generateVideo && _video.frameDuped() && frame->outcome == FrameTelemetry::Outcome::Rendered)
+    frame->outcome = FrameTelemetry::Outcome::Duped;
+
+  frame->micros[FrameTelemetry::kUpload] = (uint32_t)(_video.getUploadMicros() - upload);
+  frame->micros[FrameTelemetry::kSwap] = (uint32_t)(_videoContext.getSwapMicros() - swap);
+  frame->micros[FrameTelemetry::kAudioWait] = (uint32_t)(_audio.getStats().waitMicros - audioWait);
+
+  // whatever is left is the core itself
+  const uint32_t elapsed = (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(tStepEnd - tStepStart).count();
+  const uint32_t accounted = frame->micros[FrameTelemetry::kUpload] + frame->micros[FrameTelemetry::kSwap] + frame->micros[FrameTelemetry::kAudioWait];
+  frame->micros[FrameTelemetry::kRun] = elapsed > accounted ? elapsed - accounted : 0;
+
+  // the swap and the audio wait block on purpose, any other time the thread didn't run it was preempted
+  const uint32_t running = _threads.cyclesToMicros(_threads.threadCycles() - cycles);
+  const uint32_t blocked = frame->micros[FrameTelemetry::kSwap] + frame->micros[FrameTelemetry::kAudioWait];
+  const uint32_t busy = elapsed > blocked ? elapsed - blocked : 0;
+  frame->micros[FrameTelemetry::kPreempted] = busy > running ? busy - running : 0;
+}
+
+void Application::updateTelemetryOverlay(unsigned fps)
+{
+  char buffer[256];
+  GetWindowText(g_mainWindow, buffer, sizeof(buffer));
+
+  // strip the previous overlay, it always starts with our separator
+  char* ptr = strstr(buffer, " | ");
+  if (ptr == NULL)
+    ptr = buffer + strlen(buffer);
+
+  // average OpenGL calls per frame since the last update, the frame count goes back to zero on resets
+  const uint64_t glCalls = Gl::getCallCount();
+  const uint32_t frames = _telemetry.frames();
+  unsigned glCallsPerFrame = 0;
+  double eventsPerFrame = 0.0;
+
+  if (frames > _overlayFrames)
+  {
+    glCallsPerFrame = (unsigned)((glCalls - _overlayGlCalls) / (frames - _overlayFrames));
+    eventsPerFrame = (double)(_eventsProcessed - _overlayEvents) / (frames - _overlayFrames);
+  }
+
+  _overlayGlCalls = glCalls;
+  _overlayFrames = frames;
+  _overlayEvents = _eventsProcessed;
+
+  const std::string summary = _telemetry.summary(fps);
+  snprintf(ptr, sizeof(buffer) - (ptr - buffer), " | %s, %u GL calls, %.1f events", summary.c_str(), glCallsPerFrame, eventsPerFrame);
+  SetWindowText(g_mainWindow, buffer);
+}
+
+void Application::exportTelemetry()
+{
+  std::string extensions = "JSON Lines Files (*.jsonl)";
+  extensions.append("\0", 1);
+  extensions.append("*.jsonl");
+  extensions.append("\0", 1);
+  extensions.append("CSV Files (*.csv)");
+  extensions.append("\0", 1);
+  extensions.append("*.csv");
+  extensions.append("\0", 2);
+  std::string path = util::saveFileDialog(g_mainWindow, extensions);
+
+  if (!path.empty())
+  {
+    if (util::extension(path).empty())
+    {
+      path += ".csv";
+    }
+
+    _telemetry.exportFrames(path);
+  }
+}
+
+void Application::exportEnvCalls()
+{
+  std::string extensions = "CSV Files (*.csv)";
+  extensions.append("\0", 1);
+  extensions.append("*.csv");
+  extensions.append("\0", 2);
+  std::string path = util::saveFileDialog(g_mainWindow, extensions);
+
+  if (!path.empty())
+  {
+    if (util::extension(path).empty())
+    {
+      path += ".csv";
+    }
+
+    const std::string report = _core.getEnvReport();
+    util::saveFile(&_logger, path, report.c_str(), report.length());
   }
 }
 
@@ -427,9 +1136,6 @@ void Application::runSmoothed()
   const unsigned int TARGET_FRAMES = (int)round(_core.getSystemAVInfo()->timing.fps * 100);
   const unsigned int SMOOTHING_FRAMES = 64;
   uint32_t frameMicroseconds[SMOOTHING_FRAMES];
-#ifdef DEBUG_FRAMERATE
-  char renders[SMOOTHING_FRAMES + 1];
-#endif
   uint32_t totalMicroseconds;
   int frameIndex = 0;
   int nFaults = 0;
@@ -452,10 +1158,6 @@ void Application::runSmoothed()
   int totalDroppedFrames = 0;
   int totalSkippedFrames = 0;
 
-#ifdef DEBUG_FRAMERATE
-  memset(renders, 0, sizeof(renders));
-#endif
-
   for (unsigned int i = 0; i < SMOOTHING_RATES; ++i)
     skipRates[i] = SMOOTHING_FRAMES * 100;
   totalSkipRate = SMOOTHING_FRAMES * 100 * SMOOTHING_RATES;
@@ -485,8 +1187,12 @@ void Application::runSmoothed()
   constexpr int STARTUP_FRAMES = 2;
   for (int i = 0; i < STARTUP_FRAMES; ++i)
   {
-    _core.step(true, true);
-    RA_DoAchievementsFrame();
+    if (_netplay.active())
+      _netplay.step(&_core, true);
+    else
+      _core.step(true, true);
+
+    doAchievementsFrame();
   }
 
   const auto tFirstFrameEnd = std::chrono::steady_clock::now();
@@ -497,28 +1203,40 @@ void Application::runSmoothed()
     frameMicroseconds[i] = firstFrameElapsedMicroseconds;
   totalMicroseconds = firstFrameElapsedMicroseconds * SMOOTHING_FRAMES;
 
-#ifdef DEBUG_FRAMERATE
   {
     const unsigned int fps = (SMOOTHING_FRAMES * 1000000) / (totalMicroseconds / 100);
-    _logger.info(TAG "FPS: initial frames, fps:%u.%02u", fps / 100, fps % 100);
+    _logger.debug(TAG "FPS: initial frames, fps:%u.%02u", fps / 100, fps % 100);
   }
-#endif
+
+  auto tPreviousStart = tFirstFrameEnd;
+  bool previousKnown = false;
 
   // our rolling window has been populated with data from the startup frames, start the processing loop
   do
   {
     auto tFrameStart = std::chrono::steady_clock::now();
 
+    FrameTelemetry::Frame frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.outcome = FrameTelemetry::Outcome::Rendered;
+
+    if (previousKnown)
+      frame.micros[FrameTelemetry::kInterval] = (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(tFrameStart - tPreviousStart).count();
+
+    tPreviousStart = tFrameStart;
+    previousKnown = true;
+
     processEvents();
 
-    // state is not running - return to outer handler
-    if (_fsm.currentState() != Fsm::State::GameRunning)
+    // state is not running or the pacing mode changed - return to outer handler
+    if (_fsm.currentState() != Fsm::State::GameRunning || _video.getFramePacing() != Video::FramePacing::Adaptive)
       break;
 
     // handle fast forwarding
     if (_config.getFastForwarding())
     {
       runTurbo();
+      previousKnown = false;
       continue;
     }
 
@@ -526,22 +1244,16 @@ void Application::runSmoothed()
     if (!skipFrame)
     {
       // render it
-      _core.step(true, true);
+      step(true, &frame);
 
       // check for periodic SRAM flush
       _states.periodicSaveSRAM(&_core);
 
       skippedFrames = 0;
-
-#ifdef DEBUG_FRAMERATE
-      renders[frameIndex] = '-';
-#endif
     }
     else
     {
-#ifdef DEBUG_FRAMERATE
-      renders[frameIndex] = (skipFrame == SKIP_PLANNED) ? '.' : '_';
-#endif
+      frame.outcome = (skipFrame == SKIP_PLANNED) ? FrameTelemetry::Outcome::Skipped : FrameTelemetry::Outcome::Dropped;
 
       if (skipFrame == SKIP_PLANNED)
         ++totalSkippedFrames;
@@ -554,38 +1266,43 @@ void Application::runSmoothed()
         skippedFrames = 0;
 
         // render it
-        _core.step(true, true);
+        step(true, &frame);
 
         // check for periodic SRAM flush
         _states.periodicSaveSRAM(&_core);
 
-#ifdef DEBUG_FRAMERATE
-        renders[frameIndex] = 'F';
-#endif
+        frame.outcome = FrameTelemetry::Outcome::Fault;
       }
       else
       {
         // dont render it
-        _core.step(false, true);
+        step(false, &frame);
       }
     }
 
-    RA_DoAchievementsFrame();
+    const auto tAchievementsStart = std::chrono::steady_clock::now();
+    doAchievementsFrame();
 
     const auto tFrameEnd = std::chrono::steady_clock::now();
     const auto tFrameElapsed = std::chrono::duration_cast<std::chrono::microseconds>(tFrameEnd - tFrameStart);
 
+    frame.micros[FrameTelemetry::kAchievements] = (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(tFrameEnd - tAchievementsStart).count();
+    frame.micros[FrameTelemetry::kTotal] = (uint32_t)tFrameElapsed.count();
+
     if (tFrameElapsed > std::chrono::milliseconds(500))
     {
       // processEvents will block while the user is interacting with the UI. treat this frame
       // as a fault and ignore it. If the framerate returns to normal, it'll be canceled out.
-#ifdef DEBUG_FRAMERATE
-      renders[frameIndex] = 'X';
-#endif
+      frame.outcome = FrameTelemetry::Outcome::Stalled;
+      _telemetry.record(frame);
+
       skipFrame = 0;
+      previousKnown = false;
       continue;
     }
 
+    _telemetry.record(frame);
+
     totalMicroseconds -= frameMicroseconds[frameIndex];
     const auto frameElapsedMicroseconds = (uint32_t)tFrameElapsed.count();
     frameMicroseconds[frameIndex] = frameElapsedMicroseconds;
@@ -606,25 +1323,13 @@ void Application::runSmoothed()
 
     if (frameIndex == 0)
     {
-#if DISPLAY_FRAMERATE
-      char buffer[256];
-      GetWindowText(g_mainWindow, buffer, sizeof(buffer));
-      char* ptr = buffer + strlen(buffer);
-      if (ptr[-3] == 'f' && ptr[-2] == 'p' && ptr[-1] == 's')
-      {
-        ptr -= 3;
-        while (*ptr != '-')
-          --ptr;
-        ptr--;
-      }
+      metrics::set(metrics::kFps, fps);
 
-      sprintf(ptr, " - %u.%02ufps", fps / 100, fps % 100);
-      SetWindowText(g_mainWindow, buffer);
-#endif
-#ifdef DEBUG_FRAMERATE
-      _logger.info(TAG "FPS: rendered frames %s (vsync %s %d)", renders, (SDL_GL_GetSwapInterval() == 1) ? "on" : "off", nRecoveries);
-      _logger.info(TAG "FPS: %u.%02u (%d skipped, %d dropped, %d faults)", fps / 100, fps % 100, totalSkippedFrames, totalDroppedFrames, nFaults);
-#endif
+      if (_telemetry.overlay())
+        updateTelemetryOverlay(fps);
+
+      _logger.debug(TAG "FPS: %u.%02u (%d skipped, %d dropped, %d faults, vsync %s %d)", fps / 100, fps % 100,
+        totalSkippedFrames, totalDroppedFrames, nFaults, (SDL_GL_GetSwapInterval() == 1) ? "on" : "off", nRecoveries);
 
       if (fps < TARGET_FRAMES * 3 / 4)
       {
@@ -634,9 +1339,7 @@ void Application::runSmoothed()
           if (SDL_GL_GetSwapInterval() == 1)
           {
             // try turning off VSYNC to see if we can achieve the target framerate
-#ifdef DEBUG_FRAMERATE
             _logger.info(TAG "FPS: disabling vsync");
-#endif
             SDL_GL_SetSwapInterval(0);
             vsyncOn = false;
           }
@@ -677,9 +1380,7 @@ void Application::runSmoothed()
         {
           if (SDL_GL_GetSwapInterval() == 1)
           {
-#ifdef DEBUG_FRAMERATE
             _logger.info(TAG "FPS: disabling vsync");
-#endif
             SDL_GL_SetSwapInterval(0);
             vsyncOn = false;
           }
@@ -697,9 +1398,7 @@ void Application::runSmoothed()
         {
           if (++nRecoveries == 5)
           {
-#ifdef DEBUG_FRAMERATE
             _logger.info(TAG "FPS: re-enabling vsync");
-#endif
             SDL_GL_SetSwapInterval(1);
             vsyncOn = true;
           }
@@ -721,27 +1420,165 @@ void Application::runSmoothed()
       else
       {
         nextSkip = skipRate;
-#ifdef DEBUG_FRAMERATE
-        _logger.info(TAG "FPS: skip rate set at %d.%02d", skipRate / 100, skipRate % 100);
-#endif
+        _logger.debug(TAG "FPS: skip rate set at %d.%02d", skipRate / 100, skipRate % 100);
+      }
+
+      totalSkippedFrames = 0;
+      totalDroppedFrames = 0;
+    }
+
+    if (nextSkip > 0)
+    {
+      if (nextSkip <= 100)
+      {
+        skipFrame = SKIP_PLANNED;
+        nextSkip += skipRate;
       }
 
-      totalSkippedFrames = 0;
-      totalDroppedFrames = 0;
+      nextSkip -= 100;
+    }
+
+  } while (true);
+}
+
+void Application::runScheduled()
+{
+  const Video::FramePacing pacing = _video.getFramePacing();
+  double fps = _core.getSystemAVInfo()->timing.fps;
+
+  // the timer paces the frames, vsync would only add its own wait on top of it unless the display
+  // waits for our frames
+  bool vsync = false;
+
+  // the deadlines are aligned to it when locked to the display, and again after fast forwarding
+  int64_t vblank = 0;
+
+  if (pacing == Video::FramePacing::Display)
+  {
+    const double refreshRate = _scheduler.measureDisplayRate(&vblank);
+
+    // only lock to the display if the audio rate control can absorb the difference, with half of
+    // its range left to keep the FIFO filled
+    if (refreshRate > 0.0 && fabs(refreshRate - fps) / fps <= _audio.maxDeviation() / 2.0)
+    {
+      _logger.info(TAG "locking %.3f fps to the %.3f Hz display", fps, refreshRate);
+      fps = refreshRate;
+    }
+    else
+    {
+      _logger.info(TAG "display refresh %.3f Hz is too far from %.3f fps, using the core rate", refreshRate, fps);
+      vblank = 0;
+    }
+
+    _scheduler.start(fps, vblank);
+  }
+  else if (pacing == Video::FramePacing::Variable)
+  {
+    // the compositor reports the highest rate of a variable refresh display
+    int64_t unused;
+    double refreshRate = _scheduler.measureDisplayRate(&unused);
+
+    SDL_DisplayMode displayMode;
+    if (refreshRate <= 0.0 && SDL_GetCurrentDisplayMode(0, &displayMode) == 0 && displayMode.refresh_rate > 0)
+      refreshRate = displayMode.refresh_rate;
+
+    if (refreshRate < fps)
+      _logger.info(TAG "display refresh %.3f Hz is below %.3f fps, presenting without vsync", refreshRate, fps);
+    else if (!_video.probeVariableRefresh(refreshRate))
+      _logger.warn(TAG "the display doesn't seem to support variable refresh, presenting without vsync");
+    else
+      vsync = true;
+
+    _scheduler.start(fps);
+  }
+  else
+  {
+    _scheduler.start(fps);
+  }
+
+  _logger.info(TAG "pacing frames at %.3f fps with a precise timer (vsync %s)", fps, vsync ? "on" : "off");
+  SDL_GL_SetSwapInterval(vsync ? 1 : 0);
+
+  auto tOverlayStart = std::chrono::steady_clock::now();
+  unsigned overlayFrames = 0;
+
+  auto tPreviousStart = tOverlayStart;
+  bool previousKnown = false;
+
+  do
+  {
+    const auto tFrameStart = std::chrono::steady_clock::now();
+
+    FrameTelemetry::Frame frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.outcome = FrameTelemetry::Outcome::Rendered;
+
+    // this is the cadence the frames are presented at, its variance is what the timer controls
+    if (previousKnown)
+      frame.micros[FrameTelemetry::kInterval] = (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(tFrameStart - tPreviousStart).count();
+
+    tPreviousStart = tFrameStart;
+    previousKnown = true;
+
+    processEvents();
+
+    // state is not running or the pacing mode changed - return to outer handler
+    if (_fsm.currentState() != Fsm::State::GameRunning || _video.getFramePacing() != pacing)
+      break;
+
+    // handle fast forwarding, the schedule starts over when we get back
+    if (_config.getFastForwarding())
+    {
+      runTurbo();
+
+      // the compositor's vblank keeps the deadlines in phase with the display
+      if (vblank != 0)
+        _scheduler.measureDisplayRate(&vblank);
+
+      _scheduler.start(fps, vblank);
+      previousKnown = false;
+      continue;
+    }
+
+    step(true, &frame);
+
+    // check for periodic SRAM flush
+    _states.periodicSaveSRAM(&_core);
+
+    const auto tAchievementsStart = std::chrono::steady_clock::now();
+    doAchievementsFrame();
+
+    const auto tFrameEnd = std::chrono::steady_clock::now();
+    const auto tFrameElapsed = std::chrono::duration_cast<std::chrono::microseconds>(tFrameEnd - tFrameStart);
+
+    frame.micros[FrameTelemetry::kAchievements] = (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(tFrameEnd - tAchievementsStart).count();
+    frame.micros[FrameTelemetry::kTotal] = (uint32_t)tFrameElapsed.count();
+
+    // processEvents blocks while the user is interacting with the UI, see runSmoothed
+    if (tFrameElapsed > std::chrono::milliseconds(500))
+    {
+      frame.outcome = FrameTelemetry::Outcome::Stalled;
+      previousKnown = false;
     }
 
-    if (nextSkip > 0)
+    _telemetry.record(frame);
+
+    if (++overlayFrames == 64)
     {
-      if (nextSkip <= 100)
-      {
-        skipFrame = SKIP_PLANNED;
-        nextSkip += skipRate;
-      }
+      const auto tOverlayEnd = std::chrono::steady_clock::now();
+      const auto tOverlayElapsed = std::chrono::duration_cast<std::chrono::microseconds>(tOverlayEnd - tOverlayStart);
 
-      nextSkip -= 100;
+      if (_telemetry.overlay())
+        updateTelemetryOverlay((unsigned)(overlayFrames * 100000000.0 / tOverlayElapsed.count()));
+
+      tOverlayStart = tOverlayEnd;
+      overlayFrames = 0;
     }
 
+    _scheduler.wait();
   } while (true);
+
+  SDL_GL_SetSwapInterval(1);
 }
 
 void Application::run()
@@ -759,15 +1596,22 @@ void Application::run()
       {
         case Fsm::State::GameRunning:
         {
+          if (_idling)
+            endIdle();
+
           if (_config.getFastForwarding())
           {
             // do five frames without audio
             runTurbo();
           }
-          else
+          else if (_video.getFramePacing() == Video::FramePacing::Adaptive)
           {
             runSmoothed();
           }
+          else
+          {
+            runScheduled();
+          }
           continue;
         }
 
@@ -779,8 +1623,11 @@ void Application::run()
 
         case Fsm::State::FrameStep:
           // do one frame without audio
-          _core.step(true, false);
-          RA_DoAchievementsFrame();
+          if (!netplayBlocks("step a frame"))
+          {
+            _core.step(true, false);
+            doAchievementsFrame();
+          }
 
           // set state to GamePaused
           _fsm.resumeGame();
@@ -790,20 +1637,8 @@ void Application::run()
           return;
       }
 
-      // handle overlay navigation
-      if (RA_IsOverlayFullyVisible())
-      {
-        ControllerInput input;
-        input.m_bUpPressed = _input.read(0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_UP) != 0;
-        input.m_bDownPressed = _input.read(0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_DOWN) != 0;
-        input.m_bLeftPressed = _input.read(0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_LEFT) != 0;
-        input.m_bRightPressed = _input.read(0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_RIGHT) != 0;
-        input.m_bConfirmPressed = _input.read(0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_A) != 0;
-        input.m_bCancelPressed = _input.read(0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_B) != 0;
-        input.m_bQuitPressed = _input.read(0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_START) != 0;
-
-        RA_NavigateOverlay(&input);
-      }
+      // nothing runs until the state changes, wait for input instead of spinning
+      idle();
     } while (true);
   }
   catch (std::exception ex) {
@@ -811,21 +1646,138 @@ void Application::run()
   }
 }
 
+void Application::idle()
+{
+  const auto now = std::chrono::steady_clock::now();
+  const Fsm::State state = _fsm.currentState();
+
+  if (!_idling)
+  {
+    _idling = true;
+    _idleStart = now;
+    _idleCpuStart = processCpuMicros();
+    _idleWakeups = 0;
+  }
+
+  // the overlay slides in after pausing, and animates for a bit after each navigation
+  if (state != _idleState)
+  {
+    _idleState = state;
+    _overlayAnimationEnd = now + std::chrono::milliseconds(kOverlayAnimationMs);
+  }
+
+  bool animating = now < _overlayAnimationEnd;
+
+  if (RA_IsOverlayFullyVisible())
+  {
+    // the core's snapshot isn't latched while paused, the overlay reads the controllers directly
+    Movie::Frame live;
+    _input.getLiveFrame(&live);
+    const unsigned buttons = (uint16_t)live.state[0];
+
+    ControllerInput input;
+    memset(&input, 0, sizeof(input));
+    input.m_bUpPressed = (buttons >> RETRO_DEVICE_ID_JOYPAD_UP) & 1;
+    input.m_bDownPressed = (buttons >> RETRO_DEVICE_ID_JOYPAD_DOWN) & 1;
+    input.m_bLeftPressed = (buttons >> RETRO_DEVICE_ID_JOYPAD_LEFT) & 1;
+    input.m_bRightPressed = (buttons >> RETRO_DEVICE_ID_JOYPAD_RIGHT) & 1;
+    input.m_bConfirmPressed = (buttons >> RETRO_DEVICE_ID_JOYPAD_A) & 1;
+    input.m_bCancelPressed = (buttons >> RETRO_DEVICE_ID_JOYPAD_B) & 1;
+    input.m_bQuitPressed = (buttons >> RETRO_DEVICE_ID_JOYPAD_START) & 1;
+
+    const bool pressed = input.m_bUpPressed || input.m_bDownPressed || input.m_bLeftPressed || input.m_bRightPressed ||
+      input.m_bConfirmPressed || input.m_bCancelPressed || input.m_bQuitPressed;
+
+    if (memcmp(&input, &_overlayInput, sizeof(input)) != 0)
+    {
+      _overlayInput = input;
+      _overlayAnimationEnd = now + std::chrono::milliseconds(kOverlayAnimationMs);
+      animating = true;
+    }
+
+    // held buttons repeat, so they're fed at the animation rate too. once the overlay is static
+    // it isn't redrawn until something changes
+    if (animating || pressed)
+    {
+      RA_NavigateOverlay(&input);
+      animating = true;
+    }
+  }
+
+  // whatever event ends the wait is left in the queue for processEvents
+  _idleWakeups++;
+  SDL_WaitEventTimeout(NULL, animating ? kOverlayFrameMs : kIdleTimeoutMs);
+}
+
+void Application::endIdle()
+{
+  _idling = false;
+  _idleState = Fsm::State::GameRunning;
+
+  const auto elapsed = std::chrono::steady_clock::now() - _idleStart;
+  const double seconds = std::chrono::duration<double>(elapsed).count();
+
+  if (seconds >= 1.0)
+  {
+    const double cpu = (double)(processCpuMicros() - _idleCpuStart) / 1e6;
+    _logger.info(TAG "Idle for %.1f s, %u wakeups, %.1f%% of a core used", seconds, _idleWakeups, cpu * 100.0 / seconds);
+  }
+}
+
+uint64_t Application::processCpuMicros()
+{
+  FILETIME creation, exit, kernel, user;
+
+  if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+    return 0;
+
+  const uint64_t k = (uint64_t)kernel.dwHighDateTime << 32 | kernel.dwLowDateTime;
+  const uint64_t u = (uint64_t)user.dwHighDateTime << 32 | user.dwLowDateTime;
+  return (k + u) / 10;
+}
+
 void Application::saveConfiguration()
 {
-  std::string json = "{";
+  JsonWriter json;
+  json.beginObject();
 
   // recent items
-  json += "\"recent\":";
-  json += serializeRecentList();
+  json.key("recent");
+  serializeRecentList(&json);
 
   // bindings
-  json += ",\"bindings\":";
-  json += _keybinds.serializeBindings();
+  json.key("bindings");
+  _keybinds.serializeBindings(&json);
 
   // saves
-  json += ",\"saves\":";
-  json += _states.serializeSettings();
+  json.key("saves").raw(_states.serializeSettings());
+
+  // memory
+  json.key("memory").raw(_memory.serializeSettings());
+
+  // cores
+  json.key("cores").beginObject();
+  json.key("keepLoaded").value(_keepCoresLoaded);
+  json.key("preload").value(_preloadCores);
+  json.endObject();
+
+  // thread scheduling
+  json.key("threads").raw(_threads.serializeSettings());
+
+  // audio
+  json.key("audio").beginObject().key("lowLatency").value(_lowLatencyAudio).endObject();
+
+  // input
+  json.key("input").beginObject().key("latePolling").value(_lateInput).endObject();
+
+  // turbo
+  json.key("turbo").beginObject();
+  json.key("speed").value(_turboSpeed);
+  json.key("stretchAudio").value(_turboStretch);
+  json.endObject();
+
+  // netplay
+  json.key("netplay").raw(_netplay.serialize());
 
   // window position
   const Uint32 flags = SDL_GetWindowFlags(_window);
@@ -836,11 +1788,11 @@ void Application::saveConfiguration()
   }
   else
   {
-    json += ",\"window\":{";
+    json.key("window").beginObject();
 
     int x, y;
     SDL_GetWindowPosition(_window, &x, &y);
-    json += "\"x\":" + std::to_string(x) + ",\"y\":" + std::to_string(y);
+    json.key("x").value(x).key("y").value(y);
 
     SDL_GetWindowSize(_window, &x, &y);
     switch (_video.getRotation())
@@ -858,15 +1810,34 @@ void Application::saveConfiguration()
         break;
     }
 
-    json += ",\"w\":" + std::to_string(x) + ",\"h\":" + std::to_string(y);
-
-    json += "}";
+    json.key("w").value(x).key("h").value(y);
+    json.endObject();
   }
 
   // complete and save
-  json += "}";
+  json.endObject();
+
+  saveJson(getConfigPath(), json.str());
+}
+
+void Application::saveJson(const std::string& path, const std::string& json)
+{
+  // nothing is written if the file already has the same contents
+  std::string& saved = _savedFiles[path];
 
-  util::saveFile(&_logger, getConfigPath(), json.c_str(), json.length());
+  if (saved == json)
+    return;
+
+  saved = json;
+
+  auto contents = std::make_shared<std::string>(json);
+  _saver.queue([path, contents](Logger* logger) {
+    return util::saveFileAtomic(logger, path, contents->c_str(), contents->length());
+  }, [this, path](bool ok) {
+    // try again on the next save
+    if (!ok)
+      _savedFiles.erase(path);
+  });
 }
 
 void Application::destroy()
@@ -874,9 +1845,32 @@ void Application::destroy()
   _logger.info(TAG "begin shutdown");
 
   saveConfiguration();
+  _saver.destroy();
+
+  // finish writing the save states while RAInterface can still be told about them
+  _states.destroy();
 
   RA_Shutdown();
 
+  _memorySearch.destroy();
+  cancelCoreIndex();
+  _downloader.destroy();
+  _preloader.destroy();
+  releasePreloadedCore();
+  _core.release();
+  _hasher.destroy();
+  _screenshots.destroy();
+  _screenshotWriter.destroy();
+  _hashCache.destroy();
+  _recorder.destroy();
+  _netplay.destroy();
+  _movie.destroy();
+  _rewind.destroy();
+  _runAhead.destroy();
+  _threads.destroy();
+  _scheduler.destroy();
+  _telemetry.destroy();
+  metrics::destroy();
   _video.destroy();
   _keybinds.destroy();
   _input.destroy();
@@ -909,10 +1903,7 @@ bool Application::loadCore(const std::string& coreName)
     return false;
   }
 
-  std::string path = _config.getRootFolder();
-  path += "Cores\\";
-  path += coreName;
-  path += ".dll";
+  std::string path = getCorePath(coreName);
 
   // open the core and fetch all the hooks
   if (!_core.loadCore(path.c_str()))
@@ -923,6 +1914,12 @@ bool Application::loadCore(const std::string& coreName)
     return false;
   }
 
+  // the core holds its own reference to the module now
+  if (path == _preloadedPath)
+  {
+    releasePreloadedCore();
+  }
+
   // let the user know if the core is no longer supported
   const std::string* deprecationMessage = getCoreDeprecationMessage(coreName);
   if (deprecationMessage)
@@ -936,6 +1933,8 @@ bool Application::loadCore(const std::string& coreName)
 
   if (data != NULL)
   {
+    _savedFiles[getCoreConfigPath(coreName)].assign((const char*)data, size);
+
     struct Deserialize
     {
       Application* self;
@@ -967,6 +1966,18 @@ bool Application::loadCore(const std::string& coreName)
         {
           ud->self->_video.deserialize(str);
         }
+        else if (ud->key == "audio")
+        {
+          ud->self->_audio.deserialize(str);
+        }
+        else if (ud->key == "runahead")
+        {
+          ud->self->_runAhead.deserialize(str);
+        }
+        else if (ud->key == "rewind")
+        {
+          ud->self->_rewind.deserialize(str);
+        }
       }
 
       return 0;
@@ -1011,7 +2022,10 @@ void Application::updateMenu()
     IDM_PAUSE_GAME, IDM_RESUME_GAME, IDM_RESET_GAME,
     IDM_EXIT,
 
-    IDM_CORE_CONFIG, IDM_VIDEO_CONFIG, IDM_TURBO_GAME, IDM_ABOUT
+    IDM_CORE_CONFIG, IDM_VIDEO_CONFIG, IDM_AUDIO_CONFIG, IDM_RUNAHEAD_CONFIG, IDM_REWIND_CONFIG, IDM_TURBO_GAME, IDM_ABOUT,
+    IDM_FRAME_TIMING_EXPORT, IDM_MEMORY_SEARCH,
+    IDM_RECORD_MOVIE, IDM_PLAY_MOVIE, IDM_STOP_MOVIE, IDM_ENV_CALLS_EXPORT, IDM_NETPLAY_CONFIG,
+    IDM_RECORD_VIDEO, IDM_STOP_VIDEO
   };
 
   static const UINT start_items[] =
@@ -1021,7 +2035,7 @@ void Application::updateMenu()
 
   static const UINT core_loaded_items[] =
   {
-    IDM_LOAD_GAME, IDM_EXIT, IDM_CORE_CONFIG, IDM_VIDEO_CONFIG, IDM_ABOUT
+    IDM_LOAD_GAME, IDM_EXIT, IDM_CORE_CONFIG, IDM_VIDEO_CONFIG, IDM_AUDIO_CONFIG, IDM_RUNAHEAD_CONFIG, IDM_REWIND_CONFIG, IDM_ABOUT
   };
 
   static const UINT game_running_items[] =
@@ -1029,7 +2043,10 @@ void Application::updateMenu()
     IDM_LOAD_GAME, IDM_PAUSE_GAME, IDM_RESET_GAME,
     IDM_EXIT,
 
-    IDM_CORE_CONFIG, IDM_VIDEO_CONFIG, IDM_TURBO_GAME, IDM_ABOUT
+    IDM_CORE_CONFIG, IDM_VIDEO_CONFIG, IDM_AUDIO_CONFIG, IDM_RUNAHEAD_CONFIG, IDM_REWIND_CONFIG, IDM_TURBO_GAME, IDM_ABOUT,
+    IDM_FRAME_TIMING_EXPORT, IDM_MEMORY_SEARCH,
+    IDM_RECORD_MOVIE, IDM_PLAY_MOVIE, IDM_STOP_MOVIE, IDM_ENV_CALLS_EXPORT, IDM_NETPLAY_CONFIG,
+    IDM_RECORD_VIDEO, IDM_STOP_VIDEO
   };
 
   static const UINT game_paused_items[] =
@@ -1037,7 +2054,10 @@ void Application::updateMenu()
     IDM_LOAD_GAME, IDM_RESUME_GAME, IDM_RESET_GAME,
     IDM_EXIT,
 
-    IDM_CORE_CONFIG, IDM_VIDEO_CONFIG, IDM_TURBO_GAME, IDM_ABOUT
+    IDM_CORE_CONFIG, IDM_VIDEO_CONFIG, IDM_AUDIO_CONFIG, IDM_RUNAHEAD_CONFIG, IDM_REWIND_CONFIG, IDM_TURBO_GAME, IDM_ABOUT,
+    IDM_FRAME_TIMING_EXPORT, IDM_MEMORY_SEARCH,
+    IDM_RECORD_MOVIE, IDM_PLAY_MOVIE, IDM_STOP_MOVIE, IDM_ENV_CALLS_EXPORT, IDM_NETPLAY_CONFIG,
+    IDM_RECORD_VIDEO, IDM_STOP_VIDEO
   };
 
   enableItems(all_items, sizeof(all_items) / sizeof(all_items[0]), MF_DISABLED);
@@ -1084,11 +2104,15 @@ void Application::updateMenu()
 
 bool Application::loadGame(const std::string& path)
 {
+  const auto tLoadStart = std::chrono::steady_clock::now();
+
   const struct retro_system_info* info = _core.getSystemInfo();
   std::string unzippedFileName;
   const char* ptr;
   size_t size;
-  void* data;
+  const void* data;
+  bool mapped = false;
+  std::string mappedPath;
   bool loaded;
   bool iszip = (path.length() > 4 && stricmp(&path.at(path.length() - 4), ".zip") == 0);
   bool issupportedzip = false;
@@ -1146,13 +2170,41 @@ bool Application::loadGame(const std::string& path)
   {
     if (iszip)
     {
-      /* core doesn't support zip files, unzip it into a buffer */
-      data = util::loadZippedFile(&_logger, path, &size, unzippedFileName);
+      /* core doesn't support zip files, big files are extracted once and mapped on later loads */
+      std::string cacheDirectory = _config.getRootFolder();
+      cacheDirectory += "Cache\\Unzipped\\";
+      util::ensureDirectoryExists(cacheDirectory);
+
+      void* unzipped;
+      const std::string extractedPath = util::cacheZippedFile(&_logger, path, info->valid_extensions, cacheDirectory,
+        MIN_CACHED_UNZIP_SIZE, MAX_CACHED_UNZIP_SIZE, unzippedFileName, &unzipped, &size);
+
+      if (!extractedPath.empty())
+      {
+        data = util::mapFile(&_logger, extractedPath, &size);
+        mapped = data != NULL;
+        mappedPath = extractedPath;
+
+        /* unzip it into a buffer */
+        if (data == NULL)
+          data = util::loadZippedFile(&_logger, path, &size, unzippedFileName, info->valid_extensions);
+      }
+      else
+      {
+        /* small files come unzipped into a buffer */
+        data = unzipped;
+      }
     }
     else
     {
+      /* map the file so the core reads it without a copy on the heap */
+      data = util::mapFile(&_logger, path, &size);
+      mapped = data != NULL;
+      mappedPath = path;
+
       /* load the file into a buffer so we can hash it */
-      data = util::loadFile(&_logger, path, &size);
+      if (data == NULL)
+        data = util::loadFile(&_logger, path, &size);
     }
 
     if (data == NULL)
@@ -1168,9 +2220,70 @@ bool Application::loadGame(const std::string& path)
     unzippedFileName = util::fileNameWithExtension(path);
   }
 
+  /* the content is only needed until the core has loaded it and the hash is computed */
+  auto releaseData = [data, mapped]() {
+    if (data == NULL)
+      return;
+
+    if (mapped)
+      util::unmapFile(data);
+    else
+      free((void*)data);
+  };
+
+  const auto tReadEnd = std::chrono::steady_clock::now();
+
   /* must update save path before loading the game */
   _states.setGame(unzippedFileName, _system, _coreName, &_core);
 
+  /* hash the content while the core loads it. cores may patch what they're given in place, so
+   * the hasher reads its own view of the file, or its own copy of the buffer */
+  std::string hash;
+  long long hashMillis = 0;
+  const void* hashData = NULL;
+  bool hashMapped = false;
+
+  if (data != NULL)
+  {
+    if (mapped)
+    {
+      size_t hashSize;
+      hashData = util::mapFile(&_logger, mappedPath, &hashSize);
+      hashMapped = hashData != NULL;
+    }
+
+    if (hashData == NULL)
+    {
+      void* copy = malloc(size);
+
+      if (copy != NULL)
+        memcpy(copy, data, size);
+
+      hashData = copy;
+    }
+  }
+
+  {
+    const int system = _system;
+    HashCache* cache = &_hashCache;
+
+    // the file picked from an archive depends on the extensions the core supports
+    const std::string entry = iszip && !issupportedzip ? unzippedFileName : std::string();
+
+    // without memory for a copy the content is hashed before the core gets it
+    const void* hashed = data != NULL && hashData == NULL ? data : hashData;
+
+    _hasher.queue([&hash, &hashMillis, cache, system, path, entry, hashed, size](Logger* logger) {
+      const auto tHashStart = std::chrono::steady_clock::now();
+      hash = romHash(logger, cache, system, path, entry, hashed, size);
+      hashMillis = (long long)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - tHashStart).count();
+      return true;
+    });
+
+    if (hashed == data && data != NULL)
+      _hasher.flush();
+  }
+
   if (info->need_fullpath)
   {
     loaded = _core.loadGame(path.c_str(), NULL, 0);
@@ -1185,6 +2298,20 @@ bool Application::loadGame(const std::string& path)
     loaded = _core.loadGame(path.c_str(), data, size);
   }
 
+  const auto tCoreEnd = std::chrono::steady_clock::now();
+
+  /* the hash and the data are only safe to touch after this */
+  _hasher.flush();
+  releaseData();
+
+  if (hashMapped)
+    util::unmapFile(hashData);
+  else
+    free((void*)hashData);
+  _hashCache.save();
+
+  const auto tHashEnd = std::chrono::steady_clock::now();
+
   if (!loaded)
   {
     // The most common cause of failure is missing system files.
@@ -1192,11 +2319,6 @@ bool Application::loadGame(const std::string& path)
 
     MessageBox(g_mainWindow, "Game load error. Please ensure that required system files are present and restart.", "Core Error", MB_OK);
 
-    if (data)
-    {
-      free(data);
-    }
-
     // A failure in loadGame typically destroys the core.
     if (_core.getSystemInfo()->library_name == NULL)
       _fsm.unloadCore();
@@ -1209,39 +2331,49 @@ bool Application::loadGame(const std::string& path)
 
   _gameFileName = unzippedFileName; // store for GetEstimatedTitle callback
 
-  if (!romLoaded(&_logger, _system, path, data, size))
+  /* achievements are activated before the first frame runs */
+  if (!romIdentified(&_logger, _system, hash))
   {
-    updateCDMenu(NULL, 0, true);
+    updateCDMenu(true);
 
     _gameFileName.clear();
 
     _core.unloadGame();
-
-    if (data)
-    {
-      free(data);
-    }
-
     return false;
   }
 
-  if (data)
-  {
-    free(data);
-  }
+  const auto tIdentifyEnd = std::chrono::steady_clock::now();
+
+  _logger.info(TAG "Game loaded in %lld ms (read %lld ms%s, core %lld ms, hash %lld ms in parallel with %lld ms waited, identify %lld ms)",
+    (long long)std::chrono::duration_cast<std::chrono::milliseconds>(tIdentifyEnd - tLoadStart).count(),
+    (long long)std::chrono::duration_cast<std::chrono::milliseconds>(tReadEnd - tLoadStart).count(), mapped ? ", mapped" : "",
+    (long long)std::chrono::duration_cast<std::chrono::milliseconds>(tCoreEnd - tReadEnd).count(),
+    hashMillis,
+    (long long)std::chrono::duration_cast<std::chrono::milliseconds>(tHashEnd - tCoreEnd).count(),
+    (long long)std::chrono::duration_cast<std::chrono::milliseconds>(tIdentifyEnd - tHashEnd).count());
+
+  _loadStart = tLoadStart;
+  _loadTiming = true;
 
   // reset the vertical sync flag
   SDL_GL_SetSwapInterval(1);
 
+  _telemetry.reset();
+  _threads.beginGame();
+  _eventsProcessed = _eventsCoalesced = _overlayEvents = 0;
+  _runAhead.reset();
+  _rewind.reset();
+
   if (_core.getNumDiscs() == 0)
   {
-    updateCDMenu(NULL, 0, true);
+    _discs.clear();
+    updateCDMenu(true);
   }
   else
   {
-    char names[10][128];
-    int count = cdrom_get_cd_names(path.c_str(), names, sizeof(names) / sizeof(names[0]), &_logger);
-    updateCDMenu(names, count, true);
+    _discs.load(&_logger, path);
+    updateCDMenu(true);
+    hashDiscs();
   }
 
   _gamePath = path;
@@ -1276,14 +2408,20 @@ bool Application::loadGame(const std::string& path)
   }
 
 moved_recent_item:
+  // written now instead of at exit, in the background and only if something changed
+  saveConfiguration();
+
   refreshMemoryMap();
+  preloadCore();
 
   _validSlots = 0;
 
   _states.migrateFiles();
+  _states.refreshSlots();
   _states.loadSRAM(&_core);
+  _states.initStateBuffers(&_core);
 
-  for (unsigned ndx = 1; ndx <= 10; ndx++)
+  for (unsigned ndx = 1; ndx <= States::kSlots; ndx++)
   {
     if (_states.existsState(ndx))
     {
@@ -1297,31 +2435,116 @@ moved_recent_item:
 
 void Application::refreshMemoryMap()
 {
+  _memoryMapVersion = _core.getMemoryMapVersion();
   _memory.attachToCore(&_core, _system);
 }
 
 void Application::unloadCore()
 {
-  std::string json;
-  json.append("{\"core\":");
-  json.append(_config.serialize());
-  json.append(",\"input\":");
-  json.append(_input.serialize());
-  json.append(",\"video\":");
-  json.append(_video.serialize());
-  json.append("}");
+  JsonWriter json;
+  json.beginObject();
+  json.key("core").raw(_config.serialize());
+  json.key("input").raw(_input.serialize());
+  json.key("video").raw(_video.serialize());
+  json.key("audio").raw(_audio.serialize());
+  json.key("runahead").raw(_runAhead.serialize());
+  json.key("rewind").raw(_rewind.serialize());
+  json.endObject();
+
+  saveJson(getCoreConfigPath(_coreName), json.str());
+
+  _memorySearch.destroy();
+  _memory.destroy();
 
-  util::saveFile(&_logger, getCoreConfigPath(_coreName), json.c_str(), json.length());
+  // cores that render with OpenGL tend to keep context state in statics that outlive retro_deinit
+  _core.destroy(_keepCoresLoaded && !_core.getNeedsHardwareRender());
+}
 
-  _memory.destroy();
-  _core.destroy();
+void Application::preloadCore()
+{
+  if (!_preloadCores)
+  {
+    return;
+  }
+
+  // the core of the most recent game that doesn't use the one loaded now
+  std::string coreName;
+
+  for (const auto& item : _recentList)
+  {
+    if (item.coreName != _coreName)
+    {
+      coreName = item.coreName;
+      break;
+    }
+  }
+
+  if (coreName.empty())
+  {
+    return;
+  }
+
+  const std::string path = getCorePath(coreName);
+
+  if (path == _preloadedPath)
+  {
+    return;
+  }
+
+  // only maps the module and runs its static initializers, retro_init is still called by loadCore
+  auto handle = std::make_shared<dynlib_t>((dynlib_t)NULL);
+
+  _preloader.queue([path, handle](Logger* logger) -> bool
+  {
+    *handle = dynlib_open(path.c_str());
+
+    if (*handle == NULL)
+    {
+      logger->warn(TAG "Could not preload %s", path.c_str());
+      return false;
+    }
+
+    logger->info(TAG "Preloaded %s", path.c_str());
+    return true;
+  }, [this, path, handle](bool ok)
+  {
+    if (!ok)
+    {
+      return;
+    }
+
+    if (!_preloadCores)
+    {
+      dynlib_close(*handle);
+      return;
+    }
+
+    releasePreloadedCore();
+    _preloaded = *handle;
+    _preloadedPath = path;
+  });
+}
+
+void Application::releasePreloadedCore()
+{
+  if (_preloaded != NULL)
+  {
+    dynlib_close(_preloaded);
+    _preloaded = NULL;
+  }
+
+  _preloadedPath.clear();
 }
 
 void Application::resetGame()
 {
-  if (isGameActive())
+  if (isGameActive() && !netplayBlocks("reset the game"))
   {
+    // a movie only replays the session it was recorded from, a recording is kept up to here
+    stopMovie();
+
     _core.resetGame();
+    _runAhead.invalidate();
     _video.clear();
     refreshMemoryMap();
     RA_OnReset();
@@ -1342,14 +2565,42 @@ bool Application::unloadGame()
 
   _states.saveSRAM(&_core);
 
+  stopMovie();
+  stopVideo();
+  _netplay.stop();
+
+  _telemetry.logSummary();
+  _threads.endGame();
+
+  if (_telemetry.frames() != 0)
+  {
+    _logger.info(TAG "%.1f events processed per frame, %llu axis motions coalesced", (double)_eventsProcessed / _telemetry.frames(),
+      (unsigned long long)_eventsCoalesced);
+  }
+
+  {
+    const FileCacheStats stats = fileCacheStats();
+    _logger.info(TAG "File cache: %llu reads, %llu blocks hit, %llu blocks read, %zu bytes cached", (unsigned long long)stats.reads,
+      (unsigned long long)stats.hits, (unsigned long long)stats.misses, stats.cached);
+  }
+
+  // the blocks of the game's files would otherwise stay resident until the next game evicts them
+  fileCacheClear();
+
+  _video.logTextures();
+
   romUnloaded(&_logger);
 
   _video.clear();
 
   _gamePath.clear();
   _gameFileName.clear();
+  _discs.clear();
   _states.setGame(_gameFileName, 0, _coreName, &_core);
 
+  // settings changed while playing are kept even if the application doesn't exit cleanly
+  saveConfiguration();
+
   _validSlots = 0;
   enableSlots();
 
@@ -1419,28 +2670,67 @@ void Application::onRotationChanged(Video::Rotation oldRotation, Video::Rotation
 
 void Application::s_audioCallback(void* udata, Uint8* stream, int len)
 {
+  // realtime thread: no logging and no locks, only counters for the main thread to drain
   Application* app = (Application*)udata;
+  app->_threads.audioThread();
+  app->_audioCounters.calls.fetch_add(1, std::memory_order_relaxed);
+
+  if (!app->_audioRunning.load(std::memory_order_acquire))
+  {
+    // only between the game stopping and the device being paused
+    memset((void*)stream, 0, len);
+    return;
+  }
 
-  if (app->_fsm.currentState() == Fsm::State::GameRunning)
+  const size_t avail = app->_fifo.occupied();
+
+  if (avail < (size_t)len)
   {
-    size_t avail = app->_fifo.occupied();
+    app->_audio.underrun();
+    app->_audioCounters.shortCalls.fetch_add(1, std::memory_order_relaxed);
+    app->_audioCounters.paddedBytes.fetch_add(len - avail, std::memory_order_relaxed);
 
-    if (avail < (size_t)len)
-    {
-      app->_fifo.read((void*)stream, avail);
-      memset((void*)(stream + avail), 0, len - avail);
-      app->_logger.debug("[AUD] Audio hardware requested %d bytes, only %zu available, padding with zeroes", len, avail);
-    }
-    else
-    {
-      app->_fifo.read((void*)stream, len);
-      app->_logger.debug("[AUD] Audio hardware requested %d bytes", len);
-    }
+    app->_fifo.read((void*)stream, avail);
+    memset((void*)(stream + avail), 0, len - avail);
   }
   else
   {
-    app->_logger.debug("[AUD] Audio hardware requested %d bytes, game is not running, sending silence", len);
-    memset((void*)stream, 0, len);
+    app->_fifo.read((void*)stream, len);
+  }
+}
+
+void Application::updateAudioState()
+{
+  const bool running = _fsm.currentState() == Fsm::State::GameRunning;
+
+  if (running == _audioRunning.load(std::memory_order_relaxed))
+    return;
+
+  if (running)
+  {
+    _audioRunning.store(true, std::memory_order_release);
+    SDL_PauseAudioDevice(_audioDev, 0);
+  }
+  else
+  {
+    // a paused device plays silence on its own instead of calling back for it
+    SDL_PauseAudioDevice(_audioDev, 1);
+    _audioRunning.store(false, std::memory_order_release);
+
+    drainAudioCounters();
+  }
+}
+
+void Application::drainAudioCounters()
+{
+  const uint32_t calls = _audioCounters.calls.exchange(0, std::memory_order_relaxed);
+  const uint32_t shortCalls = _audioCounters.shortCalls.exchange(0, std::memory_order_relaxed);
+  const uint64_t paddedBytes = _audioCounters.paddedBytes.exchange(0, std::memory_order_relaxed);
+
+  if (calls != 0)
+  {
+    _logger.debug(TAG "Audio hardware called back %u times, %u of them short, padded with %llu bytes of silence", calls, shortCalls,
+      (unsigned long long)paddedBytes);
   }
 }
 
@@ -1564,7 +2854,51 @@ void Application::enableRecent()
   }
 }
 
-void Application::updateCDMenu(const char names[][128], int count, bool updateLabels)
+void Application::hashDiscs()
+{
+  if (_discs.count() < 2)
+    return;
+
+  DiscSet* discs = &_discs;
+  const unsigned generation = _discs.generation();
+  const int system = _system;
+
+  for (size_t i = 0; i < _discs.count(); i++)
+  {
+    // the cache is only touched from the main thread, the jobs below don't use it
+    const std::string path = _discs.path(i);
+    const std::string cached = _hashCache.find(system, path, std::string());
+
+    if (!cached.empty())
+    {
+      _discs.setHash(i, cached);
+      continue;
+    }
+
+    std::shared_ptr<std::string> hash = std::make_shared<std::string>();
+    std::shared_ptr<std::vector<std::string>> opened = std::make_shared<std::vector<std::string>>();
+
+    _hasher.queue([discs, generation, system, path, hash, opened](Logger* logger) {
+      // the game was unloaded while the discs before this one were hashed
+      if (discs->generation() != generation)
+        return false;
+
+      hashReaderTrack(opened.get());
+      *hash = romHash(logger, NULL, system, path, std::string(), NULL, 0);
+      hashReaderTrack(NULL);
+      return !hash->empty();
+    }, [this, generation, i, system, path, hash, opened](bool ok) {
+      if (!ok || _discs.generation() != generation)
+        return;
+
+      _discs.setHash(i, *hash);
+      _hashCache.store(system, path, std::string(), *hash, *opened);
+      _hashCache.save();
+    });
+  }
+}
+
+void Application::updateCDMenu(bool updateLabels)
 {
   size_t i = 0;
   size_t coreDiscCount = _core.getNumDiscs();
@@ -1611,9 +2945,9 @@ void Application::updateCDMenu(const char names[][128], int count, bool updateLa
 
       if (updateLabels)
       {
-        if ((int)i < count)
+        if (i < _discs.count())
         {
-          info.dwTypeData = (char*)names[i];
+          info.dwTypeData = (char*)_discs.label(i).c_str();
         }
         else
         {
@@ -1645,12 +2979,21 @@ std::string Application::getConfigPath()
   return path;
 }
 
-std::string Application::getCoreConfigPath(const std::string& coreName)
+std::string Application::getCoreConfigPath(const std::string& coreName)
+{
+  std::string path = _config.getRootFolder();
+  path += "Cores\\";
+  path += coreName;
+  path += ".json";
+  return path;
+}
+
+std::string Application::getCorePath(const std::string& coreName)
 {
   std::string path = _config.getRootFolder();
   path += "Cores\\";
   path += coreName;
-  path += ".json";
+  path += ".dll";
   return path;
 }
 
@@ -1674,10 +3017,11 @@ void Application::saveState(const std::string& path)
 
 void Application::saveState(unsigned ndx)
 {
-  _states.saveState(ndx);
-
-  _validSlots |= 1 << ndx;
-  enableSlots();
+  // the slot can only be loaded once the state is on disk
+  _states.saveState(ndx, [this, ndx]() {
+    _validSlots |= 1 << ndx;
+    enableSlots();
+  });
 }
 
 void Application::saveState()
@@ -1701,22 +3045,33 @@ void Application::saveState()
 
 void Application::loadState(const std::string& path)
 {
+  if (netplayBlocks("load a state"))
+  {
+    return;
+  }
+
+  stopMovie();
+
   if (_states.loadState(path))
   {
-    updateCDMenu(NULL, 0, false);
+    _runAhead.invalidate();
+    updateCDMenu(false);
   }
 }
 
 void Application::loadState(unsigned ndx)
 {
-  if ((_validSlots & (1 << ndx)) == 0)
+  if ((_validSlots & (1 << ndx)) == 0 || netplayBlocks("load a state"))
   {
     return;
   }
 
+  stopMovie();
+
   if (_states.loadState(ndx))
   {
-    updateCDMenu(NULL, 0, false);
+    _runAhead.invalidate();
+    updateCDMenu(false);
   }
 }
 
@@ -1736,27 +3091,139 @@ void Application::loadState()
   loadState(path);
 }
 
-void Application::screenshot()
+void Application::recordMovie()
 {
-  if (!isGameActive())
+  std::string extensions = "Movie Files (*.ramv)";
+  extensions.append("\0", 1);
+  extensions.append("*.ramv");
+  extensions.append("\0", 2);
+  std::string path = util::saveFileDialog(g_mainWindow, extensions);
+
+  if (path.empty())
+  {
+    return;
+  }
+
+  if (util::extension(path).empty())
+  {
+    path += ".ramv";
+  }
+
+  const size_t size = _core.serializeSize();
+  std::vector<uint8_t> state(size);
+
+  if (size == 0 || !_core.serialize(state.data(), size))
+  {
+    _logger.error(TAG "Core doesn't support save states, can't record a movie");
+    return;
+  }
+
+  _moviePath = path;
+  _movie.record(state.data(), size);
+}
+
+void Application::playMovie()
+{
+  std::string extensions = "Movie Files (*.ramv)";
+  extensions.append("\0", 1);
+  extensions.append("*.ramv");
+  extensions.append("\0", 2);
+  std::string path = util::openFileDialog(g_mainWindow, extensions);
+
+  if (path.empty())
+  {
+    return;
+  }
+
+  // a movie starts by loading its state, which hardcore doesn't allow
+  if (!RA_WarnDisableHardcore("play a movie"))
+  {
+    _logger.warn(TAG "Hardcore mode is active, can't play a movie");
+    return;
+  }
+
+  stopMovie();
+
+  if (!_movie.play(path))
+  {
+    return;
+  }
+
+  const std::vector<uint8_t>& state = _movie.state();
+
+  if (!_core.unserialize(state.data(), state.size()))
+  {
+    _logger.error(TAG "Core could not load the movie's state");
+    _movie.stop();
+    return;
+  }
+
+  _runAhead.invalidate();
+  _rewind.reset();
+}
+
+void Application::recordVideo()
+{
+  std::string extensions = "AVI Files (*.avi)";
+  extensions.append("\0", 1);
+  extensions.append("*.avi");
+  extensions.append("\0", 2);
+  std::string path = util::saveFileDialog(g_mainWindow, extensions);
+
+  if (path.empty())
   {
-    _logger.warn(TAG "No active game, screenshot not taken");
     return;
   }
 
-  unsigned width, height, pitch;
-  enum retro_pixel_format format;
-  const void* data = _video.getFramebuffer(&width, &height, &pitch, &format);
+  if (util::extension(path).empty())
+  {
+    path += ".avi";
+  }
+
+  _recorder.start(path, _core.getSystemAVInfo()->timing.fps, _audioSpec.freq, _audioSpec.channels);
+}
+
+void Application::stopVideo()
+{
+  // the file is completed in the background
+  _recorder.stop();
+}
+
+void Application::stopMovie()
+{
+  if (_movie.mode() == Movie::Mode::Recording)
+  {
+    _movie.save(_moviePath);
+  }
+
+  _movie.stop();
+  _moviePath.clear();
+}
 
-  if (data == NULL)
+void Application::screenshot()
+{
+  if (!isGameActive())
   {
-    _logger.error(TAG "Error getting framebuffer from the video component");
+    _logger.warn(TAG "No active game, screenshot not taken");
     return;
   }
 
-  std::string path = getScreenshotPath();
-  util::saveImage(&_logger, path, data, width, height, pitch, format);
-  free((void*)data);
+  const std::string path = getScreenshotPath();
+
+  _video.readFramebuffer([this, path](const void* data, unsigned width, unsigned height, unsigned pitch, enum retro_pixel_format format) {
+    if (data == NULL)
+    {
+      _logger.error(TAG "Error getting framebuffer from the video component");
+      return;
+    }
+
+    // encoding a full sized PNG takes longer than a frame
+    _screenshots.queue([this, path, data, width, height, pitch, format](Logger* logger) {
+      const bool ok = _screenshotWriter.write(logger, path, data, width, height, pitch, format, ImageWriter::Compression::Small);
+      free((void*)data);
+      return ok;
+    });
+  });
 }
 
 void Application::aboutDialog()
@@ -1817,6 +3284,8 @@ void Application::loadConfiguration()
 
   if (data != NULL)
   {
+    _savedFiles[getConfigPath()].assign((const char*)data, size);
+
     struct Deserialize
     {
       Application* self;
@@ -1949,6 +3418,126 @@ void Application::loadConfiguration()
           return -1;
         }
       }
+      else if (ud->key == "memory" && event == JSONSAX_OBJECT)
+      {
+        if (!ud->self->_memory.deserializeSettings(str))
+        {
+          return -1;
+        }
+      }
+      else if (ud->key == "threads" && event == JSONSAX_OBJECT)
+      {
+        if (!ud->self->_threads.deserializeSettings(str))
+        {
+          return -1;
+        }
+      }
+      else if (ud->key == "cores" && event == JSONSAX_OBJECT)
+      {
+        jsonsax_result_t res2 = jsonsax_parse((char*)str, ud, [](void* udata, jsonsax_event_t event, const char* str, size_t num)
+        {
+          auto ud = (Deserialize*)udata;
+
+          if (event == JSONSAX_KEY)
+          {
+            ud->key = std::string(str, num);
+          }
+          else if (event == JSONSAX_BOOLEAN)
+          {
+            if (ud->key == "keepLoaded")
+              ud->self->_keepCoresLoaded = num != 0;
+            else if (ud->key == "preload")
+              ud->self->_preloadCores = num != 0;
+          }
+
+          return 0;
+        });
+
+        if (res2 != JSONSAX_OK)
+        {
+          return -1;
+        }
+      }
+      else if (ud->key == "audio" && event == JSONSAX_OBJECT)
+      {
+        jsonsax_result_t res2 = jsonsax_parse((char*)str, ud, [](void* udata, jsonsax_event_t event, const char* str, size_t num)
+        {
+          auto ud = (Deserialize*)udata;
+
+          if (event == JSONSAX_KEY)
+          {
+            ud->key = std::string(str, num);
+          }
+          else if (event == JSONSAX_BOOLEAN)
+          {
+            if (ud->key == "lowLatency")
+              ud->self->_lowLatencyAudio = num != 0;
+          }
+
+          return 0;
+        });
+
+        if (res2 != JSONSAX_OK)
+        {
+          return -1;
+        }
+      }
+      else if (ud->key == "input" && event == JSONSAX_OBJECT)
+      {
+        jsonsax_result_t res2 = jsonsax_parse((char*)str, ud, [](void* udata, jsonsax_event_t event, const char* str, size_t num)
+        {
+          auto ud = (Deserialize*)udata;
+
+          if (event == JSONSAX_KEY)
+          {
+            ud->key = std::string(str, num);
+          }
+          else if (event == JSONSAX_BOOLEAN)
+          {
+            if (ud->key == "latePolling")
+              ud->self->_lateInput = num != 0;
+          }
+
+          return 0;
+        });
+
+        if (res2 != JSONSAX_OK)
+        {
+          return -1;
+        }
+      }
+      else if (ud->key == "turbo" && event == JSONSAX_OBJECT)
+      {
+        jsonsax_result_t res2 = jsonsax_parse((char*)str, ud, [](void* udata, jsonsax_event_t event, const char* str, size_t num)
+        {
+          auto ud = (Deserialize*)udata;
+
+          if (event == JSONSAX_KEY)
+          {
+            ud->key = std::string(str, num);
+          }
+          else if (event == JSONSAX_NUMBER && ud->key == "speed")
+          {
+            const long speed = strtol(str, NULL, 10);
+            ud->self->_turboSpeed = speed >= -1 && speed <= 16 ? (int)speed : 0;
+          }
+          else if (event == JSONSAX_BOOLEAN && ud->key == "stretchAudio")
+          {
+            ud->self->_turboStretch = num != 0;
+          }
+
+          return 0;
+        });
+
+        if (res2 != JSONSAX_OK)
+        {
+          return -1;
+        }
+      }
+      else if (ud->key == "netplay" && event == JSONSAX_OBJECT)
+      {
+        ud->self->_netplay.deserialize(str);
+      }
 
       return 0;
     });
@@ -1957,35 +3546,20 @@ void Application::loadConfiguration()
   }
 }
 
-std::string Application::serializeRecentList()
+void Application::serializeRecentList(JsonWriter* json)
 {
-  std::string json = "[";
+  json->beginArray();
 
-  for (unsigned i = 0; i < _recentList.size(); i++)
+  for (const auto& item : _recentList)
   {
-    char buffer[64];
-
-    if (i != 0)
-    {
-      json += ",";
-    }
-
-    json += "{";
-    json += "\"path\":\"";
-    json += util::jsonEscape(_recentList[i].path);
-
-    json += "\",\"core\":\"";
-    json += _recentList[i].coreName;
-
-    json += "\",\"system\":";
-    snprintf(buffer, sizeof(buffer), "%u", (unsigned)_recentList[i].system);
-    json += buffer;
-
-    json += "}";
+    json->beginObject();
+    json->key("path").value(item.path);
+    json->key("core").value(item.coreName);
+    json->key("system").value((unsigned)item.system);
+    json->endObject();
   }
 
-  json += "]";
-  return json;
+  json->endArray();
 }
 
 void Application::resizeWindow(unsigned multiplier)
@@ -2063,7 +3637,7 @@ void Application::handle(const SDL_SysWMEvent* syswm)
     
     case IDM_CD_OPEN_TRAY:
       _core.setTrayOpen(!_core.getTrayOpen());
-      updateCDMenu(NULL, 0, false);
+      updateCDMenu(false);
       break;
 
     case IDM_PAUSE_GAME:
@@ -2115,8 +3689,35 @@ void Application::handle(const SDL_SysWMEvent* syswm)
     case IDM_SAVE_STATE:
       saveState();
       break;
+
+    case IDM_RECORD_MOVIE:
+      recordMovie();
+      break;
+
+    case IDM_PLAY_MOVIE:
+      playMovie();
+      break;
+
+    case IDM_STOP_MOVIE:
+      stopMovie();
+      break;
+
+    case IDM_RECORD_VIDEO:
+      recordVideo();
+      break;
+
+    case IDM_STOP_VIDEO:
+      stopVideo();
+      break;
+
+    case IDM_NETPLAY_CONFIG:
+      _netplay.showDialog(hardcore());
+      break;
       
     case IDM_CORE_CONFIG:
+      if (netplayBlocks("change the core options"))
+        break;
+
       _config.showDialog(_core.getSystemInfo()->library_name, _input);
       refreshMemoryMap();
       break;
@@ -2136,6 +3737,88 @@ void Application::handle(const SDL_SysWMEvent* syswm)
     case IDM_VIDEO_CONFIG:
       _video.showDialog();
       break;
+
+    case IDM_AUDIO_CONFIG:
+      _audio.showDialog();
+      break;
+
+    case IDM_LOW_LATENCY_AUDIO:
+      _lowLatencyAudio = !_lowLatencyAudio;
+      CheckMenuItem(_menu, IDM_LOW_LATENCY_AUDIO, _lowLatencyAudio ? MF_CHECKED : MF_UNCHECKED);
+      reopenAudioDevice();
+      break;
+
+    case IDM_RUNAHEAD_CONFIG:
+      _runAhead.showDialog(hardcore());
+      break;
+
+    case IDM_REWIND_CONFIG:
+      _rewind.showDialog(hardcore());
+      break;
+
+    case IDM_TURBO_CONFIG:
+      showTurboDialog();
+      break;
+
+    case IDM_THREADS_CONFIG:
+      _threads.showDialog();
+      break;
+
+    case IDM_MEMORY_SEARCH:
+      _memorySearch.showDialog();
+      break;
+
+    case IDM_MEMORY_SNAPSHOT:
+      _memory.setSnapshot(!_memory.snapshot());
+      CheckMenuItem(_menu, IDM_MEMORY_SNAPSHOT, _memory.snapshot() ? MF_CHECKED : MF_UNCHECKED);
+      break;
+
+    case IDM_FRAME_TIMING_OVERLAY:
+      _telemetry.setOverlay(!_telemetry.overlay());
+      CheckMenuItem(_menu, IDM_FRAME_TIMING_OVERLAY, _telemetry.overlay() ? MF_CHECKED : MF_UNCHECKED);
+
+      if (!_telemetry.overlay())
+        updateMenu(); // restores the window title
+      break;
+
+    case IDM_FRAME_TIMING_EXPORT:
+      exportTelemetry();
+      break;
+
+    case IDM_ENV_CALLS_EXPORT:
+      exportEnvCalls();
+      break;
+
+    case IDM_KEEP_CORES_LOADED:
+      _keepCoresLoaded = !_keepCoresLoaded;
+      CheckMenuItem(_menu, IDM_KEEP_CORES_LOADED, _keepCoresLoaded ? MF_CHECKED : MF_UNCHECKED);
+
+      // a core that's kept loaded while no game is running isn't in use
+      if (!_keepCoresLoaded && _fsm.currentState() == Fsm::State::Start)
+        _core.release();
+      break;
+
+    case IDM_LATE_INPUT:
+      setLateInput(!_lateInput);
+      break;
+
+    case IDM_LATENCY_TEST:
+      _latencyTest = !_latencyTest;
+      CheckMenuItem(_menu, IDM_LATENCY_TEST, _latencyTest ? MF_CHECKED : MF_UNCHECKED);
+
+      if (!_latencyTest)
+        _video.logLatency();
+      break;
+
+    case IDM_PRELOAD_CORES:
+      _preloadCores = !_preloadCores;
+      CheckMenuItem(_menu, IDM_PRELOAD_CORES, _preloadCores ? MF_CHECKED : MF_UNCHECKED);
+
+      if (_preloadCores)
+        preloadCore();
+      else
+        releasePreloadedCore();
+      break;
     
     case IDM_SAVING_CONFIG:
       _states.showDialog();
@@ -2149,8 +3832,18 @@ void Application::handle(const SDL_SysWMEvent* syswm)
       break;
 
     case IDM_MANAGE_CORES:
-      if (showCoresDialog(&_config, &_logger, _coreName))
+      // Windows locks the DLLs of loaded modules, cores that aren't in use must be released so
+      // they can be updated or deleted
+      if (_fsm.currentState() == Fsm::State::Start)
+        _core.release();
+
+      _preloader.flush();
+      releasePreloadedCore();
+
+      if (showCoresDialog(&_config, &_logger, &_downloader, _coreName))
         buildSystemsMenu();
+
+      preloadCore();
       break;
 
     case IDM_EXIT:
@@ -2173,19 +3866,23 @@ void Application::handle(const SDL_SysWMEvent* syswm)
         {
           _core.setCurrentDiscIndex(newDiscIndex);
 
-          char buffer[128];
-          MENUITEMINFO info;
-          memset(&info, 0, sizeof(info));
-          info.cbSize = sizeof(info);
-          info.fMask = MIIM_TYPE | MIIM_DATA;
-          info.dwTypeData = buffer;
-          info.cch = sizeof(buffer);
-          GetMenuItemInfo(_menu, cmd, false, &info);
+          const bool known = newDiscIndex < _discs.count();
+
+          // the disc may be the one being hashed in the background, and hashes can't overlap
+          if (!known || _discs.hash(newDiscIndex).empty())
+            _hasher.flush();
 
-          std::string path = util::replaceFileName(_gamePath, buffer);
-          romLoaded(&_logger, _system, path, NULL, 0);
+          if (known && !_discs.hash(newDiscIndex).empty())
+          {
+            romIdentified(&_logger, _system, _discs.hash(newDiscIndex));
+          }
+          else
+          {
+            romLoaded(&_logger, &_hashCache, _system, known ? _discs.path(newDiscIndex) : _gamePath, NULL, 0);
+            _hashCache.save();
+          }
 
-          updateCDMenu(NULL, 0, false);
+          updateCDMenu(false);
         }
       }
       else if (cmd >= IDM_SYSTEM_FIRST && cmd <= IDM_SYSTEM_LAST)
@@ -2206,6 +3903,11 @@ void Application::handle(const SDL_WindowEvent* window)
   {
     _video.windowResized(window->data1, window->data2);
   }
+  else if (window->event == SDL_WINDOWEVENT_EXPOSED)
+  {
+    // skipping the swap on duped frames relies on the last frame still being on the screen
+    _video.damage();
+  }
 }
 
 void Application::handle(const SDL_MouseMotionEvent* motion)
@@ -2345,6 +4047,13 @@ void Application::handle(const KeyBinds::Action action, unsigned extra)
   case KeyBinds::Action::kFastForward:
     _config.setFastForwarding(static_cast<bool>(extra));
     break;
+
+  case KeyBinds::Action::kRewind:
+    _rewinding = static_cast<bool>(extra);
+
+    if (_rewinding && _rewind.enabled(hardcore()))
+      stopMovie();
+    break;
   
   case KeyBinds::Action::kScreenshot:
     screenshot();
@@ -19,6 +19,9 @@ along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <map>
 #include <string>
 #include <vector>
 
@@ -35,10 +38,24 @@ along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
 #include "components/VideoContext.h"
 #include "components/Video.h"
 
+#include "CdRom.h"
 #include "Emulator.h"
+#include "FrameScheduler.h"
+#include "FrameTelemetry.h"
+#include "HashCache.h"
+#include "ImageWriter.h"
+#include "JsonWriter.h"
 #include "KeyBinds.h"
 #include "Memory.h"
+#include "MemorySearch.h"
+#include "Movie.h"
+#include "Netplay.h"
+#include "Recorder.h"
+#include "RunAhead.h"
+#include "Rewind.h"
 #include "States.h"
+#include "ThreadScheduling.h"
+#include "Worker.h"
 
 class Application
 {
@@ -53,6 +70,7 @@ public:
   // FSM
   bool loadCore(const std::string& coreName);
   void updateMenu();
+  void updateAudioState();
   bool loadGame(const std::string& path);
   void unloadCore();
   void resetGame();
@@ -81,20 +99,41 @@ protected:
 
   // Called by SDL from the audio thread
   static void s_audioCallback(void* udata, Uint8* stream, int len);
+  void        drainAudioCounters();
 
   // Helpers
   void        processEvents();
+  void        pumpInput();
+  void        handleInput(KeyBinds::Action action, unsigned extra);
+  bool        netplayBlocks(const char* action);
+  void        setLateInput(bool enabled);
+  bool        openAudioDevice(int freq, int channels, int allowedChanges);
+  void        reopenAudioDevice();
   void        runSmoothed();
+  void        runScheduled();
+  void        doAchievementsFrame();
+  void        idle();
+  void        endIdle();
+  static uint64_t processCpuMicros();
   void        runTurbo();
+  void        runAdaptiveTurbo();
+  void        showTurboDialog();
+  void        step(bool generateVideo, FrameTelemetry::Frame* frame);
+  void        updateTelemetryOverlay(unsigned fps);
+  void        exportTelemetry();
+  void        exportEnvCalls();
 
   void        loadGame();
   void        enableItems(const UINT* items, size_t count, UINT enable);
   void        enableSlots();
   void        enableRecent();
-  void        updateCDMenu(const char names[][128], int count, bool updateLabels);
+  void        updateCDMenu(bool updateLabels);
+  /* Hashes the discs of the set that aren't in the cache in the background */
+  void        hashDiscs();
   std::string getStatePath(unsigned ndx);
   std::string getConfigPath();
   std::string getCoreConfigPath(const std::string& coreName);
+  std::string getCorePath(const std::string& coreName);
   std::string getScreenshotPath();
   void        saveState(const std::string& path);
   void        saveState(unsigned ndx);
@@ -102,6 +141,11 @@ protected:
   void        loadState(const std::string& path);
   void        loadState(unsigned ndx);
   void        loadState();
+  void        recordMovie();
+  void        playMovie();
+  void        stopMovie();
+  void        recordVideo();
+  void        stopVideo();
   void        screenshot();
   void        aboutDialog();
   void        resizeWindow(unsigned multiplier);
@@ -114,7 +158,10 @@ protected:
   void        buildSystemsMenu();
   void        loadConfiguration();
   void        saveConfiguration();
-  std::string serializeRecentList();
+  void        saveJson(const std::string& path, const std::string& json);
+  void        preloadCore();
+  void        releasePreloadedCore();
+  void        serializeRecentList(JsonWriter* json);
 
   Fsm _fsm;
   bool lastHardcore;
@@ -123,8 +170,24 @@ protected:
   int         _system;
 
   SDL_Window*       _window;
+  enum
+  {
+    kAudioSamples = 1024,          /* device buffer size */
+    kLowLatencyAudioSamples = 256
+  };
+
   SDL_AudioSpec     _audioSpec;
   SDL_AudioDeviceID _audioDev;
+  bool              _lowLatencyAudio;  /* small device buffer, and a FIFO that only grows on underruns */
+  std::atomic<bool> _audioRunning;     /* mirrors GameRunning for the audio callback */
+
+  struct
+  {
+    std::atomic<uint32_t> calls;
+    std::atomic<uint32_t> shortCalls;   /* the FIFO didn't have enough */
+    std::atomic<uint64_t> paddedBytes;
+  }
+  _audioCounters;  /* written by the audio callback, drained by the main thread */
 
   Fifo         _fifo;
   Logger       _logger;
@@ -134,19 +197,90 @@ protected:
   Audio        _audio;
   Input        _input;
   Memory       _memory;
+  MemorySearch _memorySearch;
   States       _states;
 
+  FrameTelemetry _telemetry;
+  uint64_t       _overlayGlCalls;  /* totals when the overlay was last updated */
+  uint32_t       _overlayFrames;
+  uint64_t       _overlayEvents;
+
+  enum { kEventBatch = 64 };  /* events taken from SDL's queue at once */
+  uint64_t       _eventsProcessed;
+  uint64_t       _eventsCoalesced; /* axis motions dropped because a later one in the batch superseded them */
+
+  enum
+  {
+    kIdleTimeoutMs = 100,       /* longest wait while nothing runs */
+    kOverlayFrameMs = 16,       /* wait while the overlay animates */
+    kOverlayAnimationMs = 500   /* how long the overlay animates after pausing or navigating */
+  };
+
+  bool           _idling;
+  Fsm::State     _idleState;
+  std::chrono::steady_clock::time_point _idleStart;
+  std::chrono::steady_clock::time_point _overlayAnimationEnd;
+  uint64_t       _idleCpuStart;
+  unsigned       _idleWakeups;
+  ControllerInput _overlayInput;  /* what was last fed to RA_NavigateOverlay */
+  FrameScheduler _scheduler;
+  ThreadScheduling _threads;
+  RunAhead       _runAhead;
+  Rewind         _rewind;
+  Movie          _movie;
+  std::string    _moviePath; /* where the movie being recorded goes */
+  Netplay        _netplay;
+  Recorder       _recorder;
+  Worker         _hasher;  /* hashes the content while the core loads it */
+  Worker         _screenshots;
+  Worker         _saver;      /* writes the configuration files */
+  std::map<std::string, std::string> _savedFiles; /* what each configuration file has, only written when it changes */
+  ImageWriter    _screenshotWriter; /* only used by _screenshots' jobs */
+  HashCache      _hashCache;  /* only touched by the main thread, and by _hasher while a game loads */
+  Worker         _downloader; /* refreshes the index of cores in the background */
+  Worker         _preloader;  /* maps the core that's likely to be loaded next */
+  dynlib_t       _preloaded;
+  std::string    _preloadedPath;
+  bool           _keepCoresLoaded;
+  bool           _preloadCores;
+  bool           _lateInput;    /* the input is processed again when the core polls it */
+  bool           _latencyTest;  /* flashes the frame a button press went into */
+
+  int            _turboSpeed;   /* times the core's rate, 0 runs the classic bursts of five frames, -1 is uncapped */
+  bool           _turboStretch; /* fast forward plays the audio of some frames instead of muting it */
+
+  struct
+  {
+    bool         active;        /* the last frame was fast forwarded */
+    double       period;        /* of the display refresh, in seconds */
+    double       skipMicros;    /* smoothed cost of a frame without video */
+    double       renderMicros;  /* smoothed cost of a frame with video, without the swap */
+    double       credit;        /* frames owed to the speed multiplier */
+    double       audioCredit;   /* frames of audio owed to the real time that passed */
+    std::chrono::steady_clock::time_point last;
+  }              _turbo;
+
+  /* hotkeys that came in while the core was polling, handled by the next processEvents */
+  std::vector<std::pair<KeyBinds::Action, unsigned>> _deferredActions;
+
   KeyBinds _keybinds;
   std::vector<RecentItem> _recentList;
 
-  Allocator<256 * 1024> _allocator;
+  Allocator            _allocator;
 
   libretro::Components _components;
   libretro::Core       _core;
 
   std::string _gamePath;
   std::string _gameFileName;
+  DiscSet     _discs;
   unsigned    _validSlots;
+  bool        _rewinding;
+  unsigned    _memoryMapVersion;
+
+  /* set by loadGame, the first frame ran after it logs how long the game took to start */
+  std::chrono::steady_clock::time_point _loadStart;
+  bool                                  _loadTiming;
 
   HMENU _menu;
   HMENU _cdRomMenu;
@@ -21,57 +21,59 @@ along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "Util.h"
 
-#include <stdint.h>
-#include <stdlib.h>
-
 #include <string.h>
 
-static int cdrom_get_cd_names_m3u(const char* filename, char names[][128], int max_names, Logger* logger)
+#define TAG "[CDR] "
+
+bool DiscSet::load(Logger* logger, const std::string& path)
 {
-  int count = 0;
-  char buffer[2048], *ptr, *start;
-  FILE* fp = util::openFile(logger, filename, "r");
-  if (fp)
+  clear();
+
+  const std::string extension = util::extension(path);
+
+  if (strcasecmp(extension.c_str(), ".m3u") != 0)
+  {
+    Disc disc;
+    disc.label = util::fileNameWithExtension(path);
+    disc.path = path;
+    _discs.push_back(disc);
+    return true;
+  }
+
+  const std::string contents = util::loadFile(logger, path);
+  size_t begin = 0;
+
+  while (begin < contents.length())
   {
-    size_t bytes = fread(buffer, 1, sizeof(buffer), fp);
-    fclose(fp);
-
-    buffer[bytes] = '\0';
-    ptr = buffer;
-    do
-    {
-      start = ptr;
-      while (*ptr && *ptr != '\n')
-        ++ptr;
-
-      if (ptr > start)
-      {
-        char* name = names[count];
-        memcpy(name, start, ptr - start);
-        name[ptr - start] = '\0';
-        ++count;
-
-        if (count == max_names)
-          break;
-      }
-
-      if (!*ptr)
-        break;
-
-      ++ptr;
-    } while (true);
+    size_t end = contents.find('\n', begin);
+
+    if (end == std::string::npos)
+      end = contents.length();
+
+    std::string line = contents.substr(begin, end - begin);
+    begin = end + 1;
+
+    // playlists written on Windows end their lines with \r\n, extended ones have # directives
+    while (!line.empty() && (line.back() == '\r' || line.back() == ' ' || line.back() == '\t'))
+      line.pop_back();
+
+    if (line.empty() || line[0] == '#')
+      continue;
+
+    Disc disc;
+    disc.label = line;
+    // relative paths start at the playlist's directory
+    const bool absolute = line[0] == '\\' || line[0] == '/' || line.find(':') != std::string::npos;
+    disc.path = absolute ? line : util::replaceFileName(path, line.c_str());
+    _discs.push_back(disc);
   }
 
-  return count;
+  logger->info(TAG "%zu discs in \"%s\"", _discs.size(), path.c_str());
+  return !_discs.empty();
 }
 
-int cdrom_get_cd_names(const char* filename, char names[][128], int max_names, Logger* logger)
+void DiscSet::clear()
 {
-  int len = strlen(filename);
-  if (len > 4 && strcasecmp(&filename[len - 4], ".m3u") == 0)
-    return cdrom_get_cd_names_m3u(filename, names, max_names, logger);
-
-  std::string filename_path = util::fileNameWithExtension(filename);
-  strcpy(names[0], filename_path.c_str());
-  return 1;
+  _discs.clear();
+  _generation++;
 }
@@ -21,6 +21,44 @@ along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "components/Logger.h"
 
-#include <stdio.h>
+#include <atomic>
+#include <string>
+#include <vector>
 
-int cdrom_get_cd_names(const char* filename, char names[][128], int max_names, Logger* logger);
+/* The discs of the loaded content. An m3u playlist lists one disc per line, any other content,
+ * including a cue sheet, is a set of a single disc.
+ *
+ * The hashes of the discs are filled as they become known, so swapping to a disc that was hashed
+ * in the background doesn't have to read it again.
+ */
+class DiscSet
+{
+public:
+  bool load(Logger* logger, const std::string& path);
+  void clear();
+
+  size_t count() const { return _discs.size(); }
+
+  /* The name in the playlist, or the file name of the content */
+  const std::string& label(size_t index) const { return _discs[index].label; }
+  const std::string& path(size_t index) const { return _discs[index].path; }
+
+  /* Empty until the disc is hashed */
+  const std::string& hash(size_t index) const { return _discs[index].hash; }
+  void               setHash(size_t index, const std::string& hash) { _discs[index].hash = hash; }
+
+  /* Changes whenever the set is cleared, so results for an old set can be told apart. Can be read
+   * from any thread. */
+  unsigned generation() const { return _generation; }
+
+protected:
+  struct Disc
+  {
+    std::string label;
+    std::string path;
+    std::string hash;
+  };
+
+  std::vector<Disc>     _discs;
+  std::atomic<unsigned> _generation{0};
+};
@@ -19,7 +19,9 @@ along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "Emulator.h"
 
+#include "Git.h"
 #include "Util.h"
+#include "Worker.h"
 
 #include "components/Config.h"
 #include "components/Logger.h"
@@ -31,8 +33,13 @@ along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <jsonsax/jsonsax.h>
 
+#include <atomic>
 #include <ctime>
 #include <map>
+#include <vector>
+
+#include <stdint.h>
+#include <string.h>
 
 #define TAG "[EMU] "
 
@@ -84,6 +91,134 @@ const char* getEmulatorExtensions(const std::string& coreName, int system)
   return NULL;
 }
 
+/* The parsed cores.json, so startup doesn't have to parse it again until it changes. Native
+ * endianness, a header with the release, the architecture and cores.json's size and time, then
+ * each core's strings prefixed with their lengths and its systems prefixed with their count. */
+static const char s_coreCacheMagic[4] = { 'R', 'A', 'C', 'C' };
+
+static void writeCoreCache(std::string* out, const void* data, size_t size)
+{
+  out->append((const char*)data, size);
+}
+
+static void writeCoreCache(std::string* out, const std::string& str)
+{
+  const uint32_t length = (uint32_t)str.length();
+  writeCoreCache(out, &length, sizeof(length));
+  out->append(str);
+}
+
+struct CoreCacheReader
+{
+  const char* ptr;
+  const char* end;
+
+  bool read(void* data, size_t size)
+  {
+    if ((size_t)(end - ptr) < size)
+      return false;
+
+    memcpy(data, ptr, size);
+    ptr += size;
+    return true;
+  }
+
+  bool read(std::string* str)
+  {
+    uint32_t length;
+    if (!read(&length, sizeof(length)) || (size_t)(end - ptr) < length)
+      return false;
+
+    str->assign(ptr, length);
+    ptr += length;
+    return true;
+  }
+};
+
+static std::string coreCacheHeader(uint64_t jsonSize, time_t jsonTime)
+{
+  std::string header(s_coreCacheMagic, sizeof(s_coreCacheMagic));
+  writeCoreCache(&header, git::getReleaseVersion());
+
+  const uint32_t pointerSize = sizeof(void*);
+  const int64_t time = (int64_t)jsonTime;
+  writeCoreCache(&header, &pointerSize, sizeof(pointerSize));
+  writeCoreCache(&header, &jsonSize, sizeof(jsonSize));
+  writeCoreCache(&header, &time, sizeof(time));
+  return header;
+}
+
+static bool loadCoreCache(Logger* logger, const std::string& path, const std::string& header)
+{
+  if (!util::exists(path))
+    return false;
+
+  const std::string contents = util::loadFile(logger, path);
+
+  if (contents.compare(0, header.length(), header) != 0)
+    return false;
+
+  CoreCacheReader reader;
+  reader.ptr = contents.c_str() + header.length();
+  reader.end = contents.c_str() + contents.length();
+
+  uint32_t count;
+  if (!reader.read(&count, sizeof(count)))
+    return false;
+
+  std::vector<CoreInfo> coreInfos(count);
+
+  for (auto& core : coreInfos)
+  {
+    uint32_t systems;
+
+    if (!reader.read(&core.name) || !reader.read(&core.filename) || !reader.read(&core.extensions) ||
+        !reader.read(&core.deprecationMessage) || !reader.read(&systems, sizeof(systems)))
+    {
+      return false;
+    }
+
+    for (uint32_t i = 0; i < systems; i++)
+    {
+      int32_t system;
+      if (!reader.read(&system, sizeof(system)))
+        return false;
+
+      core.systems.insert(system);
+    }
+  }
+
+  s_coreInfos.swap(coreInfos);
+  return true;
+}
+
+static void saveCoreCache(Logger* logger, const std::string& path, const std::string& header)
+{
+  std::string contents = header;
+
+  const uint32_t count = (uint32_t)s_coreInfos.size();
+  writeCoreCache(&contents, &count, sizeof(count));
+
+  for (const auto& core : s_coreInfos)
+  {
+    writeCoreCache(&contents, core.name);
+    writeCoreCache(&contents, core.filename);
+    writeCoreCache(&contents, core.extensions);
+    writeCoreCache(&contents, core.deprecationMessage);
+
+    const uint32_t systems = (uint32_t)core.systems.size();
+    writeCoreCache(&contents, &systems, sizeof(systems));
+
+    for (int system : core.systems)
+    {
+      const int32_t value = system;
+      writeCoreCache(&contents, &value, sizeof(value));
+    }
+  }
+
+  util::saveFileAtomic(logger, path, contents.c_str(), contents.length());
+}
+
 bool loadCores(Config* config, Logger* logger)
 {
   std::string path = config->getRootFolder();
@@ -91,6 +226,33 @@ bool loadCores(Config* config, Logger* logger)
 
   logger->debug(TAG "Identifying available cores");
 
+  uint64_t jsonSize;
+  time_t jsonTime;
+
+  if (!util::fileInfo(path, &jsonSize, &jsonTime))
+  {
+    logger->error(TAG "Could not locate cores.json");
+    return false;
+  }
+
+  const std::string cachePath = std::string(config->getRootFolder()) + "Cores\\cores.bin";
+  const std::string header = coreCacheHeader(jsonSize, jsonTime);
+
+  if (loadCoreCache(logger, cachePath, header))
+  {
+    // the cores may have been downloaded or deleted since the cache was written
+    for (auto& core : s_coreInfos)
+    {
+      core.filetime = util::fileTime(std::string(config->getRootFolder()) + "Cores\\" + core.filename + ".dll");
+      core.servertime = 0;
+    }
+
+    logger->info(TAG "Read %zu cores from \"%s\"", s_coreInfos.size(), cachePath.c_str());
+    return true;
+  }
+
+  s_coreInfos.clear();
+
   size_t size;
   void* data = util::loadFile(logger, path, &size);
 
@@ -198,6 +360,8 @@ bool loadCores(Config* config, Logger* logger)
   });
 
   free(data);
+
+  saveCoreCache(logger, cachePath, header);
   return true;
 }
 
@@ -536,18 +700,65 @@ static const char* s_getCoreName(int index, void* udata)
   return NULL;
 }
 
-static void getCoreSystemTimes(Config* config, Logger* logger)
+static std::string getCoreIndexPath(Config* config)
 {
   std::string path = config->getRootFolder();
   path += "Cores\\index.txt";
+  return path;
+}
+
+/* set while the worker is downloading the index, only touched by the main thread */
+static bool s_coreIndexPending = false;
+
+/* stops the download when the application quits */
+static std::atomic<bool> s_coreIndexCancel(false);
+
+void refreshCoreIndex(Config* config, Logger* logger, Worker* worker)
+{
+  const std::string path = getCoreIndexPath(config);
   const time_t now = time(NULL);
   const time_t lastCheck = util::fileTime(path);
-  if (now - lastCheck > 60 * 60 * 24) // 24 hours
-  {
-    std::string url = BUILDBOT_URL;
-    url += ".index-extended";
-    util::downloadFile(logger, url, path);
-  }
+
+  if (s_coreIndexPending || now - lastCheck <= 60 * 60 * 24) // 24 hours
+    return;
+
+  logger->info(TAG "Refreshing the core index");
+  s_coreIndexPending = true;
+
+  std::string url = BUILDBOT_URL;
+  url += ".index-extended";
+
+  // downloaded next to the index and renamed over it, so it's never read half written
+  worker->queue([url, path](Logger* logger) {
+    const std::string tempPath = path + ".tmp";
+
+    if (s_coreIndexCancel || !util::downloadFile(logger, url, tempPath, &s_coreIndexCancel))
+    {
+      util::deleteFile(tempPath);
+      return false;
+    }
+
+    return util::replaceFile(logger, tempPath, path);
+  }, [](bool ok) {
+    (void)ok;
+    s_coreIndexPending = false;
+  });
+}
+
+void cancelCoreIndex()
+{
+  s_coreIndexCancel = true;
+}
+
+static void getCoreSystemTimes(Config* config, Logger* logger, Worker* worker)
+{
+  const std::string path = getCoreIndexPath(config);
+
+  // use the index we have while a new one is downloaded, only wait if there's none yet
+  refreshCoreIndex(config, logger, worker);
+
+  if (s_coreIndexPending && !util::exists(path))
+    worker->flush();
 
   const std::string index = util::loadFile(logger, path);
 
@@ -586,7 +797,7 @@ static void getCoreSystemTimes(Config* config, Logger* logger)
   }
 }
 
-bool showCoresDialog(Config* config, Logger* logger, const std::string& loadedCore)
+bool showCoresDialog(Config* config, Logger* logger, Worker* worker, const std::string& loadedCore)
 {
   CoreDialog db;
   db.init("Manage Cores");
@@ -594,7 +805,7 @@ bool showCoresDialog(Config* config, Logger* logger, const std::string& loadedCo
   db.logger = logger;
   db.loadedCore = &loadedCore;
 
-  getCoreSystemTimes(config, logger);
+  getCoreSystemTimes(config, logger, worker);
 
   std::map<std::string, int> allSystems;
   int systemCoreCounts[NumConsoleIDs];
@@ -30,12 +30,21 @@ const char* getSystemName(int system);
 
 class Config;
 class Logger;
+class Worker;
+
+/* Reads Cores\cores.json, or the binary copy of it made the last time it changed */
 bool   loadCores(Config* config, Logger* logger);
 
+/* Downloads the buildbot's index of cores on the worker if it's more than a day old */
+void   refreshCoreIndex(Config* config, Logger* logger, Worker* worker);
+
+/* Stops the download started by refreshCoreIndex, the worker still has to be flushed or destroyed */
+void   cancelCoreIndex();
+
 void   getAvailableSystems(std::set<int>& systems);
 void   getAvailableSystemCores(int system, std::set<std::string>& coreNames);
 int    encodeCoreName(const std::string& coreName, int system);
 const std::string& getCoreName(int encoded, int& systemOut);
 const std::string* getCoreDeprecationMessage(const std::string& coreName);
 
-bool   showCoresDialog(Config* config, Logger* logger, const std::string& loadedCoreName);
+bool   showCoresDialog(Config* config, Logger* logger, Worker* worker, const std::string& loadedCoreName);
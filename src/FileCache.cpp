@@ -0,0 +1,475 @@
+/*
+Copyright (C) 2018 Andre Leiradella
+
+This file is part of RALibretro.
+
+RALibretro is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RALibretro is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "FileCache.h"
+
+#include "Util.h"
+
+#include <string.h>
+#include <time.h>
+
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#define TAG "[FCH] "
+
+/* 32 sectors of 2048 bytes, big enough that reading a whole disc is a manageable number of calls */
+#define BLOCK_SIZE (64 * 1024)
+
+/* most blocks read at once ahead of sequential reads */
+#define MAX_READ_AHEAD 16
+
+namespace
+{
+  struct Entry;
+
+  struct Block
+  {
+    Entry*               entry;
+    uint64_t             index;
+    std::vector<uint8_t> data;
+  };
+
+  typedef std::list<Block> BlockList;
+
+  struct Entry
+  {
+    std::string path;
+    uint64_t    size;
+    time_t      time;
+    unsigned    refs;
+
+    std::unordered_map<uint64_t, BlockList::iterator> blocks;
+  };
+}
+
+struct CachedFile
+{
+  Entry*         entry;
+  FILE*          file;
+  const uint8_t* data;      /* not NULL if the file is mapped */
+  uint64_t       size;
+
+  uint64_t       nextBlock; /* block after the last one read */
+  unsigned       window;    /* blocks read ahead */
+};
+
+static Logger* s_logger;
+static size_t s_budget;
+
+/* guards everything below, never held while reading from the disk */
+static std::mutex s_mutex;
+static std::unordered_map<std::string, Entry> s_entries;
+static BlockList s_blocks;  /* most recently used first */
+static size_t s_cached;
+
+static std::atomic<uint64_t> s_reads(0);
+static std::atomic<uint64_t> s_hits(0);
+static std::atomic<uint64_t> s_misses(0);
+static std::atomic<uint64_t> s_bytes(0);
+
+static size_t readAt(FILE* file, uint64_t offset, void* buffer, size_t size)
+{
+  // positional reads don't share a file position, so several threads can read the same file
+  uint8_t* out = (uint8_t*)buffer;
+  size_t total = 0;
+
+#ifdef _WIN32
+  HANDLE handle = (HANDLE)_get_osfhandle(_fileno(file));
+
+  while (total < size)
+  {
+    OVERLAPPED overlapped;
+    memset(&overlapped, 0, sizeof(overlapped));
+    overlapped.Offset = (DWORD)offset;
+    overlapped.OffsetHigh = (DWORD)(offset >> 32);
+
+    const size_t left = size - total;
+    DWORD numRead;
+
+    if (!ReadFile(handle, out, left > 0x40000000 ? 0x40000000 : (DWORD)left, &numRead, &overlapped) || numRead == 0)
+      break;
+
+    out += numRead;
+    total += numRead;
+    offset += numRead;
+  }
+#else
+  const int fd = fileno(file);
+
+  while (total < size)
+  {
+    const ssize_t numRead = pread(fd, out, size - total, (off_t)offset);
+
+    if (numRead <= 0)
+      break;
+
+    out += numRead;
+    total += (size_t)numRead;
+    offset += (uint64_t)numRead;
+  }
+#endif
+
+  return total;
+}
+
+static void dropBlocks(Entry* entry)
+{
+  for (const auto& pair : entry->blocks)
+  {
+    s_cached -= pair.second->data.size();
+    s_blocks.erase(pair.second);
+  }
+
+  entry->blocks.clear();
+}
+
+static void dropIfUnused(Entry* entry)
+{
+  if (entry->refs == 0 && entry->blocks.empty())
+  {
+    const std::string path = entry->path;
+    s_entries.erase(path);
+  }
+}
+
+static void evict()
+{
+  while (s_cached > s_budget && !s_blocks.empty())
+  {
+    Block& block = s_blocks.back();
+    Entry* entry = block.entry;
+
+    s_cached -= block.data.size();
+    entry->blocks.erase(block.index);
+    s_blocks.pop_back();
+
+    dropIfUnused(entry);
+  }
+}
+
+static void insert(Entry* entry, uint64_t index, const uint8_t* data, size_t length)
+{
+  // another thread may have read the same block in the meantime
+  if (entry->blocks.find(index) != entry->blocks.end())
+    return;
+
+  s_blocks.emplace_front();
+
+  Block& block = s_blocks.front();
+  block.entry = entry;
+  block.index = index;
+  block.data.assign(data, data + length);
+
+  entry->blocks[index] = s_blocks.begin();
+  s_cached += length;
+}
+
+void fileCacheInit(Logger* logger, size_t budget)
+{
+  s_logger = logger;
+  s_budget = budget;
+}
+
+CachedFile* fileCacheOpen(const char* path, bool map)
+{
+  uint64_t size;
+  time_t time;
+
+  if (!util::fileInfo(path, &size, &time))
+  {
+    // cores probe for optional files through the VFS, a missing one isn't an error
+    s_logger->debug(TAG "Error opening \"%s\"", path);
+    return NULL;
+  }
+
+  CachedFile* file = new CachedFile;
+  file->file = NULL;
+  file->data = NULL;
+  file->size = size;
+  file->nextBlock = 0;
+  file->window = 1;
+
+#ifdef _WINDOWS
+  // an address space of 4 GB can't map big disc images
+  if (map && size != 0 && size <= SIZE_MAX)
+  {
+    size_t mapped;
+    file->data = (const uint8_t*)util::mapFile(s_logger, path, &mapped);
+  }
+#else
+  // console builds for Windows don't have util::mapFile, read them through the cache
+  (void)map;
+#endif
+
+  if (file->data == NULL)
+  {
+    file->file = util::openFile(s_logger, path, "rb");
+
+    if (file->file == NULL)
+    {
+      delete file;
+      return NULL;
+    }
+
+    // every read goes to the cache, stdio would only copy everything once more
+    setvbuf(file->file, NULL, _IONBF, 0);
+  }
+
+  std::lock_guard<std::mutex> lock(s_mutex);
+
+  Entry* entry = &s_entries[path];
+
+  if (entry->path.empty())
+  {
+    entry->path = path;
+    entry->refs = 0;
+  }
+  else if (entry->size != size || entry->time != time)
+  {
+    s_logger->info(TAG "\"%s\" changed, dropping %zu cached blocks", path, entry->blocks.size());
+    dropBlocks(entry);
+  }
+
+  entry->size = size;
+  entry->time = time;
+  entry->refs++;
+
+  file->entry = entry;
+  return file;
+}
+
+void fileCacheClose(CachedFile* file)
+{
+#ifdef _WINDOWS
+  if (file->data != NULL)
+    util::unmapFile(file->data);
+  else
+#endif
+    fclose(file->file);
+
+  {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    file->entry->refs--;
+    dropIfUnused(file->entry);
+  }
+
+  delete file;
+}
+
+uint64_t fileCacheSize(const CachedFile* file)
+{
+  return file->size;
+}
+
+size_t fileCacheRead(CachedFile* file, uint64_t offset, void* buffer, size_t size)
+{
+  s_reads++;
+
+  if (offset >= file->size)
+    return 0;
+
+  if (size > file->size - offset)
+    size = (size_t)(file->size - offset);
+
+  if (size == 0)
+    return 0;
+
+  if (file->data != NULL)
+  {
+    memcpy(buffer, file->data + offset, size);
+    return size;
+  }
+
+  const uint64_t first = offset / BLOCK_SIZE;
+  const uint64_t last = (offset + size - 1) / BLOCK_SIZE;
+  const uint64_t blockCount = (file->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+  // reads starting in the block where the last one ended, or right after it, are sequential
+  if (first == file->nextBlock || first + 1 == file->nextBlock)
+    file->window = file->window * 2 > MAX_READ_AHEAD ? MAX_READ_AHEAD : file->window * 2;
+  else
+    file->window = 1;
+
+  file->nextBlock = last + 1;
+
+  uint8_t* out = (uint8_t*)buffer;
+  size_t remaining = size;
+  uint64_t position = offset;
+  std::vector<uint8_t> temp;
+
+  while (remaining != 0)
+  {
+    const uint64_t index = position / BLOCK_SIZE;
+    uint64_t count = 1;
+
+    {
+      std::lock_guard<std::mutex> lock(s_mutex);
+      const auto found = file->entry->blocks.find(index);
+
+      if (found != file->entry->blocks.end())
+      {
+        const Block& block = *found->second;
+        s_blocks.splice(s_blocks.begin(), s_blocks, found->second);
+
+        const size_t skip = (size_t)(position - index * BLOCK_SIZE);
+        size_t length = block.data.size() > skip ? block.data.size() - skip : 0;
+
+        if (length == 0)
+          break;
+
+        if (length > remaining)
+          length = remaining;
+
+        memcpy(out, block.data.data() + skip, length);
+        out += length;
+        remaining -= length;
+        position += length;
+        s_hits++;
+        continue;
+      }
+
+      // read the missing blocks in one go, through the last one wanted and the read ahead window
+      uint64_t end = index + file->window > last + 1 ? index + file->window : last + 1;
+
+      if (end > blockCount)
+        end = blockCount;
+
+      while (index + count < end && file->entry->blocks.find(index + count) == file->entry->blocks.end())
+        count++;
+    }
+
+    temp.resize((size_t)count * BLOCK_SIZE);
+    const size_t numRead = readAt(file->file, index * BLOCK_SIZE, temp.data(), temp.size());
+
+    s_misses += count;
+    s_bytes += numRead;
+
+    // only whole blocks and the one at the end of the file are kept
+    uint64_t numBlocks = 0;
+
+    {
+      std::lock_guard<std::mutex> lock(s_mutex);
+
+      while (numBlocks < count)
+      {
+        const uint64_t start = (index + numBlocks) * BLOCK_SIZE;
+        const size_t expected = file->size - start < BLOCK_SIZE ? (size_t)(file->size - start) : BLOCK_SIZE;
+
+        if (numRead < (size_t)(start - index * BLOCK_SIZE) + expected)
+          break;
+
+        insert(file->entry, index + numBlocks, temp.data() + (size_t)numBlocks * BLOCK_SIZE, expected);
+        numBlocks++;
+      }
+
+      evict();
+    }
+
+    if (numBlocks == 0)
+    {
+      s_logger->error(TAG "Error reading %zu bytes at %llu", temp.size(), (unsigned long long)(index * BLOCK_SIZE));
+      break;
+    }
+
+    // copy from what was just read, the blocks may already be evicted with a small budget
+    const size_t skip = (size_t)(position - index * BLOCK_SIZE);
+    size_t length = (size_t)numBlocks * BLOCK_SIZE;
+
+    if (length > numRead)
+      length = numRead;
+
+    length -= skip;
+
+    if (length > remaining)
+      length = remaining;
+
+    memcpy(out, temp.data() + skip, length);
+    out += length;
+    remaining -= length;
+    position += length;
+  }
+
+  return size - remaining;
+}
+
+FILE* fileCacheOpenWrite(const char* path, const char* mode)
+{
+  fileCacheInvalidate(path);
+  return util::openFile(s_logger, path, mode);
+}
+
+void fileCacheInvalidate(const char* path)
+{
+  std::lock_guard<std::mutex> lock(s_mutex);
+  const auto found = s_entries.find(path);
+
+  if (found != s_entries.end())
+  {
+    Entry* entry = &found->second;
+    dropBlocks(entry);
+
+    // files still open see the change when they're opened again
+    entry->size = 0;
+    entry->time = 0;
+    dropIfUnused(entry);
+  }
+}
+
+void fileCacheClear()
+{
+  std::lock_guard<std::mutex> lock(s_mutex);
+
+  for (auto it = s_entries.begin(); it != s_entries.end();)
+  {
+    it->second.blocks.clear();
+
+    if (it->second.refs == 0)
+      it = s_entries.erase(it);
+    else
+      ++it;
+  }
+
+  s_blocks.clear();
+  s_cached = 0;
+}
+
+FileCacheStats fileCacheStats()
+{
+  FileCacheStats stats;
+  stats.reads = s_reads;
+  stats.hits = s_hits;
+  stats.misses = s_misses;
+  stats.bytes = s_bytes;
+
+  std::lock_guard<std::mutex> lock(s_mutex);
+  stats.cached = s_cached;
+  return stats;
+}
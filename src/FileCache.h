@@ -0,0 +1,68 @@
+/*
+Copyright (C) 2018 Andre Leiradella
+
+This file is part of RALibretro.
+
+RALibretro is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RALibretro is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "components/Logger.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Read only file access through a block cache shared by everything that reads content: the
+ * rcheevos hasher and cores that use the libretro VFS. Blocks stay cached after the files are
+ * closed, so the data read to hash a disc is still there when the core boots it.
+ *
+ * Blocks are kept per path and dropped when the file's size or modification time changes.
+ * Reads that follow each other read ahead a window of blocks that grows while they stay
+ * sequential. The cache is thread safe, and reads from disk are done without holding its lock.
+ */
+struct CachedFile;
+
+/* Sets how many bytes of blocks are kept, must be called before any file is opened */
+void fileCacheInit(Logger* logger, size_t budget);
+
+/* Opens the file for reading, mapped files are read from the view instead of the cache */
+CachedFile* fileCacheOpen(const char* path, bool map);
+void fileCacheClose(CachedFile* file);
+
+uint64_t fileCacheSize(const CachedFile* file);
+
+/* Reads at offset, returns less than size only at the end of the file or on errors */
+size_t fileCacheRead(CachedFile* file, uint64_t offset, void* buffer, size_t size);
+
+/* Opens the file for writing with stdio, what was cached for it is dropped */
+FILE* fileCacheOpenWrite(const char* path, const char* mode);
+
+/* Drops what was cached for the file, for when it's written to, renamed or deleted */
+void fileCacheInvalidate(const char* path);
+
+/* Drops every cached block, for when the game is unloaded */
+void fileCacheClear();
+
+struct FileCacheStats
+{
+  uint64_t reads;     /* fileCacheRead calls */
+  uint64_t hits;      /* blocks copied from the cache */
+  uint64_t misses;    /* blocks read from the disk */
+  uint64_t bytes;     /* bytes read from the disk */
+  size_t   cached;    /* bytes in blocks right now */
+};
+
+/* Totals since the program started */
+FileCacheStats fileCacheStats();
@@ -0,0 +1,209 @@
+/*
+Copyright (C) 2018 Andre Leiradella
+
+This file is part of RALibretro.
+
+RALibretro is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RALibretro is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "FrameScheduler.h"
+
+#include <mmsystem.h>
+#include <dwmapi.h>
+
+#include <math.h>
+#include <string.h>
+
+#define TAG "[SCH] "
+
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+bool FrameScheduler::init(Logger* logger)
+{
+  _logger = logger;
+
+  LARGE_INTEGER frequency;
+  QueryPerformanceFrequency(&frequency);
+  _frequency = frequency.QuadPart;
+
+  /* high resolution timers are only available since Windows 10 1803, look them up at runtime */
+  typedef HANDLE (WINAPI *CreateWaitableTimerExWFunc)(LPSECURITY_ATTRIBUTES, LPCWSTR, DWORD, DWORD);
+  auto createWaitableTimerExW = (CreateWaitableTimerExWFunc)GetProcAddress(GetModuleHandleA("kernel32.dll"), "CreateWaitableTimerExW");
+
+  _timer = NULL;
+
+  if (createWaitableTimerExW != NULL)
+    _timer = createWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+
+  _highResolution = _timer != NULL;
+
+  if (_highResolution)
+  {
+    _minSpin = _frequency / 5000; // 200us
+    _spin = _frequency / 2000;    // 500us
+  }
+  else
+  {
+    _timer = CreateWaitableTimerW(NULL, FALSE, NULL);
+
+    if (_timer == NULL)
+    {
+      _logger->error(TAG "CreateWaitableTimer failed: %lu", GetLastError());
+      return false;
+    }
+
+    /* regular timers wake up on the scheduler tick, make it as short as possible */
+    timeBeginPeriod(1);
+
+    _minSpin = _frequency / 1000; // 1ms
+    _spin = _frequency / 500;     // 2ms
+  }
+
+  _maxSpin = _frequency / 250;    // 4ms
+
+  _period = _frequency / 60;
+  _deadline = now() + _period;
+
+  _logger->info(TAG "Using a %s resolution waitable timer", _highResolution ? "high" : "regular");
+  return true;
+}
+
+void FrameScheduler::destroy()
+{
+  if (_timer != NULL)
+  {
+    CloseHandle(_timer);
+    _timer = NULL;
+
+    if (!_highResolution)
+      timeEndPeriod(1);
+  }
+}
+
+int64_t FrameScheduler::now() const
+{
+  LARGE_INTEGER counter;
+  QueryPerformanceCounter(&counter);
+  return counter.QuadPart;
+}
+
+void FrameScheduler::start(double fps, int64_t vblank)
+{
+  _period = (int64_t)llround(_frequency / fps);
+
+  const int64_t t = now();
+
+  if (vblank != 0 && vblank <= t)
+  {
+    /* first vblank at least one period from now */
+    const int64_t periods = (t - vblank) / _period + 2;
+    _deadline = vblank + periods * _period;
+  }
+  else
+  {
+    _deadline = t + _period;
+  }
+}
+
+void FrameScheduler::wait()
+{
+  const int64_t t = now();
+
+  if (t - _deadline > _period)
+  {
+    /* we fell behind, probably due to the UI blocking us; start over instead of catching up */
+    _deadline = t;
+  }
+  else
+  {
+    sleepUntil(_deadline);
+  }
+
+  _deadline += _period;
+}
+
+void FrameScheduler::sleep(double seconds)
+{
+  sleepUntil(now() + (int64_t)(seconds * _frequency));
+}
+
+void FrameScheduler::sleepUntil(int64_t deadline)
+{
+  const int64_t start = now();
+  const int64_t sleepTicks = deadline - start - _spin;
+
+  if (sleepTicks > 0)
+  {
+    /* relative due time in 100ns units */
+    LARGE_INTEGER due;
+    due.QuadPart = -(sleepTicks * 10000000 / _frequency);
+
+    if (due.QuadPart < 0 && SetWaitableTimer(_timer, &due, 0, NULL, NULL, FALSE))
+    {
+      WaitForSingleObject(_timer, INFINITE);
+
+      /* widen the spin margin right away when the timer overshoots, narrow it slowly otherwise */
+      const int64_t late = now() - (start + sleepTicks);
+
+      if (late > _spin / 2)
+      {
+        _spin = late * 2;
+
+        if (_spin > _maxSpin)
+          _spin = _maxSpin;
+      }
+      else
+      {
+        _spin -= (_spin - _minSpin) / 64;
+      }
+    }
+  }
+
+  while (now() < deadline)
+    YieldProcessor();
+}
+
+double FrameScheduler::measureDisplayRate(int64_t* vblank)
+{
+  typedef HRESULT (WINAPI *DwmGetCompositionTimingInfoFunc)(HWND, DWM_TIMING_INFO*);
+
+  double rate = 0.0;
+  *vblank = 0;
+
+  HMODULE dwmapi = LoadLibraryA("dwmapi.dll");
+
+  if (dwmapi == NULL)
+    return rate;
+
+  auto getTimingInfo = (DwmGetCompositionTimingInfoFunc)GetProcAddress(dwmapi, "DwmGetCompositionTimingInfo");
+
+  if (getTimingInfo != NULL)
+  {
+    DWM_TIMING_INFO info;
+    memset(&info, 0, sizeof(info));
+    info.cbSize = sizeof(info);
+
+    /* qpcRefreshPeriod is measured by the compositor, rateRefresh is just the nominal mode */
+    if (SUCCEEDED(getTimingInfo(NULL, &info)) && info.qpcRefreshPeriod > 0)
+    {
+      rate = _frequency / (double)info.qpcRefreshPeriod;
+      *vblank = (int64_t)info.qpcVBlank;
+    }
+  }
+
+  FreeLibrary(dwmapi);
+  return rate;
+}
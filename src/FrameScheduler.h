@@ -0,0 +1,72 @@
+/*
+Copyright (C) 2018 Andre Leiradella
+
+This file is part of RALibretro.
+
+RALibretro is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RALibretro is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "components/Logger.h"
+
+#include <stdint.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+/* Paces frames against absolute deadlines on the performance counter.
+ *
+ * Sleeping is done on a waitable timer (high resolution when the system supports it) until
+ * shortly before the deadline, the remaining time is spun. The spin margin follows how late
+ * the timer has been waking up, so it stays small on systems with a precise timer.
+ */
+class FrameScheduler
+{
+public:
+  bool init(Logger* logger);
+  void destroy();
+
+  /* Starts pacing at the given rate, the first deadline is one period from now. If vblank is
+   * not zero the deadlines are aligned to it, it's a performance counter value. */
+  void start(double fps, int64_t vblank = 0);
+
+  /* Sleeps until the current deadline and moves it one period ahead. If we're already more
+   * than a period late the deadline is moved to now instead of running frames back to back. */
+  void wait();
+
+  /* Precise sleep independent of the frame deadlines */
+  void sleep(double seconds);
+
+  double fps() const { return _frequency / (double)_period; }
+
+  /* Refresh rate as measured by the compositor, or 0.0 if it's not available. */
+  double measureDisplayRate(int64_t* vblank);
+
+protected:
+  int64_t now() const;
+  void    sleepUntil(int64_t deadline);
+
+  Logger* _logger;
+
+  HANDLE  _timer;
+  bool    _highResolution;
+
+  int64_t _frequency;
+  int64_t _period;
+  int64_t _deadline;
+  int64_t _spin;      /* how long before the deadline we stop sleeping and start spinning */
+  int64_t _minSpin;
+  int64_t _maxSpin;
+};
@@ -0,0 +1,276 @@
+/*
+Copyright (C) 2018 Andre Leiradella
+
+This file is part of RALibretro.
+
+RALibretro is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RALibretro is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "FrameTelemetry.h"
+
+#include "Metrics.h"
+#include "Util.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#define TAG "[FPS] "
+
+bool FrameTelemetry::init(Logger* logger)
+{
+  _logger = logger;
+  _overlay = false;
+
+  _history.resize(kHistoryFrames);
+  reset();
+  return true;
+}
+
+void FrameTelemetry::destroy()
+{
+  std::vector<Frame>().swap(_history);
+}
+
+void FrameTelemetry::reset()
+{
+  memset(_histograms, 0, sizeof(_histograms));
+  memset(_outcomes, 0, sizeof(_outcomes));
+  _frames = 0;
+  _recorded = 0;
+
+  _intervals = 0;
+  _intervalMean = _intervalM2 = 0.0;
+
+  for (auto& frame : _history)
+    frame.number = 0;
+
+  _next = 0;
+}
+
+/* Values below 64us get their own bucket, above that each power of two is split in kSubBuckets */
+unsigned FrameTelemetry::bucket(uint32_t micros)
+{
+  if (micros < 64)
+    return micros;
+
+  unsigned msb = 6;
+  while (msb < 31 && (micros >> (msb + 1)) != 0)
+    msb++;
+
+  const unsigned shift = msb - 5;
+  return 64 + (shift - 1) * kSubBuckets + ((micros >> shift) - kSubBuckets);
+}
+
+uint32_t FrameTelemetry::bucketValue(unsigned index)
+{
+  if (index < 64)
+    return index;
+
+  const unsigned shift = (index - 64) / kSubBuckets + 1;
+  const uint32_t low = (uint32_t)(kSubBuckets + (index - 64) % kSubBuckets) << shift;
+  return low + ((1U << shift) >> 1);
+}
+
+void FrameTelemetry::record(const Frame& frame)
+{
+  _history[_next] = frame;
+  _history[_next].number = ++_recorded;
+  _next = (_next + 1) % _history.size();
+
+  _outcomes[(int)frame.outcome]++;
+
+  static const metrics::Id ids[] =
+  {
+    metrics::kFramesRendered, metrics::kFramesRendered, metrics::kFramesSkipped, metrics::kFramesDropped,
+    metrics::kFramesFaulted, metrics::kFramesStalled
+  };
+
+  static_assert(sizeof(ids) / sizeof(ids[0]) == (int)Outcome::Count, "every outcome needs a metric");
+
+  metrics::add(ids[(int)frame.outcome]);
+
+  if (frame.outcome == Outcome::Stalled)
+    return;
+
+  metrics::set(metrics::kFrameMicros, frame.micros[kTotal]);
+
+  for (int i = 0; i < kPhaseCount; i++)
+    _histograms[i][bucket(frame.micros[i])]++;
+
+  _frames++;
+
+  // Welford's algorithm, the histograms are too coarse for the variance
+  if (frame.micros[kInterval] != 0)
+  {
+    const double interval = frame.micros[kInterval];
+    const double delta = interval - _intervalMean;
+
+    _intervals++;
+    _intervalMean += delta / _intervals;
+    _intervalM2 += delta * (interval - _intervalMean);
+  }
+}
+
+double FrameTelemetry::intervalStdDev() const
+{
+  return _intervals > 1 ? sqrt(_intervalM2 / (_intervals - 1)) : 0.0;
+}
+
+uint32_t FrameTelemetry::percentile(Phase phase, double p) const
+{
+  if (_frames == 0)
+    return 0;
+
+  uint32_t target = (uint32_t)(p * _frames + 0.5);
+  if (target == 0)
+    target = 1;
+
+  const uint32_t* histogram = _histograms[phase];
+  uint32_t seen = 0;
+
+  for (unsigned i = 0; i < kBuckets; i++)
+  {
+    seen += histogram[i];
+
+    if (seen >= target)
+      return bucketValue(i);
+  }
+
+  return bucketValue(kBuckets - 1);
+}
+
+std::string FrameTelemetry::summary(unsigned fps) const
+{
+  char buffer[160];
+  snprintf(buffer, sizeof(buffer), "%u.%02ufps p50 %.1fms p99 %.1fms, +/-%.2fms, %u dropped, %.0f%% duped, p99 preempted %.1fms", fps / 100, fps % 100,
+    percentile(kTotal, 0.50) / 1000.0, percentile(kTotal, 0.99) / 1000.0, intervalStdDev() / 1000.0,
+    count(Outcome::Dropped) + count(Outcome::Fault), dupeRatio() * 100.0, percentile(kPreempted, 0.99) / 1000.0);
+
+  return buffer;
+}
+
+void FrameTelemetry::logSummary() const
+{
+  if (_frames == 0)
+    return;
+
+  _logger->info(TAG "%u frames (%u rendered, %u duped, %u skipped, %u dropped, %u faults, %u stalls)", _frames,
+    count(Outcome::Rendered), count(Outcome::Duped), count(Outcome::Skipped), count(Outcome::Dropped), count(Outcome::Fault), count(Outcome::Stalled));
+
+  // cores running at half their nominal rate dupe every other frame
+  _logger->info(TAG "%.1f%% of the frames with video were duped by the core", dupeRatio() * 100.0);
+
+  _logger->info(TAG "Frames started every %.0f us on average, standard deviation %.0f us", intervalMean(), intervalStdDev());
+
+  for (int i = 0; i < kPhaseCount; i++)
+  {
+    const Phase phase = (Phase)i;
+    _logger->info(TAG "%-12s p50 %6u us, p90 %6u us, p99 %6u us, max %6u us", phaseName(phase),
+      percentile(phase, 0.50), percentile(phase, 0.90), percentile(phase, 0.99), percentile(phase, 1.0));
+  }
+}
+
+bool FrameTelemetry::exportFrames(const std::string& path) const
+{
+  FILE* file = util::openFile(_logger, path, "w");
+
+  if (file == NULL)
+    return false;
+
+  const bool jsonl = util::extension(path) == ".jsonl";
+
+  if (!jsonl)
+  {
+    fprintf(file, "frame,outcome");
+
+    for (int i = 0; i < kPhaseCount; i++)
+      fprintf(file, ",%s_us", phaseName((Phase)i));
+
+    fprintf(file, "\n");
+  }
+
+  size_t written = 0;
+
+  /* oldest first, slots never written have a frame number of zero */
+  for (size_t i = 0; i < _history.size(); i++)
+  {
+    const Frame& frame = _history[(_next + i) % _history.size()];
+
+    if (frame.number == 0)
+      continue;
+
+    if (jsonl)
+    {
+      fprintf(file, "{\"frame\":%u,\"outcome\":\"%s\"", frame.number, outcomeName(frame.outcome));
+
+      for (int j = 0; j < kPhaseCount; j++)
+        fprintf(file, ",\"%s\":%u", phaseName((Phase)j), frame.micros[j]);
+
+      fprintf(file, "}\n");
+    }
+    else
+    {
+      fprintf(file, "%u,%s", frame.number, outcomeName(frame.outcome));
+
+      for (int j = 0; j < kPhaseCount; j++)
+        fprintf(file, ",%u", frame.micros[j]);
+
+      fprintf(file, "\n");
+    }
+
+    written++;
+  }
+
+  fclose(file);
+
+  _logger->info(TAG "Exported %zu frames to \"%s\"", written, path.c_str());
+  return true;
+}
+
+const char* FrameTelemetry::phaseName(Phase phase)
+{
+  switch (phase)
+  {
+    case kRun:          return "run";
+    case kAchievements: return "achievements";
+    case kUpload:       return "upload";
+    case kSwap:         return "swap";
+    case kAudioWait:    return "audio_wait";
+    case kTotal:        return "total";
+    case kInterval:     return "interval";
+    case kPreempted:    return "preempted";
+    default:            return "?";
+  }
+}
+
+double FrameTelemetry::dupeRatio() const
+{
+  const uint32_t video = count(Outcome::Rendered) + count(Outcome::Duped);
+  return video != 0 ? (double)count(Outcome::Duped) / (double)video : 0.0;
+}
+
+const char* FrameTelemetry::outcomeName(Outcome outcome)
+{
+  switch (outcome)
+  {
+    case Outcome::Rendered: return "rendered";
+    case Outcome::Duped:    return "duped";
+    case Outcome::Skipped:  return "skipped";
+    case Outcome::Dropped:  return "dropped";
+    case Outcome::Fault:    return "fault";
+    case Outcome::Stalled:  return "stalled";
+    default:                return "?";
+  }
+}
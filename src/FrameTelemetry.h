@@ -0,0 +1,130 @@
+/*
+Copyright (C) 2018 Andre Leiradella
+
+This file is part of RALibretro.
+
+RALibretro is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RALibretro is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "components/Logger.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/* Always-on frame pacing statistics collected by Application::runSmoothed.
+ *
+ * Every frame is split into the time spent in the core, in the achievements runtime, uploading
+ * the frame to the GPU, swapping buffers (which includes waiting for vsync) and waiting for the
+ * audio FIFO. Each phase feeds a log-linear histogram covering the whole session, and the most
+ * recent frames are kept verbatim so they can be exported when diagnosing a stutter report.
+ */
+class FrameTelemetry
+{
+public:
+  enum Phase
+  {
+    kRun,
+    kAchievements,
+    kUpload,
+    kSwap,
+    kAudioWait,
+    kTotal,
+    kInterval,  /* from the start of the previous frame, zero when it's not known */
+    kPreempted, /* time the emulation thread wasn't running during run and upload */
+
+    kPhaseCount
+  };
+
+  enum class Outcome : uint8_t
+  {
+    Rendered, /* ran with video */
+    Duped,    /* ran with video, but the core repeated the previous frame so nothing was presented */
+    Skipped,  /* planned skip to keep up with the target rate */
+    Dropped,  /* skipped because the frame rate fell behind */
+    Fault,    /* four skips in a row, rendered anyway */
+    Stalled,  /* blocked by the UI for more than 500ms, not counted in the histograms */
+
+    Count
+  };
+
+  struct Frame
+  {
+    uint32_t micros[kPhaseCount];
+    uint32_t number;  /* assigned by record */
+    Outcome  outcome;
+  };
+
+  bool init(Logger* logger);
+  void destroy();
+
+  void reset();
+  void record(const Frame& frame);
+
+  uint32_t percentile(Phase phase, double p) const;
+  uint32_t count(Outcome outcome) const { return _outcomes[(int)outcome]; }
+  uint32_t frames() const { return _frames; }
+
+  /* Fraction of the frames ran with video that the core duped */
+  double dupeRatio() const;
+
+  /* Mean and standard deviation of the time between frames, in microseconds */
+  double intervalMean() const { return _intervalMean; }
+  double intervalStdDev() const;
+
+  /* One line summary used by the overlay */
+  std::string summary(unsigned fps) const;
+
+  /* Logs the percentiles of every phase, called when a game is unloaded */
+  void logSummary() const;
+
+  /* Writes the recent frames as CSV, or as JSON lines if the extension is .jsonl */
+  bool exportFrames(const std::string& path) const;
+
+  bool overlay() const { return _overlay; }
+  void setOverlay(bool overlay) { _overlay = overlay; }
+
+  static const char* phaseName(Phase phase);
+  static const char* outcomeName(Outcome outcome);
+
+protected:
+  enum
+  {
+    kHistoryFrames = 3600,  /* one minute at 60 fps */
+    kSubBuckets = 32,       /* about 3% resolution above 64us */
+    kBuckets = 64 + 26 * kSubBuckets
+  };
+
+  static unsigned bucket(uint32_t micros);
+  static uint32_t bucketValue(unsigned index);
+
+  Logger* _logger;
+
+  uint32_t _histograms[kPhaseCount][kBuckets];
+  uint32_t _outcomes[(int)Outcome::Count];
+  uint32_t _frames;
+  uint32_t _recorded;
+
+  /* running variance of the intervals, see record */
+  uint32_t _intervals;
+  double   _intervalMean;
+  double   _intervalM2;
+
+  std::vector<Frame> _history;
+  size_t _next;
+
+  bool _overlay;
+};
@@ -35,6 +35,7 @@ bool Fsm::before(State state) const {
 void Fsm::after() const {
 
     ctx.updateMenu();
+    ctx.updateAudioState();
   
 }
 
@@ -3,18 +3,57 @@
 #include <SDL_video.h>
 #include <SDL_opengl_glext.h>
 
+#include <atomic>
+#include <mutex>
+#include <string.h>
+
 #define TAG "[OGL] "
 
 static libretro::LoggerComponent* s_logger;
 static bool s_ok;
 static int s_version;
 
+// read from the main thread while frames are presented on another one
+static std::atomic<uint64_t> s_calls;
+static std::atomic<uint64_t> s_skipped;
+
+// bindings known to be current, kUnknown means we have to ask the driver
+static const GLuint kUnknown = ~(GLuint)0;
+static const unsigned kTextureUnits = 16;
+
+static struct
+{
+  GLuint program;
+  GLenum activeTexture;
+  GLuint textures[kTextureUnits];
+  GLuint vertexArray;
+  GLuint arrayBuffer;
+  GLuint framebuffer;
+  GLint viewport[4];
+  bool viewportKnown;
+  GLclampf clearColor[4];
+  bool clearColorKnown;
+}
+s_state;
+
 static PFNGLACTIVETEXTUREPROC s_glActiveTexture;
 
 static PFNGLGENBUFFERSPROC s_glGenBuffers;
 static PFNGLDELETEBUFFERSPROC s_glDeleteBuffers;
 static PFNGLBINDBUFFERPROC s_glBindBuffer;
 static PFNGLBUFFERDATAPROC s_glBufferData;
+static PFNGLBUFFERSUBDATAPROC s_glBufferSubData;
+static PFNGLMAPBUFFERRANGEPROC s_glMapBufferRange;
+static PFNGLUNMAPBUFFERPROC s_glUnmapBuffer;
+static PFNGLFENCESYNCPROC s_glFenceSync;
+static PFNGLCLIENTWAITSYNCPROC s_glClientWaitSync;
+static PFNGLDELETESYNCPROC s_glDeleteSync;
+static PFNGLGENQUERIESPROC s_glGenQueries;
+static PFNGLDELETEQUERIESPROC s_glDeleteQueries;
+static PFNGLBEGINQUERYPROC s_glBeginQuery;
+static PFNGLENDQUERYPROC s_glEndQuery;
+static PFNGLGETQUERYOBJECTIVPROC s_glGetQueryObjectiv;
+static PFNGLGETQUERYOBJECTUI64VPROC s_glGetQueryObjectui64v;
 static PFNGLGENVERTEXARRAYSPROC s_glGenVertexArrays;
 static PFNGLDELETEVERTEXARRAYSPROC s_glDeleteVertexArrays;
 static PFNGLBINDVERTEXARRAYPROC s_glBindVertexArray;
@@ -38,9 +77,13 @@ static PFNGLGETPROGRAMIVPROC s_glGetProgramiv;
 static PFNGLGETPROGRAMINFOLOGPROC s_glGetProgramInfoLog;
 static PFNGLUSEPROGRAMPROC s_glUseProgram;
 static PFNGLGETATTRIBLOCATIONPROC s_glGetAttribLocation;
+static PFNGLBINDATTRIBLOCATIONPROC s_glBindAttribLocation;
 static PFNGLGETUNIFORMLOCATIONPROC s_glGetUniformLocation;
+static PFNGLGETACTIVEUNIFORMPROC s_glGetActiveUniform;
 static PFNGLUNIFORM1IPROC s_glUniform1i;
+static PFNGLUNIFORM1FPROC s_glUniform1f;
 static PFNGLUNIFORM2FPROC s_glUniform2f;
+static PFNGLUNIFORMMATRIX4FVPROC s_glUniformMatrix4fv;
 
 static PFNGLGENFRAMEBUFFERSPROC s_glGenFramebuffers;
 static PFNGLDELETEFRAMEBUFFERSPROC s_glDeleteFramebuffers;
@@ -48,6 +91,7 @@ static PFNGLBINDFRAMEBUFFERPROC s_glBindFramebuffer;
 static PFNGLFRAMEBUFFERTEXTURE2DPROC s_glFramebufferTexture2D;
 static PFNGLFRAMEBUFFERRENDERBUFFERPROC s_glFramebufferRenderbuffer;
 static PFNGLDRAWBUFFERSPROC s_glDrawBuffers;
+static PFNGLBLITFRAMEBUFFERPROC s_glBlitFramebuffer;
 static PFNGLCHECKFRAMEBUFFERSTATUSPROC s_glCheckFramebufferStatus;
 
 static PFNGLGENRENDERBUFFERSPROC s_glGenRenderbuffers;
@@ -57,6 +101,15 @@ static PFNGLRENDERBUFFERSTORAGEPROC s_glRenderbufferStorage;
 
 static PFNGLBLENDEQUATIONEXTPROC s_glBlendEquationEXT;
 
+static PFNGLDEBUGMESSAGECALLBACKPROC s_glDebugMessageCallback;
+static PFNGLDEBUGMESSAGECONTROLPROC s_glDebugMessageControl;
+
+// errors reported by the driver, the callback may be called from any thread. The count and the
+// message are only touched under the mutex, which is never held while calling the driver
+static std::mutex s_debugMutex;
+static unsigned s_debugErrors;
+static char s_debugMessage[256];
+
 static void* getProcAddress(const char* symbol)
 {
   void* address = SDL_GL_GetProcAddress(symbol);
@@ -69,42 +122,77 @@ static void* getProcAddress(const char* symbol)
   return address;
 }
 
+static void fail(const char* function, GLenum err)
+{
+  s_ok = false;
+  s_logger->error(TAG "Error in %s:", function);
+
+  do
+  {
+    switch (err)
+    {
+    case GL_INVALID_OPERATION:
+      s_logger->error(TAG "  INVALID_OPERATION");
+      break;
+
+    case GL_INVALID_ENUM:
+      s_logger->error(TAG "  INVALID_ENUM");
+      break;
+
+    case GL_INVALID_VALUE:
+      s_logger->error(TAG "  INVALID_VALUE");
+      break;
+
+    case GL_OUT_OF_MEMORY:
+      s_logger->error(TAG "  OUT_OF_MEMORY");
+      break;
+
+    case GL_INVALID_FRAMEBUFFER_OPERATION:
+      s_logger->error(TAG "  INVALID_FRAMEBUFFER_OPERATION");
+      break;
+    }
+
+    err = glGetError();
+  } while (err != GL_NO_ERROR);
+}
+
 static void check(const char* function, bool ok = true)
 {
-  GLenum err = glGetError();
+  s_calls++;
+
+#ifdef NDEBUG
+  // glGetError is a round trip to the driver, release builds look for errors once per frame in
+  // Gl::pollErrors, and get the details from the debug output when the driver has it
+  const GLenum err = GL_NO_ERROR;
+#else
+  const GLenum err = glGetError();
+#endif
 
   if (err != GL_NO_ERROR || !ok)
+    fail(function, err);
+}
+
+static void APIENTRY debugCallback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar* message, const void* userParam)
+{
+  (void)source;
+  (void)id;
+  (void)severity;
+  (void)userParam;
+
+  if (type != GL_DEBUG_TYPE_ERROR)
+    return;
+
+  std::lock_guard<std::mutex> lock(s_debugMutex);
+
+  // keep the first message until pollErrors logs it
+  if (s_debugErrors++ == 0)
   {
-    s_ok = false;
-    s_logger->error(TAG "Error in %s:", function);
+    size_t size = length < 0 ? strlen(message) : (size_t)length;
+    if (size >= sizeof(s_debugMessage))
+      size = sizeof(s_debugMessage) - 1;
 
-    do
-    {
-      switch (err)
-      {
-      case GL_INVALID_OPERATION:
-        s_logger->error(TAG "  INVALID_OPERATION");
-        break;
-
-      case GL_INVALID_ENUM:
-        s_logger->error(TAG "  INVALID_ENUM");
-        break;
-
-      case GL_INVALID_VALUE:
-        s_logger->error(TAG "  INVALID_VALUE");
-        break;
-
-      case GL_OUT_OF_MEMORY:
-        s_logger->error(TAG "  OUT_OF_MEMORY");
-        break;
-
-      case GL_INVALID_FRAMEBUFFER_OPERATION:
-        s_logger->error(TAG "  INVALID_FRAMEBUFFER_OPERATION");
-        break;
-      }
-
-      err = glGetError();
-    } while (err != GL_NO_ERROR);
+    memcpy(s_debugMessage, message, size);
+    s_debugMessage[size] = 0;
   }
 }
 
@@ -138,6 +226,34 @@ void Gl::init(libretro::LoggerComponent* logger)
   s_glDeleteBuffers = (PFNGLDELETEBUFFERSPROC)getProcAddress("glDeleteBuffers");
   s_glBindBuffer = (PFNGLBINDBUFFERPROC)getProcAddress("glBindBuffer");
   s_glBufferData = (PFNGLBUFFERDATAPROC)getProcAddress("glBufferData");
+  s_glBufferSubData = (PFNGLBUFFERSUBDATAPROC)getProcAddress("glBufferSubData");
+
+  // glMapBufferRange requires 3.0, don't complain if it's not there
+  if (s_version >= 300)
+  {
+    s_glMapBufferRange = (PFNGLMAPBUFFERRANGEPROC)getProcAddress("glMapBufferRange");
+    s_glUnmapBuffer = (PFNGLUNMAPBUFFERPROC)getProcAddress("glUnmapBuffer");
+  }
+
+  // same for sync objects, which require 3.2
+  if (s_version >= 302)
+  {
+    s_glFenceSync = (PFNGLFENCESYNCPROC)getProcAddress("glFenceSync");
+    s_glClientWaitSync = (PFNGLCLIENTWAITSYNCPROC)getProcAddress("glClientWaitSync");
+    s_glDeleteSync = (PFNGLDELETESYNCPROC)getProcAddress("glDeleteSync");
+  }
+
+  // and for timer queries, which require 3.3
+  if (s_version >= 303)
+  {
+    s_glGenQueries = (PFNGLGENQUERIESPROC)getProcAddress("glGenQueries");
+    s_glDeleteQueries = (PFNGLDELETEQUERIESPROC)getProcAddress("glDeleteQueries");
+    s_glBeginQuery = (PFNGLBEGINQUERYPROC)getProcAddress("glBeginQuery");
+    s_glEndQuery = (PFNGLENDQUERYPROC)getProcAddress("glEndQuery");
+    s_glGetQueryObjectiv = (PFNGLGETQUERYOBJECTIVPROC)getProcAddress("glGetQueryObjectiv");
+    s_glGetQueryObjectui64v = (PFNGLGETQUERYOBJECTUI64VPROC)getProcAddress("glGetQueryObjectui64v");
+  }
+
   s_glGenVertexArrays = (PFNGLGENVERTEXARRAYSPROC)getProcAddress("glGenVertexArrays");
   s_glDeleteVertexArrays = (PFNGLDELETEVERTEXARRAYSPROC)getProcAddress("glDeleteVertexArrays");
   s_glBindVertexArray = (PFNGLBINDVERTEXARRAYPROC)getProcAddress("glBindVertexArray");
@@ -161,9 +277,13 @@ void Gl::init(libretro::LoggerComponent* logger)
   s_glGetProgramInfoLog = (PFNGLGETPROGRAMINFOLOGPROC)getProcAddress("glGetProgramInfoLog");
   s_glUseProgram = (PFNGLUSEPROGRAMPROC)getProcAddress("glUseProgram");
   s_glGetAttribLocation = (PFNGLGETATTRIBLOCATIONPROC)getProcAddress("glGetAttribLocation");
+  s_glBindAttribLocation = (PFNGLBINDATTRIBLOCATIONPROC)getProcAddress("glBindAttribLocation");
   s_glGetUniformLocation = (PFNGLGETUNIFORMLOCATIONPROC)getProcAddress("glGetUniformLocation");
+  s_glGetActiveUniform = (PFNGLGETACTIVEUNIFORMPROC)getProcAddress("glGetActiveUniform");
   s_glUniform1i = (PFNGLUNIFORM1IPROC)getProcAddress("glUniform1i");
+  s_glUniform1f = (PFNGLUNIFORM1FPROC)getProcAddress("glUniform1f");
   s_glUniform2f = (PFNGLUNIFORM2FPROC)getProcAddress("glUniform2f");
+  s_glUniformMatrix4fv = (PFNGLUNIFORMMATRIX4FVPROC)getProcAddress("glUniformMatrix4fv");
 
   s_glGenFramebuffers = (PFNGLGENFRAMEBUFFERSPROC)getProcAddress("glGenFramebuffers");
   s_glDeleteFramebuffers = (PFNGLDELETEFRAMEBUFFERSPROC)getProcAddress("glDeleteFramebuffers");
@@ -173,12 +293,36 @@ void Gl::init(libretro::LoggerComponent* logger)
   s_glRenderbufferStorage = (PFNGLRENDERBUFFERSTORAGEPROC)getProcAddress("glRenderbufferStorage");
   s_glFramebufferRenderbuffer = (PFNGLFRAMEBUFFERRENDERBUFFERPROC)getProcAddress("glFramebufferRenderbuffer");
   s_glDrawBuffers = (PFNGLDRAWBUFFERSPROC)getProcAddress("glDrawBuffers");
+  s_glBlitFramebuffer = (PFNGLBLITFRAMEBUFFERPROC)getProcAddress("glBlitFramebuffer");
   s_glCheckFramebufferStatus = (PFNGLCHECKFRAMEBUFFERSTATUSPROC)getProcAddress("glCheckFramebufferStatus");
 
   s_glGenRenderbuffers = (PFNGLGENRENDERBUFFERSPROC)getProcAddress("glGenRenderbuffers");
   s_glDeleteRenderbuffers = (PFNGLDELETERENDERBUFFERSPROC)getProcAddress("glDeleteRenderbuffers");
 
   s_glBlendEquationEXT = (PFNGLBLENDEQUATIONEXTPROC)getProcAddress("glBlendEquationEXT");
+
+  resetState();
+
+#ifdef NDEBUG
+  // debug output is core in 4.3, before that it may be there as an extension
+  if (s_version >= 403 || SDL_GL_ExtensionSupported("GL_KHR_debug"))
+  {
+    s_glDebugMessageCallback = (PFNGLDEBUGMESSAGECALLBACKPROC)getProcAddress("glDebugMessageCallback");
+    s_glDebugMessageControl = (PFNGLDEBUGMESSAGECONTROLPROC)getProcAddress("glDebugMessageControl");
+  }
+
+  if (s_glDebugMessageCallback != NULL && s_glDebugMessageControl != NULL)
+  {
+    // only errors, and asynchronous so the driver doesn't have to stop to call us
+    s_glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, NULL, GL_FALSE);
+    s_glDebugMessageControl(GL_DONT_CARE, GL_DEBUG_TYPE_ERROR, GL_DONT_CARE, 0, NULL, GL_TRUE);
+    s_glDebugMessageCallback(debugCallback, NULL);
+    glEnable(GL_DEBUG_OUTPUT);
+
+    if (glGetError() == GL_NO_ERROR)
+      logger->info(TAG "Errors reported through the debug output");
+  }
+#endif
 }
 
 bool Gl::ok()
@@ -186,11 +330,63 @@ bool Gl::ok()
   return s_ok;
 }
 
+void Gl::resetState()
+{
+  s_state.program = kUnknown;
+  s_state.activeTexture = kUnknown;
+
+  for (unsigned i = 0; i < kTextureUnits; i++)
+    s_state.textures[i] = kUnknown;
+
+  s_state.vertexArray = kUnknown;
+  s_state.arrayBuffer = kUnknown;
+  s_state.framebuffer = kUnknown;
+  s_state.viewportKnown = false;
+  s_state.clearColorKnown = false;
+}
+
+uint64_t Gl::getCallCount()
+{
+  return s_calls;
+}
+
+uint64_t Gl::getSkippedCount()
+{
+  return s_skipped;
+}
+
 GLenum Gl::getError()
 {
   return glGetError();
 }
 
+void Gl::pollErrors()
+{
+  unsigned count;
+  char message[sizeof(s_debugMessage)];
+
+  {
+    std::lock_guard<std::mutex> lock(s_debugMutex);
+    count = s_debugErrors;
+    s_debugErrors = 0;
+
+    if (count != 0)
+      memcpy(message, s_debugMessage, sizeof(message));
+  }
+
+  if (count != 0)
+    s_logger->error(TAG "%u error(s) reported by the driver, the first one: %s", count, message);
+
+#ifdef NDEBUG
+  if (!s_ok) return;
+
+  GLenum err = glGetError();
+
+  if (err != GL_NO_ERROR)
+    fail(__FUNCTION__, err);
+#endif
+}
+
 int Gl::getVersion()
 {
   return s_version;
@@ -215,20 +411,52 @@ void Gl::deleteTextures(GLsizei n, const GLuint* textures)
   if (!s_ok) return;
   glDeleteTextures(n, textures);
   check(__FUNCTION__);
+
+  // deleted textures are unbound from all units
+  for (GLsizei i = 0; i < n; i++)
+  {
+    for (unsigned j = 0; j < kTextureUnits; j++)
+    {
+      if (s_state.textures[j] == textures[i])
+        s_state.textures[j] = 0;
+    }
+  }
 }
 
 void Gl::bindTexture(GLenum target, GLuint texture)
 {
   if (!s_ok) return;
+
+  // only 2D textures are cached, and only when we know which unit is active
+  const GLenum unit = s_state.activeTexture - GL_TEXTURE0;
+  const bool cached = target == GL_TEXTURE_2D && unit < kTextureUnits;
+
+  if (cached && s_state.textures[unit] == texture)
+  {
+    s_skipped++;
+    return;
+  }
+
   glBindTexture(target, texture);
   check(__FUNCTION__);
+
+  if (cached)
+    s_state.textures[unit] = texture;
 }
 
 void Gl::activeTexture(GLenum texture)
 {
   if (!s_ok) return;
+
+  if (s_state.activeTexture == texture)
+  {
+    s_skipped++;
+    return;
+  }
+
   s_glActiveTexture(texture);
   check(__FUNCTION__);
+  s_state.activeTexture = texture;
 }
 
 void Gl::texParameteri(GLenum target, GLenum pname, GLint param)
@@ -259,6 +487,13 @@ void Gl::getTexImage(GLenum target, GLint level, GLenum format, GLenum type, GLv
   check(__FUNCTION__);
 }
 
+void Gl::readPixels(GLint x, GLint y, GLsizei width, GLsizei height, GLenum format, GLenum type, GLvoid* pixels)
+{
+  if (!s_ok) return;
+  glReadPixels(x, y, width, height, format, type, pixels);
+  check(__FUNCTION__);
+}
+
 void Gl::pixelStorei(GLenum pname, GLint param)
 {
   if (!s_ok) return;
@@ -278,13 +513,30 @@ void Gl::deleteBuffers(GLsizei n, const GLuint* buffers)
   if (!s_ok || s_glDeleteBuffers == NULL) return;
   s_glDeleteBuffers(n, buffers);
   check(__FUNCTION__);
+
+  for (GLsizei i = 0; i < n; i++)
+  {
+    if (s_state.arrayBuffer == buffers[i])
+      s_state.arrayBuffer = 0;
+  }
 }
 
 void Gl::bindBuffer(GLenum target, GLuint buffer)
 {
   if (!s_ok || s_glBindBuffer == NULL) return;
+
+  // pixel buffers are bound and unbound around each transfer, there's nothing to gain there
+  if (target == GL_ARRAY_BUFFER && s_state.arrayBuffer == buffer)
+  {
+    s_skipped++;
+    return;
+  }
+
   s_glBindBuffer(target, buffer);
   check(__FUNCTION__);
+
+  if (target == GL_ARRAY_BUFFER)
+    s_state.arrayBuffer = buffer;
 }
 
 void Gl::bufferData(GLenum target, GLsizeiptr size, const GLvoid* data, GLenum usage)
@@ -294,6 +546,110 @@ void Gl::bufferData(GLenum target, GLsizeiptr size, const GLvoid* data, GLenum u
   check(__FUNCTION__);
 }
 
+void Gl::bufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const GLvoid* data)
+{
+  if (!s_ok || s_glBufferSubData == NULL) return;
+  s_glBufferSubData(target, offset, size, data);
+  check(__FUNCTION__);
+}
+
+void* Gl::mapBufferRange(GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access)
+{
+  if (!s_ok || s_glMapBufferRange == NULL) return NULL;
+  void* pointer = s_glMapBufferRange(target, offset, length, access);
+  check(__FUNCTION__);
+  return pointer;
+}
+
+GLboolean Gl::unmapBuffer(GLenum target)
+{
+  if (!s_ok || s_glUnmapBuffer == NULL) return GL_FALSE;
+  GLboolean result = s_glUnmapBuffer(target);
+  check(__FUNCTION__);
+  return result;
+}
+
+bool Gl::supportsMapBuffer()
+{
+  return s_glMapBufferRange != NULL && s_glUnmapBuffer != NULL;
+}
+
+GLsync Gl::fenceSync(GLenum condition, GLbitfield flags)
+{
+  if (!s_ok || s_glFenceSync == NULL) return NULL;
+  GLsync sync = s_glFenceSync(condition, flags);
+  check(__FUNCTION__);
+  return sync;
+}
+
+GLenum Gl::clientWaitSync(GLsync sync, GLbitfield flags, GLuint64 timeout)
+{
+  if (!s_ok || s_glClientWaitSync == NULL) return GL_WAIT_FAILED;
+  GLenum result = s_glClientWaitSync(sync, flags, timeout);
+  check(__FUNCTION__);
+  return result;
+}
+
+void Gl::deleteSync(GLsync sync)
+{
+  if (!s_ok || s_glDeleteSync == NULL) return;
+  s_glDeleteSync(sync);
+  check(__FUNCTION__);
+}
+
+bool Gl::supportsSync()
+{
+  return s_glFenceSync != NULL && s_glClientWaitSync != NULL && s_glDeleteSync != NULL;
+}
+
+void Gl::genQueries(GLsizei n, GLuint* ids)
+{
+  if (!s_ok || s_glGenQueries == NULL) return;
+  s_glGenQueries(n, ids);
+  check(__FUNCTION__);
+}
+
+void Gl::deleteQueries(GLsizei n, const GLuint* ids)
+{
+  if (!s_ok || s_glDeleteQueries == NULL) return;
+  s_glDeleteQueries(n, ids);
+  check(__FUNCTION__);
+}
+
+void Gl::beginQuery(GLenum target, GLuint id)
+{
+  if (!s_ok || s_glBeginQuery == NULL) return;
+  s_glBeginQuery(target, id);
+  check(__FUNCTION__);
+}
+
+void Gl::endQuery(GLenum target)
+{
+  if (!s_ok || s_glEndQuery == NULL) return;
+  s_glEndQuery(target);
+  check(__FUNCTION__);
+}
+
+void Gl::getQueryObjectiv(GLuint id, GLenum pname, GLint* params)
+{
+  if (!s_ok || s_glGetQueryObjectiv == NULL) return;
+  s_glGetQueryObjectiv(id, pname, params);
+  check(__FUNCTION__);
+}
+
+void Gl::getQueryObjectui64v(GLuint id, GLenum pname, GLuint64* params)
+{
+  if (!s_ok || s_glGetQueryObjectui64v == NULL) return;
+  s_glGetQueryObjectui64v(id, pname, params);
+  check(__FUNCTION__);
+}
+
+bool Gl::supportsTimerQuery()
+{
+  return s_glGenQueries != NULL && s_glDeleteQueries != NULL && s_glBeginQuery != NULL && s_glEndQuery != NULL
+    && s_glGetQueryObjectiv != NULL && s_glGetQueryObjectui64v != NULL;
+}
+
 void Gl::genVertexArray(GLsizei n, GLuint *arrays)
 {
   if (!s_ok || s_glGenVertexArrays == NULL) return;
@@ -306,13 +662,27 @@ void Gl::deleteVertexArrays(GLsizei n, const GLuint *arrays)
   if (!s_ok || s_glDeleteVertexArrays == NULL) return;
   s_glDeleteVertexArrays(n, arrays);
   check(__FUNCTION__);
+
+  for (GLsizei i = 0; i < n; i++)
+  {
+    if (s_state.vertexArray == arrays[i])
+      s_state.vertexArray = 0;
+  }
 }
 
 void Gl::bindVertexArray(GLuint array)
 {
   if (!s_ok || s_glBindVertexArray == NULL) return;
+
+  if (s_state.vertexArray == array)
+  {
+    s_skipped++;
+    return;
+  }
+
   s_glBindVertexArray(array);
   check(__FUNCTION__);
+  s_state.vertexArray = array;
 }
 
 void Gl::vertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const GLvoid* pointer)
@@ -392,6 +762,10 @@ void Gl::deleteProgram(GLuint program)
   if (!s_ok || s_glDeleteProgram == NULL) return;
   s_glDeleteProgram(program);
   check(__FUNCTION__);
+
+  // the name could be reused by the next program created
+  if (s_state.program == program)
+    s_state.program = kUnknown;
 }
 
 void Gl::attachShader(GLuint program, GLuint shader)
@@ -432,8 +806,16 @@ void Gl::getProgramInfoLog(GLuint program, GLsizei maxLength, GLsizei* length, G
 void Gl::useProgram(GLuint program)
 {
   if (!s_ok || s_glUseProgram == NULL) return;
+
+  if (s_state.program == program)
+  {
+    s_skipped++;
+    return;
+  }
+
   s_glUseProgram(program);
   check(__FUNCTION__);
+  s_state.program = program;
 }
 
 GLint Gl::getAttribLocation(GLuint program, const GLchar* name)
@@ -444,6 +826,13 @@ GLint Gl::getAttribLocation(GLuint program, const GLchar* name)
   return location;
 }
 
+void Gl::bindAttribLocation(GLuint program, GLuint index, const GLchar* name)
+{
+  if (!s_ok || s_glBindAttribLocation == NULL) return;
+  s_glBindAttribLocation(program, index, name);
+  check(__FUNCTION__);
+}
+
 GLint Gl::getUniformLocation(GLuint program, const GLchar* name)
 {
   if (!s_ok || s_glGetUniformLocation == NULL) return -1;
@@ -452,6 +841,13 @@ GLint Gl::getUniformLocation(GLuint program, const GLchar* name)
   return location;
 }
 
+void Gl::getActiveUniform(GLuint program, GLuint index, GLsizei bufSize, GLsizei* length, GLint* size, GLenum* type, GLchar* name)
+{
+  if (!s_ok || s_glGetActiveUniform == NULL) return;
+  s_glGetActiveUniform(program, index, bufSize, length, size, type, name);
+  check(__FUNCTION__);
+}
+
 void Gl::uniform1i(GLint location, GLint v0)
 {
   if (!s_ok || s_glUniform1i == NULL) return;
@@ -459,6 +855,13 @@ void Gl::uniform1i(GLint location, GLint v0)
   check(__FUNCTION__);
 }
 
+void Gl::uniform1f(GLint location, GLfloat v0)
+{
+  if (!s_ok || s_glUniform1f == NULL) return;
+  s_glUniform1f(location, v0);
+  check(__FUNCTION__);
+}
+
 void Gl::uniform2f(GLint location, GLfloat v0, GLfloat v1)
 {
   if (!s_ok || s_glUniform2f == NULL) return;
@@ -466,6 +869,13 @@ void Gl::uniform2f(GLint location, GLfloat v0, GLfloat v1)
   check(__FUNCTION__);
 }
 
+void Gl::uniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value)
+{
+  if (!s_ok || s_glUniformMatrix4fv == NULL) return;
+  s_glUniformMatrix4fv(location, count, transpose, value);
+  check(__FUNCTION__);
+}
+
 void Gl::genFramebuffers(GLsizei n, GLuint* ids)
 {
   if (!s_ok || s_glGenFramebuffers == NULL) return;
@@ -478,13 +888,28 @@ void Gl::deleteFramebuffers(GLsizei n, GLuint* ids)
   if (!s_ok || s_glDeleteFramebuffers == NULL) return;
   s_glDeleteFramebuffers(n, ids);
   check(__FUNCTION__);
+
+  for (GLsizei i = 0; i < n; i++)
+  {
+    if (s_state.framebuffer == ids[i])
+      s_state.framebuffer = 0;
+  }
 }
 
 void Gl::bindFramebuffer(GLenum target, GLuint framebuffer)
 {
   if (!s_ok || s_glBindFramebuffer == NULL) return;
+
+  // GL_FRAMEBUFFER sets both the draw and read bindings, the other targets only one of them
+  if (target == GL_FRAMEBUFFER && s_state.framebuffer == framebuffer)
+  {
+    s_skipped++;
+    return;
+  }
+
   s_glBindFramebuffer(target, framebuffer);
   check(__FUNCTION__);
+  s_state.framebuffer = target == GL_FRAMEBUFFER ? framebuffer : kUnknown;
 }
 
 void Gl::framebufferTexture2D(GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level)
@@ -508,6 +933,13 @@ void Gl::drawBuffers(GLsizei n, const GLenum* bufs)
   check(__FUNCTION__);
 }
 
+void Gl::blitFramebuffer(GLint srcX0, GLint srcY0, GLint srcX1, GLint srcY1, GLint dstX0, GLint dstY0, GLint dstX1, GLint dstY1, GLbitfield mask, GLenum filter)
+{
+  if (!s_ok || s_glBlitFramebuffer == NULL) return;
+  s_glBlitFramebuffer(srcX0, srcY0, srcX1, srcY1, dstX0, dstY0, dstX1, dstY1, mask, filter);
+  check(__FUNCTION__);
+}
+
 GLenum Gl::checkFramebufferStatus(GLenum target)
 {
   if (!s_ok || s_glCheckFramebufferStatus == NULL) return 0;
@@ -547,8 +979,22 @@ void Gl::renderbufferStorage(GLenum target, GLenum internalformat, GLsizei width
 void Gl::clearColor(GLclampf red, GLclampf green, GLclampf blue, GLclampf alpha)
 {
   if (!s_ok) return;
+
+  if (s_state.clearColorKnown && s_state.clearColor[0] == red && s_state.clearColor[1] == green
+    && s_state.clearColor[2] == blue && s_state.clearColor[3] == alpha)
+  {
+    s_skipped++;
+    return;
+  }
+
   glClearColor(red, green, blue, alpha);
   check(__FUNCTION__);
+
+  s_state.clearColor[0] = red;
+  s_state.clearColor[1] = green;
+  s_state.clearColor[2] = blue;
+  s_state.clearColor[3] = alpha;
+  s_state.clearColorKnown = true;
 }
 
 void Gl::clear(GLbitfield mask)
@@ -558,6 +1004,13 @@ void Gl::clear(GLbitfield mask)
   check(__FUNCTION__);
 }
 
+void Gl::finish()
+{
+  if (!s_ok) return;
+  glFinish();
+  check(__FUNCTION__);
+}
+
 void Gl::enable(GLenum cap)
 {
   if (!s_ok) return;
@@ -589,8 +1042,22 @@ void Gl::blendEquation(GLenum mode)
 void Gl::viewport(GLint x, GLint y, GLsizei width, GLsizei height)
 {
   if (!s_ok) return;
+
+  if (s_state.viewportKnown && s_state.viewport[0] == x && s_state.viewport[1] == y
+    && s_state.viewport[2] == width && s_state.viewport[3] == height)
+  {
+    s_skipped++;
+    return;
+  }
+
   glViewport(x, y, width, height);
   check(__FUNCTION__);
+
+  s_state.viewport[0] = x;
+  s_state.viewport[1] = y;
+  s_state.viewport[2] = width;
+  s_state.viewport[3] = height;
+  s_state.viewportKnown = true;
 }
 
 void Gl::drawArrays(GLenum mode, GLint first, GLsizei count)
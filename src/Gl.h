@@ -4,12 +4,28 @@
 
 #include <SDL_opengl.h>
 
+#include <stdint.h>
+
 namespace Gl
 {
   void init(libretro::LoggerComponent* logger);
   bool ok();
 
+  /* The bound program, textures, vertex array, array buffer, framebuffer, viewport and clear color
+   * are cached so binding them again is free. Anything that calls OpenGL directly, like cores doing
+   * hardware rendering, must reset the cache before these functions are used again. */
+  void resetState();
+
+  /* Number of calls that made it to the driver, and of calls skipped because of the cache */
+  uint64_t getCallCount();
+  uint64_t getSkippedCount();
+
   GLenum getError();
+
+  /* Debug builds check for errors after every call. Release builds only do it here, once per
+   * frame, and log what the driver reported through the debug output in the meantime. Either way
+   * the first error disables OpenGL. */
+  void pollErrors();
   void getIntegerv(GLenum pname, GLint *params);
 
   void genTextures(GLsizei n, GLuint* textures);
@@ -20,12 +36,31 @@ namespace Gl
   void texImage2D(GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const GLvoid* data);
   void texSubImage2D(GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height, GLenum format, GLenum type, const GLvoid* pixels);
   void getTexImage(GLenum target, GLint level, GLenum format, GLenum type, GLvoid* pixels);
+  void readPixels(GLint x, GLint y, GLsizei width, GLsizei height, GLenum format, GLenum type, GLvoid* pixels);
   void pixelStorei(GLenum pname, GLint param);
 
   void genBuffers(GLsizei n, GLuint* buffers);
   void deleteBuffers(GLsizei n, const GLuint* buffers);
   void bindBuffer(GLenum target, GLuint buffer);
   void bufferData(GLenum target, GLsizeiptr size, const GLvoid* data, GLenum usage);
+  void bufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const GLvoid* data);
+  void* mapBufferRange(GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access);
+  GLboolean unmapBuffer(GLenum target);
+  bool supportsMapBuffer();
+
+  GLsync fenceSync(GLenum condition, GLbitfield flags);
+  GLenum clientWaitSync(GLsync sync, GLbitfield flags, GLuint64 timeout);
+  void deleteSync(GLsync sync);
+  bool supportsSync();
+
+  void genQueries(GLsizei n, GLuint* ids);
+  void deleteQueries(GLsizei n, const GLuint* ids);
+  void beginQuery(GLenum target, GLuint id);
+  void endQuery(GLenum target);
+  void getQueryObjectiv(GLuint id, GLenum pname, GLint* params);
+  void getQueryObjectui64v(GLuint id, GLenum pname, GLuint64* params);
+  bool supportsTimerQuery();
+
   void genVertexArray(GLsizei n, GLuint *arrays);
   void deleteVertexArrays(GLsizei n, const GLuint *arrays);
   void bindVertexArray(GLuint array);
@@ -49,9 +84,13 @@ namespace Gl
   void getProgramInfoLog(GLuint program, GLsizei maxLength, GLsizei* length, GLchar* infoLog);
   void useProgram(GLuint program);
   GLint getAttribLocation(GLuint program, const GLchar* name);
+  void bindAttribLocation(GLuint program, GLuint index, const GLchar* name);
   GLint getUniformLocation(GLuint program, const GLchar* name);
+  void getActiveUniform(GLuint program, GLuint index, GLsizei bufSize, GLsizei* length, GLint* size, GLenum* type, GLchar* name);
   void uniform1i(GLint location, GLint v0);
+  void uniform1f(GLint location, GLfloat v0);
   void uniform2f(GLint location, GLfloat v0, GLfloat v1);
+  void uniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value);
 
   void genFramebuffers(GLsizei n, GLuint* ids);
   void deleteFramebuffers(GLsizei n, GLuint* ids);
@@ -59,6 +98,7 @@ namespace Gl
   void framebufferTexture2D(GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level);
   void framebufferRenderbuffer(GLenum target, GLenum attachment, GLenum renderbuffertarget, GLuint renderbuffer);
   void drawBuffers(GLsizei n, const GLenum* bufs);
+  void blitFramebuffer(GLint srcX0, GLint srcY0, GLint srcX1, GLint srcY1, GLint dstX0, GLint dstY0, GLint dstX1, GLint dstY1, GLbitfield mask, GLenum filter);
   GLenum checkFramebufferStatus(GLenum target);
 
   void genRenderbuffers(GLsizei n, GLuint* renderbuffers);
@@ -68,6 +108,7 @@ namespace Gl
 
   void clearColor(GLclampf red, GLclampf green, GLclampf blue, GLclampf alpha);
   void clear(GLbitfield mask);
+  void finish();
   void enable(GLenum cap);
   void disable(GLenum cap);
   void blendFunc(GLenum sfactor, GLenum dfactor);
@@ -65,15 +65,37 @@ GLuint GlUtil::createShader(GLenum shaderType, const char* source)
 }
 
 GLuint GlUtil::createProgram(const char* vertexShader, const char* fragmentShader)
+{
+  return createProgram(vertexShader, fragmentShader, NULL, 0);
+}
+
+GLuint GlUtil::createProgram(const char* vertexShader, const char* fragmentShader, const char* const* attributes, unsigned count)
 {
   if (!Gl::ok()) return 0;
 
   GLuint vs = createShader(GL_VERTEX_SHADER, vertexShader);
   GLuint fs = createShader(GL_FRAGMENT_SHADER, fragmentShader);
+
+  // attaching a shader that didn't compile is an error that would disable OpenGL altogether
+  if (vs == 0 || fs == 0)
+  {
+    if (vs != 0)
+      Gl::deleteShader(vs);
+
+    if (fs != 0)
+      Gl::deleteShader(fs);
+
+    return 0;
+  }
+
   GLuint program = Gl::createProgram();
 
   Gl::attachShader(program, vs);
   Gl::attachShader(program, fs);
+
+  for (unsigned i = 0; i < count; i++)
+    Gl::bindAttribLocation(program, i, attributes[i]);
+
   Gl::linkProgram(program);
 
   Gl::deleteShader(vs);
@@ -11,5 +11,7 @@ namespace GlUtil
   GLuint createTexture(GLsizei width, GLsizei height, GLint internalFormat, GLenum format, GLenum type, GLenum filter);
   GLuint createShader(GLenum shaderType, const char* source);
   GLuint createProgram(const char* vertexShader, const char* fragmentShader);
+  /* Binds attributes[i] to location i before linking, so programs can share the same vertex setup */
+  GLuint createProgram(const char* vertexShader, const char* fragmentShader, const char* const* attributes, unsigned count);
   GLuint createFramebuffer(GLuint *renderbuffer, GLsizei width, GLsizei height, GLuint texture, bool depth, bool stencil);
 }
@@ -18,6 +18,7 @@ along with RALibretro.  If not, see <http://www.gnu.org/licenses/>.
 */
 
 #include "Hash.h"
+#include "HashReader.h"
 #include "Util.h"
 
 #include <RA_Interface.h>
@@ -36,7 +37,15 @@ along with RALibretro.  If not, see <http://www.gnu.org/licenses/>.
 extern void RA_ActivateDisc(int loadedGame);
 extern void RA_DeactivateDisc();
 
+// hashes may be computed on a worker, errors are only shown once the game is identified
+static std::string g_hashError;
+
 static void rhash_handle_error_message(const char* message)
+{
+  g_hashError = message;
+}
+
+static void rhash_show_error_message(const char* message)
 {
 #ifdef _WINDOWS
   extern HWND g_mainWindow;
@@ -46,55 +55,55 @@ static void rhash_handle_error_message(const char* message)
 #endif
 }
 
-static Logger* g_logger = NULL;
-static void* rhash_file_open(const char* path)
-{
-  return util::openFile(g_logger, path, "rb");
-}
-
-static void rhash_file_seek(void* file_handle, size_t offset, int origin)
-{
-  fseek((FILE*)file_handle, offset, origin);
-}
-
-static size_t rhash_file_tell(void* file_handle)
+std::string romHash(Logger* logger, HashCache* cache, int system, const std::string& path, const std::string& entry, const void* rom, size_t size)
 {
-  return ftell((FILE*)file_handle);
-}
-
-static size_t rhash_file_read(void* file_handle, void* buffer, size_t requested_bytes)
-{
-  return fread(buffer, 1, requested_bytes, (FILE*)file_handle);
-}
+  if (cache != NULL)
+  {
+    const std::string cached = cache->find(system, path, entry);
 
-static void rhash_file_close(void* file_handle)
-{
-  fclose((FILE*)file_handle);
-}
+    if (!cached.empty())
+      return cached;
+  }
 
-bool romLoaded(Logger* logger, int system, const std::string& path, void* rom, size_t size)
-{
-  unsigned int gameId = 0;
   char hash[33];
-  struct rc_hash_filereader filereader;
 
-  g_logger = logger;
   rc_hash_init_error_message_callback(rhash_handle_error_message);
 
-  filereader.open = rhash_file_open;
-  filereader.seek = rhash_file_seek;
-  filereader.tell = rhash_file_tell;
-  filereader.read = rhash_file_read;
-  filereader.close = rhash_file_close;
-  rc_hash_init_custom_filereader(&filereader);
-
+  // what's read to hash the content is cached for the core to read it again
+  hashReaderInit(logger, HashReader::Cached);
   rc_hash_init_default_cdreader();
 
+  // the cached hash must be dropped when any of the files read, like the tracks of a CUE sheet,
+  // changes. Callers without a cache may track the files themselves
+  std::vector<std::string> opened;
+
+  if (cache != NULL)
+    hashReaderTrack(&opened);
+
   hash[0] = '\0';
-  if (!rom || !rc_hash_generate_from_buffer(hash, system, (uint8_t*)rom, size))
+  if (!rom || !rc_hash_generate_from_buffer(hash, system, (const uint8_t*)rom, size))
     rc_hash_generate_from_file(hash, (int)system, path.c_str());
 
-  if (!hash[0])
+  if (cache != NULL)
+  {
+    hashReaderTrack(NULL);
+    cache->store(system, path, entry, hash, opened);
+  }
+
+  return hash;
+}
+
+bool romIdentified(Logger* logger, int system, const std::string& hash)
+{
+  unsigned int gameId = 0;
+
+  if (!g_hashError.empty())
+  {
+    rhash_show_error_message(g_hashError.c_str());
+    g_hashError.clear();
+  }
+
+  if (hash.empty())
   {
     // could not generate hash, deactivate game, but return true to allow it to load
     RA_ActivateGame(0);
@@ -102,7 +111,7 @@ bool romLoaded(Logger* logger, int system, const std::string& path, void* rom, s
     return true;
   }
 
-  gameId = RA_IdentifyHash(hash);
+  gameId = RA_IdentifyHash(hash.c_str());
 
   switch (system)
   {
@@ -129,6 +138,11 @@ bool romLoaded(Logger* logger, int system, const std::string& path, void* rom, s
   return true;
 }
 
+bool romLoaded(Logger* logger, HashCache* cache, int system, const std::string& path, const void* rom, size_t size)
+{
+  return romIdentified(logger, system, romHash(logger, cache, system, path, std::string(), rom, size));
+}
+
 void romUnloaded(Logger* logger)
 {
   RA_DeactivateDisc();
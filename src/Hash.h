@@ -32,6 +32,17 @@ void RA_OnLoadNewRom(BYTE* pROMData, unsigned int nROMSize);
 #endif
 
 #include "Emulator.h"
+#include "HashCache.h"
 
-bool   romLoaded(Logger* logger, int consoleId, const std::string& path, void* rom, size_t size);
+/* Hashes the content, rom can be NULL to hash the file. Doesn't touch RAInterface so it can run
+ * on a worker, but only one hash can be computed at a time. The hash is looked up in the cache
+ * first and stored there when computed, the cache can be NULL. entry is the file rom was
+ * extracted from if path is an archive, and empty otherwise. */
+std::string romHash(Logger* logger, HashCache* cache, int consoleId, const std::string& path, const std::string& entry, const void* rom, size_t size);
+
+/* Activates the game with the hash, which is empty if it couldn't be computed */
+bool   romIdentified(Logger* logger, int consoleId, const std::string& hash);
+
+/* Both of the above, for content that didn't come from an archive */
+bool   romLoaded(Logger* logger, HashCache* cache, int consoleId, const std::string& path, const void* rom, size_t size);
 void   romUnloaded(Logger* logger);
@@ -0,0 +1,247 @@
+/*
+Copyright (C) 2018 Andre Leiradella
+
+This file is part of RALibretro.
+
+RALibretro is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RALibretro is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "HashCache.h"
+
+#include "Git.h"
+#include "Util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TAG "[HSC] "
+
+/* first line of the file, followed by the release that wrote it */
+static const char s_header[] = "RALibretro hash cache ";
+
+bool HashCache::init(Logger* logger, const std::string& path)
+{
+  _logger = logger;
+  _path = path;
+  _dirty = false;
+  _hits = _misses = 0;
+
+  if (_path.empty() || !util::exists(_path))
+    return true;
+
+  const std::string contents = util::loadFile(_logger, _path);
+  const std::string version = std::string(s_header) + git::getReleaseVersion();
+
+  size_t begin = contents.find('\n');
+
+  if (begin == std::string::npos || contents.compare(0, begin, version) != 0)
+  {
+    _logger->info(TAG "Hash cache was written by another version, starting over");
+    _dirty = true;
+    return true;
+  }
+
+  // console, size, time and hash separated by tabs, then the path and the archive entry up to the
+  // end of the line. The files read along with it follow in lines that start with a tab, with
+  // their size, time and path
+  Entry* last = NULL;
+
+  while (++begin < contents.length())
+  {
+    size_t end = contents.find('\n', begin);
+
+    if (end == std::string::npos)
+      end = contents.length();
+
+    const std::string line = contents.substr(begin, end - begin);
+    begin = end;
+
+    char* ptr;
+
+    if (line[0] == '\t')
+    {
+      Companion companion;
+      companion.size = (uint64_t)strtoull(line.c_str() + 1, &ptr, 10);
+      companion.time = (time_t)strtoll(ptr, &ptr, 10);
+
+      if (last == NULL || *ptr++ != '\t' || *ptr == '\0')
+        continue;
+
+      companion.path = ptr;
+      last->companions.push_back(companion);
+      continue;
+    }
+
+    last = NULL;
+    const int consoleId = (int)strtol(line.c_str(), &ptr, 10);
+
+    Entry entry;
+    entry.size = (uint64_t)strtoull(ptr, &ptr, 10);
+    entry.time = (time_t)strtoll(ptr, &ptr, 10);
+
+    if (*ptr++ != '\t')
+      continue;
+
+    const char* tab = strchr(ptr, '\t');
+
+    if (tab == NULL || tab == ptr)
+      continue;
+
+    entry.hash.assign(ptr, tab - ptr);
+
+    if (tab[1] == '\0')
+      continue;
+
+    // the key is the rest of the line, the entry is already separated from the path by a tab
+    last = &(_entries[std::to_string(consoleId) + tab] = entry);
+  }
+
+  _logger->info(TAG "Loaded %zu hashes from \"%s\"", _entries.size(), _path.c_str());
+  return true;
+}
+
+void HashCache::destroy()
+{
+  save();
+
+  if (_hits != 0 || _misses != 0)
+    _logger->info(TAG "Hash cache: %u hits, %u misses", _hits, _misses);
+
+  _entries.clear();
+}
+
+std::string HashCache::key(int consoleId, const std::string& path, const std::string& entry)
+{
+  std::string key = std::to_string(consoleId) + '\t' + path;
+
+  if (!entry.empty())
+    key.append("\t").append(entry);
+
+  return key;
+}
+
+std::string HashCache::find(int consoleId, const std::string& path, const std::string& entry)
+{
+  if (_path.empty())
+    return std::string();
+
+  const auto found = _entries.find(key(consoleId, util::fullPath(path), entry));
+
+  if (found == _entries.end())
+  {
+    _misses++;
+    return std::string();
+  }
+
+  uint64_t size;
+  time_t time;
+
+  // the file, or one read along with it, was changed or deleted since the hash was computed
+  bool changed = !util::fileInfo(path, &size, &time) || size != found->second.size || time != found->second.time;
+
+  for (const auto& companion : found->second.companions)
+  {
+    if (changed)
+      break;
+
+    changed = !util::fileInfo(companion.path, &size, &time) || size != companion.size || time != companion.time;
+  }
+
+  if (changed)
+  {
+    _entries.erase(found);
+    _dirty = true;
+    _misses++;
+    return std::string();
+  }
+
+  _hits++;
+  return found->second.hash;
+}
+
+void HashCache::store(int consoleId, const std::string& path, const std::string& entry, const std::string& hash, const std::vector<std::string>& opened)
+{
+  Entry value;
+
+  // files without a modification time can't be validated later
+  if (_path.empty() || hash.empty() || !util::fileInfo(path, &value.size, &value.time) || value.time == 0)
+    return;
+
+  const std::string fullPath = util::fullPath(path);
+
+  for (const auto& file : opened)
+  {
+    Companion companion;
+    companion.path = util::fullPath(file);
+
+    // CUE sheets open their tracks more than once
+    bool known = companion.path == fullPath;
+
+    for (const auto& other : value.companions)
+      known = known || other.path == companion.path;
+
+    if (known)
+      continue;
+
+    if (!util::fileInfo(companion.path, &companion.size, &companion.time) || companion.time == 0)
+      return;
+
+    value.companions.push_back(companion);
+  }
+
+  value.hash = hash;
+  _entries[key(consoleId, fullPath, entry)] = value;
+  _dirty = true;
+}
+
+bool HashCache::save()
+{
+  if (!_dirty)
+    return true;
+
+  std::string contents = s_header;
+  contents.append(git::getReleaseVersion());
+  contents.append("\n");
+
+  char buffer[64];
+
+  for (const auto& pair : _entries)
+  {
+    // the key already has the console and the path
+    const size_t tab = pair.first.find('\t');
+
+    snprintf(buffer, sizeof(buffer), "\t%llu\t%lld\t", (unsigned long long)pair.second.size, (long long)pair.second.time);
+
+    contents.append(pair.first, 0, tab);
+    contents.append(buffer);
+    contents.append(pair.second.hash);
+    contents.append(pair.first, tab, std::string::npos);
+    contents.append("\n");
+
+    for (const auto& companion : pair.second.companions)
+    {
+      snprintf(buffer, sizeof(buffer), "\t%llu\t%lld\t", (unsigned long long)companion.size, (long long)companion.time);
+      contents.append(buffer);
+      contents.append(companion.path);
+      contents.append("\n");
+    }
+  }
+
+  if (!util::saveFileAtomic(_logger, _path, contents.c_str(), contents.length()))
+    return false;
+
+  _dirty = false;
+  return true;
+}
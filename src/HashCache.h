@@ -0,0 +1,88 @@
+/*
+Copyright (C) 2018 Andre Leiradella
+
+This file is part of RALibretro.
+
+RALibretro is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RALibretro is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "components/Logger.h"
+
+#include <stdint.h>
+#include <time.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/* Hashes computed before, so launching the same game again doesn't read the content.
+ *
+ * Entries are keyed by the console, the absolute path of the file and the file picked from it if
+ * it's an archive, and remember the size and modification time of the file and of every other
+ * file read to compute the hash, like the tracks of a CUE sheet or the discs of an M3U playlist.
+ * An entry is dropped when any of them changed or can't be found anymore. The whole cache is dropped when it was written by another release, the hashing code
+ * comes with it and may hash some files differently.
+ *
+ * The cache is a text file with a line per entry. It's not thread safe, but find and store don't
+ * log so they can be used on a worker while nothing else touches the cache.
+ */
+class HashCache
+{
+public:
+  /* Loads path if it exists, an empty path disables the cache */
+  bool init(Logger* logger, const std::string& path);
+  void destroy();
+
+  /* The hash of the file, or an empty string if it's not in the cache. entry is the name of the
+   * file that was hashed when path is an archive, and empty otherwise */
+  std::string find(int consoleId, const std::string& path, const std::string& entry);
+
+  /* opened has the files read to compute the hash, path may be among them */
+  void store(int consoleId, const std::string& path, const std::string& entry, const std::string& hash, const std::vector<std::string>& opened);
+
+  /* Writes the cache if it changed */
+  bool save();
+
+  unsigned hits() const { return _hits; }
+  unsigned misses() const { return _misses; }
+
+protected:
+  struct Companion
+  {
+    uint64_t    size;
+    time_t      time;
+    std::string path;
+  };
+
+  struct Entry
+  {
+    uint64_t    size;
+    time_t      time;
+    std::string hash;
+    std::vector<Companion> companions;
+  };
+
+  static std::string key(int consoleId, const std::string& path, const std::string& entry);
+
+  Logger*     _logger;
+  std::string _path;
+
+  std::unordered_map<std::string, Entry> _entries;
+  bool _dirty;
+
+  unsigned _hits;
+  unsigned _misses;
+};
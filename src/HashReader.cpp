@@ -0,0 +1,339 @@
+/*
+Copyright (C) 2018 Andre Leiradella
+
+This file is part of RALibretro.
+
+RALibretro is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RALibretro is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "HashReader.h"
+
+#include "FileCache.h"
+#include "Util.h"
+
+#include <rhash.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define TAG "[HRD] "
+
+/* 128 raw sectors, which is also a whole number of 2048 byte sectors */
+#define BUFFER_SIZE (128 * 2352)
+
+/* fills start at this boundary before the position being read, so a read that crosses the end of
+ * the buffer starts the next fill at the sector it's in instead of in the middle of it */
+#define FILL_ALIGNMENT 2048
+
+static Logger* s_logger;
+static HashReader s_reader;
+
+static std::atomic<uint64_t> s_reads(0);
+static std::atomic<uint64_t> s_fills(0);
+static std::atomic<uint64_t> s_bytes(0);
+
+static thread_local std::vector<std::string>* s_opened = NULL;
+
+struct HashFile
+{
+  FILE*                file;
+  CachedFile*          cached;    /* not NULL if the file is read through the cache */
+  const uint8_t*       data;      /* not NULL if the file is mapped */
+  uint64_t             size;
+  uint64_t             position;
+  uint64_t             filePosition;  /* where the next fread reads from */
+
+  uint64_t             bufferStart;   /* file offset of the first byte in the buffer */
+  size_t               bufferLength;
+  std::vector<uint8_t> buffer;
+};
+
+static bool seek64(FILE* file, uint64_t offset)
+{
+#ifdef _WIN32
+  return _fseeki64(file, (__int64)offset, SEEK_SET) == 0;
+#else
+  return fseeko(file, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+static const uint8_t* mapFile(const std::string& path, uint64_t size)
+{
+#if defined(_WINDOWS)
+  size_t mapped;
+  return (const uint8_t*)util::mapFile(s_logger, path, &mapped);
+#elif !defined(_WIN32)
+  const int fd = open(path.c_str(), O_RDONLY);
+
+  if (fd < 0)
+    return NULL;
+
+  void* data = mmap(NULL, (size_t)size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (data == MAP_FAILED)
+    return NULL;
+
+  madvise(data, (size_t)size, MADV_SEQUENTIAL);
+  return (const uint8_t*)data;
+#else
+  // console builds for Windows don't have util::mapFile, read them buffered
+  (void)path;
+  (void)size;
+  return NULL;
+#endif
+}
+
+static void unmapFile(const uint8_t* data, uint64_t size)
+{
+#if defined(_WINDOWS)
+  (void)size;
+  util::unmapFile(data);
+#elif !defined(_WIN32)
+  munmap((void*)data, (size_t)size);
+#else
+  (void)data;
+  (void)size;
+#endif
+}
+
+static void* hashFileOpen(const char* path)
+{
+  uint64_t size;
+  time_t time;
+
+  if (!util::fileInfo(path, &size, &time))
+  {
+    s_logger->error(TAG "Error opening \"%s\"", path);
+    return NULL;
+  }
+
+  if (s_opened != NULL)
+    s_opened->push_back(path);
+
+  HashFile* file = new HashFile;
+  file->file = NULL;
+  file->cached = NULL;
+  file->data = NULL;
+  file->size = size;
+  file->position = file->filePosition = 0;
+  file->bufferStart = 0;
+  file->bufferLength = 0;
+
+  if (s_reader == HashReader::Cached)
+  {
+    file->cached = fileCacheOpen(path, false);
+
+    if (file->cached == NULL)
+    {
+      delete file;
+      return NULL;
+    }
+
+    return file;
+  }
+
+  // an address space of 4 GB can't map big disc images
+  if (s_reader == HashReader::Mapped && size != 0 && size <= SIZE_MAX)
+    file->data = mapFile(path, size);
+
+  if (file->data == NULL)
+  {
+    file->file = util::openFile(s_logger, path, "rb");
+
+    if (file->file == NULL)
+    {
+      delete file;
+      return NULL;
+    }
+
+    if (s_reader == HashReader::Stdio)
+    {
+      // what RAHasher used before, kept to compare against
+      setvbuf(file->file, NULL, _IOFBF, 256 * 1024);
+    }
+    else
+    {
+      // we buffer ourselves, stdio would only copy everything once more
+      setvbuf(file->file, NULL, _IONBF, 0);
+      file->buffer.resize(BUFFER_SIZE);
+    }
+  }
+
+  return file;
+}
+
+static void hashFileSeek(void* handle, size_t offset, int origin)
+{
+  HashFile* file = (HashFile*)handle;
+
+  // only SEEK_SET offsets are positive, the others are signed even though they come as size_t
+  switch (origin)
+  {
+    case SEEK_SET: file->position = offset; break;
+    case SEEK_CUR: file->position += (int64_t)(ptrdiff_t)offset; break;
+    case SEEK_END: file->position = file->size + (int64_t)(ptrdiff_t)offset; break;
+  }
+}
+
+static size_t hashFileTell(void* handle)
+{
+  return (size_t)((HashFile*)handle)->position;
+}
+
+static size_t readFile(HashFile* file, uint64_t offset, void* buffer, size_t size)
+{
+  if (offset != file->filePosition)
+  {
+    if (!seek64(file->file, offset))
+      return 0;
+
+    file->filePosition = offset;
+  }
+
+  const size_t numRead = fread(buffer, 1, size, file->file);
+  file->filePosition += numRead;
+
+  s_fills++;
+  s_bytes += numRead;
+  return numRead;
+}
+
+static size_t hashFileRead(void* handle, void* buffer, size_t requested)
+{
+  HashFile* file = (HashFile*)handle;
+  s_reads++;
+
+  if (file->position >= file->size)
+    return 0;
+
+  if (requested > file->size - file->position)
+    requested = (size_t)(file->size - file->position);
+
+  if (file->cached != NULL)
+  {
+    const size_t numRead = fileCacheRead(file->cached, file->position, buffer, requested);
+    file->position += numRead;
+    s_bytes += numRead;
+    return numRead;
+  }
+
+  if (file->data != NULL)
+  {
+    memcpy(buffer, file->data + file->position, requested);
+    file->position += requested;
+    s_bytes += requested;
+    return requested;
+  }
+
+  if (file->buffer.empty())
+  {
+    const size_t numRead = readFile(file, file->position, buffer, requested);
+    file->position += numRead;
+    return numRead;
+  }
+
+  uint8_t* out = (uint8_t*)buffer;
+  size_t total = 0;
+
+  while (requested != 0)
+  {
+    if (file->position >= file->bufferStart && file->position < file->bufferStart + file->bufferLength)
+    {
+      const size_t offset = (size_t)(file->position - file->bufferStart);
+      size_t count = file->bufferLength - offset;
+
+      if (count > requested)
+        count = requested;
+
+      memcpy(out, file->buffer.data() + offset, count);
+      out += count;
+      total += count;
+      requested -= count;
+      file->position += count;
+      continue;
+    }
+
+    // big reads go straight to the caller's buffer
+    if (requested >= BUFFER_SIZE)
+    {
+      const size_t numRead = readFile(file, file->position, out, requested);
+      file->position += numRead;
+      return total + numRead;
+    }
+
+    file->bufferStart = file->position - file->position % FILL_ALIGNMENT;
+    file->bufferLength = readFile(file, file->bufferStart, file->buffer.data(), BUFFER_SIZE);
+
+    if (file->bufferStart + file->bufferLength <= file->position)
+    {
+      file->bufferLength = 0;
+      break;
+    }
+  }
+
+  return total;
+}
+
+static void hashFileClose(void* handle)
+{
+  HashFile* file = (HashFile*)handle;
+
+  if (file->cached != NULL)
+    fileCacheClose(file->cached);
+  else if (file->data != NULL)
+    unmapFile(file->data, file->size);
+  else
+    fclose(file->file);
+
+  delete file;
+}
+
+void hashReaderInit(Logger* logger, HashReader reader)
+{
+  s_logger = logger;
+  s_reader = reader;
+
+  struct rc_hash_filereader filereader;
+  filereader.open = hashFileOpen;
+  filereader.seek = hashFileSeek;
+  filereader.tell = hashFileTell;
+  filereader.read = hashFileRead;
+  filereader.close = hashFileClose;
+  rc_hash_init_custom_filereader(&filereader);
+}
+
+void hashReaderTrack(std::vector<std::string>* opened)
+{
+  s_opened = opened;
+}
+
+HashReaderStats hashReaderStats()
+{
+  HashReaderStats stats;
+  stats.reads = s_reads;
+  stats.fills = s_fills;
+  stats.bytes = s_bytes;
+  return stats;
+}
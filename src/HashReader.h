@@ -0,0 +1,53 @@
+/*
+Copyright (C) 2018 Andre Leiradella
+
+This file is part of RALibretro.
+
+RALibretro is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RALibretro is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "components/Logger.h"
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+/* How the rcheevos hasher reads files */
+enum class HashReader
+{
+  Stdio,    /* plain stdio calls, only kept to compare against */
+  Buffered, /* 64-bit offsets and a read-ahead buffer sized in CD sectors */
+  Mapped,   /* reads from a memory mapped view of the file, buffered if it can't be mapped */
+  Cached    /* reads through the file cache shared with the cores, fileCacheInit must be called first */
+};
+
+/* Installs the reader as the rcheevos file reader. Files can be read on several threads at once,
+ * but the reader must not be changed while they are. */
+void hashReaderInit(Logger* logger, HashReader reader);
+
+/* Adds the path of every file opened on this thread to opened, until it's called again with NULL */
+void hashReaderTrack(std::vector<std::string>* opened);
+
+struct HashReaderStats
+{
+  uint64_t reads;     /* read calls from the hasher */
+  uint64_t fills;     /* reads that went to the disk */
+  uint64_t bytes;     /* bytes read from the disk, or copied from mapped files */
+};
+
+/* Totals since the program started */
+HashReaderStats hashReaderStats();
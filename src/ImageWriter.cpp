@@ -0,0 +1,227 @@
+/*
+Copyright (C) 2018 Andre Leiradella
+
+This file is part of RALibretro.
+
+RALibretro is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RALibretro is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ImageWriter.h"
+
+#include "Util.h"
+
+#include "components/Pixels.h"
+
+#ifndef NO_MINIZ
+#include <miniz.h>
+#endif
+
+#include "stb_image_write.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+
+#define TAG "[IMG] "
+
+#ifndef NO_MINIZ
+static const uint8_t s_signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+static void putBe32(std::vector<uint8_t>& out, uint32_t value)
+{
+  out.push_back(value >> 24);
+  out.push_back((value >> 16) & 0xff);
+  out.push_back((value >> 8) & 0xff);
+  out.push_back(value & 0xff);
+}
+
+/* the length and the type are already in out, starting at begin */
+static void endChunk(std::vector<uint8_t>& out, size_t begin)
+{
+  const uint32_t length = (uint32_t)(out.size() - begin - 8);
+
+  out[begin] = length >> 24;
+  out[begin + 1] = (length >> 16) & 0xff;
+  out[begin + 2] = (length >> 8) & 0xff;
+  out[begin + 3] = length & 0xff;
+
+  putBe32(out, (uint32_t)mz_crc32(MZ_CRC32_INIT, out.data() + begin + 4, length + 4));
+}
+
+static void beginChunk(std::vector<uint8_t>& out, const char* type)
+{
+  putBe32(out, 0);
+  out.insert(out.end(), type, type + 4);
+}
+
+static mz_bool appendDeflated(const void* data, int size, void* user)
+{
+  std::vector<uint8_t>* out = (std::vector<uint8_t>*)user;
+  out->insert(out->end(), (const uint8_t*)data, (const uint8_t*)data + size);
+  return MZ_TRUE;
+}
+#endif
+
+static void appendBytes(void* context, void* data, int size)
+{
+  std::vector<uint8_t>* out = (std::vector<uint8_t>*)context;
+  out->insert(out->end(), (const uint8_t*)data, (const uint8_t*)data + size);
+}
+
+void ImageWriter::init()
+{
+  _compressor = NULL;
+}
+
+void ImageWriter::destroy()
+{
+  free(_compressor);
+  _compressor = NULL;
+
+  std::vector<uint8_t>().swap(_rgb);
+  std::vector<uint8_t>().swap(_filtered);
+  std::vector<uint8_t>().swap(_png);
+}
+
+bool ImageWriter::toRgb(Logger* logger, const void* data, unsigned width, unsigned height, unsigned pitch, enum retro_pixel_format format)
+{
+  _rgb.resize((size_t)width * height * 3);
+
+  const uint8_t* source = (const uint8_t*)data;
+  uint8_t* target = _rgb.data();
+
+  for (unsigned y = 0; y < height; y++, source += pitch, target += width * 3)
+  {
+    switch (format)
+    {
+      case RETRO_PIXEL_FORMAT_XRGB8888:
+        pixels::xrgb8888ToRgb(target, (const uint32_t*)source, width);
+        break;
+
+      case RETRO_PIXEL_FORMAT_RGB565:
+        pixels::rgb565ToRgb(target, (const uint16_t*)source, width);
+        break;
+
+      case RETRO_PIXEL_FORMAT_0RGB1555:
+        pixels::argb1555ToRgb(target, (const uint16_t*)source, width);
+        break;
+
+      default:
+        logger->error(TAG "Unknown pixel format");
+        return false;
+    }
+  }
+
+  return true;
+}
+
+bool ImageWriter::encodeFast(unsigned width, unsigned height)
+{
+#ifndef NO_MINIZ
+  if (_compressor == NULL)
+  {
+    _compressor = malloc(sizeof(tdefl_compressor));
+
+    if (_compressor == NULL)
+      return false;
+  }
+
+  // sub takes the pixel to the left, it's cheap and does well on the flat colors games have
+  const size_t rowSize = (size_t)width * 3;
+  _filtered.resize((rowSize + 1) * height);
+
+  const uint8_t* source = _rgb.data();
+  uint8_t* target = _filtered.data();
+
+  for (unsigned y = 0; y < height; y++, source += rowSize)
+  {
+    *target++ = 1;
+
+    for (size_t i = 0; i < 3 && i < rowSize; i++)
+      *target++ = source[i];
+
+    for (size_t i = 3; i < rowSize; i++)
+      *target++ = (uint8_t)(source[i] - source[i - 3]);
+  }
+
+  _png.assign(s_signature, s_signature + sizeof(s_signature));
+
+  size_t begin = _png.size();
+  beginChunk(_png, "IHDR");
+  putBe32(_png, width);
+  putBe32(_png, height);
+  _png.push_back(8);  // bits per channel
+  _png.push_back(2);  // RGB
+  _png.push_back(0);
+  _png.push_back(0);
+  _png.push_back(0);
+  endChunk(_png, begin);
+
+  begin = _png.size();
+  beginChunk(_png, "IDAT");
+
+  tdefl_compressor* compressor = (tdefl_compressor*)_compressor;
+  const int flags = (int)tdefl_create_comp_flags_from_zip_params(1, 15, MZ_DEFAULT_STRATEGY);
+
+  if (tdefl_init(compressor, appendDeflated, &_png, flags) != TDEFL_STATUS_OKAY ||
+      tdefl_compress_buffer(compressor, _filtered.data(), _filtered.size(), TDEFL_FINISH) != TDEFL_STATUS_DONE)
+  {
+    return false;
+  }
+
+  endChunk(_png, begin);
+
+  begin = _png.size();
+  beginChunk(_png, "IEND");
+  endChunk(_png, begin);
+
+  return true;
+#else
+  // without miniz there's only stb_image_write's deflate
+  return encodeSmall(width, height);
+#endif
+}
+
+bool ImageWriter::encodeSmall(unsigned width, unsigned height)
+{
+  _png.clear();
+  return stbi_write_png_to_func(appendBytes, &_png, (int)width, (int)height, 3, _rgb.data(), (int)width * 3) != 0;
+}
+
+bool ImageWriter::write(Logger* logger, const std::string& path, const void* data, unsigned width, unsigned height, unsigned pitch, enum retro_pixel_format format, Compression compression)
+{
+  const auto tStart = std::chrono::steady_clock::now();
+
+  if (!toRgb(logger, data, width, height, pitch, format))
+    return false;
+
+  const bool ok = compression == Compression::Fast ? encodeFast(width, height) : encodeSmall(width, height);
+
+  if (!ok)
+  {
+    logger->error(TAG "Error encoding image %u x %u", width, height);
+    return false;
+  }
+
+  const auto tEnd = std::chrono::steady_clock::now();
+
+  if (!util::saveFile(logger, path, _png.data(), _png.size()))
+    return false;
+
+  const long long micros = (long long)std::chrono::duration_cast<std::chrono::microseconds>(tEnd - tStart).count();
+  logger->info(TAG "Wrote image %u x %u to %s, %zu bytes encoded in %lld us", width, height, path.c_str(), _png.size(), micros);
+  return true;
+}
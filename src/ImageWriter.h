@@ -0,0 +1,60 @@
+/*
+Copyright (C) 2018 Andre Leiradella
+
+This file is part of RALibretro.
+
+RALibretro is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RALibretro is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "components/Logger.h"
+
+#include "libretro/libretro.h"
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+/* Writes frames as 24-bit PNG files.
+ *
+ * The buffers for the conversion, the filtered rows and the compressed file are kept from one
+ * image to the next, so writing images of the same size doesn't allocate. An instance must only
+ * be used by one thread at a time, give each worker its own.
+ */
+class ImageWriter
+{
+public:
+  enum class Compression
+  {
+    Fast,  /* one filter for all rows and the fastest deflate level, for the images saved with states */
+    Small  /* the best filter for each row and stb_image_write's deflate, for screenshots */
+  };
+
+  void init();
+  void destroy();
+
+  bool write(Logger* logger, const std::string& path, const void* data, unsigned width, unsigned height, unsigned pitch, enum retro_pixel_format format, Compression compression);
+
+protected:
+  bool toRgb(Logger* logger, const void* data, unsigned width, unsigned height, unsigned pitch, enum retro_pixel_format format);
+  bool encodeFast(unsigned width, unsigned height);
+  bool encodeSmall(unsigned width, unsigned height);
+
+  std::vector<uint8_t> _rgb;
+  std::vector<uint8_t> _filtered;
+  std::vector<uint8_t> _png;
+  void*                _compressor;  /* a tdefl_compressor, allocated on the first fast write */
+};
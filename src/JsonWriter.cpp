@@ -0,0 +1,186 @@
+/*
+Copyright (C) 2018 Andre Leiradella
+
+This file is part of RALibretro.
+
+RALibretro is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RALibretro is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "JsonWriter.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+JsonWriter::JsonWriter(size_t reserve)
+{
+  _buffer.reserve(reserve);
+  _first.reserve(8);
+  _key = false;
+}
+
+void JsonWriter::separate()
+{
+  if (_key)
+  {
+    _key = false;
+    return;
+  }
+
+  if (!_first.empty())
+  {
+    if (!_first.back())
+      _buffer += ',';
+
+    _first.back() = false;
+  }
+}
+
+void JsonWriter::escape(const char* str, size_t length)
+{
+  _buffer += '"';
+
+  const char* end = str + length;
+  const char* run = str;
+
+  // copy the characters that don't need escaping in runs
+  for (; str < end; str++)
+  {
+    const char* escaped;
+
+    switch (*str)
+    {
+    case '"':  escaped = "\\\""; break;
+    case '\\': escaped = "\\\\"; break;
+    case '/':  escaped = "\\/"; break;
+    case '\b': escaped = "\\b"; break;
+    case '\f': escaped = "\\f"; break;
+    case '\n': escaped = "\\n"; break;
+    case '\r': escaped = "\\r"; break;
+    case '\t': escaped = "\\t"; break;
+    default:   continue;
+    }
+
+    _buffer.append(run, str - run);
+    _buffer += escaped;
+    run = str + 1;
+  }
+
+  _buffer.append(run, end - run);
+  _buffer += '"';
+}
+
+JsonWriter& JsonWriter::beginObject()
+{
+  separate();
+  _buffer += '{';
+  _first.push_back(true);
+  return *this;
+}
+
+JsonWriter& JsonWriter::endObject()
+{
+  _buffer += '}';
+  _first.pop_back();
+  return *this;
+}
+
+JsonWriter& JsonWriter::beginArray()
+{
+  separate();
+  _buffer += '[';
+  _first.push_back(true);
+  return *this;
+}
+
+JsonWriter& JsonWriter::endArray()
+{
+  _buffer += ']';
+  _first.pop_back();
+  return *this;
+}
+
+JsonWriter& JsonWriter::key(const char* name)
+{
+  separate();
+  escape(name, strlen(name));
+  _buffer += ':';
+  _key = true;
+  return *this;
+}
+
+JsonWriter& JsonWriter::value(bool b)
+{
+  separate();
+  _buffer += b ? "true" : "false";
+  return *this;
+}
+
+JsonWriter& JsonWriter::value(int i)
+{
+  return value((int64_t)i);
+}
+
+JsonWriter& JsonWriter::value(unsigned u)
+{
+  return value((int64_t)u);
+}
+
+JsonWriter& JsonWriter::value(int64_t i)
+{
+  char buffer[32];
+  const int length = snprintf(buffer, sizeof(buffer), "%" PRId64, i);
+
+  separate();
+  _buffer.append(buffer, length);
+  return *this;
+}
+
+JsonWriter& JsonWriter::value(double d)
+{
+  char buffer[32];
+  const int length = snprintf(buffer, sizeof(buffer), "%.9g", d);
+
+  separate();
+  _buffer.append(buffer, length);
+  return *this;
+}
+
+JsonWriter& JsonWriter::value(const char* str)
+{
+  separate();
+  escape(str, strlen(str));
+  return *this;
+}
+
+JsonWriter& JsonWriter::value(const std::string& str)
+{
+  separate();
+  escape(str.c_str(), str.length());
+  return *this;
+}
+
+JsonWriter& JsonWriter::raw(const std::string& json)
+{
+  separate();
+  _buffer += json;
+  return *this;
+}
+
+void JsonWriter::clear()
+{
+  _buffer.clear();
+  _first.clear();
+  _key = false;
+}
@@ -0,0 +1,66 @@
+/*
+Copyright (C) 2018 Andre Leiradella
+
+This file is part of RALibretro.
+
+RALibretro is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RALibretro is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+/* Writes JSON into one buffer, adding the commas and escaping strings as it goes, so a document
+ * is built without a temporary string per value. Keys are only written inside objects, and each
+ * key must be followed by exactly one value.
+ */
+class JsonWriter
+{
+public:
+  explicit JsonWriter(size_t reserve = 4096);
+
+  JsonWriter& beginObject();
+  JsonWriter& endObject();
+  JsonWriter& beginArray();
+  JsonWriter& endArray();
+
+  JsonWriter& key(const char* name);
+
+  JsonWriter& value(bool b);
+  JsonWriter& value(int i);
+  JsonWriter& value(unsigned u);
+  JsonWriter& value(int64_t i);
+  JsonWriter& value(double d);
+  JsonWriter& value(const char* str);
+  JsonWriter& value(const std::string& str);
+
+  /* A value that is already JSON, like what the components' serialize methods return */
+  JsonWriter& raw(const std::string& json);
+
+  const std::string& str() const { return _buffer; }
+
+  /* Starts a new document, keeping the memory of the last one */
+  void clear();
+
+protected:
+  void separate();
+  void escape(const char* str, size_t length);
+
+  std::string       _buffer;
+  std::vector<bool> _first;  /* nothing was written yet in each open object or array */
+  bool              _key;    /* the next value goes after a key */
+};
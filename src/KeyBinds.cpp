@@ -127,6 +127,7 @@ enum
   kFastForward,
   kFastForwardToggle,
   kStep,
+  kRewind,
 
   // Screenshot
   kScreenshot,
@@ -155,7 +156,7 @@ static const char* bindingNames[] = {
   "WINDOW_1X", "WINDOW_2X", "WINDOW_3X", "WINDOW_4X",
   "TOGGLE_FULLSCREEN", "ROTATE_RIGHT", "ROTATE_LEFT",
 
-  "SHOW_OVERLAY", "PAUSE", "FAST_FORWARD", "FAST_FORWARD_TOGGLE", "FRAME_ADVANCE",
+  "SHOW_OVERLAY", "PAUSE", "FAST_FORWARD", "FAST_FORWARD_TOGGLE", "FRAME_ADVANCE", "REWIND",
 
   "SCREENSHOT",
 
@@ -263,6 +264,7 @@ bool KeyBinds::init(libretro::LoggerComponent* logger)
   _bindings[kFastForward] = { 0, SDLK_EQUALS, Binding::Type::Key, 0 };
   _bindings[kFastForwardToggle] = { 0, SDLK_MINUS, Binding::Type::Key, 0 };
   _bindings[kStep] = { 0, SDLK_SEMICOLON, Binding::Type::Key, 0 };
+  _bindings[kRewind] = { 0, SDLK_BACKSPACE, Binding::Type::Key, 0 };
 
   _bindings[kScreenshot] = { 0, SDLK_PRINTSCREEN, Binding::Type::Key, 0 };
 
@@ -270,9 +272,50 @@ bool KeyBinds::init(libretro::LoggerComponent* logger)
 
    // TODO: load persisted
 
+  rebuildIndex();
   return true;
 }
 
+static bool IsAnalog(int button);
+
+void KeyBinds::rebuildIndex()
+{
+  _keyIndex.clear();
+  _buttonIndex.clear();
+  _axisIndex.clear();
+
+  // the first binding wins, like the linear searches this replaces
+  for (int i = 0; i < kMaxBindings; i++)
+  {
+    const Binding& binding = _bindings[i];
+
+    switch (binding.type)
+    {
+      case Binding::Type::Key:
+        _keyIndex.insert(std::make_pair(indexKey(binding.button, binding.modifiers), i));
+        break;
+
+      case Binding::Type::Button:
+        _buttonIndex.insert(std::make_pair(indexKey((uint32_t)binding.joystick_id, binding.button), i));
+        break;
+
+      case Binding::Type::Axis:
+      {
+        // an analog binding consumes the axis, nothing after it is looked at
+        auto& list = _axisIndex[indexKey((uint32_t)binding.joystick_id, binding.button)];
+
+        if (list.empty() || !IsAnalog(list.back()))
+          list.push_back(i);
+
+        break;
+      }
+
+      default:
+        break;
+    }
+  }
+}
+
 #define JOY_EXTRA(port, pressed) ((port << 8) | pressed)
 
 KeyBinds::Action KeyBinds::translateButtonPress(int button, unsigned* extra)
@@ -365,6 +408,7 @@ KeyBinds::Action KeyBinds::translateButtonPress(int button, unsigned* extra)
     case kFastForward:       *extra = (unsigned)!_ff; return Action::kFastForward;
     case kFastForwardToggle: _ff = !_ff; *extra = (unsigned)_ff; return Action::kFastForward;
     case kStep:              return Action::kStep;
+    case kRewind:            *extra = 1; return Action::kRewind;
 
     // Screenshot
     case kScreenshot:        return Action::kScreenshot;
@@ -417,6 +461,7 @@ KeyBinds::Action KeyBinds::translateButtonReleased(int button, unsigned* extra)
 
     // Emulation speed
     case kFastForward: *extra = (unsigned)_ff; return Action::kFastForward;
+    case kRewind:      *extra = 0; return Action::kRewind;
 
     default: return Action::kNothing;
   }
@@ -631,21 +676,17 @@ KeyBinds::Action KeyBinds::translate(const SDL_KeyboardEvent* key, unsigned* ext
   }
   else
   {
-    for (size_t i = 0; i < kMaxBindings; i++)
+    auto found = _keyIndex.find(indexKey((uint32_t)key->keysym.sym, mod));
+
+    if (found != _keyIndex.end())
     {
-      if (_bindings[i].type == Binding::Type::Key)
-      {
-        if ((uint32_t)key->keysym.sym == _bindings[i].button && mod == _bindings[i].modifiers)
-        {
-          if (key->state == SDL_PRESSED)
-            return translateButtonPress(i, extra);
+      if (key->state == SDL_PRESSED)
+        return translateButtonPress(found->second, extra);
 
-          if (key->state == SDL_RELEASED)
-            return translateButtonReleased(i, extra);
+      if (key->state == SDL_RELEASED)
+        return translateButtonReleased(found->second, extra);
 
-          return Action::kNothing;
-        }
-      }
+      return Action::kNothing;
     }
   }
 
@@ -656,22 +697,15 @@ KeyBinds::Action KeyBinds::translate(const SDL_KeyboardEvent* key, unsigned* ext
 KeyBinds::Action KeyBinds::translate(const SDL_ControllerButtonEvent* cbutton, unsigned* extra)
 {
   SDL_JoystickID bindingID = getBindingID(cbutton->which);
+  auto found = _buttonIndex.find(indexKey((uint32_t)bindingID, cbutton->button));
 
-  for (size_t i = 0; i < kMaxBindings; i++)
+  if (found != _buttonIndex.end())
   {
-    if (_bindings[i].type == Binding::Type::Button)
-    {
-      if (cbutton->button == _bindings[i].button && bindingID == _bindings[i].joystick_id)
-      {
-        if (cbutton->state == SDL_PRESSED)
-          return translateButtonPress(i, extra);
-
-        if (cbutton->state == SDL_RELEASED)
-          return translateButtonReleased(i, extra);
+    if (cbutton->state == SDL_PRESSED)
+      return translateButtonPress(found->second, extra);
 
-        break;
-      }
-    }
+    if (cbutton->state == SDL_RELEASED)
+      return translateButtonReleased(found->second, extra);
   }
 
   return Action::kNothing;
@@ -749,36 +783,34 @@ void KeyBinds::translate(const SDL_ControllerAxisEvent* caxis, Input& input,
 
   int threshold = static_cast<int>(32767 * input.getJoystickSensitivity(caxis->which));
   int analogThreshold = threshold / 4;
-  for (size_t i = 0; i < kMaxBindings; i++)
+
+  auto found = _axisIndex.find(indexKey((uint32_t)bindingID, caxis->axis));
+
+  if (found == _axisIndex.end())
+    return;
+
+  for (const int i : found->second)
   {
-    if (_bindings[i].type == Binding::Type::Axis)
+    if (IsAnalog(i))
     {
-      if (caxis->axis == _bindings[i].button && bindingID == _bindings[i].joystick_id)
-      {
-        if (IsAnalog(i))
-        {
-          if (caxis->value > analogThreshold || caxis->value < -analogThreshold)
-            *action1 = translateAnalog(i, caxis->value, extra1);
-          else
-            *action1 = translateAnalog(i, 0, extra1);
-
-          break;
-        }
-        else if ((_bindings[i].modifiers & 0xFF) == 0xFF) // negative axis
-        {
-          if (caxis->value < -threshold)
-            *action1 = translateButtonPress(i, extra1);
-          else
-            *action1 = translateButtonReleased(i, extra1);
-        }
-        else // positive axis
-        {
-          if (caxis->value > threshold)
-            *action2 = translateButtonPress(i, extra2);
-          else
-            *action2 = translateButtonReleased(i, extra2);
-        }
-      }
+      if (caxis->value > analogThreshold || caxis->value < -analogThreshold)
+        *action1 = translateAnalog(i, caxis->value, extra1);
+      else
+        *action1 = translateAnalog(i, 0, extra1);
+    }
+    else if ((_bindings[i].modifiers & 0xFF) == 0xFF) // negative axis
+    {
+      if (caxis->value < -threshold)
+        *action1 = translateButtonPress(i, extra1);
+      else
+        *action1 = translateButtonReleased(i, extra1);
+    }
+    else // positive axis
+    {
+      if (caxis->value > threshold)
+        *action2 = translateButtonPress(i, extra2);
+      else
+        *action2 = translateButtonReleased(i, extra2);
     }
   }
 }
@@ -922,28 +954,18 @@ static bool parseBindingString(const std::string& str, KeyBinds::Binding& bindin
   return false;
 }
 
-std::string KeyBinds::serializeBindings() const
+void KeyBinds::serializeBindings(JsonWriter* json) const
 {
   char binding[32];
-  std::string bindings = "{";
-  bindings.reserve(kMaxBindings * 16);
+  json->beginObject();
 
   for (int i = 0; i < kMaxBindings; ++i)
   {
-    if (i != 0)
-      bindings += ",";
-
-    bindings += "\"";
-    bindings += bindingNames[i];
-    bindings += "\":\"";
-
     getBindingString(binding, _bindings[i]);
-    bindings += util::jsonEscape(binding);
-    bindings += "\"";
+    json->key(bindingNames[i]).value(binding);
   }
 
-  bindings += "}";
-  return bindings;
+  json->endObject();
 }
 
 bool KeyBinds::deserializeBindings(const char* json)
@@ -978,6 +1000,7 @@ bool KeyBinds::deserializeBindings(const char* json)
     return 0;
   });
 
+  rebuildIndex();
   return (res == JSONSAX_OK);
 }
 
@@ -1348,6 +1371,8 @@ public:
     }
     addButtonInput(10, 3, "Save Current State", kSaveCurrent);
 
+    addButtonInput(12, 3, "Rewind (Hold)", kRewind);
+
     for (int i = 0; i < 10; ++i)
     {
       snprintf(label, sizeof(label), "Load State %d", i + 1);
@@ -1475,7 +1500,10 @@ void KeyBinds::showControllerDialog(Input& input, int port)
   }
 
   if (db.show())
+  {
     _bindings = db.getBindings();
+    rebuildIndex();
+  }
 }
 
 void KeyBinds::showHotKeyDialog(Input& input)
@@ -1488,5 +1516,8 @@ void KeyBinds::showHotKeyDialog(Input& input)
   db.initHotKeyButtons(_bindings);
 
   if (db.show())
+  {
     _bindings = db.getBindings();
+    rebuildIndex();
+  }
 }
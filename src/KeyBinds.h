@@ -21,10 +21,14 @@ along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "libretro/Components.h"
 
+#include "JsonWriter.h"
+
 #include <SDL_events.h>
 
 #include <array>
 #include <map>
+#include <unordered_map>
+#include <vector>
 
 class Input; // forward reference
 
@@ -77,6 +81,7 @@ public:
     kPauseToggleNoOvl,
     kFastForward, // (extra = enabled)
     kStep,
+    kRewind, // (extra = enabled)
 
     // Screenshot
     kScreenshot,
@@ -114,11 +119,11 @@ public:
     Type type;
     uint16_t modifiers;
   };
-  typedef std::array<Binding, 88> BindingList;
+  typedef std::array<Binding, 89> BindingList;
 
   static void getBindingString(char buffer[32], const KeyBinds::Binding& desc);
 
-  std::string serializeBindings() const;
+  void serializeBindings(JsonWriter* json) const;
   bool deserializeBindings(const char* json);
 
 protected:
@@ -132,6 +137,15 @@ protected:
   BindingList _bindings;
   SDL_JoystickID getBindingID(SDL_JoystickID id) const;
 
+  /* Reverse lookups from what an event carries to the bindings it triggers, so translating an
+   * event doesn't depend on how many bindings there are. Rebuilt whenever _bindings changes. */
+  void rebuildIndex();
+  static uint64_t indexKey(uint32_t high, uint32_t low) { return (uint64_t)high << 32 | low; }
+
+  std::unordered_map<uint64_t, int> _keyIndex;                  /* keycode, modifiers -> first binding */
+  std::unordered_map<uint64_t, int> _buttonIndex;               /* joystick, button -> first binding */
+  std::unordered_map<uint64_t, std::vector<int>> _axisIndex;    /* joystick, axis -> bindings, in order */
+
   std::map<SDL_JoystickID, SDL_JoystickID> _bindingMap;
 
   unsigned _slot;
@@ -19,33 +19,66 @@ along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "Memory.h"
 
-#include "Application.h"
+#include "Metrics.h"
+#include "jsonsax/jsonsax.h"
 
 #include <RA_Interface.h>
 #include <rcheevos.h>
 
-#include <time.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
 
 #define TAG "[MEM] "
 
-#define MAX_MEMORY_REGIONS 64
-static uint8_t* g_memoryRegionData[MAX_MEMORY_REGIONS];
-static size_t g_memoryRegionSize[MAX_MEMORY_REGIONS];
-static unsigned g_memoryRegionCount = 0;
-static size_t g_memoryTotalSize = 0;
+/* The address space is split in pages, each one pointing to where its first byte is in the core's
+ * memory, or NULL if it's not backed by anything. Pages that straddle two regions can't be
+ * translated that way and fall back to walking the regions. */
+#define MEMORY_PAGE_BITS 12
+#define MEMORY_PAGE_SIZE (1 << MEMORY_PAGE_BITS)
+#define MEMORY_PAGE_MASK (MEMORY_PAGE_SIZE - 1)
+#define MEMORY_MIXED_PAGE (&_mixedPage)
+
+/* The toolkit's memory banks are plain functions, they go to the instance that installed them */
+static Memory* s_installed = NULL;
 
 static unsigned char memoryRead(unsigned addr)
+{
+  return s_installed->read(addr);
+}
+
+static void memoryWrite(unsigned addr, unsigned value)
+{
+  s_installed->write(addr, value);
+}
+
+static unsigned memoryReadBlock(unsigned addr, unsigned char* buffer, unsigned bytes)
+{
+  return s_installed->readBlock(addr, buffer, bytes);
+}
+
+Memory::Memory()
+{
+  _regionCount = 0;
+  _totalSize = 0;
+  _snapshotEnabled = false;
+  _snapshotActive = false;
+}
+
+unsigned char Memory::readSlow(unsigned addr) const
 {
   unsigned i;
-  for (i = 0; i < g_memoryRegionCount; ++i)
+  for (i = 0; i < _regionCount; ++i)
   {
-    const size_t size = g_memoryRegionSize[i];
+    const size_t size = _regionSize[i];
     if (addr < size)
     {
-      if (g_memoryRegionData[i] == NULL)
+      if (_regionData[i] == NULL)
         break;
 
-      return g_memoryRegionData[i][addr];
+      return _regionData[i][addr];
     }
 
     addr -= size;
@@ -54,16 +87,40 @@ static unsigned char memoryRead(unsigned addr)
   return 0;
 }
 
-static void memoryWrite(unsigned addr, unsigned value)
+unsigned char Memory::read(unsigned addr)
+{
+  const size_t page = addr >> MEMORY_PAGE_BITS;
+
+  if (page < _pages.size())
+  {
+    if (_snapshotActive)
+    {
+      _snapshotTouched[page] = 1;
+
+      const uint32_t offset = _snapshotOffsets[page];
+      if (offset != 0)
+        return _snapshot[offset - 1 + (addr & MEMORY_PAGE_MASK)];
+    }
+
+    const uint8_t* base = _pages[page];
+
+    if (base != MEMORY_MIXED_PAGE)
+      return base ? base[addr & MEMORY_PAGE_MASK] : 0;
+  }
+
+  return readSlow(addr);
+}
+
+void Memory::writeSlow(unsigned addr, unsigned value)
 {
   unsigned i;
-  for (i = 0; i < g_memoryRegionCount; ++i)
+  for (i = 0; i < _regionCount; ++i)
   {
-    const size_t size = g_memoryRegionSize[i];
+    const size_t size = _regionSize[i];
     if (addr < size)
     {
-      if (g_memoryRegionData[i])
-        g_memoryRegionData[i][addr] = value;
+      if (_regionData[i])
+        _regionData[i][addr] = value;
 
       break;
     }
@@ -72,19 +129,95 @@ static void memoryWrite(unsigned addr, unsigned value)
   }
 }
 
-static clock_t g_lastMemoryRefresh = 0;
-static unsigned char deferredMemoryRead(unsigned addr)
+void Memory::write(unsigned addr, unsigned value)
 {
-  const clock_t now = clock();
-  const clock_t elapsed = now - g_lastMemoryRefresh;
-  if (elapsed < CLOCKS_PER_SEC / 100) /* 10ms */
-    return '\0';
+  const size_t page = addr >> MEMORY_PAGE_BITS;
 
-  g_lastMemoryRefresh = now;
+  if (page < _pages.size())
+  {
+    /* keep the copy in sync so the rest of the evaluation sees the write */
+    if (_snapshotActive && _snapshotOffsets[page] != 0)
+      _snapshot[_snapshotOffsets[page] - 1 + (addr & MEMORY_PAGE_MASK)] = value;
 
-  extern Application app;
-  app.refreshMemoryMap();
-  return memoryRead(addr);
+    uint8_t* base = _pages[page];
+
+    if (base != MEMORY_MIXED_PAGE)
+    {
+      if (base)
+        base[addr & MEMORY_PAGE_MASK] = value;
+
+      return;
+    }
+  }
+
+  writeSlow(addr, value);
+}
+
+unsigned Memory::readBlock(unsigned addr, uint8_t* buffer, unsigned bytes) const
+{
+  if (addr >= _totalSize)
+    return 0;
+
+  if (bytes > _totalSize - addr)
+    bytes = (unsigned)(_totalSize - addr);
+
+  /* find the region where the block starts, and copy from it and the ones after it */
+  unsigned i = 0;
+  while (i < _regionCount && addr >= _regionSize[i])
+    addr -= (unsigned)_regionSize[i++];
+
+  unsigned remaining = bytes;
+
+  for (; remaining > 0 && i < _regionCount; i++)
+  {
+    size_t count = _regionSize[i] - addr;
+    if (count > remaining)
+      count = remaining;
+
+    if (_regionData[i])
+      memcpy(buffer, _regionData[i] + addr, count);
+    else
+      memset(buffer, 0, count);
+
+    buffer += count;
+    remaining -= (unsigned)count;
+    addr = 0;
+  }
+
+  return bytes - remaining;
+}
+
+void Memory::buildPages()
+{
+  _pages.assign((_totalSize + MEMORY_PAGE_MASK) >> MEMORY_PAGE_BITS, MEMORY_MIXED_PAGE);
+
+  size_t regionStart = 0;
+
+  for (unsigned i = 0; i < _regionCount; i++)
+  {
+    const size_t regionEnd = regionStart + _regionSize[i];
+
+    /* only the pages that are entirely inside the region, the last one may be cut short by the end of the address space */
+    for (size_t page = (regionStart + MEMORY_PAGE_MASK) >> MEMORY_PAGE_BITS; page < _pages.size(); page++)
+    {
+      const size_t pageStart = page << MEMORY_PAGE_BITS;
+      size_t pageEnd = pageStart + MEMORY_PAGE_SIZE;
+
+      if (pageEnd > _totalSize)
+        pageEnd = _totalSize;
+
+      if (pageEnd > regionEnd)
+        break;
+
+      _pages[page] = _regionData[i] ? _regionData[i] + (pageStart - regionStart) : NULL;
+    }
+
+    regionStart = regionEnd;
+  }
+
+  /* the pages moved, start over */
+  _snapshotTouched.assign(_pages.size(), 0);
+  _snapshotOffsets.assign(_pages.size(), 0);
 }
 
 static const char* getMemoryType(int type)
@@ -103,64 +236,190 @@ void Memory::registerMemoryRegion(int type, uint8_t* data, size_t size, const ch
   if (size == 0)
     return;
 
-  if (g_memoryRegionCount == MAX_MEMORY_REGIONS)
+  if (_regionCount == kMaxRegions)
   {
     _logger->warn(TAG "Too many memory regions to register");
     return;
   }
 
-  if (!data && g_memoryRegionCount > 0 && !g_memoryRegionData[g_memoryRegionCount - 1])
+  if (!data && _regionCount > 0 && !_regionData[_regionCount - 1])
   {
     /* extend null region */
-    g_memoryRegionSize[g_memoryRegionCount - 1] += size;
+    _regionSize[_regionCount - 1] += size;
   }
-  else if (data && g_memoryRegionCount > 0 &&
-    data == (g_memoryRegionData[g_memoryRegionCount - 1] + g_memoryRegionSize[g_memoryRegionCount - 1]))
+  else if (data && _regionCount > 0 &&
+    data == (_regionData[_regionCount - 1] + _regionSize[_regionCount - 1]))
   {
     /* extend non-null region */
-    g_memoryRegionSize[g_memoryRegionCount - 1] += size;
+    _regionSize[_regionCount - 1] += size;
   }
   else
   {
     /* create new region */
-    g_memoryRegionData[g_memoryRegionCount] = data;
-    g_memoryRegionSize[g_memoryRegionCount] = size;
-    ++g_memoryRegionCount;
+    _regionData[_regionCount] = data;
+    _regionSize[_regionCount] = size;
+    ++_regionCount;
   }
 
-  g_memoryTotalSize += size;
+  _totalSize += size;
+  metrics::set(metrics::kMemoryRegionBytes, _totalSize);
 
-  _logger->info(TAG "Registered 0x%04X bytes of %s at $%06X (%s)", size, getMemoryType(type), g_memoryTotalSize - size, description);
+  _logger->info(TAG "Registered 0x%04X bytes of %s at $%06X (%s)", size, getMemoryType(type), _totalSize - size, description);
 }
 
 bool Memory::init(libretro::LoggerComponent* logger)
 {
   _logger = logger;
+  _waiting = false;
+  _refreshes = 0;
+  _rebuilds = 0;
   return true;
 }
 
 void Memory::destroy()
 {
-  g_memoryRegionCount = 0;
-  g_memoryTotalSize = 0;
-  g_lastMemoryRefresh = 0;
-  RA_ClearMemoryBanks();
+  _regionCount = 0;
+  _totalSize = 0;
+  metrics::set(metrics::kMemoryRegionBytes, 0);
+  _waiting = false;
+  std::vector<uint8_t*>().swap(_pages);
+  std::vector<uint8_t>().swap(_snapshotTouched);
+  std::vector<uint32_t>().swap(_snapshotOffsets);
+  std::vector<uint8_t>().swap(_snapshot);
+  _snapshotActive = false;
+
+  if (s_installed == this)
+  {
+    RA_ClearMemoryBanks();
+    s_installed = NULL;
+  }
+}
+
+size_t Memory::totalSize() const
+{
+  return _totalSize;
+}
+
+void Memory::setSnapshot(bool enabled)
+{
+  _snapshotEnabled = enabled;
+
+  std::fill(_snapshotOffsets.begin(), _snapshotOffsets.end(), 0);
+  _logger->info(TAG "Achievement memory snapshot %s", enabled ? "enabled" : "disabled");
+}
+
+bool Memory::snapshot() const
+{
+  return _snapshotEnabled;
+}
+
+void Memory::beginFrame()
+{
+  if (!_snapshotEnabled || _pages.empty())
+    return;
+
+  /* lay out the pages read during the last evaluation in address order */
+  uint32_t size = 0;
+
+  for (size_t page = 0; page < _pages.size(); page++)
+  {
+    uint32_t offset = 0;
+
+    if (_snapshotTouched[page])
+    {
+      offset = size + 1;
+      size += MEMORY_PAGE_SIZE;
+    }
+
+    _snapshotOffsets[page] = offset;
+  }
+
+  _snapshot.resize(size);
+
+  /* copy runs of consecutive pages at once */
+  size_t page = 0;
+
+  while (page < _pages.size())
+  {
+    if (!_snapshotTouched[page])
+    {
+      page++;
+      continue;
+    }
+
+    const size_t first = page;
+    while (page < _pages.size() && _snapshotTouched[page])
+      page++;
+
+    readBlock((unsigned)(first << MEMORY_PAGE_BITS), &_snapshot[_snapshotOffsets[first] - 1], (unsigned)((page - first) << MEMORY_PAGE_BITS));
+  }
+
+  std::fill(_snapshotTouched.begin(), _snapshotTouched.end(), 0);
+  _snapshotActive = true;
+}
+
+void Memory::endFrame()
+{
+  _snapshotActive = false;
+}
+
+std::string Memory::serializeSettings() const
+{
+  std::string json("{");
+
+  json.append("\"snapshot\":");
+  json.append(_snapshotEnabled ? "true" : "false");
+
+  json.append("}");
+  return json;
+}
+
+bool Memory::deserializeSettings(const char* json)
+{
+  struct Deserialize
+  {
+    Memory* self;
+    std::string key;
+  };
+  Deserialize ud;
+  ud.self = this;
+
+  jsonsax_result_t res = jsonsax_parse((char*)json, &ud, [](void* udata, jsonsax_event_t event, const char* str, size_t num)
+  {
+    auto* ud = (Deserialize*)udata;
+
+    if (event == JSONSAX_KEY)
+    {
+      ud->key = std::string(str, num);
+    }
+    else if (event == JSONSAX_BOOLEAN)
+    {
+      if (ud->key == "snapshot")
+        ud->self->_snapshotEnabled = num != 0;
+    }
+
+    return 0;
+  });
+
+  return (res == JSONSAX_OK);
 }
 
 void Memory::attachToCore(libretro::Core* core, int consoleId)
 {
   /* capture the registered regions */
-  uint8_t* memoryRegionData[MAX_MEMORY_REGIONS];
-  size_t memoryRegionSize[MAX_MEMORY_REGIONS];
-  size_t memoryRegionCount = g_memoryRegionCount;
-  size_t memoryTotalSize = g_memoryTotalSize;
+  uint8_t* memoryRegionData[kMaxRegions];
+  size_t memoryRegionSize[kMaxRegions];
+  size_t memoryRegionCount = _regionCount;
+  size_t memoryTotalSize = _totalSize;
+
+  memcpy(memoryRegionData, _regionData, sizeof(memoryRegionData));
+  memcpy(memoryRegionSize, _regionSize, sizeof(memoryRegionSize));
 
-  memcpy(memoryRegionData, g_memoryRegionData, sizeof(memoryRegionData));
-  memcpy(memoryRegionSize, g_memoryRegionSize, sizeof(memoryRegionSize));
+  _refreshes++;
 
   /* reset and register new regions */
-  g_memoryRegionCount = 0;
-  g_memoryTotalSize = 0;
+  _regionCount = 0;
+  _totalSize = 0;
 
   const rc_memory_regions_t* regions = rc_console_memory_regions(consoleId);
   if (regions == NULL || regions->num_regions == 0)
@@ -171,43 +430,45 @@ void Memory::attachToCore(libretro::Core* core, int consoleId)
   {
     const retro_memory_map* mmap = core->getMemoryMap();
     if (mmap && mmap->num_descriptors > 0)
-      initializeFromMemoryMap(regions, mmap);
+      initializeFromMemoryMap(regions, core);
     else
       initializeFromUnmappedMemory(regions, core);
   }
 
   /* if no change is detected, do nothing */
-  if (g_memoryTotalSize == memoryTotalSize && g_memoryRegionCount == memoryRegionCount)
+  if (_totalSize == memoryTotalSize && _regionCount == memoryRegionCount)
   {
-    if (memcmp(memoryRegionData, g_memoryRegionData, memoryRegionCount * sizeof(memoryRegionData[0])) == 0 &&
-        memcmp(memoryRegionSize, g_memoryRegionSize, memoryRegionCount * sizeof(memoryRegionSize[0])) == 0)
+    if (memcmp(memoryRegionData, _regionData, memoryRegionCount * sizeof(memoryRegionData[0])) == 0 &&
+        memcmp(memoryRegionSize, _regionSize, memoryRegionCount * sizeof(memoryRegionSize[0])) == 0)
     {
       return;
     }
   }
 
   /* change detected - update the installed memory banks */
+  buildPages();
+  _rebuilds++;
+
   bool hasValidRegion = false;
-  for (size_t i = 0; i < g_memoryRegionCount; i++)
+  for (size_t i = 0; i < _regionCount; i++)
   {
-    if (g_memoryRegionData[i] != NULL)
+    if (_regionData[i] != NULL)
     {
       hasValidRegion = true;
       break;
     }
   }
 
-  if (hasValidRegion)
-  {
-    RA_ClearMemoryBanks();
-    RA_InstallMemoryBank(0, memoryRead, memoryWrite, g_memoryTotalSize);
-  }
-  else if (g_lastMemoryRefresh == 0)
-  {
-    g_lastMemoryRefresh = clock();
-    RA_ClearMemoryBanks();
-    RA_InstallMemoryBank(0, deferredMemoryRead, memoryWrite, g_memoryTotalSize);
-  }
+  /* pages that aren't backed by anything read as zero until the core exposes its memory, the
+   * application keeps refreshing the map once per frame while we wait for that */
+  _waiting = !hasValidRegion;
+
+  s_installed = this;
+  RA_ClearMemoryBanks();
+  RA_InstallMemoryBank(0, memoryRead, memoryWrite, _totalSize);
+  RA_InstallMemoryBankBlockReader(0, memoryReadBlock);
+
+  _logger->info(TAG "Memory map rebuilt%s (%u rebuilds in %u refreshes)", _waiting ? ", no memory exposed yet" : "", _rebuilds, _refreshes);
 }
 
 void Memory::initializeWithoutRegions(libretro::Core* core)
@@ -224,37 +485,6 @@ void Memory::initializeWithoutRegions(libretro::Core* core)
   registerMemoryRegion(RC_MEMORY_TYPE_SAVE_RAM, regionStart, regionSize, description);
 }
 
-static const struct retro_memory_descriptor* getDescriptor(const struct retro_memory_map* mmap, unsigned realAddress)
-{
-  if (mmap->num_descriptors == 0)
-    return NULL;
-
-  const retro_memory_descriptor* desc = mmap->descriptors;
-  const retro_memory_descriptor* end = desc + mmap->num_descriptors;
-
-  for (; desc < end; desc++)
-  {
-    if (desc->select == 0)
-    {
-      /* if select is 0, attempt to explcitly match the address */
-      if (realAddress >= desc->start && realAddress < desc->start + desc->len)
-        return desc;
-    }
-    else
-    {
-      /* otherwise, attempt to match the address by matching the select bits */
-      if (((desc->start ^ realAddress) & desc->select) == 0)
-      {
-        /* sanity check - make sure the descriptor is large enough to hold the target address */
-        if (realAddress - desc->start < desc->len)
-          return desc;
-      }
-    }
-  }
-
-  return NULL;
-}
-
 static void dumpDescriptors(const retro_memory_map* mmap, libretro::LoggerComponent* logger)
 {
   const retro_memory_descriptor* desc = mmap->descriptors;
@@ -270,8 +500,9 @@ static void dumpDescriptors(const retro_memory_map* mmap, libretro::LoggerCompon
   }
 }
 
-void Memory::initializeFromMemoryMap(const rc_memory_regions_t* regions, const retro_memory_map* mmap)
+void Memory::initializeFromMemoryMap(const rc_memory_regions_t* regions, libretro::Core* core)
 {
+  const retro_memory_map* mmap = core->getMemoryMap();
   char description[64];
   unsigned i;
 
@@ -286,7 +517,7 @@ void Memory::initializeFromMemoryMap(const rc_memory_regions_t* regions, const r
 
     while (regionSize > 0)
     {
-      const struct retro_memory_descriptor* desc = getDescriptor(mmap, realAddress);
+      const struct retro_memory_descriptor* desc = core->getMemoryDescriptor(realAddress);
       if (!desc || !desc->ptr)
       {
         if (region->type != RC_MEMORY_TYPE_UNUSED)
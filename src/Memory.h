@@ -23,21 +23,80 @@ along with RALibretro.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "Emulator.h"
 
+#include <string>
+#include <vector>
+
 struct rc_memory_regions_t;
 
+/* Owns the address space exposed to achievements. Each instance keeps its own map, the one that
+ * last attached to a core is the one installed in the toolkit. */
 class Memory
 {
 public:
+  Memory();
+
   bool init(libretro::LoggerComponent* logger);
   void destroy();
 
   void attachToCore(libretro::Core* core, int consoleId);
 
+  /* Size of the address space exposed to achievements, and a copy of a block of it taken straight
+   * from the core's memory */
+  size_t   totalSize() const;
+  unsigned readBlock(unsigned address, uint8_t* buffer, unsigned bytes) const;
+
+  /* The core didn't expose any memory the last time the map was built */
+  bool waiting() const { return _waiting; }
+
+  /* Times attachToCore was called, and times it found the map had changed */
+  unsigned refreshes() const { return _refreshes; }
+  unsigned rebuilds() const { return _rebuilds; }
+
+  /* Achievements can be evaluated against a copy of the memory they read, taken once per frame
+   * between beginFrame and endFrame */
+  void setSnapshot(bool enabled);
+  bool snapshot() const;
+  void beginFrame();
+  void endFrame();
+
+  std::string serializeSettings() const;
+  bool        deserializeSettings(const char* json);
+
+  /* Entry points of the toolkit's memory bank */
+  unsigned char read(unsigned address);
+  void          write(unsigned address, unsigned value);
+
 protected:
+  enum { kMaxRegions = 64 };
+
+  unsigned char readSlow(unsigned address) const;
+  void          writeSlow(unsigned address, unsigned value);
+  void          buildPages();
+
   void registerMemoryRegion(int type, uint8_t* data, size_t size, const char* description);
   void initializeWithoutRegions(libretro::Core* core);
-  void initializeFromMemoryMap(const rc_memory_regions_t* regions, const retro_memory_map* mmap);
+  void initializeFromMemoryMap(const rc_memory_regions_t* regions, libretro::Core* core);
   void initializeFromUnmappedMemory(const rc_memory_regions_t* regions, libretro::Core* core);
 
   libretro::LoggerComponent* _logger;
+
+  bool     _waiting;
+  unsigned _refreshes;
+  unsigned _rebuilds;
+
+  uint8_t* _regionData[kMaxRegions];
+  size_t   _regionSize[kMaxRegions];
+  unsigned _regionCount;
+  size_t   _totalSize;
+
+  std::vector<uint8_t*> _pages;
+  uint8_t               _mixedPage; /* only its address is used, marks pages that straddle regions */
+
+  /* While achievements are evaluated, the pages they read on the previous frame are served from a
+   * copy taken right before the evaluation */
+  bool                  _snapshotEnabled;
+  bool                  _snapshotActive;
+  std::vector<uint8_t>  _snapshotTouched;   /* pages read during the last evaluation */
+  std::vector<uint32_t> _snapshotOffsets;   /* where each page is in the copy plus one, zero if it isn't */
+  std::vector<uint8_t>  _snapshot;
 };
@@ -0,0 +1,488 @@
+/*
+Copyright (C) 2018 Andre Leiradella
+
+This file is part of RALibretro.
+
+RALibretro is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RALibretro is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "MemorySearch.h"
+
+#include "components/Dialog.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MEMORY_SEARCH_SSE2
+#endif
+
+#define TAG "[MSR] "
+
+extern HWND g_mainWindow;
+
+static unsigned countBits(uint64_t bits)
+{
+#ifdef __GNUC__
+  return (unsigned)__builtin_popcountll(bits);
+#else
+  unsigned count = 0;
+
+  for (; bits != 0; bits &= bits - 1)
+    count++;
+
+  return count;
+#endif
+}
+
+static unsigned lowestBit(uint64_t bits)
+{
+#ifdef __GNUC__
+  return (unsigned)__builtin_ctzll(bits);
+#else
+  unsigned bit = 0;
+
+  for (; (bits & 1) == 0; bits >>= 1)
+    bit++;
+
+  return bit;
+#endif
+}
+
+/* Compares the values at 64 consecutive positions, other is NULL when comparing against a
+ * constant. The loops have a fixed trip count and no branches so the compiler can vectorize them. */
+template<typename T>
+static uint64_t compareBlock(const uint8_t* current, const uint8_t* other, size_t stride, T constant, MemorySearch::Compare compare)
+{
+  T a[64], b[64];
+
+  for (size_t i = 0; i < 64; i++)
+  {
+    memcpy(&a[i], current + i * stride, sizeof(T));
+
+    if (other != NULL)
+      memcpy(&b[i], other + i * stride, sizeof(T));
+    else
+      b[i] = constant;
+  }
+
+  uint64_t mask = 0;
+
+  switch (compare)
+  {
+    case MemorySearch::Compare::Equal:
+      for (size_t i = 0; i < 64; i++)
+        mask |= (uint64_t)(a[i] == b[i]) << i;
+      break;
+
+    case MemorySearch::Compare::NotEqual:
+      for (size_t i = 0; i < 64; i++)
+        mask |= (uint64_t)(a[i] != b[i]) << i;
+      break;
+
+    case MemorySearch::Compare::Greater:
+      for (size_t i = 0; i < 64; i++)
+        mask |= (uint64_t)(a[i] > b[i]) << i;
+      break;
+
+    case MemorySearch::Compare::Less:
+      for (size_t i = 0; i < 64; i++)
+        mask |= (uint64_t)(a[i] < b[i]) << i;
+      break;
+  }
+
+  return mask;
+}
+
+#ifdef MEMORY_SEARCH_SSE2
+/* Unaligned 8-bit searches are the most common ones, and map directly to SSE2 compares */
+static uint64_t compareBytes(const uint8_t* current, const uint8_t* other, uint8_t constant, MemorySearch::Compare compare)
+{
+  // SSE2 only has signed compares, flipping the sign bits makes them unsigned
+  const __m128i bias = _mm_set1_epi8((char)0x80);
+  const __m128i value = _mm_set1_epi8((char)constant);
+  uint64_t mask = 0;
+
+  for (int i = 0; i < 4; i++)
+  {
+    const __m128i a = _mm_loadu_si128((const __m128i*)(current + i * 16));
+    const __m128i b = other != NULL ? _mm_loadu_si128((const __m128i*)(other + i * 16)) : value;
+    __m128i result;
+
+    switch (compare)
+    {
+      default:
+      case MemorySearch::Compare::Equal:
+        result = _mm_cmpeq_epi8(a, b);
+        break;
+
+      case MemorySearch::Compare::NotEqual:
+        result = _mm_andnot_si128(_mm_cmpeq_epi8(a, b), _mm_set1_epi8(-1));
+        break;
+
+      case MemorySearch::Compare::Greater:
+        result = _mm_cmpgt_epi8(_mm_xor_si128(a, bias), _mm_xor_si128(b, bias));
+        break;
+
+      case MemorySearch::Compare::Less:
+        result = _mm_cmplt_epi8(_mm_xor_si128(a, bias), _mm_xor_si128(b, bias));
+        break;
+    }
+
+    mask |= (uint64_t)(uint16_t)_mm_movemask_epi8(result) << (i * 16);
+  }
+
+  return mask;
+}
+#endif
+
+bool MemorySearch::init(Logger* logger, Memory* memory)
+{
+  _logger = logger;
+  _memory = memory;
+
+  _size = Size::Bits8;
+  _aligned = false;
+  _positions = 0;
+  _matches = 0;
+
+  _compare = Compare::Equal;
+  _against = Against::Previous;
+  _value = 0;
+  return true;
+}
+
+void MemorySearch::destroy()
+{
+  std::vector<uint8_t>().swap(_current);
+  std::vector<uint8_t>().swap(_previous);
+  std::vector<uint64_t>().swap(_candidates);
+
+  _positions = 0;
+  _matches = 0;
+}
+
+unsigned MemorySearch::width() const
+{
+  switch (_size)
+  {
+    default:
+    case Size::Bits8:  return 1;
+    case Size::Bits16: return 2;
+    case Size::Bits32: return 4;
+  }
+}
+
+uint32_t MemorySearch::read(const std::vector<uint8_t>& buffer, size_t position) const
+{
+  const uint8_t* data = &buffer[address(position)];
+
+  switch (_size)
+  {
+    default:
+    case Size::Bits8:  return data[0];
+    case Size::Bits16: return data[0] | data[1] << 8;
+    case Size::Bits32: return data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24;
+  }
+}
+
+bool MemorySearch::snapshot(std::vector<uint8_t>* buffer)
+{
+  const size_t total = _memory->totalSize();
+  const size_t stride = _aligned ? width() : 1;
+
+  // the last block of 64 positions reads past the end of the memory, pad it with zeros
+  const size_t words = (_positions + 63) / 64;
+  buffer->assign(words * 64 * stride + 4, 0);
+
+  if (total == 0)
+    return false;
+
+  _memory->readBlock(0, buffer->data(), (unsigned)total);
+  return true;
+}
+
+bool MemorySearch::start(Size size, bool aligned)
+{
+  _size = size;
+  _aligned = aligned;
+
+  const size_t total = _memory->totalSize();
+
+  if (_aligned)
+    _positions = total / width();
+  else
+    _positions = total >= width() ? total - width() + 1 : 0;
+
+  if (!snapshot(&_current))
+  {
+    _logger->warn(TAG "No memory to search");
+    destroy();
+    return false;
+  }
+
+  _previous = _current;
+  _candidates.assign((_positions + 63) / 64, ~(uint64_t)0);
+
+  // positions past the end of the memory aren't candidates
+  if ((_positions & 63) != 0)
+    _candidates.back() = ((uint64_t)1 << (_positions & 63)) - 1;
+
+  _matches = _positions;
+  _logger->info(TAG "New %u-bit search over %zu bytes", width() * 8, total);
+  return true;
+}
+
+bool MemorySearch::filter(Compare compare, Against against, uint32_t value)
+{
+  if (_candidates.empty())
+    return false;
+
+  const size_t total = _memory->totalSize();
+  const size_t expected = _aligned ? _positions * width() : _positions + width() - 1;
+
+  if (total < expected || total - expected >= (_aligned ? width() : 1))
+  {
+    _logger->warn(TAG "The memory map changed, a new search must be started");
+    return false;
+  }
+
+  _current.swap(_previous);
+  snapshot(&_current);
+
+  const size_t stride = _aligned ? width() : 1;
+  const size_t words = _candidates.size();
+  _matches = 0;
+
+  for (size_t w = 0; w < words; w++)
+  {
+    uint64_t bits = _candidates[w];
+
+    if (bits == 0)
+      continue;
+
+    const size_t offset = w * 64 * stride;
+    const uint8_t* current = &_current[offset];
+    const uint8_t* other = against == Against::Previous ? &_previous[offset] : NULL;
+    uint64_t mask;
+
+    switch (_size)
+    {
+      default:
+      case Size::Bits8:
+#ifdef MEMORY_SEARCH_SSE2
+        mask = compareBytes(current, other, (uint8_t)value, compare);
+#else
+        mask = compareBlock<uint8_t>(current, other, stride, (uint8_t)value, compare);
+#endif
+        break;
+
+      case Size::Bits16:
+        mask = compareBlock<uint16_t>(current, other, stride, (uint16_t)value, compare);
+        break;
+
+      case Size::Bits32:
+        mask = compareBlock<uint32_t>(current, other, stride, value, compare);
+        break;
+    }
+
+    bits &= mask;
+    _candidates[w] = bits;
+    _matches += countBits(bits);
+  }
+
+  _logger->info(TAG "%zu matches left", _matches);
+  return true;
+}
+
+size_t MemorySearch::results(Result* results, size_t max, size_t first) const
+{
+  size_t count = 0;
+  size_t skipped = 0;
+
+  for (size_t w = 0; w < _candidates.size() && count < max; w++)
+  {
+    uint64_t bits = _candidates[w];
+    const size_t inWord = countBits(bits);
+
+    // skip whole words until we get to the first result asked for
+    if (skipped + inWord <= first)
+    {
+      skipped += inWord;
+      continue;
+    }
+
+    for (; bits != 0 && count < max; bits &= bits - 1)
+    {
+      if (skipped < first)
+      {
+        skipped++;
+        continue;
+      }
+
+      const size_t position = w * 64 + lowestBit(bits);
+
+      results[count].address = address(position);
+      results[count].current = read(_current, position);
+      results[count].previous = read(_previous, position);
+      count++;
+    }
+  }
+
+  return count;
+}
+
+static const char* s_getActionOptions(int index, void* udata)
+{
+  switch (index)
+  {
+    case 0: return "New search";
+    case 1: return "Filter";
+    default: return NULL;
+  }
+}
+
+static const char* s_getSizeOptions(int index, void* udata)
+{
+  switch (index)
+  {
+    case 0: return "8-bit";
+    case 1: return "16-bit";
+    case 2: return "32-bit";
+    default: return NULL;
+  }
+}
+
+static const char* s_getCompareOptions(int index, void* udata)
+{
+  switch (index)
+  {
+    case 0: return "Equal to";
+    case 1: return "Not equal to";
+    case 2: return "Greater than";
+    case 3: return "Less than";
+    default: return NULL;
+  }
+}
+
+static const char* s_getAgainstOptions(int index, void* udata)
+{
+  switch (index)
+  {
+    case 0: return "Previous value";
+    case 1: return "Value";
+    default: return NULL;
+  }
+}
+
+void MemorySearch::showDialog()
+{
+  const WORD WIDTH = 200;
+  const WORD LINE = 15;
+  const size_t MAX_RESULTS = 100;
+
+  for (;;)
+  {
+    Dialog db;
+    db.init("Memory Search");
+
+    WORD y = 0;
+
+    int action = _candidates.empty() ? 0 : 1;
+    db.addLabel("Action", 51001, 0, y, 60, 8);
+    db.addCombobox(51002, 65, y - 2, WIDTH - 65, 12, 100, s_getActionOptions, NULL, &action);
+    y += LINE;
+
+    int size = (int)_size;
+    db.addLabel("Size", 51003, 0, y, 60, 8);
+    db.addCombobox(51004, 65, y - 2, WIDTH - 65, 12, 100, s_getSizeOptions, NULL, &size);
+    y += LINE;
+
+    bool aligned = _aligned;
+    db.addCheckbox("Aligned", 51005, 65, y, WIDTH - 65, 8, &aligned);
+    y += LINE;
+
+    int compare = (int)_compare;
+    db.addLabel("Compare", 51006, 0, y, 60, 8);
+    db.addCombobox(51007, 65, y - 2, WIDTH - 65, 12, 100, s_getCompareOptions, NULL, &compare);
+    y += LINE;
+
+    int against = (int)_against;
+    db.addLabel("Against", 51008, 0, y, 60, 8);
+    db.addCombobox(51009, 65, y - 2, WIDTH - 65, 12, 100, s_getAgainstOptions, NULL, &against);
+    y += LINE;
+
+    char value[32];
+    snprintf(value, sizeof(value), "0x%X", _value);
+    db.addLabel("Value", 51010, 0, y, 60, 8);
+    db.addEditbox(51011, 65, y - 2, WIDTH - 65, 12, 1, value, sizeof(value), false);
+    y += LINE;
+
+    std::string text;
+    char line[64];
+
+    if (_candidates.empty())
+    {
+      text = "Start a new search, then run the game and filter";
+    }
+    else
+    {
+      Result results[MAX_RESULTS];
+      const size_t count = this->results(results, MAX_RESULTS, 0);
+
+      snprintf(line, sizeof(line), "%zu matches\r\n", _matches);
+      text = line;
+
+      for (size_t i = 0; i < count; i++)
+      {
+        snprintf(line, sizeof(line), "$%06X: 0x%X (was 0x%X)\r\n", results[i].address, results[i].current, results[i].previous);
+        text += line;
+      }
+
+      if (_matches > count)
+        text += "...";
+    }
+
+    db.addEditbox(51012, 0, y, WIDTH, LINE, 8, (char*)text.c_str(), 0, true);
+    y += LINE * 8;
+
+    db.addButton("Search", IDOK, WIDTH - 55 - 50, y, 50, 14, true);
+    db.addButton("Close", IDCANCEL, WIDTH - 50, y, 50, 14, false);
+
+    if (!db.show())
+      break;
+
+    _compare = (Compare)compare;
+    _against = (Against)against;
+
+    // accept $ as a hex prefix, like the toolkit does
+    _value = (uint32_t)strtoul(value[0] == '$' ? value + 1 : value, NULL, value[0] == '$' ? 16 : 0);
+
+    if (action == 0 || _candidates.empty())
+    {
+      if (!start((Size)size, aligned))
+        MessageBox(g_mainWindow, "There is no memory to search, the core doesn't expose any", "RALibRetro", MB_OK);
+    }
+    else if (!filter(_compare, _against, _value))
+    {
+      // the candidates refer to positions that don't exist anymore
+      destroy();
+      MessageBox(g_mainWindow, "The memory map changed since the search was started, start a new search", "RALibRetro", MB_OK);
+    }
+  }
+}
@@ -0,0 +1,105 @@
+/*
+Copyright (C) 2018 Andre Leiradella
+
+This file is part of RALibretro.
+
+RALibretro is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RALibretro is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "components/Logger.h"
+
+#include "Memory.h"
+
+#include <stdint.h>
+#include <vector>
+
+/* Finds addresses by comparing whole snapshots of the memory exposed to achievements.
+ *
+ * Each search position is a bit in a bitmap of candidates, filters compare 64 positions at a time
+ * and clear the bits of the ones that don't pass. Positions whose 64-bit word is already zero are
+ * skipped, so later filters only cost as much as the candidates left.
+ */
+class MemorySearch
+{
+public:
+  enum class Size
+  {
+    Bits8,
+    Bits16,
+    Bits32
+  };
+
+  enum class Compare
+  {
+    Equal,
+    NotEqual,
+    Greater,
+    Less
+  };
+
+  enum class Against
+  {
+    Previous, /* the value in the previous snapshot */
+    Value     /* a constant */
+  };
+
+  struct Result
+  {
+    unsigned address;
+    uint32_t current;
+    uint32_t previous;
+  };
+
+  bool init(Logger* logger, Memory* memory);
+  void destroy();
+
+  /* Takes the first snapshot, every position is a candidate */
+  bool start(Size size, bool aligned);
+
+  /* Takes a new snapshot and keeps the candidates that pass the comparison */
+  bool filter(Compare compare, Against against, uint32_t value);
+
+  size_t matches() const { return _matches; }
+
+  /* Copies up to max candidates, starting at the first'th one, returns how many were copied */
+  size_t results(Result* results, size_t max, size_t first) const;
+
+  void showDialog();
+
+protected:
+  bool snapshot(std::vector<uint8_t>* buffer);
+
+  unsigned width() const;
+  unsigned address(size_t position) const { return (unsigned)(_aligned ? position * width() : position); }
+  uint32_t read(const std::vector<uint8_t>& buffer, size_t position) const;
+
+  Logger* _logger;
+  Memory* _memory;
+
+  Size   _size;
+  bool   _aligned;
+  size_t _positions;
+  size_t _matches;
+
+  /* last choices made in the dialog */
+  Compare  _compare;
+  Against  _against;
+  uint32_t _value;
+
+  std::vector<uint8_t>  _current;
+  std::vector<uint8_t>  _previous;
+  std::vector<uint64_t> _candidates;
+};
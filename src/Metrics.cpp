@@ -0,0 +1,224 @@
+/*
+Copyright (C) 2018 Andre Leiradella
+
+This file is part of RALibretro.
+
+RALibretro is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RALibretro is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Metrics.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <chrono>
+
+#ifdef _WIN32
+// takes GetProcessMemoryInfo from kernel32, so nothing else has to be linked
+#define PSAPI_VERSION 2
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <unistd.h>
+#endif
+
+#define TAG "[MTR] "
+
+#define MAGIC 0x544d4152  /* 'RAMT' */
+#define VERSION 1
+
+namespace
+{
+  struct Block
+  {
+    metrics::Header header;
+    metrics::Entry  entries[metrics::kCount];
+  };
+
+  struct Info
+  {
+    const char*   name;
+    metrics::Kind kind;
+  };
+}
+
+static_assert(sizeof(metrics::Header) == 40, "the header is part of the shared layout");
+static_assert(sizeof(metrics::Entry) == 56, "entries are part of the shared layout");
+
+static const Info s_info[] =
+{
+  {"uptime_seconds", metrics::Kind::Gauge},
+  {"process_working_set_bytes", metrics::Kind::Gauge},
+  {"process_private_bytes", metrics::Kind::Gauge},
+
+  {"frames_rendered", metrics::Kind::Counter},
+  {"frames_skipped", metrics::Kind::Counter},
+  {"frames_dropped", metrics::Kind::Counter},
+  {"frames_faulted", metrics::Kind::Counter},
+  {"frames_stalled", metrics::Kind::Counter},
+  {"frame_micros", metrics::Kind::Gauge},
+  {"fps_hundredths", metrics::Kind::Gauge},
+
+  {"audio_underruns", metrics::Kind::Counter},
+  {"audio_fifo_bytes", metrics::Kind::Gauge},
+  {"audio_fifo_limit_bytes", metrics::Kind::Gauge},
+
+  {"video_frames", metrics::Kind::Counter},
+  {"video_frames_duped", metrics::Kind::Counter},
+  {"video_upload_micros", metrics::Kind::Counter},
+
+  {"states_saved", metrics::Kind::Counter},
+  {"states_failed", metrics::Kind::Counter},
+  {"state_save_millis", metrics::Kind::Gauge},
+  {"states_loaded", metrics::Kind::Counter},
+  {"sram_saves", metrics::Kind::Counter},
+
+  {"memory_region_bytes", metrics::Kind::Gauge},
+
+  {"core_environment_calls", metrics::Kind::Counter},
+  {"core_unsupported_calls", metrics::Kind::Counter}
+};
+
+static_assert(sizeof(s_info) / sizeof(s_info[0]) == metrics::kCount, "every metric needs a name");
+
+// updates go here until init, and when the shared block can't be created
+static Block s_local;
+static Block* s_block = &s_local;
+
+#ifdef _WIN32
+static HANDLE s_mapping;
+#endif
+
+static std::chrono::steady_clock::time_point s_start = std::chrono::steady_clock::now();
+static std::chrono::steady_clock::time_point s_lastSample;
+
+static void setup(Block* block)
+{
+  block->header.magic = MAGIC;
+  block->header.version = VERSION;
+  block->header.headerSize = sizeof(metrics::Header);
+  block->header.entrySize = sizeof(metrics::Entry);
+  block->header.count = metrics::kCount;
+#ifdef _WIN32
+  block->header.pid = (uint32_t)GetCurrentProcessId();
+#else
+  block->header.pid = (uint32_t)getpid();
+#endif
+  block->header.startTime = (int64_t)time(NULL);
+
+  for (unsigned i = 0; i < metrics::kCount; i++)
+  {
+    metrics::Entry* entry = block->entries + i;
+    strncpy(entry->name, s_info[i].name, sizeof(entry->name) - 1);
+    entry->name[sizeof(entry->name) - 1] = 0;
+    entry->kind = s_info[i].kind;
+    entry->reserved = 0;
+  }
+}
+
+bool metrics::init(libretro::LoggerComponent* logger)
+{
+  setup(&s_local);
+
+#ifdef _WIN32
+  char name[64];
+  snprintf(name, sizeof(name), "Local\\RALibretro.Metrics.%lu", (unsigned long)GetCurrentProcessId());
+
+  s_mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(Block), name);
+
+  if (s_mapping == NULL)
+  {
+    // monitoring is optional, keep counting in private memory
+    logger->error(TAG "Error creating shared memory \"%s\": %lu", name, GetLastError());
+    return true;
+  }
+
+  Block* block = (Block*)MapViewOfFile(s_mapping, FILE_MAP_WRITE, 0, 0, sizeof(Block));
+
+  if (block == NULL)
+  {
+    logger->error(TAG "Error mapping shared memory \"%s\": %lu", name, GetLastError());
+    CloseHandle(s_mapping);
+    s_mapping = NULL;
+    return true;
+  }
+
+  setup(block);
+
+  for (unsigned i = 0; i < kCount; i++)
+    block->entries[i].value = s_local.entries[i].value.load();
+
+  // the header is complete before the heartbeat moves, agents can wait for it to be non zero
+  block->header.heartbeat = 0;
+  s_block = block;
+
+  logger->info(TAG "Publishing %u metrics in \"%s\"", (unsigned)kCount, name);
+#else
+  logger->info(TAG "Shared memory is only supported on Windows, metrics are kept in the process");
+#endif
+
+  return true;
+}
+
+void metrics::destroy()
+{
+#ifdef _WIN32
+  if (s_block != &s_local)
+  {
+    Block* block = s_block;
+
+    for (unsigned i = 0; i < kCount; i++)
+      s_local.entries[i].value = block->entries[i].value.load();
+
+    s_block = &s_local;
+    UnmapViewOfFile(block);
+    CloseHandle(s_mapping);
+    s_mapping = NULL;
+  }
+#endif
+}
+
+void metrics::add(Id id, int64_t delta)
+{
+  s_block->entries[id].value.fetch_add(delta, std::memory_order_relaxed);
+}
+
+void metrics::set(Id id, int64_t value)
+{
+  s_block->entries[id].value.store(value, std::memory_order_relaxed);
+}
+
+void metrics::sample()
+{
+  const auto now = std::chrono::steady_clock::now();
+
+  if (now - s_lastSample < std::chrono::seconds(1))
+    return;
+
+  s_lastSample = now;
+  set(kUptimeSeconds, std::chrono::duration_cast<std::chrono::seconds>(now - s_start).count());
+
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS_EX counters;
+
+  if (GetProcessMemoryInfo(GetCurrentProcess(), (PROCESS_MEMORY_COUNTERS*)&counters, sizeof(counters)))
+  {
+    set(kProcessWorkingSet, (int64_t)counters.WorkingSetSize);
+    set(kProcessPrivateBytes, (int64_t)counters.PrivateUsage);
+  }
+#endif
+
+  s_block->header.heartbeat.fetch_add(1, std::memory_order_release);
+}
@@ -0,0 +1,116 @@
+/*
+Copyright (C) 2018 Andre Leiradella
+
+This file is part of RALibretro.
+
+RALibretro is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RALibretro is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "libretro/Components.h"
+
+#include <stdint.h>
+
+#include <atomic>
+
+/* Counters and gauges for watching a running instance from another process, without attaching a
+ * debugger. Updating one is an atomic add or store, they can be updated from any thread.
+ *
+ * On Windows the values live in a named shared memory block, "Local\RALibretro.Metrics.<pid>",
+ * that an agent opens read only and reads whenever it wants. The layout is stable: a Header, then
+ * Header::count Entries of Header::entrySize bytes. Ids are never reused or reordered, new ones
+ * are only added at the end and bump nothing else, so agents should look metrics up by name and
+ * skip the ones they don't know. Counters only go up while the process runs, gauges hold the last
+ * value set.
+ *
+ * Elsewhere, and before init is called, the values live in private memory.
+ */
+namespace metrics
+{
+  enum Id : uint32_t
+  {
+    kUptimeSeconds,         /* gauge, updated by sample() */
+    kProcessWorkingSet,     /* gauge, bytes, updated by sample() */
+    kProcessPrivateBytes,   /* gauge, bytes, updated by sample() */
+
+    kFramesRendered,        /* counter, frames run with video, duped ones included */
+    kFramesSkipped,         /* counter, planned skips */
+    kFramesDropped,         /* counter, skips to catch up */
+    kFramesFaulted,         /* counter, rendered after too many skips in a row */
+    kFramesStalled,         /* counter, frames longer than 500 ms, like when a menu is open */
+    kFrameMicros,           /* gauge, last frame from start to end */
+    kFps,                   /* gauge, hundredths of frames per second over the last 64 frames */
+
+    kAudioUnderruns,        /* counter, the device ran out of samples */
+    kAudioFifoBytes,        /* gauge, bytes waiting in the FIFO when the core sent more */
+    kAudioFifoLimit,        /* gauge, bytes the FIFO is allowed to hold */
+
+    kVideoFrames,           /* counter, frames the core sent, duped ones included */
+    kVideoFramesDuped,      /* counter */
+    kVideoUploadMicros,     /* counter, time spent uploading software rendered frames */
+
+    kStatesSaved,           /* counter */
+    kStatesFailed,          /* counter, saves that couldn't be written */
+    kStateSaveMillis,       /* gauge, last save from the request to the file being written */
+    kStatesLoaded,          /* counter */
+    kSramSaves,             /* counter */
+
+    kMemoryRegionBytes,     /* gauge, memory the core exposes to achievements */
+
+    kCoreEnvironmentCalls,  /* counter */
+    kCoreUnsupportedCalls,  /* counter, environment calls we don't implement */
+
+    kCount
+  };
+
+  enum class Kind : uint32_t
+  {
+    Counter,
+    Gauge
+  };
+
+#pragma pack(push, 8)
+  struct Header
+  {
+    uint32_t magic;         /* 'RAMT' */
+    uint32_t version;       /* 1, changes only if the header or the entry layout change */
+    uint32_t headerSize;
+    uint32_t entrySize;
+    uint32_t count;
+    uint32_t pid;
+    int64_t  startTime;     /* seconds since the Unix epoch */
+
+    std::atomic<uint64_t> heartbeat;  /* incremented by sample(), stops moving if the process hangs */
+  };
+
+  struct Entry
+  {
+    char     name[40];      /* null terminated */
+    Kind     kind;
+    uint32_t reserved;
+    std::atomic<int64_t> value;
+  };
+#pragma pack(pop)
+
+  /* Creates the shared block, the values collected so far are carried over */
+  bool init(libretro::LoggerComponent* logger);
+  void destroy();
+
+  void add(Id id, int64_t delta = 1);
+  void set(Id id, int64_t value);
+
+  /* Updates the process gauges at most once per second, call it regularly */
+  void sample();
+}
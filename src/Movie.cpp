@@ -0,0 +1,265 @@
+/*
+Copyright (C) 2018 Andre Leiradella
+
+This file is part of RALibretro.
+
+RALibretro is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RALibretro is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Movie.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define TAG "[MOV] "
+
+#define MOVIE_MAGIC   0x564d4152 /* "RAMV" */
+#define MOVIE_VERSION 1
+
+static void put32(std::vector<uint8_t>& out, uint32_t value)
+{
+  out.push_back(value & 0xff);
+  out.push_back((value >> 8) & 0xff);
+  out.push_back((value >> 16) & 0xff);
+  out.push_back(value >> 24);
+}
+
+static uint32_t get32(const uint8_t* in)
+{
+  return in[0] | in[1] << 8 | in[2] << 16 | (uint32_t)in[3] << 24;
+}
+
+static void put16(std::vector<uint8_t>& out, int16_t value)
+{
+  out.push_back((uint16_t)value & 0xff);
+  out.push_back((uint16_t)value >> 8);
+}
+
+static int16_t get16(const uint8_t* in)
+{
+  return (int16_t)(in[0] | in[1] << 8);
+}
+
+bool Movie::init(libretro::LoggerComponent* logger)
+{
+  _logger = logger;
+  _mode = Mode::Idle;
+  reset();
+  return true;
+}
+
+void Movie::destroy()
+{
+  stop();
+}
+
+void Movie::reset()
+{
+  _state.clear();
+  _data.clear();
+  _offset = 0;
+  _frames = _position = 0;
+  memset(&_last, 0, sizeof(_last));
+}
+
+void Movie::record(const void* state, size_t size)
+{
+  reset();
+  _state.assign((const uint8_t*)state, (const uint8_t*)state + size);
+  _mode = Mode::Recording;
+  _logger->info(TAG "Recording a movie from a state of %zu bytes", size);
+}
+
+bool Movie::save(const std::string& path)
+{
+  if (_mode != Mode::Recording)
+    return false;
+
+  _mode = Mode::Idle;
+
+  std::vector<uint8_t> header;
+  put32(header, MOVIE_MAGIC);
+  put32(header, MOVIE_VERSION);
+  put32(header, _frames);
+  put32(header, (uint32_t)_state.size());
+  put32(header, (uint32_t)_data.size());
+
+  FILE* file = fopen(path.c_str(), "wb");
+
+  if (file == NULL)
+  {
+    _logger->error(TAG "Error opening \"%s\"", path.c_str());
+    return false;
+  }
+
+  bool ok = fwrite(header.data(), 1, header.size(), file) == header.size();
+  ok = ok && fwrite(_state.data(), 1, _state.size(), file) == _state.size();
+  ok = ok && fwrite(_data.data(), 1, _data.size(), file) == _data.size();
+  ok = fclose(file) == 0 && ok;
+
+  if (!ok)
+  {
+    _logger->error(TAG "Error writing \"%s\"", path.c_str());
+    return false;
+  }
+
+  _logger->info(TAG "Movie with %u frames saved to \"%s\" (%zu bytes of input)", _frames, path.c_str(), _data.size());
+  return true;
+}
+
+bool Movie::play(const std::string& path)
+{
+  stop();
+
+  FILE* file = fopen(path.c_str(), "rb");
+
+  if (file == NULL)
+  {
+    _logger->error(TAG "Error opening \"%s\"", path.c_str());
+    return false;
+  }
+
+  // the sizes in the header must add up to the file's, so a broken file can't make us allocate
+  // gigabytes
+  bool ok = fseek(file, 0, SEEK_END) == 0;
+  const long fileSize = ok ? ftell(file) : -1;
+  ok = ok && fileSize >= 0 && fseek(file, 0, SEEK_SET) == 0;
+
+  uint8_t header[20];
+  ok = ok && fread(header, 1, sizeof(header), file) == sizeof(header);
+  ok = ok && get32(header) == MOVIE_MAGIC && get32(header + 4) == MOVIE_VERSION;
+
+  const uint64_t stateSize = ok ? get32(header + 12) : 0;
+  const uint64_t dataSize = ok ? get32(header + 16) : 0;
+  ok = ok && sizeof(header) + stateSize + dataSize == (uint64_t)fileSize;
+
+  if (ok)
+  {
+    _frames = get32(header + 8);
+    _state.resize((size_t)stateSize);
+    _data.resize((size_t)dataSize);
+
+    ok = fread(_state.data(), 1, _state.size(), file) == _state.size();
+    ok = ok && fread(_data.data(), 1, _data.size(), file) == _data.size();
+  }
+
+  fclose(file);
+
+  if (!ok)
+  {
+    _logger->error(TAG "\"%s\" is not a valid movie", path.c_str());
+    reset();
+    return false;
+  }
+
+  _mode = Mode::Playing;
+  _logger->info(TAG "Playing a movie with %u frames from \"%s\"", _frames, path.c_str());
+  return true;
+}
+
+void Movie::stop()
+{
+  if (_mode == Mode::Playing)
+    _logger->info(TAG "Movie stopped at frame %u of %u", _position, _frames);
+  else if (_mode == Mode::Recording)
+    _logger->warn(TAG "Movie with %u frames discarded", _frames);
+
+  _mode = Mode::Idle;
+  reset();
+}
+
+void Movie::recordFrame(const Frame& frame)
+{
+  if (_mode != Mode::Recording)
+    return;
+
+  const size_t start = _data.size();
+  uint8_t ports = 0;
+  _data.push_back(0);
+
+  for (unsigned port = 0; port < kMaxPorts; port++)
+  {
+    uint8_t fields = frame.state[port] != _last.state[port] ? 1 : 0;
+
+    for (unsigned axis = 0; axis < kAxes; axis++)
+    {
+      if (frame.axis[port][axis] != _last.axis[port][axis])
+        fields |= 2 << axis;
+    }
+
+    if (fields == 0)
+      continue;
+
+    ports |= 1 << port;
+    _data.push_back(fields);
+
+    if (fields & 1)
+      put16(_data, frame.state[port]);
+
+    for (unsigned axis = 0; axis < kAxes; axis++)
+    {
+      if (fields & (2 << axis))
+        put16(_data, frame.axis[port][axis]);
+    }
+  }
+
+  _data[start] = ports;
+  _last = frame;
+  _frames++;
+}
+
+bool Movie::playFrame(Frame* frame)
+{
+  if (_mode != Mode::Playing)
+    return false;
+
+  if (_position == _frames || _offset >= _data.size())
+  {
+    _logger->info(TAG "Movie ended after %u frames", _position);
+    _mode = Mode::Idle;
+    reset();
+    return false;
+  }
+
+  const uint8_t* data = _data.data();
+  const size_t size = _data.size();
+  const uint8_t ports = data[_offset++];
+
+  for (unsigned port = 0; port < kMaxPorts; port++)
+  {
+    if ((ports & (1 << port)) == 0 || _offset >= size)
+      continue;
+
+    const uint8_t fields = data[_offset++];
+
+    if ((fields & 1) && _offset + 2 <= size)
+    {
+      _last.state[port] = get16(data + _offset);
+      _offset += 2;
+    }
+
+    for (unsigned axis = 0; axis < kAxes; axis++)
+    {
+      if ((fields & (2 << axis)) && _offset + 2 <= size)
+      {
+        _last.axis[port][axis] = get16(data + _offset);
+        _offset += 2;
+      }
+    }
+  }
+
+  *frame = _last;
+  _position++;
+  return true;
+}
@@ -0,0 +1,97 @@
+/*
+Copyright (C) 2018 Andre Leiradella
+
+This file is part of RALibretro.
+
+RALibretro is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RALibretro is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "libretro/Components.h"
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+/* A recording of the joypad and analog input of all ports, to run the same game session again
+ * with exactly the same input.
+ *
+ * A movie starts with the core's state when the recording started, followed by one entry each
+ * time the core polls the input. An entry has a byte with a bit for each port that changed since
+ * the last poll, then for each of those ports a byte with the fields that changed (bit 0 for the
+ * buttons, bits 1 to 4 for the axes) followed by their new values, so polls where nothing changed
+ * take a single byte.
+ *
+ * Replays only match the recording if the core polls the same way, run-ahead and rewind must be
+ * set up like they were when the movie was recorded. Mouse, pointer and keyboard input are not
+ * recorded.
+ */
+class Movie
+{
+public:
+  enum
+  {
+    kMaxPorts = 8,
+    kAxes = 4
+  };
+
+  enum class Mode
+  {
+    Idle,
+    Recording,
+    Playing
+  };
+
+  struct Frame
+  {
+    int16_t state[kMaxPorts];
+    int16_t axis[kMaxPorts][kAxes];
+  };
+
+  bool init(libretro::LoggerComponent* logger);
+  void destroy();
+
+  /* Starts a new recording from the core's state, empty if the core can't save states */
+  void record(const void* state, size_t size);
+  /* Stops the recording and writes it */
+  bool save(const std::string& path);
+  /* Loads a movie and starts playing it, the caller must load state() into the core */
+  bool play(const std::string& path);
+  void stop();
+
+  Mode mode() const { return _mode; }
+  const std::vector<uint8_t>& state() const { return _state; }
+  unsigned frames() const { return _frames; }
+  unsigned position() const { return _position; }
+
+  /* Called every time the core polls the input */
+  void recordFrame(const Frame& frame);
+  /* Returns false when the movie has ended, the mode goes back to Idle */
+  bool playFrame(Frame* frame);
+
+protected:
+  void reset();
+
+  libretro::LoggerComponent* _logger;
+
+  Mode                 _mode;
+  std::vector<uint8_t> _state;
+  std::vector<uint8_t> _data;   /* the encoded entries */
+  size_t               _offset; /* next entry to play */
+  unsigned             _frames;
+  unsigned             _position;
+  Frame                _last;
+};
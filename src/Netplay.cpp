@@ -0,0 +1,806 @@
+/*
+Copyright (C) 2018 Andre Leiradella
+
+This file is part of RALibretro.
+
+RALibretro is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RALibretro is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef _WIN32
+// must come before windows.h, which Dialog.h includes
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include "Netplay.h"
+
+#include "Util.h"
+
+#include "components/Dialog.h"
+#include "jsonsax/jsonsax.h"
+
+#include <SDL_timer.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TAG "[NET] "
+
+#define NETPLAY_MAGIC    0x504e4152 /* "RANP" */
+#define NETPLAY_VERSION  1
+
+/* the peer is gone if nothing came from it for this long */
+#define NETPLAY_TIMEOUT  10000
+/* the guest says hello this often until the host answers */
+#define NETPLAY_HELLO    500
+
+#ifndef _WIN32
+typedef int SOCKET;
+#define INVALID_SOCKET -1
+#define closesocket close
+#endif
+
+enum
+{
+  kHello,
+  kWelcome,
+  kInput,
+  kHash
+};
+
+const Netplay::Socket Netplay::kNoSocket = (Netplay::Socket)~(uintptr_t)0;
+
+static void put8(std::vector<uint8_t>& out, uint8_t value)
+{
+  out.push_back(value);
+}
+
+static void put16(std::vector<uint8_t>& out, int16_t value)
+{
+  out.push_back((uint16_t)value & 0xff);
+  out.push_back((uint16_t)value >> 8);
+}
+
+static void put32(std::vector<uint8_t>& out, uint32_t value)
+{
+  out.push_back(value & 0xff);
+  out.push_back((value >> 8) & 0xff);
+  out.push_back((value >> 16) & 0xff);
+  out.push_back(value >> 24);
+}
+
+static int16_t get16(const uint8_t* in)
+{
+  return (int16_t)(in[0] | in[1] << 8);
+}
+
+static uint32_t get32(const uint8_t* in)
+{
+  return in[0] | in[1] << 8 | in[2] << 16 | (uint32_t)in[3] << 24;
+}
+
+static uint32_t hashState(const void* data, size_t size)
+{
+  // FNV-1a
+  const uint8_t* bytes = (const uint8_t*)data;
+  uint32_t hash = 2166136261U;
+
+  for (size_t i = 0; i < size; i++)
+    hash = (hash ^ bytes[i]) * 16777619U;
+
+  return hash;
+}
+
+bool Netplay::Pad::operator==(const Pad& other) const
+{
+  return buttons == other.buttons && memcmp(axis, other.axis, sizeof(axis)) == 0;
+}
+
+bool Netplay::init(Logger* logger, Input* input)
+{
+  _logger = logger;
+  _input = input;
+
+  _mode = Mode::Off;
+  _address = "127.0.0.1";
+  _port = kDefaultPort;
+
+  _socket = kNoSocket;
+  _connected = false;
+  _capacity = _size = 0;
+
+#ifdef _WIN32
+  WSADATA wsa;
+
+  if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0)
+  {
+    _logger->error(TAG "Error initializing Winsock, netplay won't be available");
+  }
+#endif
+
+  return true;
+}
+
+void Netplay::destroy()
+{
+  stop();
+
+#ifdef _WIN32
+  WSACleanup();
+#endif
+}
+
+bool Netplay::start(Mode mode, const std::string& address, unsigned port, bool hardcore)
+{
+  stop();
+
+  if (mode == Mode::Off)
+    return true;
+
+  if (hardcore)
+  {
+    _logger->warn(TAG "Netplay is not available in hardcore mode");
+    return false;
+  }
+
+  const SOCKET sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+  if (sock == INVALID_SOCKET)
+  {
+    _logger->error(TAG "Error creating the socket");
+    return false;
+  }
+
+  struct sockaddr_in local;
+  memset(&local, 0, sizeof(local));
+  local.sin_family = AF_INET;
+  local.sin_addr.s_addr = htonl(INADDR_ANY);
+  local.sin_port = htons(mode == Mode::Host ? (uint16_t)port : 0);
+
+  if (bind(sock, (struct sockaddr*)&local, sizeof(local)) != 0)
+  {
+    _logger->error(TAG "Error binding to port %u", mode == Mode::Host ? port : 0);
+    closesocket(sock);
+    return false;
+  }
+
+  // the socket is read every frame, it must never block the emulation
+#ifdef _WIN32
+  u_long nonBlocking = 1;
+  ioctlsocket(sock, FIONBIO, &nonBlocking);
+#else
+  fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+#endif
+
+  _peerLength = 0;
+
+  if (mode == Mode::Join)
+  {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+
+    struct addrinfo* result;
+    const std::string service = std::to_string(port);
+
+    if (getaddrinfo(address.c_str(), service.c_str(), &hints, &result) != 0 || result == NULL)
+    {
+      _logger->error(TAG "Could not resolve %s", address.c_str());
+      closesocket(sock);
+      return false;
+    }
+
+    memcpy(_peer, result->ai_addr, result->ai_addrlen);
+    _peerLength = (int)result->ai_addrlen;
+    freeaddrinfo(result);
+  }
+
+  _mode = mode;
+  _address = address;
+  _port = port;
+  _socket = (Socket)sock;
+  _connected = false;
+  _lastHello = 0;
+
+  memset(&_stats, 0, sizeof(_stats));
+
+  if (mode == Mode::Host)
+    _logger->info(TAG "Waiting for a guest on port %u", port);
+  else
+    _logger->info(TAG "Joining %s:%u", address.c_str(), port);
+
+  return true;
+}
+
+void Netplay::stop()
+{
+  if (_socket == kNoSocket)
+    return;
+
+  closesocket((SOCKET)_socket);
+  _socket = kNoSocket;
+
+  if (_connected)
+    logStats();
+
+  _connected = false;
+  _input->setOverride(NULL);
+
+  _localHashes.clear();
+  _remoteHashes.clear();
+}
+
+void Netplay::begin(libretro::Core* core)
+{
+  // both sides start from a freshly reset game
+  core->resetGame();
+
+  _connected = true;
+  _lastReceived = SDL_GetTicks();
+
+  _frame = 0;
+  _remoteConfirmed = _remoteAcked = _rollbackTo = -1;
+  _lastHashed = 0;
+  _echo = 0;
+
+  memset(_local, 0, sizeof(_local));
+  memset(_remote, 0, sizeof(_remote));
+  memset(_used, 0, sizeof(_used));
+
+  _localHashes.clear();
+  _remoteHashes.clear();
+
+  _logger->info(TAG "Connected, playing on port %d", _mode == Mode::Host ? 1 : 2);
+}
+
+Netplay::Pad Netplay::predicted(unsigned frame) const
+{
+  if ((int)frame <= _remoteConfirmed)
+    return _remote[frame % kHistory];
+
+  // the peer most likely still holds what it held last
+  if (_remoteConfirmed >= 0)
+    return _remote[_remoteConfirmed % kHistory];
+
+  Pad none;
+  memset(&none, 0, sizeof(none));
+  return none;
+}
+
+void Netplay::send(const void* data, size_t size)
+{
+  if (_peerLength == 0)
+    return;
+
+  const int sent = sendto((SOCKET)_socket, (const char*)data, (int)size, 0, (const struct sockaddr*)_peer, _peerLength);
+
+  if (sent == (int)size)
+  {
+    _stats.bytesSent += size;
+    _stats.packetsSent++;
+  }
+}
+
+void Netplay::sendInput()
+{
+  // everything the peer doesn't have yet, as far back as the history goes
+  unsigned first = (unsigned)(_remoteAcked + 1);
+
+  if (_frame - first > kMaxSend)
+    first = _frame - kMaxSend;
+
+  std::vector<uint8_t> packet;
+  put32(packet, NETPLAY_MAGIC);
+  put8(packet, kInput);
+  put32(packet, SDL_GetTicks());
+  put32(packet, _echo);
+  put32(packet, (uint32_t)_remoteConfirmed);
+  put32(packet, first);
+  put8(packet, (uint8_t)(_frame - first));
+
+  for (unsigned frame = first; frame < _frame; frame++)
+  {
+    const Pad& pad = local(frame);
+    put16(packet, pad.buttons);
+
+    for (unsigned axis = 0; axis < 4; axis++)
+      put16(packet, pad.axis[axis]);
+  }
+
+  send(packet.data(), packet.size());
+}
+
+void Netplay::receive(libretro::Core* core)
+{
+  uint8_t buffer[1024];
+
+  for (;;)
+  {
+    struct sockaddr_in from;
+    socklen_t fromLength = sizeof(from);
+
+    const int size = recvfrom((SOCKET)_socket, (char*)buffer, sizeof(buffer), 0, (struct sockaddr*)&from, &fromLength);
+
+    if (size <= 0)
+      break;
+
+    if (size < 5 || get32(buffer) != NETPLAY_MAGIC)
+      continue;
+
+    // the host takes the first guest that says hello, and ignores everyone else after that
+    if (_mode == Mode::Host && !_connected && buffer[4] == kHello)
+    {
+      memcpy(_peer, &from, fromLength);
+      _peerLength = (int)fromLength;
+    }
+    else if (_peerLength == 0 || memcmp(_peer, &from, fromLength) != 0)
+    {
+      continue;
+    }
+
+    _stats.bytesReceived += size;
+    _stats.packetsReceived++;
+    _lastReceived = SDL_GetTicks();
+
+    handlePacket(core, buffer, (size_t)size);
+  }
+}
+
+void Netplay::handlePacket(libretro::Core* core, const uint8_t* data, size_t size)
+{
+  switch (data[4])
+  {
+    case kHello:
+    {
+      if (size < 9 || get32(data + 5) != NETPLAY_VERSION)
+      {
+        _logger->warn(TAG "Guest runs another version of netplay");
+
+        // keep waiting for a guest we can play with
+        if (!_connected)
+          _peerLength = 0;
+
+        break;
+      }
+
+      // said again if the welcome was lost, the guest starts over with us
+      std::vector<uint8_t> packet;
+      put32(packet, NETPLAY_MAGIC);
+      put8(packet, kWelcome);
+      send(packet.data(), packet.size());
+
+      if (!_connected)
+        begin(core);
+
+      break;
+    }
+
+    case kWelcome:
+      if (_mode == Mode::Join && !_connected)
+        begin(core);
+
+      break;
+
+    case kInput:
+    {
+      if (!_connected || size < 22)
+        break;
+
+      const uint32_t echo = get32(data + 9);
+      const unsigned rtt = SDL_GetTicks() - echo;
+
+      if (echo != 0 && rtt < NETPLAY_TIMEOUT)
+        _stats.rtt = _stats.rtt == 0 ? rtt : (_stats.rtt * 7 + rtt) / 8;
+
+      _echo = get32(data + 5);
+
+      const int acked = (int)get32(data + 13);
+      if (acked > _remoteAcked)
+        _remoteAcked = acked;
+
+      const unsigned first = get32(data + 17);
+      const unsigned count = data[21];
+
+      if (size < 22 + count * 10)
+        break;
+
+      const uint8_t* in = data + 22;
+
+      for (unsigned i = 0; i < count; i++, in += 10)
+      {
+        const unsigned frame = first + i;
+
+        // only the next frame we don't have, the inputs must be confirmed in order
+        if ((int)frame != _remoteConfirmed + 1)
+          continue;
+
+        Pad pad;
+        pad.buttons = get16(in);
+
+        for (unsigned axis = 0; axis < 4; axis++)
+          pad.axis[axis] = get16(in + 2 + axis * 2);
+
+        // the frame ran with a guess that turned out to be wrong
+        if (frame < _frame && _used[frame % kRing] != pad && (_rollbackTo < 0 || (int)frame < _rollbackTo))
+          _rollbackTo = (int)frame;
+
+        remote(frame) = pad;
+        _remoteConfirmed = (int)frame;
+      }
+
+      break;
+    }
+
+    case kHash:
+    {
+      if (!_connected || size < 13)
+        break;
+
+      const unsigned frame = get32(data + 5);
+      _remoteHashes[frame] = get32(data + 9);
+      compareHash(frame);
+      break;
+    }
+  }
+}
+
+void Netplay::compareHash(unsigned frame)
+{
+  const auto local = _localHashes.find(frame);
+  const auto remote = _remoteHashes.find(frame);
+
+  if (local == _localHashes.end() || remote == _remoteHashes.end())
+    return;
+
+  if (local->second != remote->second)
+  {
+    _stats.desyncs++;
+    _logger->error(TAG "Desync detected at frame %u (%08x here, %08x on the peer)", frame, local->second, remote->second);
+  }
+
+  _localHashes.erase(local);
+  _remoteHashes.erase(remote);
+
+  // hashes the peer never sent don't pile up
+  while (!_localHashes.empty() && _localHashes.begin()->first < frame)
+    _localHashes.erase(_localHashes.begin());
+
+  while (!_remoteHashes.empty() && _remoteHashes.begin()->first < frame)
+    _remoteHashes.erase(_remoteHashes.begin());
+}
+
+void Netplay::checkHashes()
+{
+  // the newest frame whose state is in the ring and came from confirmed inputs only
+  unsigned frame = (unsigned)(_remoteConfirmed + 1);
+
+  if (frame >= _frame)
+    frame = _frame - 1;
+
+  frame -= frame % kHashInterval;
+
+  if (frame == 0 || frame <= _lastHashed || frame + kMaxRollback < _frame)
+    return;
+
+  _lastHashed = frame;
+
+  const uint32_t hash = hashState(state(frame), _size);
+  _localHashes[frame] = hash;
+
+  std::vector<uint8_t> packet;
+  put32(packet, NETPLAY_MAGIC);
+  put8(packet, kHash);
+  put32(packet, frame);
+  put32(packet, hash);
+  send(packet.data(), packet.size());
+
+  compareHash(frame);
+}
+
+void Netplay::runFrame(libretro::Core* core, unsigned frame, bool generateVideo, bool generateAudio)
+{
+  const Pad& mine = local(frame);
+  const Pad& theirs = _used[frame % kRing];
+  const Pad& host = _mode == Mode::Host ? mine : theirs;
+  const Pad& guest = _mode == Mode::Host ? theirs : mine;
+
+  Movie::Frame pads;
+  memset(&pads, 0, sizeof(pads));
+
+  pads.state[0] = host.buttons;
+  memcpy(pads.axis[0], host.axis, sizeof(host.axis));
+  pads.state[1] = guest.buttons;
+  memcpy(pads.axis[1], guest.axis, sizeof(guest.axis));
+
+  _input->setOverride(&pads);
+  core->step(generateVideo, generateAudio);
+  _input->setOverride(NULL);
+}
+
+bool Netplay::rollback(libretro::Core* core, unsigned frame, size_t size)
+{
+  if (!core->unserialize(state(frame), size))
+  {
+    _logger->error(TAG "Error loading state, stopping netplay");
+    return false;
+  }
+
+  // run the frames again with what we know now, saving their states again as we go
+  for (unsigned i = frame; i < _frame; i++)
+  {
+    if (i != frame)
+      core->serialize(state(i), size);
+
+    _used[i % kRing] = predicted(i);
+    runFrame(core, i, false, false);
+  }
+
+  _stats.rollbacks++;
+  _stats.resimulated += _frame - frame;
+  return true;
+}
+
+void Netplay::step(libretro::Core* core, bool generateVideo)
+{
+  receive(core);
+
+  if (!_connected)
+  {
+    // the game keeps running until the peer shows up
+    if (_mode == Mode::Join && SDL_GetTicks() - _lastHello >= NETPLAY_HELLO)
+    {
+      std::vector<uint8_t> packet;
+      put32(packet, NETPLAY_MAGIC);
+      put8(packet, kHello);
+      put32(packet, NETPLAY_VERSION);
+      send(packet.data(), packet.size());
+
+      _lastHello = SDL_GetTicks();
+    }
+
+    if (!_connected)
+    {
+      core->step(generateVideo, true);
+      return;
+    }
+  }
+
+  if (SDL_GetTicks() - _lastReceived > NETPLAY_TIMEOUT)
+  {
+    _logger->warn(TAG "Nothing came from the peer for %u seconds, stopping netplay", NETPLAY_TIMEOUT / 1000);
+    stop();
+    core->step(generateVideo, true);
+    return;
+  }
+
+  const size_t size = core->serializeSize();
+
+  if (size == 0)
+  {
+    _logger->error(TAG "Core doesn't support save states, stopping netplay");
+    stop();
+    return;
+  }
+
+  if (size > _capacity)
+  {
+    // some cores grow their states over time, leave some room so we don't reallocate every time.
+    // The states in the ring move to the new stride, they may still be rolled back to
+    const size_t capacity = size + size / 4;
+    std::vector<uint8_t> states(capacity * kRing);
+
+    if (_size != 0)
+    {
+      for (unsigned slot = 0; slot < kRing; slot++)
+        memcpy(states.data() + slot * capacity, _states.data() + slot * _capacity, _size);
+    }
+
+    _states.swap(states);
+    _capacity = capacity;
+  }
+
+  _size = size;
+
+  if (_rollbackTo >= 0)
+  {
+    const unsigned frame = (unsigned)_rollbackTo;
+    _rollbackTo = -1;
+
+    if (!rollback(core, frame, size))
+    {
+      stop();
+      return;
+    }
+  }
+
+  checkHashes();
+
+  // too far ahead of the peer, our oldest state would have to be rolled past
+  if ((int)_frame > _remoteConfirmed + kMaxRollback)
+  {
+    _stats.stalls++;
+    sendInput();
+    return;
+  }
+
+  if (!core->serialize(state(_frame), size))
+  {
+    _logger->error(TAG "Error saving state, stopping netplay");
+    stop();
+    core->step(generateVideo, true);
+    return;
+  }
+
+  Movie::Frame live;
+  _input->getLiveFrame(&live);
+
+  Pad& mine = local(_frame);
+  mine.buttons = live.state[0];
+  memcpy(mine.axis, live.axis[0], sizeof(mine.axis));
+
+  _used[_frame % kRing] = predicted(_frame);
+  runFrame(core, _frame, generateVideo, true);
+  _frame++;
+
+  sendInput();
+}
+
+void Netplay::logStats() const
+{
+  _logger->info(TAG "Netplay: %llu bytes sent in %llu packets, %llu bytes received in %llu packets, %u ms round trip",
+    (unsigned long long)_stats.bytesSent, (unsigned long long)_stats.packetsSent,
+    (unsigned long long)_stats.bytesReceived, (unsigned long long)_stats.packetsReceived, _stats.rtt);
+
+  _logger->info(TAG "Netplay: %u rollbacks ran %u frames again, %u frames stalled, %u desyncs",
+    _stats.rollbacks, _stats.resimulated, _stats.stalls, _stats.desyncs);
+}
+
+std::string Netplay::serialize()
+{
+  std::string json("{");
+
+  json.append("\"address\":\"");
+  json.append(util::jsonEscape(_address));
+  json.append("\",");
+
+  json.append("\"port\":");
+  json.append(std::to_string(_port));
+
+  json.append("}");
+  return json;
+}
+
+void Netplay::deserialize(const char* json)
+{
+  struct Deserialize
+  {
+    Netplay* self;
+    std::string key;
+  };
+
+  Deserialize ud;
+  ud.self = this;
+
+  jsonsax_parse(json, &ud, [](void* udata, jsonsax_event_t event, const char* str, size_t num) {
+    auto ud = (Deserialize*)udata;
+
+    if (event == JSONSAX_KEY)
+    {
+      ud->key = std::string(str, num);
+    }
+    else if (event == JSONSAX_STRING && ud->key == "address")
+    {
+      ud->self->_address = std::string(str, num);
+    }
+    else if (event == JSONSAX_NUMBER && ud->key == "port")
+    {
+      const long value = strtol(str, NULL, 10);
+      if (value > 0 && value <= 65535)
+        ud->self->_port = (unsigned)value;
+    }
+
+    return 0;
+  });
+}
+
+static const char* s_getModeOptions(int index, void* udata)
+{
+  switch (index)
+  {
+    case 0: return "Off";
+    case 1: return "Host";
+    case 2: return "Join";
+    default: return NULL;
+  }
+}
+
+void Netplay::showDialog(bool hardcore)
+{
+  const WORD WIDTH = 200;
+  const WORD LINE = 15;
+
+  Dialog db;
+  db.init("Netplay");
+
+  WORD y = 0;
+
+  int mode = active() ? (int)_mode : 0;
+  db.addLabel("Mode", 51101, 0, y, 60, 8);
+  db.addCombobox(51102, 65, y - 2, WIDTH - 65, 12, 100, s_getModeOptions, NULL, &mode);
+  y += LINE;
+
+  char address[128];
+  snprintf(address, sizeof(address), "%s", _address.c_str());
+  db.addLabel("Host address", 51103, 0, y, 60, 8);
+  db.addEditbox(51104, 65, y - 2, WIDTH - 65, 12, 1, address, sizeof(address), false);
+  y += LINE;
+
+  char port[16];
+  snprintf(port, sizeof(port), "%u", _port);
+  db.addLabel("Port", 51105, 0, y, 60, 8);
+  db.addEditbox(51106, 65, y - 2, WIDTH - 65, 12, 1, port, sizeof(port), false);
+  y += LINE;
+
+  char status[128];
+  if (hardcore)
+    snprintf(status, sizeof(status), "Not available in hardcore mode");
+  else if (_connected)
+    snprintf(status, sizeof(status), "%u ms round trip, %u rollbacks, %u desyncs", _stats.rtt, _stats.rollbacks, _stats.desyncs);
+  else if (active())
+    snprintf(status, sizeof(status), "Waiting for the other player");
+  else
+    snprintf(status, sizeof(status), "Both players must run the same core and game");
+
+  db.addLabel(status, 51107, 0, y, WIDTH, 8);
+  y += LINE;
+
+  char traffic[128];
+  snprintf(traffic, sizeof(traffic), "%llu KB sent, %llu KB received, %u frames stalled",
+    (unsigned long long)(_stats.bytesSent / 1024), (unsigned long long)(_stats.bytesReceived / 1024), _stats.stalls);
+  db.addLabel(traffic, 51108, 0, y, WIDTH, 8);
+  y += LINE;
+
+  db.addButton("OK", IDOK, WIDTH - 55 - 50, y, 50, 14, true);
+  db.addButton("Cancel", IDCANCEL, WIDTH - 50, y, 50, 14, false);
+
+  if (!db.show())
+    return;
+
+  const long value = strtol(port, NULL, 10);
+  const unsigned newPort = value > 0 && value <= 65535 ? (unsigned)value : kDefaultPort;
+
+  // changing nothing while connected keeps the connection
+  if (active() && (Mode)mode == _mode && _address == address && _port == newPort)
+    return;
+
+  if ((Mode)mode == Mode::Off)
+  {
+    stop();
+    _address = address;
+    _port = newPort;
+  }
+  else
+  {
+    start((Mode)mode, address, newPort, hardcore);
+  }
+}
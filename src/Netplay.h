@@ -0,0 +1,169 @@
+/*
+Copyright (C) 2018 Andre Leiradella
+
+This file is part of RALibretro.
+
+RALibretro is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RALibretro is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "components/Input.h"
+#include "components/Logger.h"
+
+#include "libretro/Core.h"
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+/* Two player netplay over UDP with rollback.
+ *
+ * Both sides reset the game when they connect and then run the same frames. The host plays on
+ * port 1 and the guest on port 2, each with their own first controller. Every frame sends the
+ * local input of the frames the peer hasn't acknowledged yet, so lost packets only cost latency.
+ *
+ * The peer's input for frames it hasn't sent yet is predicted to be the last one received. The
+ * state before each frame goes into a ring, and when the real input turns out to be different
+ * the core goes back to the state of the first mispredicted frame and runs the frames again with
+ * video and audio off. A side stops and waits when the peer is more than kMaxRollback frames
+ * behind.
+ *
+ * Every kHashInterval frames whose input is confirmed on both sides the state is hashed and the
+ * hashes are exchanged, a mismatch means the cores desynced.
+ */
+class Netplay
+{
+public:
+  enum class Mode
+  {
+    Off,
+    Host,
+    Join
+  };
+
+  enum
+  {
+    kMaxRollback = 8,
+    kHashInterval = 60,
+    kDefaultPort = 55435
+  };
+
+  struct Stats
+  {
+    uint64_t bytesSent;
+    uint64_t bytesReceived;
+    uint64_t packetsSent;
+    uint64_t packetsReceived;
+    unsigned rtt;          /* milliseconds, smoothed */
+    unsigned rollbacks;
+    unsigned resimulated;  /* frames run again by the rollbacks */
+    unsigned stalls;       /* frames spent waiting for the peer */
+    unsigned desyncs;
+  };
+
+  bool init(Logger* logger, Input* input);
+  void destroy();
+
+  /* Netplay loads states, which hardcore doesn't allow */
+  bool start(Mode mode, const std::string& address, unsigned port, bool hardcore);
+  void stop();
+
+  /* Waiting for the peer or playing with it, step must be used instead of the core's */
+  bool active() const { return _socket != kNoSocket; }
+  bool connected() const { return _connected; }
+
+  /* Runs the next frame, or nothing if it has to wait for the peer */
+  void step(libretro::Core* core, bool generateVideo);
+
+  const Stats& stats() const { return _stats; }
+
+  std::string serialize();
+  void deserialize(const char* json);
+  void showDialog(bool hardcore);
+
+protected:
+  enum
+  {
+    kRing = kMaxRollback + 1, /* states before the frames that can still be rolled back to */
+    kHistory = 64,            /* inputs kept to send and receive */
+    kMaxSend = 32             /* inputs in a packet */
+  };
+
+  /* a SOCKET or a file descriptor, the header doesn't drag the socket headers in */
+  typedef uintptr_t Socket;
+  static const Socket kNoSocket;
+
+  struct Pad
+  {
+    int16_t buttons;
+    int16_t axis[4];
+
+    bool operator==(const Pad& other) const;
+    bool operator!=(const Pad& other) const { return !(*this == other); }
+  };
+
+  void* state(unsigned frame) const { return (uint8_t*)_states.data() + (frame % kRing) * _capacity; }
+  Pad&  local(unsigned frame) { return _local[frame % kHistory]; }
+  Pad&  remote(unsigned frame) { return _remote[frame % kHistory]; }
+  Pad   predicted(unsigned frame) const;
+
+  void receive(libretro::Core* core);
+  void handlePacket(libretro::Core* core, const uint8_t* data, size_t size);
+  void send(const void* data, size_t size);
+  void sendInput();
+  void checkHashes();
+  void compareHash(unsigned frame);
+
+  bool rollback(libretro::Core* core, unsigned frame, size_t size);
+  void runFrame(libretro::Core* core, unsigned frame, bool generateVideo, bool generateAudio);
+  void begin(libretro::Core* core);
+  void logStats() const;
+
+  Logger* _logger;
+  Input*  _input;
+
+  Mode        _mode;
+  std::string _address;
+  unsigned    _port;
+
+  Socket   _socket;
+  uint8_t  _peer[128];  /* sockaddr of the peer */
+  int      _peerLength;
+  bool     _connected;
+  uint32_t _lastReceived; /* SDL ticks */
+  uint32_t _lastHello;
+
+  unsigned _frame;           /* next frame to run */
+  int      _remoteConfirmed; /* last frame with the peer's input, -1 if none */
+  int      _remoteAcked;     /* last frame of our input the peer has */
+  int      _rollbackTo;      /* first frame ran with a wrong prediction, -1 if none */
+  unsigned _lastHashed;
+  uint32_t _echo;            /* time of the peer's last packet, sent back to measure the round trip */
+
+  Pad _local[kHistory];
+  Pad _remote[kHistory];
+  Pad _used[kRing];          /* the peer's input each frame in the ring ran with */
+
+  std::vector<uint8_t> _states;
+  size_t               _capacity;
+  size_t               _size;
+
+  std::map<unsigned, uint32_t> _localHashes;
+  std::map<unsigned, uint32_t> _remoteHashes;
+
+  Stats _stats;
+};
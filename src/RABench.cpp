@@ -0,0 +1,1346 @@
+// RABench.cpp : Micro-benchmarks for the frontend's hot paths.
+//
+
+#include "Git.h"
+
+#include "components/Allocator.h"
+#include "components/Pixels.h"
+#include "components/Resampler.h"
+#include "libretro/Core.h"
+#include "speex/speex_resampler.h"
+
+#include "Movie.h"
+
+#include <rcheevos.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdarg.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#include <sys/wait.h>
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+static void usage(const char* appname)
+{
+  printf("RABench %s\n====================\n", git::getReleaseVersion());
+
+  printf("Usage: %s benchmark [options]\n", appname);
+  printf("\n");
+  printf("  resampler [seconds]   compares the stereo resampler against the two speex resamplers\n");
+  printf("  pixels [seconds]      checks the pixel format conversions against the reference loops and times them\n");
+  printf("  core corepath contentpath [-f frames] [-s statefile] [-m moviefile] [-a achievementsfile] [-c consoleid] [-d systemdir] [-k interval] [-v]\n");
+  printf("                        runs the content without a window and times the frames, save states and achievements\n");
+  printf("  farm sessionsfile [-j jobs] [-o reportfile] [-b baselinefile] [-t tolerance] [-k interval]\n");
+  printf("                        runs every session in the file in its own process, several at once, and writes a report\n");
+  printf("\n");
+  printf("  frames           frames to run, 3000 if not given\n");
+  printf("  statefile        save state to load before running\n");
+  printf("  moviefile        input movie to play, starts from the movie's state instead of statefile\n");
+  printf("  achievementsfile achievement definitions to evaluate every frame, one per line\n");
+  printf("  consoleid        maps memory for the achievements like RALibretro does for the console\n");
+  printf("  systemdir        directory with the BIOS files, System if not given\n");
+  printf("  sessionsfile     the arguments of the core benchmark for a session per line, # starts a comment\n");
+  printf("  jobs             sessions running at the same time, the number of CPUs if not given\n");
+  printf("  reportfile       CSV report, farm.csv if not given\n");
+  printf("  baselinefile     report of an earlier run, sessions that got different state hashes or got worse are failed\n");
+  printf("  tolerance        percentage the fps and the peak memory can get worse by, 10 if not given\n");
+  printf("  interval         frames between the state hashes, 600 if not given\n");
+}
+
+typedef std::chrono::steady_clock Clock;
+
+static double elapsedSeconds(const Clock::time_point& start)
+{
+  return std::chrono::duration_cast<std::chrono::duration<double>>(Clock::now() - start).count();
+}
+
+static void generateAudio(std::vector<int16_t>& samples, unsigned rate)
+{
+  samples.resize(rate * 2);
+
+  for (unsigned i = 0; i < rate; i++)
+  {
+    samples[i * 2] = (int16_t)(12000.0 * sin(2.0 * M_PI * 440.0 * i / rate) + 4000.0 * sin(2.0 * M_PI * 5000.0 * i / rate));
+    samples[i * 2 + 1] = (int16_t)(12000.0 * sin(2.0 * M_PI * 660.0 * i / rate) - 4000.0 * sin(2.0 * M_PI * 7000.0 * i / rate));
+  }
+}
+
+/* Feeds one second of audio in 60Hz batches until the time budget runs out, the same way
+ * Audio::mix is driven by the core. Returns input samples (both channels) per second. */
+template<typename T>
+static double runResampler(const std::vector<int16_t>& input, unsigned inRate, unsigned outRate, double seconds, T process)
+{
+  const size_t batch = inRate / 60;
+  const size_t total = input.size() / 2;
+  std::vector<int16_t> output(((size_t)ceil(batch * (double)outRate / inRate) + 16) * 2);
+
+  size_t processed = 0;
+  const Clock::time_point start = Clock::now();
+
+  do
+  {
+    for (size_t offset = 0; offset + batch <= total; offset += batch)
+    {
+      process(&input[offset * 2], batch, output.data(), output.size() / 2);
+      processed += batch;
+    }
+  } while (elapsedSeconds(start) < seconds);
+
+  return processed * 2 / elapsedSeconds(start);
+}
+
+static int benchResampler(double seconds)
+{
+  static const unsigned rates[][2] =
+  {
+    {32040, 44100}, // SNES
+    {32000, 48000},
+    {44100, 48000},
+    {48000, 44100},
+    {55930, 48000}, // Virtual Boy / PC Engine style odd rates
+  };
+
+  static const Resampler::Quality qualities[] =
+  {
+    Resampler::Quality::Linear,
+    Resampler::Quality::Cubic,
+    Resampler::Quality::Low,
+    Resampler::Quality::Medium,
+    Resampler::Quality::High
+  };
+
+  printf("stereo resampler kernel: %s, results in millions of input samples per second\n\n", Resampler::kernelName());
+  printf("%-16s %12s", "rates", "speex x2");
+
+  for (size_t q = 0; q < sizeof(qualities) / sizeof(qualities[0]); q++)
+    printf(" %12s", Resampler::qualityName(qualities[q]));
+
+  printf("\n");
+
+  for (size_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i++)
+  {
+    const unsigned inRate = rates[i][0];
+    const unsigned outRate = rates[i][1];
+
+    std::vector<int16_t> input;
+    generateAudio(input, inRate);
+
+    /* the previous setup: two mono speex resamplers with stride 2 */
+    int error;
+    SpeexResamplerState* left = speex_resampler_init(1, inRate, outRate, SPEEX_RESAMPLER_QUALITY_DEFAULT, &error);
+    SpeexResamplerState* right = speex_resampler_init(1, inRate, outRate, SPEEX_RESAMPLER_QUALITY_DEFAULT, &error);
+
+    if (left == NULL || right == NULL)
+    {
+      fprintf(stderr, "speex_resampler_init: %s\n", speex_resampler_strerror(error));
+      return 1;
+    }
+
+    speex_resampler_set_input_stride(left, 2);
+    speex_resampler_set_input_stride(right, 2);
+    speex_resampler_set_output_stride(left, 2);
+    speex_resampler_set_output_stride(right, 2);
+
+    const double speex = runResampler(input, inRate, outRate, seconds, [left, right](const int16_t* in, size_t inFrames, int16_t* out, size_t outFrames)
+    {
+      spx_uint32_t in_frames = (spx_uint32_t)inFrames;
+      spx_uint32_t out_frames = (spx_uint32_t)outFrames;
+      speex_resampler_process_int(left, 0, in, &in_frames, out, &out_frames);
+
+      in_frames = (spx_uint32_t)inFrames;
+      out_frames = (spx_uint32_t)outFrames;
+      speex_resampler_process_int(right, 0, in + 1, &in_frames, out + 1, &out_frames);
+    });
+
+    speex_resampler_destroy(left);
+    speex_resampler_destroy(right);
+
+    char label[32];
+    snprintf(label, sizeof(label), "%u -> %u", inRate, outRate);
+    printf("%-16s %12.2f", label, speex / 1e6);
+
+    for (size_t q = 0; q < sizeof(qualities) / sizeof(qualities[0]); q++)
+    {
+      Resampler resampler;
+
+      if (!resampler.init(inRate, outRate, qualities[q]))
+      {
+        fprintf(stderr, "Resampler::init failed for %u -> %u\n", inRate, outRate);
+        return 1;
+      }
+
+      const double stereo = runResampler(input, inRate, outRate, seconds, [&resampler](const int16_t* in, size_t inFrames, int16_t* out, size_t outFrames)
+      {
+        resampler.process(in, inFrames, out, outFrames);
+      });
+
+      resampler.destroy();
+      printf(" %12.2f", stereo / 1e6);
+    }
+
+    printf("\n");
+  }
+
+  return 0;
+}
+
+/* Runs a conversion over a 640x480 frame until the time budget runs out, returns pixels per second */
+template<typename T>
+static double runPixels(double seconds, T convert)
+{
+  const size_t frame = 640 * 480;
+  size_t converted = 0;
+  const Clock::time_point start = Clock::now();
+
+  do
+  {
+    convert();
+    converted += frame;
+  } while (elapsedSeconds(start) < seconds);
+
+  return converted / elapsedSeconds(start);
+}
+
+static int benchPixels(double seconds)
+{
+  const size_t width = 640;
+  const size_t height = 480;
+  const size_t count = width * height;
+
+  /* every 16-bit value appears in the frame, the rest is noise */
+  std::vector<uint16_t> pixels16(count);
+  std::vector<uint32_t> pixels32(count);
+  std::vector<uint8_t> rgb(count * 3);
+  uint32_t seed = 0x12345678;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    seed = seed * 1664525 + 1013904223;
+    pixels16[i] = i < 65536 ? (uint16_t)i : (uint16_t)(seed >> 16);
+    pixels32[i] = seed;
+    rgb[i * 3] = (uint8_t)(seed >> 8);
+    rgb[i * 3 + 1] = (uint8_t)(seed >> 16);
+    rgb[i * 3 + 2] = (uint8_t)(seed >> 24);
+  }
+
+  std::vector<uint8_t> rgbOut(count * 3), rgbRef(count * 3);
+  std::vector<uint16_t> out16(count), ref16(count);
+
+  struct
+  {
+    const char* name;
+    void (*convert16)(uint8_t*, const uint16_t*, size_t);
+    void (*reference16)(uint8_t*, const uint16_t*, size_t);
+    void (*convert32)(uint8_t*, const uint32_t*, size_t);
+    void (*reference32)(uint8_t*, const uint32_t*, size_t);
+    void (*convertRgb)(uint16_t*, const uint8_t*, size_t);
+    void (*referenceRgb)(uint16_t*, const uint8_t*, size_t);
+  }
+  const tests[] =
+  {
+    {"RGB565 -> RGB", pixels::rgb565ToRgb, pixels::reference::rgb565ToRgb, NULL, NULL, NULL, NULL},
+    {"0RGB1555 -> RGB", pixels::argb1555ToRgb, pixels::reference::argb1555ToRgb, NULL, NULL, NULL, NULL},
+    {"XRGB8888 -> RGB", NULL, NULL, pixels::xrgb8888ToRgb, pixels::reference::xrgb8888ToRgb, NULL, NULL},
+    {"RGB -> RGB565", NULL, NULL, NULL, NULL, pixels::rgbToRgb565, pixels::reference::rgbToRgb565},
+    {"RGB -> 0RGB1555", NULL, NULL, NULL, NULL, pixels::rgbToArgb1555, pixels::reference::rgbToArgb1555},
+  };
+
+  printf("pixel conversion kernel: %s, results in millions of pixels per second\n\n", pixels::kernelName());
+  printf("%-16s %12s %12s %8s\n", "conversion", "reference", "kernel", "exact");
+
+  int result = 0;
+
+  for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+  {
+    const auto& test = tests[i];
+    double reference, kernel;
+    bool exact = true;
+
+    if (test.convert16 != NULL)
+    {
+      /* odd widths exercise the tails that don't fill a whole vector */
+      for (size_t w = 1; w <= 64; w++)
+      {
+        test.convert16(rgbOut.data(), pixels16.data(), w);
+        test.reference16(rgbRef.data(), pixels16.data(), w);
+        exact = exact && memcmp(rgbOut.data(), rgbRef.data(), w * 3) == 0;
+      }
+
+      test.convert16(rgbOut.data(), pixels16.data(), count);
+      test.reference16(rgbRef.data(), pixels16.data(), count);
+      exact = exact && rgbOut == rgbRef;
+
+      reference = runPixels(seconds, [&]() { test.reference16(rgbRef.data(), pixels16.data(), count); });
+      kernel = runPixels(seconds, [&]() { test.convert16(rgbOut.data(), pixels16.data(), count); });
+    }
+    else if (test.convert32 != NULL)
+    {
+      for (size_t w = 1; w <= 64; w++)
+      {
+        test.convert32(rgbOut.data(), pixels32.data(), w);
+        test.reference32(rgbRef.data(), pixels32.data(), w);
+        exact = exact && memcmp(rgbOut.data(), rgbRef.data(), w * 3) == 0;
+      }
+
+      test.convert32(rgbOut.data(), pixels32.data(), count);
+      test.reference32(rgbRef.data(), pixels32.data(), count);
+      exact = exact && rgbOut == rgbRef;
+
+      reference = runPixels(seconds, [&]() { test.reference32(rgbRef.data(), pixels32.data(), count); });
+      kernel = runPixels(seconds, [&]() { test.convert32(rgbOut.data(), pixels32.data(), count); });
+    }
+    else
+    {
+      for (size_t w = 1; w <= 64; w++)
+      {
+        test.convertRgb(out16.data(), rgb.data(), w);
+        test.referenceRgb(ref16.data(), rgb.data(), w);
+        exact = exact && memcmp(out16.data(), ref16.data(), w * 2) == 0;
+      }
+
+      test.convertRgb(out16.data(), rgb.data(), count);
+      test.referenceRgb(ref16.data(), rgb.data(), count);
+      exact = exact && out16 == ref16;
+
+      reference = runPixels(seconds, [&]() { test.referenceRgb(ref16.data(), rgb.data(), count); });
+      kernel = runPixels(seconds, [&]() { test.convertRgb(out16.data(), rgb.data(), count); });
+    }
+
+    printf("%-16s %12.2f %12.2f %8s\n", test.name, reference / 1e6, kernel / 1e6, exact ? "yes" : "NO");
+
+    if (!exact)
+      result = 1;
+  }
+
+  return result;
+}
+
+/* Null components to drive libretro::Core without a window. Hardware rendered cores are refused, a
+ * console build has no GL context to give them. */
+class BenchLogger: public libretro::LoggerComponent
+{
+public:
+  virtual void vprintf(enum retro_log_level level, const char* fmt, va_list args) override
+  {
+    if (!logLevel(level))
+      return;
+
+    char line[1024];
+    vsnprintf(line, sizeof(line) - 1, fmt, args);
+    strcat(line, "\n");
+    fputs(line, stderr);
+  }
+};
+
+class BenchConfig: public libretro::ConfigComponent
+{
+public:
+  std::string systemPath;
+  std::string savePath;
+
+  virtual const char* getCoreAssetsDirectory() override { return savePath.c_str(); }
+  virtual const char* getSaveDirectory() override { return savePath.c_str(); }
+  virtual const char* getSystemPath() override { return systemPath.c_str(); }
+
+  virtual void setVariables(const struct retro_variable* variables, unsigned count) override
+  {
+    // "Description; first|second|...", use the first option
+    for (unsigned i = 0; i < count; i++)
+    {
+      const char* value = strchr(variables[i].value, ';');
+      value = value != NULL ? value + 1 : variables[i].value;
+
+      while (*value == ' ')
+        value++;
+
+      const char* pipe = strchr(value, '|');
+      _values[variables[i].key] = pipe != NULL ? std::string(value, pipe - value) : std::string(value);
+    }
+
+    _updated = true;
+  }
+
+  virtual void setVariables(const struct retro_core_option_definition* options, unsigned count) override
+  {
+    for (unsigned i = 0; i < count; i++)
+    {
+      const char* value = options[i].default_value != NULL ? options[i].default_value : options[i].values[0].value;
+      _values[options[i].key] = value != NULL ? value : "";
+    }
+
+    _updated = true;
+  }
+
+  virtual void setVariableDisplay(const struct retro_core_option_display* display) override { (void)display; }
+
+  virtual bool varUpdated() override
+  {
+    const bool updated = _updated;
+    _updated = false;
+    return updated;
+  }
+
+  virtual const char* getVariable(const char* variable) override
+  {
+    const auto found = _values.find(variable);
+    return found != _values.end() ? found->second.c_str() : NULL;
+  }
+
+  virtual bool getFastForwarding() override { return false; }
+  virtual void setFastForwarding(bool value) override { (void)value; }
+
+protected:
+  std::map<std::string, std::string> _values;
+  bool _updated = false;
+};
+
+class BenchVideo: public libretro::VideoComponent
+{
+public:
+  unsigned frames = 0;
+
+  virtual void setEnabled(bool enabled) override { (void)enabled; }
+
+  virtual bool setGeometry(unsigned width, unsigned height, unsigned maxWidth, unsigned maxHeight, float aspect, enum retro_pixel_format pixelFormat, const struct retro_hw_render_callback* hwRenderCallback) override
+  {
+    (void)maxWidth;
+    (void)maxHeight;
+    (void)aspect;
+    (void)pixelFormat;
+
+    if (hwRenderCallback != NULL)
+    {
+      fprintf(stderr, "Hardware rendered cores are not supported\n");
+      return false;
+    }
+
+    printf("geometry: %ux%u\n", width, height);
+    return true;
+  }
+
+  virtual void refresh(const void* data, unsigned width, unsigned height, size_t pitch) override
+  {
+    (void)data;
+    (void)width;
+    (void)height;
+    (void)pitch;
+    frames++;
+  }
+
+  virtual bool                 supportsContext(enum retro_hw_context_type type) override { (void)type; return false; }
+  virtual uintptr_t            getCurrentFramebuffer() override { return 0; }
+  virtual retro_proc_address_t getProcAddress(const char* symbol) override { (void)symbol; return NULL; }
+
+  virtual void showMessage(const char* msg, unsigned frames) override { (void)msg; (void)frames; }
+
+  virtual void setRotation(Rotation rotation) override { _rotation = rotation; }
+  virtual Rotation getRotation() const override { return _rotation; }
+
+protected:
+  Rotation _rotation = Rotation::None;
+};
+
+class BenchAudio: public libretro::AudioComponent
+{
+public:
+  uint64_t frames = 0;
+
+  virtual bool setRate(double rate) override { (void)rate; return true; }
+  virtual void mix(const int16_t* samples, size_t count) override { (void)samples; frames += count; }
+};
+
+class BenchInput: public libretro::InputComponent
+{
+public:
+  Movie* movie = NULL;
+
+  virtual void setInputDescriptors(const struct retro_input_descriptor* descs, unsigned count) override { (void)descs; (void)count; }
+
+  virtual void     setControllerInfo(const struct retro_controller_info* info, unsigned count) override { (void)info; (void)count; }
+  virtual bool     ctrlUpdated() override { return false; }
+  virtual unsigned getController(unsigned port) override { (void)port; return RETRO_DEVICE_JOYPAD; }
+
+  virtual bool     setRumble(unsigned port, retro_rumble_effect effect, uint16_t strength) override { (void)port; (void)effect; (void)strength; return false; }
+
+  virtual void poll() override
+  {
+    _playing = movie != NULL && movie->playFrame(&_frame);
+  }
+
+  virtual int16_t read(unsigned port, unsigned device, unsigned index, unsigned id) override
+  {
+    if (!_playing || port >= Movie::kMaxPorts)
+      return 0;
+
+    switch (device)
+    {
+      case RETRO_DEVICE_JOYPAD:
+        return id == RETRO_DEVICE_ID_JOYPAD_MASK ? _frame.state[port] : (_frame.state[port] >> id) & 1;
+
+      case RETRO_DEVICE_ANALOG:
+        return _frame.axis[port][(index << 1 | id) & 3];
+    }
+
+    return 0;
+  }
+
+protected:
+  bool         _playing = false;
+  Movie::Frame _frame;
+};
+
+/* The memory achievements read, laid out like Memory does it for RALibretro */
+struct BenchMemory
+{
+  struct Bank
+  {
+    uint8_t* data;  /* NULL if the core doesn't expose it */
+    size_t   size;
+  };
+
+  std::vector<Bank> banks;
+
+  void add(uint8_t* data, size_t size)
+  {
+    Bank bank;
+    bank.data = data;
+    bank.size = size;
+    banks.push_back(bank);
+  }
+
+  void attach(libretro::Core* core, int consoleId)
+  {
+    const rc_memory_regions_t* regions = consoleId != 0 ? rc_console_memory_regions(consoleId) : NULL;
+
+    if (regions == NULL || regions->num_regions == 0 || core->getMemoryMap()->num_descriptors == 0)
+    {
+      add((uint8_t*)core->getMemoryData(RETRO_MEMORY_SYSTEM_RAM), core->getMemorySize(RETRO_MEMORY_SYSTEM_RAM));
+      add((uint8_t*)core->getMemoryData(RETRO_MEMORY_SAVE_RAM), core->getMemorySize(RETRO_MEMORY_SAVE_RAM));
+      return;
+    }
+
+    for (unsigned i = 0; i < regions->num_regions; i++)
+    {
+      const rc_memory_region_t* region = &regions->region[i];
+      size_t regionSize = region->end_address - region->start_address + 1;
+      size_t realAddress = region->real_address;
+
+      while (regionSize > 0)
+      {
+        const struct retro_memory_descriptor* desc = core->getMemoryDescriptor(realAddress);
+        const size_t offset = desc != NULL ? realAddress - desc->start : 0;
+
+        if (desc == NULL || desc->ptr == NULL || offset >= desc->len)
+        {
+          add(NULL, regionSize);
+          break;
+        }
+
+        const size_t size = std::min(regionSize, desc->len - offset);
+        add((uint8_t*)desc->ptr + desc->offset + offset, size);
+        regionSize -= size;
+        realAddress += size;
+      }
+    }
+  }
+
+  uint8_t peek(unsigned address) const
+  {
+    for (const auto& bank : banks)
+    {
+      if (address < bank.size)
+        return bank.data != NULL ? bank.data[address] : 0;
+
+      address -= (unsigned)bank.size;
+    }
+
+    return 0;
+  }
+
+  static unsigned s_peek(unsigned address, unsigned numBytes, void* ud)
+  {
+    const BenchMemory* self = (const BenchMemory*)ud;
+    unsigned value = 0;
+
+    for (unsigned i = 0; i < numBytes; i++)
+      value |= (unsigned)self->peek(address + i) << (i * 8);
+
+    return value;
+  }
+};
+
+static unsigned s_triggered;
+
+static void achievementEvent(const rc_runtime_event_t* event)
+{
+  if (event->type == RC_RUNTIME_EVENT_ACHIEVEMENT_TRIGGERED)
+    s_triggered++;
+}
+
+static bool loadBinary(const char* path, std::vector<uint8_t>& data)
+{
+  FILE* file = fopen(path, "rb");
+
+  if (file == NULL)
+  {
+    fprintf(stderr, "Could not open %s\n", path);
+    return false;
+  }
+
+  fseek(file, 0, SEEK_END);
+  const long size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+
+  data.resize(size > 0 ? (size_t)size : 0);
+  const bool ok = data.empty() || fread(data.data(), 1, data.size(), file) == data.size();
+  fclose(file);
+
+  if (!ok)
+    fprintf(stderr, "Could not read %s\n", path);
+
+  return ok;
+}
+
+static double percentile(const std::vector<double>& sorted, double p)
+{
+  if (sorted.empty())
+    return 0.0;
+
+  size_t index = (size_t)(p * (sorted.size() - 1) + 0.5);
+  return sorted[std::min(index, sorted.size() - 1)];
+}
+
+/* FNV-1a, only has to tell two states apart */
+static uint32_t hashBytes(const uint8_t* data, size_t size)
+{
+  uint32_t hash = 2166136261U;
+
+  for (size_t i = 0; i < size; i++)
+    hash = (hash ^ data[i]) * 16777619U;
+
+  return hash;
+}
+
+/* The most memory the process has had at once */
+static uint64_t peakMemoryKB()
+{
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS counters;
+
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    return 0;
+
+  return counters.PeakWorkingSetSize / 1024;
+#else
+  struct rusage usage;
+
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+
+#ifdef __APPLE__
+  return (uint64_t)usage.ru_maxrss / 1024;
+#else
+  return (uint64_t)usage.ru_maxrss;
+#endif
+#endif
+}
+
+static int benchCore(int argc, char* argv[])
+{
+  if (argc < 2)
+  {
+    fprintf(stderr, "The core and content paths are required\n");
+    return 1;
+  }
+
+  const char* corePath = argv[0];
+  const char* contentPath = argv[1];
+  unsigned frames = 3000;
+  const char* statePath = NULL;
+  const char* moviePath = NULL;
+  const char* achievementsPath = NULL;
+  int consoleId = 0;
+  unsigned checkpoints = 0;
+
+  BenchLogger logger;
+  BenchConfig config;
+  BenchVideo video;
+  BenchAudio audio;
+  BenchInput input;
+  Allocator allocator;
+
+  logger.setLogLevel(RETRO_LOG_WARN);
+  config.systemPath = "System";
+  config.savePath = ".";
+
+  for (int i = 2; i < argc; i++)
+  {
+    if (strcmp(argv[i], "-v") == 0)
+      logger.setLogLevel(RETRO_LOG_DEBUG);
+    else if (i + 1 >= argc)
+      break;
+    else if (strcmp(argv[i], "-f") == 0)
+      frames = (unsigned)strtoul(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "-s") == 0)
+      statePath = argv[++i];
+    else if (strcmp(argv[i], "-m") == 0)
+      moviePath = argv[++i];
+    else if (strcmp(argv[i], "-a") == 0)
+      achievementsPath = argv[++i];
+    else if (strcmp(argv[i], "-c") == 0)
+      consoleId = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-d") == 0)
+      config.systemPath = argv[++i];
+    else if (strcmp(argv[i], "-k") == 0)
+      checkpoints = (unsigned)strtoul(argv[++i], NULL, 10);
+  }
+
+  allocator.init(&logger);
+
+  libretro::Components components;
+  components.logger = &logger;
+  components.config = &config;
+  components.videoContext = NULL;
+  components.video = &video;
+  components.audio = &audio;
+  components.input = &input;
+  components.allocator = &allocator;
+
+  libretro::Core core;
+  core.init(&components);
+
+  const Clock::time_point loadStart = Clock::now();
+
+  if (!core.loadCore(corePath) || !core.initCore())
+  {
+    fprintf(stderr, "Could not load the core %s\n", corePath);
+    return 1;
+  }
+
+  const double coreSeconds = elapsedSeconds(loadStart);
+  std::vector<uint8_t> content;
+
+  if (!core.getSystemInfo()->need_fullpath && !loadBinary(contentPath, content))
+  {
+    core.destroy();
+    return 1;
+  }
+
+  const Clock::time_point gameStart = Clock::now();
+
+  if (!core.loadGame(contentPath, content.empty() ? NULL : content.data(), content.size()))
+  {
+    fprintf(stderr, "Could not load the content %s\n", contentPath);
+    return 1;
+  }
+
+  printf("core: %s %s, loaded in %.1f ms\n", core.getSystemInfo()->library_name, core.getSystemInfo()->library_version, coreSeconds * 1000.0);
+  printf("content: %s, loaded in %.1f ms\n", contentPath, elapsedSeconds(gameStart) * 1000.0);
+
+  Movie movie;
+  movie.init(&logger);
+
+  if (moviePath != NULL)
+  {
+    if (!movie.play(moviePath) || !core.unserialize(movie.state().data(), movie.state().size()))
+    {
+      fprintf(stderr, "Could not play the movie %s\n", moviePath);
+      core.destroy();
+      return 1;
+    }
+
+    input.movie = &movie;
+    printf("movie: %s, %u frames\n", moviePath, movie.frames());
+  }
+  else if (statePath != NULL)
+  {
+    std::vector<uint8_t> state;
+
+    if (!loadBinary(statePath, state) || !core.unserialize(state.data(), state.size()))
+    {
+      fprintf(stderr, "Could not load the state %s\n", statePath);
+      core.destroy();
+      return 1;
+    }
+
+    printf("state: %s\n", statePath);
+  }
+
+  rc_runtime_t runtime;
+  rc_runtime_init(&runtime);
+  unsigned achievements = 0;
+  BenchMemory memory;
+
+  if (achievementsPath != NULL)
+  {
+    std::vector<uint8_t> text;
+
+    if (!loadBinary(achievementsPath, text))
+    {
+      core.destroy();
+      return 1;
+    }
+
+    text.push_back('\n');
+    std::string line;
+
+    for (uint8_t c : text)
+    {
+      if (c != '\n' && c != '\r')
+      {
+        line += (char)c;
+        continue;
+      }
+
+      if (!line.empty())
+      {
+        const int res = rc_runtime_activate_achievement(&runtime, achievements + 1, line.c_str(), NULL, 0);
+
+        if (res == RC_OK)
+          achievements++;
+        else
+          fprintf(stderr, "Invalid achievement \"%s\": %d\n", line.c_str(), res);
+
+        line.clear();
+      }
+    }
+
+    memory.attach(&core, consoleId);
+  }
+
+  std::vector<double> frameTimes, achievementTimes;
+  frameTimes.reserve(frames);
+  achievementTimes.reserve(achievements != 0 ? frames : 0);
+
+  std::vector<uint8_t> checkpoint(checkpoints != 0 ? core.serializeSize() : 0);
+
+  const Clock::time_point runStart = Clock::now();
+
+  for (unsigned i = 0; i < frames; i++)
+  {
+    const Clock::time_point frameStart = Clock::now();
+    core.step(true, true);
+    const Clock::time_point frameEnd = Clock::now();
+    frameTimes.push_back(std::chrono::duration<double>(frameEnd - frameStart).count());
+
+    if (achievements != 0)
+    {
+      rc_runtime_do_frame(&runtime, achievementEvent, BenchMemory::s_peek, &memory, NULL);
+      achievementTimes.push_back(elapsedSeconds(frameEnd));
+    }
+
+    // the farm compares these between builds to find out when a core stopped being deterministic
+    if (!checkpoint.empty() && ((i + 1) % checkpoints == 0 || i + 1 == frames))
+    {
+      if (core.serialize(checkpoint.data(), checkpoint.size()))
+        printf("checkpoint: %u %08x\n", i + 1, hashBytes(checkpoint.data(), checkpoint.size()));
+      else
+        printf("checkpoint: %u failed\n", i + 1);
+    }
+  }
+
+  const double runSeconds = elapsedSeconds(runStart);
+
+  double coreTotal = 0.0;
+  for (double t : frameTimes)
+    coreTotal += t;
+
+  std::sort(frameTimes.begin(), frameTimes.end());
+
+  printf("\n%u frames in %.3f s, %.1f fps (%.1f fps counting only the core), %u video frames, %llu audio frames\n",
+    frames, runSeconds, frames / runSeconds, coreTotal > 0.0 ? frames / coreTotal : 0.0, video.frames, (unsigned long long)audio.frames);
+
+  printf("frame time in ms: p50 %.3f, p90 %.3f, p99 %.3f, max %.3f\n",
+    percentile(frameTimes, 0.5) * 1000.0, percentile(frameTimes, 0.9) * 1000.0,
+    percentile(frameTimes, 0.99) * 1000.0, frameTimes.empty() ? 0.0 : frameTimes.back() * 1000.0);
+
+  if (achievements != 0)
+  {
+    double total = 0.0;
+    for (double t : achievementTimes)
+      total += t;
+
+    std::sort(achievementTimes.begin(), achievementTimes.end());
+
+    printf("achievements: %u active, %u triggered, %.2f us per frame (p99 %.2f us)\n", achievements, s_triggered,
+      total * 1e6 / achievementTimes.size(), percentile(achievementTimes, 0.99) * 1e6);
+  }
+
+  rc_runtime_destroy(&runtime);
+
+  printf("\nenvironment calls:\n%s\n", core.getEnvReport().c_str());
+
+  const size_t stateSize = core.serializeSize();
+
+  if (stateSize != 0)
+  {
+    const unsigned iterations = 100;
+    std::vector<uint8_t> state(stateSize);
+    double serialize = 0.0, unserialize = 0.0;
+    bool ok = true;
+
+    for (unsigned i = 0; i < iterations && ok; i++)
+    {
+      Clock::time_point start = Clock::now();
+      ok = core.serialize(state.data(), state.size());
+      serialize += elapsedSeconds(start);
+
+      start = Clock::now();
+      ok = ok && core.unserialize(state.data(), state.size());
+      unserialize += elapsedSeconds(start);
+    }
+
+    if (ok)
+      printf("save state: %zu bytes, serialize %.1f us, unserialize %.1f us\n", stateSize, serialize * 1e6 / iterations, unserialize * 1e6 / iterations);
+    else
+      printf("save state: %zu bytes, the core failed to serialize or unserialize\n", stateSize);
+  }
+  else
+  {
+    printf("save state: not supported\n");
+  }
+
+  movie.destroy();
+  core.destroy();
+  allocator.destroy();
+
+  printf("peak memory: %llu KB\n", (unsigned long long)peakMemoryKB());
+  return 0;
+}
+
+/* A line of the sessions file, and what the process that ran it printed */
+struct FarmSession
+{
+  std::string              args;    /* as in the file, identifies the session in the reports */
+  std::vector<std::string> argv;
+
+  bool        ran = false;
+  int         exitCode = -1;
+  std::string error;                /* last line printed when the session failed */
+  double      fps = 0.0;
+  double      coreFps = 0.0;
+  uint64_t    peakKB = 0;
+  std::string checkpoints;          /* "frame:hash" separated by spaces */
+  std::string status;
+};
+
+/* Splits at spaces, double quotes group words with spaces in them */
+static std::vector<std::string> splitArgs(const std::string& line)
+{
+  std::vector<std::string> args;
+  size_t i = 0;
+
+  while (i < line.length())
+  {
+    if (line[i] == ' ' || line[i] == '\t')
+    {
+      i++;
+      continue;
+    }
+
+    std::string arg;
+    bool quoted = false;
+
+    for (; i < line.length() && (quoted || (line[i] != ' ' && line[i] != '\t')); i++)
+    {
+      if (line[i] == '"')
+        quoted = !quoted;
+      else
+        arg += line[i];
+    }
+
+    args.push_back(arg);
+  }
+
+  return args;
+}
+
+static std::string csvField(const std::string& value)
+{
+  if (value.find_first_of(",\"\n") == std::string::npos)
+    return value;
+
+  std::string field("\"");
+
+  for (char c : value)
+  {
+    if (c == '"')
+      field += '"';
+
+    field += c;
+  }
+
+  return field + '"';
+}
+
+static std::vector<std::string> splitCsv(const std::string& line)
+{
+  std::vector<std::string> fields(1);
+  bool quoted = false;
+
+  for (size_t i = 0; i < line.length(); i++)
+  {
+    const char c = line[i];
+
+    if (quoted)
+    {
+      if (c != '"')
+        fields.back() += c;
+      else if (i + 1 < line.length() && line[i + 1] == '"')
+        fields.back() += line[++i];
+      else
+        quoted = false;
+    }
+    else if (c == '"')
+      quoted = true;
+    else if (c == ',')
+      fields.emplace_back();
+    else
+      fields.back() += c;
+  }
+
+  return fields;
+}
+
+static std::vector<std::string> readLines(const char* path)
+{
+  std::vector<uint8_t> data;
+  std::vector<std::string> lines;
+
+  if (!loadBinary(path, data))
+    return lines;
+
+  std::string line;
+  data.push_back('\n');
+
+  for (uint8_t c : data)
+  {
+    if (c == '\r')
+      continue;
+
+    if (c != '\n')
+    {
+      line += (char)c;
+      continue;
+    }
+
+    lines.push_back(line);
+    line.clear();
+  }
+
+  return lines;
+}
+
+/* First frame hashed in both lists of checkpoints where the hashes differ, zero if there's none. The
+ * lists may have been taken at different intervals. */
+static unsigned firstMismatch(const std::string& checkpoints, const std::string& baseline)
+{
+  std::map<unsigned, std::string> hashes;
+
+  for (const auto& checkpoint : splitArgs(baseline))
+    hashes[(unsigned)strtoul(checkpoint.c_str(), NULL, 10)] = checkpoint.substr(checkpoint.find(':') + 1);
+
+  for (const auto& checkpoint : splitArgs(checkpoints))
+  {
+    const unsigned frame = (unsigned)strtoul(checkpoint.c_str(), NULL, 10);
+    const auto found = hashes.find(frame);
+
+    if (found != hashes.end() && found->second != checkpoint.substr(checkpoint.find(':') + 1))
+      return frame;
+  }
+
+  return 0;
+}
+
+/* Runs the core benchmark for the session in a process of its own. Cores keep their state in
+ * globals, so sessions of the same core can't share a process, and a crash only fails its own
+ * session. */
+static void runSession(const char* exe, unsigned interval, FarmSession* session)
+{
+  std::string command("\"");
+  command += exe;
+  command += "\" core";
+
+  for (const auto& arg : session->argv)
+  {
+    command += " \"";
+    command += arg;
+    command += '"';
+  }
+
+  command += " -k " + std::to_string(interval) + " 2>&1";
+
+#ifdef _WIN32
+  // cmd.exe strips the first and last quotes of the command
+  command = "\"" + command + "\"";
+  FILE* pipe = _popen(command.c_str(), "r");
+#else
+  FILE* pipe = popen(command.c_str(), "r");
+#endif
+
+  if (pipe == NULL)
+  {
+    session->error = "could not start the process";
+    return;
+  }
+
+  char line[1024];
+
+  while (fgets(line, sizeof(line), pipe) != NULL)
+  {
+    line[strcspn(line, "\r\n")] = 0;
+
+    unsigned frames, frame;
+    double seconds;
+    char hash[16];
+    unsigned long long peak;
+
+    if (sscanf(line, "%u frames in %lf s, %lf fps (%lf fps", &frames, &seconds, &session->fps, &session->coreFps) == 4)
+      continue;
+
+    if (sscanf(line, "checkpoint: %u %15s", &frame, hash) == 2)
+    {
+      if (!session->checkpoints.empty())
+        session->checkpoints += ' ';
+
+      session->checkpoints += std::to_string(frame) + ':' + hash;
+      continue;
+    }
+
+    if (sscanf(line, "peak memory: %llu KB", &peak) == 1)
+    {
+      session->peakKB = peak;
+      continue;
+    }
+
+    if (line[0] != 0)
+      session->error = line;
+  }
+
+#ifdef _WIN32
+  session->exitCode = _pclose(pipe);
+#else
+  const int status = pclose(pipe);
+  session->exitCode = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+#endif
+
+  session->ran = true;
+}
+
+static int benchFarm(const char* exe, int argc, char* argv[])
+{
+  if (argc < 1)
+  {
+    fprintf(stderr, "The sessions file is required\n");
+    return 1;
+  }
+
+  const char* sessionsPath = argv[0];
+  const char* reportPath = "farm.csv";
+  const char* baselinePath = NULL;
+  unsigned jobs = std::thread::hardware_concurrency();
+  double tolerance = 10.0;
+  unsigned interval = 600;
+
+  for (int i = 1; i + 1 < argc; i++)
+  {
+    if (strcmp(argv[i], "-j") == 0)
+      jobs = (unsigned)strtoul(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "-o") == 0)
+      reportPath = argv[++i];
+    else if (strcmp(argv[i], "-b") == 0)
+      baselinePath = argv[++i];
+    else if (strcmp(argv[i], "-t") == 0)
+      tolerance = atof(argv[++i]);
+    else if (strcmp(argv[i], "-k") == 0)
+      interval = (unsigned)strtoul(argv[++i], NULL, 10);
+  }
+
+  if (jobs == 0)
+    jobs = 1;
+
+  if (interval == 0)
+    interval = 600;
+
+  std::vector<FarmSession> sessions;
+
+  for (const auto& line : readLines(sessionsPath))
+  {
+    const std::string args = line.substr(0, line.find('#'));
+    FarmSession session;
+    session.argv = splitArgs(args);
+
+    if (session.argv.empty())
+      continue;
+
+    session.args = args.substr(args.find_first_not_of(" \t"));
+    session.args.erase(session.args.find_last_not_of(" \t") + 1);
+
+    if (session.argv.size() < 2)
+    {
+      fprintf(stderr, "Sessions need a core and a content: %s\n", session.args.c_str());
+      return 1;
+    }
+
+    sessions.push_back(session);
+  }
+
+  if (sessions.empty())
+  {
+    fprintf(stderr, "No sessions in %s\n", sessionsPath);
+    return 1;
+  }
+
+  // the baseline is a report, keyed by the session's arguments
+  std::map<std::string, std::vector<std::string>> baseline;
+
+  if (baselinePath != NULL)
+  {
+    const std::vector<std::string> lines = readLines(baselinePath);
+
+    for (size_t i = 1; i < lines.size(); i++)
+    {
+      std::vector<std::string> fields = splitCsv(lines[i]);
+
+      if (fields.size() >= 6)
+        baseline[fields[0]] = fields;
+    }
+
+    printf("baseline: %s, %zu sessions\n", baselinePath, baseline.size());
+  }
+
+  printf("running %zu sessions, %u at a time\n", sessions.size(), jobs);
+
+  std::atomic<size_t> next(0);
+  std::vector<std::thread> threads;
+  const Clock::time_point start = Clock::now();
+
+  for (unsigned i = 0; i < std::min<size_t>(jobs, sessions.size()); i++)
+  {
+    threads.emplace_back([&]() {
+      size_t index;
+
+      while ((index = next++) < sessions.size())
+        runSession(exe, interval, &sessions[index]);
+    });
+  }
+
+  for (auto& thread : threads)
+    thread.join();
+
+  unsigned failed = 0;
+  const double slower = 1.0 - tolerance / 100.0;
+  const double bigger = 1.0 + tolerance / 100.0;
+
+  for (auto& session : sessions)
+  {
+    if (!session.ran || session.exitCode != 0)
+    {
+      session.status = "failed: " + (session.error.empty() ? "exit code " + std::to_string(session.exitCode) : session.error);
+      failed++;
+      continue;
+    }
+
+    const auto found = baseline.find(session.args);
+
+    if (found == baseline.end())
+    {
+      session.status = baselinePath != NULL ? "new" : "ok";
+      continue;
+    }
+
+    const std::vector<std::string>& base = found->second;
+    unsigned frame;
+    const double baseFps = atof(base[3].c_str());
+    const uint64_t basePeak = strtoull(base[4].c_str(), NULL, 10);
+
+    if (base[1].compare(0, 6, "failed") == 0)
+      session.status = "fixed";
+    else if ((frame = firstMismatch(session.checkpoints, base[5])) != 0)
+      session.status = "state changed at frame " + std::to_string(frame);
+    else if (session.coreFps < baseFps * slower)
+      session.status = "slower";
+    else if ((double)session.peakKB > (double)basePeak * bigger)
+      session.status = "more memory";
+    else
+      session.status = "ok";
+
+    if (session.status != "ok" && session.status != "fixed")
+      failed++;
+  }
+
+  FILE* report = fopen(reportPath, "w");
+
+  if (report == NULL)
+  {
+    fprintf(stderr, "Could not create %s\n", reportPath);
+    return 1;
+  }
+
+  fprintf(report, "session,status,fps,core fps,peak KB,checkpoints\n");
+
+  for (const auto& session : sessions)
+  {
+    fprintf(report, "%s,%s,%.1f,%.1f,%llu,%s\n", csvField(session.args).c_str(), csvField(session.status).c_str(),
+      session.fps, session.coreFps, (unsigned long long)session.peakKB, csvField(session.checkpoints).c_str());
+
+    if (session.status != "ok")
+      printf("%s: %s\n", session.args.c_str(), session.status.c_str());
+  }
+
+  fclose(report);
+
+  printf("\n%zu sessions in %.1f s, %u failed, report written to %s\n", sessions.size(), elapsedSeconds(start), failed, reportPath);
+  return failed != 0 ? 1 : 0;
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc >= 2 && strcmp(argv[1], "resampler") == 0)
+  {
+    const double seconds = argc >= 3 ? atof(argv[2]) : 1.0;
+    return benchResampler(seconds > 0.0 ? seconds : 1.0);
+  }
+
+  if (argc >= 2 && strcmp(argv[1], "pixels") == 0)
+  {
+    const double seconds = argc >= 3 ? atof(argv[2]) : 1.0;
+    return benchPixels(seconds > 0.0 ? seconds : 1.0);
+  }
+
+  if (argc >= 2 && strcmp(argv[1], "core") == 0)
+  {
+    return benchCore(argc - 2, argv + 2);
+  }
+
+  if (argc >= 2 && strcmp(argv[1], "farm") == 0)
+  {
+    return benchFarm(argv[0], argc - 2, argv + 2);
+  }
+
+  usage(argv[0]);
+  return 1;
+}
@@ -1,22 +1,49 @@
 // RAHasher.cpp : This file contains the 'main' function. Program execution begins and ends there.
 //
 
+#include "FileCache.h"
 #include "Git.h"
 #include "Hash.h"
+#include "HashCache.h"
+#include "HashReader.h"
 #include "Util.h"
 
 #include <rcheevos/include/rhash.h>
 
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <memory>
+#include <thread>
+#include <vector>
 #include <string.h>
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+
 static void usage(const char* appname)
 {
   printf("RAHasher %s\n====================\n", git::getReleaseVersion());
 
-  printf("Usage: %s [-v] systemid filepath\n", util::fileName(appname).c_str());
+  printf("Usage: %s [-v] [-c cachefile] systemid filepath\n", util::fileName(appname).c_str());
+  printf("       %s [-v] [-c cachefile] [-j threads] [-o tsv|json] [-r reader] -b systemid path...\n", util::fileName(appname).c_str());
   printf("\n");
   printf("  -v           (optional) enables verbose messages for debugging\n");
+  printf("  -c           (optional) reuses hashes of unchanged files from cachefile, and adds new ones\n");
+  printf("  -j           (optional) number of files hashed at the same time [number of cores]\n");
+  printf("  -o           (optional) output format of the batch mode [tsv]\n");
+  printf("  -r           (optional) how files are read: stdio, buffered, mapped or cached [buffered],\n");
+  printf("               the batch mode prints the throughput of each so they can be compared on the same\n");
+  printf("               files\n");
+  printf("  -b           hashes all the paths given, a path can be a file, a directory (hashes all the\n");
+  printf("               files in it and its subdirectories), @listfile (hashes the files listed in\n");
+  printf("               listfile, one per line) or - (hashes the files listed in stdin)\n");
   printf("  systemid     specifies the system id associated to the game (which hash algorithm to use)\n");
   printf("  filepath     specifies the path to the game file\n");
 }
@@ -36,8 +63,11 @@ public:
     while (*fmt == ']' || *fmt == ' ')
       ++fmt;
 
-    ::vfprintf(stderr, fmt, args);
-    ::fprintf(stderr, "\n");
+    // a single write, so lines from different threads don't mix
+    char line[RING_LOG_MAX_LINE_SIZE];
+    vsnprintf(line, sizeof(line) - 1, fmt, args);
+    strcat(line, "\n");
+    ::fputs(line, stderr);
   }
 };
 
@@ -53,103 +83,420 @@ static void rhash_log_error(const char* message)
   fprintf(stderr, "%s\n", message);
 }
 
-static void* rhash_file_open(const char* path)
+#define RC_CONSOLE_MAX 90
+
+/* Hashes a file with the console's algorithm, or all the algorithms that fit the file when the
+ * console is above RC_CONSOLE_MAX. The rhash callbacks must be set up before, after that files
+ * can be hashed on several threads at once. */
+static bool hashFile(int consoleId, const std::string& file, std::vector<std::string>* hashes, std::vector<std::string>* opened)
 {
-  return util::openFile(logger.get(), path, "rb");
+  char hash[33];
+
+  // the files read along with this one, to check them before using a cached hash
+  hashReaderTrack(opened);
+
+  std::string ext = util::extension(file);
+  if (consoleId != RC_CONSOLE_ARCADE && consoleId <= RC_CONSOLE_MAX && ext.length() == 4 &&
+    tolower(ext[1]) == 'z' && tolower(ext[2]) == 'i' && tolower(ext[3]) == 'p')
+  {
+    std::string unzippedFilename;
+    size_t size;
+    void* data = util::loadZippedFile(logger.get(), file, &size, unzippedFilename);
+    if (data)
+    {
+      if (rc_hash_generate_from_buffer(hash, consoleId, (uint8_t*)data, size))
+        hashes->push_back(hash);
+
+      free(data);
+    }
+  }
+  else if (consoleId > RC_CONSOLE_MAX)
+  {
+    rc_hash_iterator iterator;
+    rc_hash_initialize_iterator(&iterator, file.c_str(), NULL, 0);
+    while (rc_hash_iterate(hash, &iterator))
+      hashes->push_back(hash);
+    rc_hash_destroy_iterator(&iterator);
+  }
+  else
+  {
+    if (rc_hash_generate_from_file(hash, consoleId, file.c_str()))
+      hashes->push_back(hash);
+  }
+
+  hashReaderTrack(NULL);
+  return !hashes->empty();
 }
 
-static void rhash_file_seek(void* file_handle, size_t offset, int origin)
+static bool isDirectory(const std::string& path)
 {
-  fseek((FILE*)file_handle, (long)offset, origin);
+#ifdef _WIN32
+  wchar_t unicodePath[MAX_PATH];
+  if (MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, unicodePath, MAX_PATH) == 0)
+    return false;
+
+  const DWORD attributes = GetFileAttributesW(unicodePath);
+  return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+#else
+  struct stat filestat;
+  return stat(path.c_str(), &filestat) == 0 && S_ISDIR(filestat.st_mode);
+#endif
 }
 
-static size_t rhash_file_tell(void* file_handle)
+/* Adds the files in the directory and its subdirectories, sorted so the output is the same in
+ * every run */
+static void listFiles(const std::string& directory, std::vector<std::string>* files)
 {
-  return ftell((FILE*)file_handle);
+  std::vector<std::string> names;
+
+#ifdef _WIN32
+  wchar_t pattern[MAX_PATH];
+  if (MultiByteToWideChar(CP_UTF8, 0, (directory + "\\*").c_str(), -1, pattern, MAX_PATH) == 0)
+    return;
+
+  WIN32_FIND_DATAW data;
+  HANDLE find = FindFirstFileW(pattern, &data);
+  if (find == INVALID_HANDLE_VALUE)
+    return;
+
+  do
+  {
+    char name[MAX_PATH * 3];
+    if (WideCharToMultiByte(CP_UTF8, 0, data.cFileName, -1, name, sizeof(name), NULL, NULL) != 0)
+      names.push_back(name);
+  } while (FindNextFileW(find, &data));
+
+  FindClose(find);
+  const char separator = '\\';
+#else
+  DIR* dir = opendir(directory.c_str());
+  if (dir == NULL)
+    return;
+
+  while (const struct dirent* entry = readdir(dir))
+    names.push_back(entry->d_name);
+
+  closedir(dir);
+  const char separator = '/';
+#endif
+
+  std::sort(names.begin(), names.end());
+
+  for (const auto& name : names)
+  {
+    if (name == "." || name == "..")
+      continue;
+
+    const std::string path = directory + separator + name;
+
+    if (isDirectory(path))
+      listFiles(path, files);
+    else
+      files->push_back(path);
+  }
 }
 
-static size_t rhash_file_read(void* file_handle, void* buffer, size_t requested_bytes)
+static void listFiles(FILE* list, std::vector<std::string>* files)
 {
-  return fread(buffer, 1, requested_bytes, (FILE*)file_handle);
+  char line[4096];
+
+  while (fgets(line, sizeof(line), list))
+  {
+    size_t length = strlen(line);
+    while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+      line[--length] = '\0';
+
+    if (length != 0)
+      files->push_back(util::fullPath(line));
+  }
 }
 
-static void rhash_file_close(void* file_handle)
+struct BatchEntry
 {
-  fclose((FILE*)file_handle);
-}
+  std::string              file;
+  uint64_t                 size;
+  std::vector<std::string> hashes;
+  std::vector<std::string> opened;
+  bool                     cached;
+};
 
-#define RC_CONSOLE_MAX 90
+static int batch(int consoleId, const std::vector<std::string>& paths, HashCache* cache, unsigned threads, bool json, bool verbose)
+{
+  std::vector<BatchEntry> entries;
+
+  {
+    std::vector<std::string> files;
+
+    for (const auto& path : paths)
+    {
+      if (path == "-")
+      {
+        listFiles(stdin, &files);
+      }
+      else if (path[0] == '@')
+      {
+        FILE* list = util::openFile(logger.get(), path.substr(1), "r");
+        if (list != NULL)
+        {
+          listFiles(list, &files);
+          fclose(list);
+        }
+      }
+      else
+      {
+        const std::string full = util::fullPath(path);
+
+        if (isDirectory(full))
+          listFiles(full, &files);
+        else
+          files.push_back(full);
+      }
+    }
+
+    entries.resize(files.size());
+
+    for (size_t i = 0; i < files.size(); i++)
+    {
+      BatchEntry* entry = &entries[i];
+      entry->file = files[i];
+      entry->cached = false;
+
+      time_t time;
+      if (!util::fileInfo(entry->file, &entry->size, &time))
+        entry->size = 0;
+    }
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+
+  // the cache isn't thread safe, look everything up before starting the workers
+  for (auto& entry : entries)
+  {
+    const std::string hash = cache->find(consoleId, entry.file, std::string());
+
+    if (!hash.empty())
+    {
+      entry.hashes.push_back(hash);
+      entry.cached = true;
+    }
+  }
+
+  {
+    std::atomic<size_t> next(0);
+
+    const auto work = [&entries, &next, consoleId]() {
+      for (;;)
+      {
+        const size_t i = next++;
+
+        if (i >= entries.size())
+          return;
+
+        if (!entries[i].cached)
+          hashFile(consoleId, entries[i].file, &entries[i].hashes, &entries[i].opened);
+      }
+    };
+
+    if (threads > entries.size())
+      threads = (unsigned)entries.size();
+
+    std::vector<std::thread> pool;
+
+    for (unsigned i = 1; i < threads; i++)
+      pool.emplace_back(work);
+
+    work();
+
+    for (auto& thread : pool)
+      thread.join();
+  }
+
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  size_t hashed = 0, cached = 0, failed = 0;
+  uint64_t bytes = 0;
+
+  if (json)
+    printf("[");
+
+  for (size_t i = 0; i < entries.size(); i++)
+  {
+    const BatchEntry& entry = entries[i];
+
+    if (entry.cached)
+    {
+      cached++;
+    }
+    else if (entry.hashes.empty())
+    {
+      failed++;
+    }
+    else
+    {
+      hashed++;
+      bytes += entry.size;
+
+      if (entry.hashes.size() == 1)
+        cache->store(consoleId, entry.file, std::string(), entry.hashes[0], entry.opened);
+    }
+
+    if (json)
+    {
+      printf("%s\n  {\"file\":\"%s\",\"hashes\":[", i == 0 ? "" : ",", util::jsonEscape(entry.file).c_str());
+
+      for (size_t j = 0; j < entry.hashes.size(); j++)
+        printf("%s\"%s\"", j == 0 ? "" : ",", entry.hashes[j].c_str());
+
+      printf("]}");
+    }
+    else if (entry.hashes.empty())
+    {
+      printf("\t%s\n", entry.file.c_str());
+    }
+    else
+    {
+      for (const auto& hash : entry.hashes)
+        printf("%s\t%s\n", hash.c_str(), entry.file.c_str());
+    }
+  }
+
+  if (json)
+    printf("\n]\n");
+
+  // hashes that came from the cache didn't read anything, leave them out of the throughput
+  const double megabytes = (double)bytes / (1024.0 * 1024.0);
+  fprintf(stderr, "%zu files hashed, %zu from the cache, %zu failed, using %u threads\n", hashed, cached, failed, threads);
+  fprintf(stderr, "%.1f MB in %.2f s, %.1f files/s, %.1f MB/s\n", megabytes, seconds,
+    seconds > 0.0 ? (double)hashed / seconds : 0.0, seconds > 0.0 ? megabytes / seconds : 0.0);
+
+  const HashReaderStats stats = hashReaderStats();
+  fprintf(stderr, "%llu reads, %llu from the disk, %.1f MB read\n", (unsigned long long)stats.reads,
+    (unsigned long long)stats.fills, (double)stats.bytes / (1024.0 * 1024.0));
+
+  if (verbose)
+    fprintf(stderr, "Hash cache: %u hits, %u misses\n", cache->hits(), cache->misses());
+
+  return failed == 0 ? 0 : 1;
+}
 
 int main(int argc, char* argv[])
 {
   int consoleId = 0;
   std::string file;
-  char hash[33];
+  std::string cacheFile;
+  bool verbose = false;
+  bool batchMode = false;
+  bool json = false;
+  HashReader reader = HashReader::Buffered;
+  unsigned threads = std::thread::hardware_concurrency();
   int result = 1;
 
-  if (argc == 3)
+  int arg = 1;
+  while (arg < argc && argv[arg][0] == '-')
   {
-    consoleId = atoi(argv[1]);
-    file = argv[2];
+    if (strcmp(argv[arg], "-v") == 0)
+    {
+      verbose = true;
+      ++arg;
+    }
+    else if (strcmp(argv[arg], "-b") == 0)
+    {
+      batchMode = true;
+      ++arg;
+    }
+    else if (strcmp(argv[arg], "-c") == 0 && arg + 1 < argc)
+    {
+      cacheFile = argv[arg + 1];
+      arg += 2;
+    }
+    else if (strcmp(argv[arg], "-j") == 0 && arg + 1 < argc)
+    {
+      threads = (unsigned)atoi(argv[arg + 1]);
+      arg += 2;
+    }
+    else if (strcmp(argv[arg], "-o") == 0 && arg + 1 < argc)
+    {
+      json = strcmp(argv[arg + 1], "json") == 0;
+      if (!json && strcmp(argv[arg + 1], "tsv") != 0)
+        break;
+
+      arg += 2;
+    }
+    else if (strcmp(argv[arg], "-r") == 0 && arg + 1 < argc)
+    {
+      if (strcmp(argv[arg + 1], "stdio") == 0)
+        reader = HashReader::Stdio;
+      else if (strcmp(argv[arg + 1], "buffered") == 0)
+        reader = HashReader::Buffered;
+      else if (strcmp(argv[arg + 1], "mapped") == 0)
+        reader = HashReader::Mapped;
+      else if (strcmp(argv[arg + 1], "cached") == 0)
+        reader = HashReader::Cached;
+      else
+        break;
+
+      arg += 2;
+    }
+    else
+    {
+      break;
+    }
   }
-  else if (argc == 4 && strcmp(argv[1], "-v") == 0)
-  {
-    rc_hash_init_verbose_message_callback(rhash_log);
 
-    consoleId = atoi(argv[2]);
-    file = argv[3];
+  if (threads == 0)
+    threads = 1;
+
+  if (batchMode ? argc - arg >= 2 : argc - arg == 2)
+  {
+    consoleId = atoi(argv[arg]);
+    file = argv[arg + 1];
   }
 
   if (consoleId != 0 && !file.empty())
   {
-    file = util::fullPath(file);
-
     logger.reset(new StdErrLogger);
 
+    if (verbose)
+      rc_hash_init_verbose_message_callback(rhash_log);
+
     rc_hash_init_error_message_callback(rhash_log_error);
 
-    std::string ext = util::extension(file);
-    if (consoleId != RC_CONSOLE_ARCADE && consoleId <= RC_CONSOLE_MAX && ext.length() == 4 &&
-      tolower(ext[1]) == 'z' && tolower(ext[2]) == 'i' && tolower(ext[3]) == 'p')
+    fileCacheInit(logger.get(), 64 * 1024 * 1024);
+    hashReaderInit(logger.get(), reader);
+    rc_hash_init_default_cdreader();
+
+    // iterating doesn't know the console up front, so it's never cached
+    HashCache cache;
+    cache.init(logger.get(), consoleId <= RC_CONSOLE_MAX ? cacheFile : std::string());
+
+    if (batchMode)
     {
-      std::string unzippedFilename;
-      size_t size;
-      void* data = util::loadZippedFile(logger.get(), file, &size, unzippedFilename);
-      if (data)
-      {
-        if (rc_hash_generate_from_buffer(hash, consoleId, (uint8_t*)data, size))
-          printf("%s\n", hash);
+      result = batch(consoleId, std::vector<std::string>(argv + arg + 1, argv + argc), &cache, threads, json, verbose);
+      cache.destroy();
+      return result;
+    }
 
-        free(data);
-      }
+    file = util::fullPath(file);
+
+    std::vector<std::string> hashes, opened;
+    const std::string cached = cache.find(consoleId, file, std::string());
+
+    if (!cached.empty())
+    {
+      hashes.push_back(cached);
     }
-    else
+    else if (hashFile(consoleId, file, &hashes, &opened) && consoleId <= RC_CONSOLE_MAX)
     {
-      struct rc_hash_filereader filereader;
-      filereader.open = rhash_file_open;
-      filereader.seek = rhash_file_seek;
-      filereader.tell = rhash_file_tell;
-      filereader.read = rhash_file_read;
-      filereader.close = rhash_file_close;
-      rc_hash_init_custom_filereader(&filereader);
+      cache.store(consoleId, file, std::string(), hashes[0], opened);
+    }
 
-      rc_hash_init_default_cdreader();
+    for (const auto& hash : hashes)
+      printf("%s\n", hash.c_str());
 
-      if (consoleId > RC_CONSOLE_MAX)
-      {
-        rc_hash_iterator iterator;
-        rc_hash_initialize_iterator(&iterator, file.c_str(), NULL, 0);
-        while (rc_hash_iterate(hash, &iterator))
-          printf("%s\n", hash);
-        rc_hash_destroy_iterator(&iterator);
-      }
-      else
-      {
-        if (rc_hash_generate_from_file(hash, consoleId, file.c_str()))
-          printf("%s\n", hash);
-      }
-    }
+    if (verbose && !cacheFile.empty())
+      printf("Hash cache: %u hits, %u misses\n", cache.hits(), cache.misses());
 
+    cache.destroy();
     return result;
   }
 
@@ -0,0 +1,568 @@
+/*
+Copyright (C) 2018 Andre Leiradella
+
+This file is part of RALibretro.
+
+RALibretro is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RALibretro is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Recorder.h"
+
+#include "Util.h"
+
+#include "components/Pixels.h"
+
+#include "stb_image_write.h"
+
+#include <string.h>
+
+#include <chrono>
+
+#define TAG "[REC] "
+
+/* stop writing before the 32-bit offsets of the index overflow */
+#define MAX_FILE_SIZE 0x7f000000L
+
+#define AVIF_HASINDEX   0x00000010
+#define AVIIF_KEYFRAME  0x00000010
+
+static uint32_t fourcc(const char* code)
+{
+  return (uint32_t)code[0] | (uint32_t)code[1] << 8 | (uint32_t)code[2] << 16 | (uint32_t)code[3] << 24;
+}
+
+static void put16(std::vector<uint8_t>& out, uint16_t value)
+{
+  out.push_back(value & 0xff);
+  out.push_back(value >> 8);
+}
+
+static void put32(std::vector<uint8_t>& out, uint32_t value)
+{
+  out.push_back(value & 0xff);
+  out.push_back((value >> 8) & 0xff);
+  out.push_back((value >> 16) & 0xff);
+  out.push_back(value >> 24);
+}
+
+static bool patch32(FILE* fp, long offset, uint32_t value)
+{
+  std::vector<uint8_t> bytes;
+  put32(bytes, value);
+  return fseek(fp, offset, SEEK_SET) == 0 && fwrite(bytes.data(), 1, 4, fp) == 4;
+}
+
+static void appendJpeg(void* context, void* data, int size)
+{
+  std::vector<uint8_t>* jpeg = (std::vector<uint8_t>*)context;
+  jpeg->insert(jpeg->end(), (const uint8_t*)data, (const uint8_t*)data + size);
+}
+
+bool Recorder::init(Logger* logger)
+{
+  _logger = logger;
+  _recording = false;
+  _file = NULL;
+  _queued = 0;
+  _channels = 2;
+
+  memset(&_stats, 0, sizeof(_stats));
+
+  return _worker.init(logger, "Recorder");
+}
+
+void Recorder::destroy()
+{
+  stop();
+  _worker.destroy();
+
+  for (Frame* frame : _frames)
+    delete frame;
+
+  _frames.clear();
+}
+
+bool Recorder::writeHeader(File* file, double fps, unsigned sampleRate)
+{
+  const uint32_t rate = (uint32_t)(fps * 1000.0 + 0.5);
+  const uint32_t blockAlign = file->channels * 2;
+
+  std::vector<uint8_t> header;
+
+  auto list = [&header](const char* id, size_t* sizeAt, const char* type) {
+    put32(header, fourcc(id));
+    *sizeAt = header.size();
+    put32(header, 0);
+    put32(header, fourcc(type));
+  };
+
+  auto close = [&header](size_t sizeAt) {
+    const uint32_t size = (uint32_t)(header.size() - sizeAt - 4);
+    header[sizeAt] = size & 0xff;
+    header[sizeAt + 1] = (size >> 8) & 0xff;
+    header[sizeAt + 2] = (size >> 16) & 0xff;
+    header[sizeAt + 3] = size >> 24;
+  };
+
+  size_t riff, hdrl, strl, movi;
+  list("RIFF", &riff, "AVI ");
+  list("LIST", &hdrl, "hdrl");
+
+  // main header
+  put32(header, fourcc("avih"));
+  put32(header, 56);
+  put32(header, (uint32_t)(1000000.0 / fps + 0.5));
+  put32(header, 0);
+  put32(header, 0);
+  put32(header, AVIF_HASINDEX);
+  file->totalFramesAt = (long)header.size();
+  put32(header, 0);
+  put32(header, 0);
+  put32(header, 2);
+  put32(header, 0);
+  put32(header, file->width);
+  put32(header, file->height);
+
+  for (unsigned i = 0; i < 4; i++)
+    put32(header, 0);
+
+  // video stream
+  list("LIST", &strl, "strl");
+
+  put32(header, fourcc("strh"));
+  put32(header, 56);
+  put32(header, fourcc("vids"));
+  put32(header, fourcc("MJPG"));
+  put32(header, 0);
+  put16(header, 0);
+  put16(header, 0);
+  put32(header, 0);
+  put32(header, 1000);
+  put32(header, rate);
+  put32(header, 0);
+  file->videoLengthAt = (long)header.size();
+  put32(header, 0);
+  put32(header, file->width * file->height * 3);
+  put32(header, 0xffffffff);
+  put32(header, 0);
+  put16(header, 0);
+  put16(header, 0);
+  put16(header, (uint16_t)file->width);
+  put16(header, (uint16_t)file->height);
+
+  put32(header, fourcc("strf"));
+  put32(header, 40);
+  put32(header, 40);
+  put32(header, file->width);
+  put32(header, file->height);
+  put16(header, 1);
+  put16(header, 24);
+  put32(header, fourcc("MJPG"));
+  put32(header, file->width * file->height * 3);
+
+  for (unsigned i = 0; i < 4; i++)
+    put32(header, 0);
+
+  close(strl);
+
+  // audio stream, lengths are in sample frames
+  list("LIST", &strl, "strl");
+
+  put32(header, fourcc("strh"));
+  put32(header, 56);
+  put32(header, fourcc("auds"));
+  put32(header, 0);
+  put32(header, 0);
+  put16(header, 0);
+  put16(header, 0);
+  put32(header, 0);
+  put32(header, 1);
+  put32(header, sampleRate);
+  put32(header, 0);
+  file->audioLengthAt = (long)header.size();
+  put32(header, 0);
+  put32(header, sampleRate * blockAlign);
+  put32(header, 0xffffffff);
+  put32(header, blockAlign);
+  put16(header, 0);
+  put16(header, 0);
+  put16(header, 0);
+  put16(header, 0);
+
+  put32(header, fourcc("strf"));
+  put32(header, 18);
+  put16(header, 1);  // PCM
+  put16(header, (uint16_t)file->channels);
+  put32(header, sampleRate);
+  put32(header, sampleRate * blockAlign);
+  put16(header, (uint16_t)blockAlign);
+  put16(header, 16);
+  put16(header, 0);
+
+  close(strl);
+  close(hdrl);
+
+  list("LIST", &movi, "movi");
+
+  file->riffSizeAt = (long)riff;
+  file->moviSizeAt = (long)movi;
+  file->moviStart = (long)movi + 4;
+
+  if (fwrite(header.data(), 1, header.size(), file->fp) != header.size())
+    return false;
+
+  file->stats.bytes = header.size();
+  return true;
+}
+
+bool Recorder::start(const std::string& path, double fps, unsigned sampleRate, unsigned channels)
+{
+  stop();
+
+  if (fps <= 0.0 || sampleRate == 0 || channels == 0)
+  {
+    _logger->error(TAG "Invalid timing, %f fps and %u Hz", fps, sampleRate);
+    return false;
+  }
+
+  // the header needs the size of the video, it's written along with the first frame
+  _file = new File;
+  _file->fp = NULL;
+  _file->width = _file->height = 0;
+  _file->channels = channels;
+  _file->full = false;
+  memset(&_file->stats, 0, sizeof(_file->stats));
+
+  _file->fp = util::openFile(_logger, path, "wb");
+
+  if (_file->fp == NULL)
+  {
+    delete _file;
+    _file = NULL;
+    return false;
+  }
+
+  _path = path;
+  _fps = fps;
+  _sampleRate = sampleRate;
+  _channels = channels;
+  _recording = true;
+  _audio.clear();
+
+  memset(&_stats, 0, sizeof(_stats));
+
+  _logger->info(TAG "Recording to %s at %.3f fps, %u Hz and %u channels", path.c_str(), fps, sampleRate, channels);
+  return true;
+}
+
+void Recorder::stop()
+{
+  if (!_recording)
+    return;
+
+  _recording = false;
+
+  File* file = _file;
+  _file = NULL;
+
+  _worker.queue([file](Logger* logger) {
+    return finish(file, logger);
+  }, [this, file](bool ok) {
+    _stats.bytes = file->stats.bytes;
+    _stats.encodeMicros = file->stats.encodeMicros;
+    delete file;
+
+    if (!ok)
+      return;
+
+    const unsigned encoded = _stats.frames - _stats.dropped - _stats.duped;
+
+    _logger->info(TAG "Recorded %u frames, %u dropped, %u duped, %llu KB",
+      _stats.frames, _stats.dropped, _stats.duped, (unsigned long long)(_stats.bytes / 1024));
+
+    if (encoded != 0)
+      _logger->info(TAG "Encoding took %llu us per frame on average", (unsigned long long)(_stats.encodeMicros / encoded));
+  });
+}
+
+Recorder::Frame* Recorder::acquireFrame()
+{
+  if (!_frames.empty())
+  {
+    Frame* frame = _frames.back();
+    _frames.pop_back();
+    return frame;
+  }
+
+  return new Frame;
+}
+
+void Recorder::queueFrame(Frame* frame)
+{
+  File* file = _file;
+  const bool pixels = !frame->pixels.empty();
+
+  if (pixels)
+    _queued++;
+
+  _worker.queue([file, frame](Logger* logger) {
+    (void)logger;
+    return encode(file, frame);
+  }, [this, frame, pixels](bool ok) {
+    (void)ok;
+
+    if (pixels)
+      _queued--;
+
+    frame->pixels.clear();
+    frame->audio.clear();
+    _frames.push_back(frame);
+  });
+}
+
+void Recorder::addFrame(const void* pixels, unsigned width, unsigned height, size_t pitch, enum retro_pixel_format format)
+{
+  if (!_recording)
+    return;
+
+  // the size of the video is the size of the first frame with pixels
+  if (_file->width == 0)
+  {
+    if (pixels == NULL)
+      return;
+
+    _file->width = width;
+    _file->height = height;
+
+    if (!writeHeader(_file, _fps, _sampleRate))
+    {
+      _logger->error(TAG "Error writing the header to %s", _path.c_str());
+      fclose(_file->fp);
+      delete _file;
+      _file = NULL;
+      _recording = false;
+      return;
+    }
+  }
+
+  Frame* frame = acquireFrame();
+  frame->audio.swap(_audio);
+
+  _stats.frames++;
+
+  if (pixels == NULL)
+  {
+    _stats.duped++;
+  }
+  else if (_queued >= kMaxQueued)
+  {
+    // the encoder is behind, the emulation doesn't wait for it
+    _stats.dropped++;
+  }
+  else
+  {
+    const size_t bpp = format == RETRO_PIXEL_FORMAT_XRGB8888 ? 4 : 2;
+    const size_t rowSize = width * bpp;
+
+    frame->width = width;
+    frame->height = height;
+    frame->pitch = rowSize;
+    frame->format = format;
+    frame->pixels.resize(rowSize * height);
+
+    const uint8_t* source = (const uint8_t*)pixels;
+    uint8_t* target = frame->pixels.data();
+
+    for (unsigned y = 0; y < height; y++, source += pitch, target += rowSize)
+      memcpy(target, source, rowSize);
+  }
+
+  queueFrame(frame);
+}
+
+void Recorder::addAudio(const int16_t* samples, size_t frames)
+{
+  // audio before the first frame has nowhere to go
+  if (!_recording || _file->width == 0)
+    return;
+
+  _audio.insert(_audio.end(), samples, samples + frames * _channels);
+  _stats.audioFrames += frames;
+}
+
+void Recorder::poll()
+{
+  _worker.poll();
+}
+
+bool Recorder::writeChunk(File* file, uint32_t id, const void* data, size_t size)
+{
+  if (file->full)
+    return true;
+
+  const long offset = ftell(file->fp);
+
+  if (offset < 0 || offset + (long)size > MAX_FILE_SIZE)
+  {
+    file->full = true;
+    return true;
+  }
+
+  std::vector<uint8_t> header;
+  put32(header, id);
+  put32(header, (uint32_t)size);
+
+  static const uint8_t padding = 0;
+
+  if (fwrite(header.data(), 1, 8, file->fp) != 8 ||
+      (size != 0 && fwrite(data, 1, size, file->fp) != size) ||
+      ((size & 1) != 0 && fwrite(&padding, 1, 1, file->fp) != 1))
+  {
+    return false;
+  }
+
+  Index entry;
+  entry.id = id;
+  entry.offset = (uint32_t)(offset - file->moviStart);
+  entry.size = (uint32_t)size;
+  file->index.push_back(entry);
+
+  file->stats.bytes += 8 + size + (size & 1);
+  return true;
+}
+
+bool Recorder::encode(File* file, const Frame* frame)
+{
+  if (file->full)
+    return true;
+
+  if (!frame->audio.empty())
+  {
+    if (!writeChunk(file, fourcc("01wb"), frame->audio.data(), frame->audio.size() * sizeof(int16_t)))
+      return false;
+
+    if (!file->full)
+      file->stats.audioFrames += frame->audio.size() / file->channels;
+  }
+
+  // an empty chunk repeats the previous frame
+  if (frame->pixels.empty())
+  {
+    if (!writeChunk(file, fourcc("00dc"), NULL, 0))
+      return false;
+
+    if (!file->full)
+      file->stats.frames++;
+
+    return true;
+  }
+
+  const auto tStart = std::chrono::steady_clock::now();
+
+  const unsigned width = file->width;
+  const unsigned height = file->height;
+  const unsigned copyWidth = frame->width < width ? frame->width : width;
+  const unsigned copyHeight = frame->height < height ? frame->height : height;
+
+  file->rgb.resize(width * height * 3);
+
+  // frames of another size are centered on a black background
+  if (copyWidth != width || copyHeight != height)
+    memset(file->rgb.data(), 0, file->rgb.size());
+
+  const size_t bpp = frame->format == RETRO_PIXEL_FORMAT_XRGB8888 ? 4 : 2;
+  const uint8_t* source = frame->pixels.data() + (frame->height - copyHeight) / 2 * frame->pitch + (frame->width - copyWidth) / 2 * bpp;
+  uint8_t* target = file->rgb.data() + ((height - copyHeight) / 2 * width + (width - copyWidth) / 2) * 3;
+
+  for (unsigned y = 0; y < copyHeight; y++, source += frame->pitch, target += width * 3)
+  {
+    switch (frame->format)
+    {
+      case RETRO_PIXEL_FORMAT_XRGB8888:
+        pixels::xrgb8888ToRgb(target, (const uint32_t*)source, copyWidth);
+        break;
+
+      case RETRO_PIXEL_FORMAT_RGB565:
+        pixels::rgb565ToRgb(target, (const uint16_t*)source, copyWidth);
+        break;
+
+      case RETRO_PIXEL_FORMAT_0RGB1555:
+      default:
+        pixels::argb1555ToRgb(target, (const uint16_t*)source, copyWidth);
+        break;
+    }
+  }
+
+  file->jpeg.clear();
+
+  if (!stbi_write_jpg_to_func(appendJpeg, &file->jpeg, (int)width, (int)height, 3, file->rgb.data(), kQuality))
+    return false;
+
+  const auto tEnd = std::chrono::steady_clock::now();
+  file->stats.encodeMicros += (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(tEnd - tStart).count();
+
+  if (!writeChunk(file, fourcc("00dc"), file->jpeg.data(), file->jpeg.size()))
+    return false;
+
+  if (!file->full)
+    file->stats.frames++;
+
+  return true;
+}
+
+bool Recorder::finish(File* file, Logger* logger)
+{
+  bool ok = true;
+
+  if (file->width == 0)
+  {
+    logger->warn(TAG "The core didn't render any frame, nothing was recorded");
+  }
+  else
+  {
+    if (file->full)
+      logger->warn(TAG "The recording reached the 2 GB limit of AVI files, the end is missing");
+
+    const long indexStart = ftell(file->fp);
+
+    std::vector<uint8_t> index;
+    put32(index, fourcc("idx1"));
+    put32(index, (uint32_t)(file->index.size() * 16));
+
+    for (const auto& entry : file->index)
+    {
+      put32(index, entry.id);
+      put32(index, AVIIF_KEYFRAME);
+      put32(index, entry.offset);
+      put32(index, entry.size);
+    }
+
+    ok = fwrite(index.data(), 1, index.size(), file->fp) == index.size();
+    file->stats.bytes += index.size();
+
+    ok = ok && patch32(file->fp, file->riffSizeAt, (uint32_t)(file->stats.bytes - 8));
+    ok = ok && patch32(file->fp, file->moviSizeAt, (uint32_t)(indexStart - file->moviSizeAt - 4));
+    ok = ok && patch32(file->fp, file->totalFramesAt, file->stats.frames);
+    ok = ok && patch32(file->fp, file->videoLengthAt, file->stats.frames);
+    ok = ok && patch32(file->fp, file->audioLengthAt, (uint32_t)file->stats.audioFrames);
+  }
+
+  if (fclose(file->fp) != 0)
+    ok = false;
+
+  if (!ok)
+    logger->error(TAG "Error writing the recording");
+
+  return ok;
+}
@@ -0,0 +1,146 @@
+/*
+Copyright (C) 2018 Andre Leiradella
+
+This file is part of RALibretro.
+
+RALibretro is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RALibretro is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "components/Logger.h"
+
+#include "libretro/libretro.h"
+
+#include "Worker.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+/* Records the video and the audio to an AVI file with MJPEG video and 16-bit PCM audio.
+ *
+ * Frames and audio come from the emulation thread and are only copied there. Encoding and
+ * writing happen in order on a worker, and at most kMaxQueued frames wait for it. When the
+ * worker falls behind the frame is dropped and written as an empty chunk, which players show as
+ * the previous frame, so the audio stays in sync and the emulation never waits for the encoder.
+ *
+ * The size of the video is the size of the first frame. Later frames of other sizes are
+ * cropped or padded with black, centered.
+ */
+class Recorder
+{
+public:
+  struct Stats
+  {
+    unsigned frames;         /* frames written, including the dropped and duped ones */
+    unsigned dropped;        /* frames the encoder couldn't keep up with */
+    unsigned duped;          /* frames the core didn't render */
+    uint64_t audioFrames;
+    uint64_t bytes;          /* size of the file so far */
+    uint64_t encodeMicros;   /* total time spent converting and compressing frames */
+  };
+
+  bool init(Logger* logger);
+  void destroy();
+
+  /* fps sets the frame rate of the file, sampleRate and channels describe the audio given to addAudio */
+  bool start(const std::string& path, double fps, unsigned sampleRate, unsigned channels);
+  /* Queues the end of the file, it's complete once the worker gets to it */
+  void stop();
+
+  bool recording() const { return _recording; }
+
+  /* pixels can be NULL when the core dupes the frame */
+  void addFrame(const void* pixels, unsigned width, unsigned height, size_t pitch, enum retro_pixel_format format);
+  void addAudio(const int16_t* samples, size_t frames);
+
+  /* Returns the buffers of the frames written, must be called regularly from the main thread */
+  void poll();
+
+  /* The bytes and the encoding time are only known once the file is complete */
+  const Stats& stats() const { return _stats; }
+
+protected:
+  enum
+  {
+    kMaxQueued = 4,
+    kQuality = 90
+  };
+
+  struct Index
+  {
+    uint32_t id;
+    uint32_t offset;
+    uint32_t size;
+  };
+
+  /* Everything the worker touches, it's only used there while recording */
+  struct File
+  {
+    FILE*                fp;
+    unsigned             width;
+    unsigned             height;
+    unsigned             channels;
+    long                 moviStart;     /* where the "movi" list type is, index offsets start there */
+    long                 riffSizeAt;    /* where the sizes and counts only known at the end go */
+    long                 moviSizeAt;
+    long                 totalFramesAt;
+    long                 videoLengthAt;
+    long                 audioLengthAt;
+    bool                 full;          /* AVI files can't grow past 2 GB */
+    std::vector<Index>   index;
+    std::vector<uint8_t> rgb;
+    std::vector<uint8_t> jpeg;
+    Stats                stats;
+  };
+
+  struct Frame
+  {
+    std::vector<uint8_t>    pixels;   /* empty if the frame was dropped or duped */
+    unsigned                width;
+    unsigned                height;
+    size_t                  pitch;
+    enum retro_pixel_format format;
+    std::vector<int16_t>    audio;
+  };
+
+  static bool writeHeader(File* file, double fps, unsigned sampleRate);
+  static bool writeChunk(File* file, uint32_t id, const void* data, size_t size);
+  static bool encode(File* file, const Frame* frame);
+  static bool finish(File* file, Logger* logger);
+
+  Frame* acquireFrame();
+  void   queueFrame(Frame* frame);
+
+  Logger* _logger;
+  Worker  _worker;
+
+  bool     _recording;
+  File*    _file;     /* only touched by the worker's jobs until finish */
+  unsigned _queued;   /* frames with pixels waiting for the worker */
+
+  std::vector<Frame*>  _frames;  /* free frames */
+  std::vector<int16_t> _audio;   /* audio since the last frame */
+
+  std::string _path;
+  double      _fps;
+  unsigned    _sampleRate;
+  unsigned    _channels;
+
+  /* counted here, the worker's copy only knows about what it wrote */
+  Stats _stats;
+};
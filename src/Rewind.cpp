@@ -0,0 +1,444 @@
+/*
+Copyright (C) 2018 Andre Leiradella
+
+This file is part of RALibretro.
+
+RALibretro is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RALibretro is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Rewind.h"
+
+#include "components/Dialog.h"
+#include "jsonsax/jsonsax.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TAG "[RWD] "
+
+bool Rewind::init(Logger* logger)
+{
+  _logger = logger;
+
+  _enabled = false;
+  _interval = 2;
+  _budget = 64;
+  _failed = false;
+
+  _size = 0;
+  _last = _current = _delta = NULL;
+
+  _arena = NULL;
+  _arenaSize = 0;
+
+  reset();
+  return true;
+}
+
+void Rewind::destroy()
+{
+  free(_last);
+  free(_current);
+  free(_delta);
+  free(_arena);
+
+  _last = _current = _delta = _arena = NULL;
+  _size = _arenaSize = 0;
+
+  reset();
+}
+
+void Rewind::reset()
+{
+  _failed = false;
+  _frame = 0;
+  _hasLast = false;
+  _head = 0;
+  _deltas.clear();
+}
+
+bool Rewind::allocate(size_t size)
+{
+  const size_t arenaSize = (size_t)_budget * 1024 * 1024;
+
+  if (size == _size && arenaSize == _arenaSize)
+    return true;
+
+  // the deltas are useless if the size of the state changed
+  reset();
+
+  free(_last);
+  free(_current);
+  free(_delta);
+  free(_arena);
+
+  // a delta is at most a header for every 9 bytes on top of the state itself
+  _last = (uint8_t*)malloc(size);
+  _current = (uint8_t*)malloc(size);
+  _delta = (uint8_t*)malloc(size * 2 + 16);
+  _arena = (uint8_t*)malloc(arenaSize);
+
+  if (_last == NULL || _current == NULL || _delta == NULL || _arena == NULL)
+  {
+    _logger->error(TAG "Error allocating %zu bytes for the rewind buffer", size * 4 + 16 + arenaSize);
+
+    free(_last);
+    free(_current);
+    free(_delta);
+    free(_arena);
+
+    _last = _current = _delta = _arena = NULL;
+    _size = _arenaSize = 0;
+    return false;
+  }
+
+  _size = size;
+  _arenaSize = arenaSize;
+
+  _logger->info(TAG "Rewind buffer of %u MB for states of %zu bytes", _budget, size);
+  return true;
+}
+
+void Rewind::capture(libretro::Core* core)
+{
+  if (++_frame < _interval)
+    return;
+
+  _frame = 0;
+
+  const size_t size = core->serializeSize();
+
+  if (size == 0 || !allocate(size))
+  {
+    _logger->warn(TAG "Core doesn't support save states, disabling rewind");
+    _failed = true;
+    return;
+  }
+
+  if (!core->serialize(_current, size))
+    return;
+
+  if (_hasLast)
+    push(_delta, encode(_delta, _current, _last, size));
+
+  uint8_t* last = _last;
+  _last = _current;
+  _current = last;
+  _hasLast = true;
+}
+
+bool Rewind::pop(libretro::Core* core)
+{
+  if (!_hasLast)
+    return false;
+
+  if (!core->unserialize(_last, _size))
+  {
+    _logger->error(TAG "Error loading state, disabling rewind");
+    _failed = true;
+    return false;
+  }
+
+  if (!_deltas.empty())
+  {
+    const Delta& delta = _deltas.back();
+    apply(_last, _arena + delta.offset, delta.size);
+
+    // the newest delta is always the last one written, so its space can be reused right away
+    _head = delta.offset;
+    _deltas.pop_back();
+  }
+
+  _frame = 0;
+  return true;
+}
+
+void Rewind::push(const uint8_t* delta, size_t size)
+{
+  if (size > _arenaSize)
+  {
+    // doesn't fit at all, there's no way to go back past this point
+    _deltas.clear();
+    _head = 0;
+    return;
+  }
+
+  size_t offset = _head;
+
+  if (offset + size > _arenaSize)
+  {
+    // the deltas past the head are the oldest ones, they go first when we wrap around
+    while (!_deltas.empty() && _deltas.front().offset >= _head)
+      _deltas.pop_front();
+
+    offset = 0;
+  }
+
+  while (!_deltas.empty() && _deltas.front().offset < offset + size && _deltas.front().offset + _deltas.front().size > offset)
+    _deltas.pop_front();
+
+  memcpy(_arena + offset, delta, size);
+
+  Delta entry;
+  entry.offset = offset;
+  entry.size = size;
+  _deltas.push_back(entry);
+
+  _head = offset + size;
+}
+
+size_t Rewind::used() const
+{
+  size_t total = _size;
+
+  for (const auto& delta : _deltas)
+    total += delta.size;
+
+  return total;
+}
+
+/* Deltas are a sequence of runs, each one being the number of unchanged bytes to skip and the
+ * number of changed bytes that follow, as 32-bit values, and then the changed bytes XORed. */
+size_t Rewind::encode(uint8_t* delta, const uint8_t* current, const uint8_t* previous, size_t size)
+{
+  uint8_t* out = delta;
+  size_t i = 0;
+
+  while (i < size)
+  {
+    const size_t start = i;
+
+    // most of the state doesn't change from one snapshot to the next, skip it a word at a time
+    while (i + 8 <= size)
+    {
+      uint64_t a, b;
+      memcpy(&a, current + i, 8);
+      memcpy(&b, previous + i, 8);
+
+      if (a != b)
+        break;
+
+      i += 8;
+    }
+
+    while (i < size && current[i] == previous[i])
+      i++;
+
+    if (i == size)
+      break;
+
+    // the changed bytes go on until there are more unchanged bytes than a run header costs
+    const size_t changed = i;
+    size_t end = ++i;
+
+    while (i < size && i - end < 8)
+    {
+      if (current[i] != previous[i])
+        end = i + 1;
+
+      i++;
+    }
+
+    const uint32_t skip = (uint32_t)(changed - start);
+    const uint32_t count = (uint32_t)(end - changed);
+
+    memcpy(out, &skip, 4);
+    memcpy(out + 4, &count, 4);
+    out += 8;
+
+    for (size_t j = changed; j < end; j++)
+      *out++ = current[j] ^ previous[j];
+
+    i = end;
+  }
+
+  return out - delta;
+}
+
+void Rewind::apply(uint8_t* state, const uint8_t* delta, size_t size)
+{
+  const uint8_t* end = delta + size;
+
+  while (delta < end)
+  {
+    uint32_t skip, count;
+    memcpy(&skip, delta, 4);
+    memcpy(&count, delta + 4, 4);
+    delta += 8;
+
+    state += skip;
+
+    for (uint32_t i = 0; i < count; i++)
+      *state++ ^= *delta++;
+  }
+}
+
+std::string Rewind::serialize()
+{
+  std::string json("{");
+
+  json.append("\"_enabled\":");
+  json.append(_enabled ? "true" : "false");
+  json.append(",");
+
+  json.append("\"_interval\":");
+  json.append(std::to_string(_interval));
+  json.append(",");
+
+  json.append("\"_budget\":");
+  json.append(std::to_string(_budget));
+
+  json.append("}");
+  return json;
+}
+
+void Rewind::deserialize(const char* json)
+{
+  struct Deserialize
+  {
+    Rewind* self;
+    std::string key;
+  };
+
+  Deserialize ud;
+  ud.self = this;
+
+  jsonsax_parse(json, &ud, [](void* udata, jsonsax_event_t event, const char* str, size_t num) {
+    auto ud = (Deserialize*)udata;
+
+    if (event == JSONSAX_KEY)
+    {
+      ud->key = std::string(str, num);
+    }
+    else if (event == JSONSAX_BOOLEAN)
+    {
+      if (ud->key == "_enabled")
+        ud->self->_enabled = num != 0;
+    }
+    else if (event == JSONSAX_NUMBER)
+    {
+      if (ud->key == "_interval")
+      {
+        const long value = strtol(str, NULL, 10);
+        if (value >= 1 && value <= kMaxInterval)
+          ud->self->_interval = (unsigned)value;
+      }
+      else if (ud->key == "_budget")
+      {
+        const long value = strtol(str, NULL, 10);
+        if (value >= 1 && value <= kMaxBudget)
+          ud->self->_budget = (unsigned)value;
+      }
+    }
+
+    return 0;
+  });
+}
+
+static const unsigned s_intervals[] = { 1, 2, 3, 4, 6, 10, 15, 30, 60 };
+static const unsigned s_budgets[] = { 16, 32, 64, 128, 256, 512, 1024 };
+
+static const char* s_getIntervalOptions(int index, void* udata)
+{
+  static char buffer[32];
+
+  if (index < 0 || index >= (int)(sizeof(s_intervals) / sizeof(s_intervals[0])))
+    return NULL;
+
+  if (s_intervals[index] == 1)
+    return "Every frame";
+
+  snprintf(buffer, sizeof(buffer), "Every %u frames", s_intervals[index]);
+  return buffer;
+}
+
+static const char* s_getBudgetOptions(int index, void* udata)
+{
+  static char buffer[32];
+
+  if (index < 0 || index >= (int)(sizeof(s_budgets) / sizeof(s_budgets[0])))
+    return NULL;
+
+  snprintf(buffer, sizeof(buffer), "%u MB", s_budgets[index]);
+  return buffer;
+}
+
+template<size_t N>
+static int s_findOption(const unsigned (&options)[N], unsigned value)
+{
+  for (size_t i = 0; i < N; i++)
+  {
+    if (options[i] >= value)
+      return (int)i;
+  }
+
+  return (int)N - 1;
+}
+
+void Rewind::showDialog(bool hardcore)
+{
+  const WORD WIDTH = 160;
+  const WORD LINE = 15;
+
+  Dialog db;
+  db.init("Rewind Settings");
+
+  WORD y = 0;
+
+  bool enabled = _enabled;
+  db.addCheckbox("Enabled", 51001, 0, y, WIDTH, 8, &enabled);
+  y += LINE;
+
+  int interval = s_findOption(s_intervals, _interval);
+  db.addLabel("Snapshots", 51002, 0, y, 60, 8);
+  db.addCombobox(51003, 65, y - 2, WIDTH - 65, 12, 100, s_getIntervalOptions, NULL, &interval);
+  y += LINE;
+
+  int budget = s_findOption(s_budgets, _budget);
+  db.addLabel("Memory", 51004, 0, y, 60, 8);
+  db.addCombobox(51005, 65, y - 2, WIDTH - 65, 12, 100, s_getBudgetOptions, NULL, &budget);
+  y += LINE;
+
+  char status[64];
+  if (hardcore)
+    snprintf(status, sizeof(status), "Not available in hardcore mode");
+  else if (_failed)
+    snprintf(status, sizeof(status), "Not available, the core can't save states");
+  else if (_enabled && _hasLast)
+    snprintf(status, sizeof(status), "%zu snapshots, %zu KB used", _deltas.size() + 1, used() / 1024);
+  else
+    snprintf(status, sizeof(status), "Hold the rewind key to go back in time");
+
+  db.addLabel(status, 51006, 0, y, WIDTH, 8);
+  y += LINE;
+
+  db.addButton("OK", IDOK, WIDTH - 55 - 50, y, 50, 14, true);
+  db.addButton("Cancel", IDCANCEL, WIDTH - 50, y, 50, 14, false);
+
+  if (db.show())
+  {
+    _enabled = enabled;
+    _interval = s_intervals[interval];
+    _budget = s_budgets[budget];
+
+    // the buffers are allocated again with the new budget on the next snapshot
+    if (!_enabled)
+    {
+      destroy();
+    }
+
+    _logger->info(TAG "Rewind %s, a snapshot every %u frames in %u MB", _enabled ? "enabled" : "disabled", _interval, _budget);
+  }
+}
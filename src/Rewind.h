@@ -0,0 +1,105 @@
+/*
+Copyright (C) 2018 Andre Leiradella
+
+This file is part of RALibretro.
+
+RALibretro is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RALibretro is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "components/Logger.h"
+
+#include "libretro/Core.h"
+
+#include <deque>
+#include <string>
+
+/* Keeps a history of the game's state so it can be played backwards while the rewind key is held.
+ *
+ * A snapshot is taken every few frames. Only the newest one is kept in full, each older one is
+ * stored as the XOR of it and the snapshot that came after it, with the runs of zeros (the bytes
+ * that didn't change) left out. Going back one snapshot is loading the newest one and applying
+ * its delta to get the one before it.
+ *
+ * Deltas go into a ring of fixed size, the oldest ones are dropped to make room for new ones.
+ */
+class Rewind
+{
+public:
+  enum
+  {
+    kMaxInterval = 60,
+    kMaxBudget = 1024
+  };
+
+  bool init(Logger* logger);
+  void destroy();
+
+  /* Forgets the history, must be called when a different game is loaded */
+  void reset();
+
+  /* Rewind is disabled in hardcore mode, which doesn't allow loading states */
+  bool enabled(bool hardcore) const { return _enabled && !_failed && !hardcore; }
+
+  /* Called after every frame, takes a snapshot when it's time to */
+  void capture(libretro::Core* core);
+
+  /* Loads the newest snapshot and drops it from the history, except if it's the only one left */
+  bool pop(libretro::Core* core);
+
+  /* Number of snapshots that can still be rewound to */
+  size_t depth() const { return _deltas.size(); }
+
+  /* Bytes used by the newest snapshot and the deltas */
+  size_t used() const;
+
+  std::string serialize();
+  void deserialize(const char* json);
+  void showDialog(bool hardcore);
+
+protected:
+  struct Delta
+  {
+    size_t offset;
+    size_t size;
+  };
+
+  bool allocate(size_t size);
+  void push(const uint8_t* delta, size_t size);
+
+  static size_t encode(uint8_t* delta, const uint8_t* current, const uint8_t* previous, size_t size);
+  static void   apply(uint8_t* state, const uint8_t* delta, size_t size);
+
+  Logger* _logger;
+
+  bool     _enabled;
+  unsigned _interval; /* frames between snapshots */
+  unsigned _budget;   /* megabytes for the deltas */
+  bool     _failed;
+
+  unsigned _frame;
+
+  size_t   _size;     /* size of the core's state */
+  uint8_t* _last;     /* the newest snapshot */
+  uint8_t* _current;  /* scratch for the snapshot being taken */
+  uint8_t* _delta;    /* scratch for the delta, big enough for the worst case */
+  bool     _hasLast;
+
+  uint8_t* _arena;
+  size_t   _arenaSize;
+  size_t   _head;     /* where the next delta goes */
+
+  std::deque<Delta> _deltas; /* oldest first */
+};
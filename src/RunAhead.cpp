@@ -0,0 +1,320 @@
+/*
+Copyright (C) 2018 Andre Leiradella
+
+This file is part of RALibretro.
+
+RALibretro is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RALibretro is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "RunAhead.h"
+
+#include "components/Dialog.h"
+#include "jsonsax/jsonsax.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TAG "[RUN] "
+
+bool RunAhead::init(Logger* logger, Input* input)
+{
+  _logger = logger;
+  _input = input;
+
+  _mode = Mode::RunAhead;
+  _frames = 0;
+  _failed = false;
+
+  _states = NULL;
+  _capacity = 0;
+  _count = 0;
+
+  _valid = _next = 0;
+  _rollbacks = 0;
+  return true;
+}
+
+void RunAhead::destroy()
+{
+  if (_states != NULL)
+  {
+    free(_states);
+    _states = NULL;
+  }
+
+  _capacity = 0;
+  _count = 0;
+}
+
+void RunAhead::reset()
+{
+  _failed = false;
+  _valid = _next = 0;
+  _rollbacks = 0;
+}
+
+bool RunAhead::ensureStates(size_t size, unsigned count)
+{
+  if (size <= _capacity && count <= _count)
+    return true;
+
+  /* some cores grow their states over time, leave some room so we don't reallocate every time */
+  const size_t capacity = size <= _capacity ? _capacity : size + size / 4;
+  if (count < _count)
+    count = _count;
+
+  void* states = realloc(_states, capacity * count);
+
+  if (states == NULL)
+  {
+    _logger->error(TAG "Error allocating %zu bytes for the run-ahead states", capacity * count);
+    return false;
+  }
+
+  _states = states;
+  _capacity = capacity;
+  _count = count;
+
+  /* the slots moved around */
+  _valid = _next = 0;
+  return true;
+}
+
+void RunAhead::step(libretro::Core* core, bool generateVideo)
+{
+  const size_t size = core->serializeSize();
+  const unsigned count = _mode == Mode::Preemptive ? _frames : 1;
+
+  if (size == 0 || !ensureStates(size, count))
+  {
+    _logger->warn(TAG "Core doesn't support save states, disabling run-ahead");
+    _failed = true;
+
+    core->step(generateVideo, true);
+    return;
+  }
+
+  if (_mode == Mode::Preemptive)
+    stepPreemptive(core, generateVideo, size);
+  else
+    stepRunAhead(core, generateVideo, size);
+}
+
+void RunAhead::stepRunAhead(libretro::Core* core, bool generateVideo, size_t size)
+{
+  // nothing to show, so nothing to run ahead for
+  if (!generateVideo)
+  {
+    core->step(false, true);
+    return;
+  }
+
+  // the real frame; its audio is the only audio the player hears
+  core->step(false, true);
+
+  if (!core->serialize(state(0), size))
+  {
+    _logger->warn(TAG "Error saving state, disabling run-ahead");
+    _failed = true;
+    return;
+  }
+
+  // the look-ahead frames, with the input the real frame just read
+  for (unsigned i = 1; i < _frames; i++)
+    core->step(false, false);
+
+  core->step(true, false);
+
+  if (!core->unserialize(state(0), size))
+  {
+    _logger->error(TAG "Error loading state, disabling run-ahead");
+    _failed = true;
+  }
+}
+
+void RunAhead::stepPreemptive(libretro::Core* core, bool generateVideo, size_t size)
+{
+  // small stick jitter isn't worth a rollback, the next frame will see it anyway
+  const int AXIS_THRESHOLD = 4096;
+
+  if (_valid == _frames && _input->changedSince(1, AXIS_THRESHOLD))
+  {
+    // the slot for the next frame still has the state from _frames frames ago
+    if (!core->unserialize(state(_next), size))
+    {
+      _logger->error(TAG "Error loading state, disabling preemptive frames");
+      _failed = true;
+
+      core->step(generateVideo, true);
+      return;
+    }
+
+    // replay the frames with the new input, saving their states again as we go
+    unsigned slot = _next;
+    core->step(false, false);
+
+    for (unsigned i = 1; i < _frames; i++)
+    {
+      slot = (slot + 1) % _frames;
+      core->serialize(state(slot), size);
+      core->step(false, false);
+    }
+
+    _rollbacks++;
+  }
+
+  if (!core->serialize(state(_next), size))
+  {
+    _logger->warn(TAG "Error saving state, disabling preemptive frames");
+    _failed = true;
+
+    core->step(generateVideo, true);
+    return;
+  }
+
+  _next = (_next + 1) % _frames;
+
+  if (_valid < _frames)
+    _valid++;
+
+  core->step(generateVideo, true);
+  _input->recordFrame();
+}
+
+std::string RunAhead::serialize()
+{
+  std::string json("{");
+
+  json.append("\"_mode\":");
+  json.append(std::to_string((int)_mode));
+  json.append(",");
+
+  json.append("\"_frames\":");
+  json.append(std::to_string(_frames));
+
+  json.append("}");
+  return json;
+}
+
+void RunAhead::deserialize(const char* json)
+{
+  struct Deserialize
+  {
+    RunAhead* self;
+    std::string key;
+  };
+
+  Deserialize ud;
+  ud.self = this;
+
+  jsonsax_parse(json, &ud, [](void* udata, jsonsax_event_t event, const char* str, size_t num) {
+    auto ud = (Deserialize*)udata;
+
+    if (event == JSONSAX_KEY)
+    {
+      ud->key = std::string(str, num);
+    }
+    else if (event == JSONSAX_NUMBER)
+    {
+      if (ud->key == "_mode")
+      {
+        const long value = strtol(str, NULL, 10);
+        if (value >= 0 && value <= (long)Mode::Preemptive)
+          ud->self->_mode = (Mode)value;
+      }
+      else if (ud->key == "_frames")
+      {
+        const long value = strtol(str, NULL, 10);
+        if (value >= 0 && value <= kMaxFrames)
+          ud->self->_frames = (unsigned)value;
+      }
+    }
+
+    return 0;
+  });
+}
+
+static const char* s_getModeOptions(int index, void* udata)
+{
+  switch (index)
+  {
+    case 0: return "Run-ahead";
+    case 1: return "Preemptive frames";
+    default: return NULL;
+  }
+}
+
+static const char* s_getFramesOptions(int index, void* udata)
+{
+  switch (index)
+  {
+    case 0: return "Off";
+    case 1: return "1 frame";
+    case 2: return "2 frames";
+    case 3: return "3 frames";
+    case 4: return "4 frames";
+    case 5: return "5 frames";
+    case 6: return "6 frames";
+    default: return NULL;
+  }
+}
+
+void RunAhead::showDialog(bool hardcore)
+{
+  const WORD WIDTH = 160;
+  const WORD LINE = 15;
+
+  Dialog db;
+  db.init("Run-Ahead Settings");
+
+  WORD y = 0;
+
+  int mode = (int)_mode;
+  db.addLabel("Mode", 51004, 0, y, 60, 8);
+  db.addCombobox(51005, 65, y - 2, WIDTH - 65, 12, 100, s_getModeOptions, NULL, &mode);
+  y += LINE;
+
+  int frames = (int)_frames;
+  db.addLabel("Frames", 51001, 0, y, 60, 8);
+  db.addCombobox(51002, 65, y - 2, WIDTH - 65, 12, 100, s_getFramesOptions, NULL, &frames);
+  y += LINE;
+
+  char status[64];
+  if (hardcore)
+    snprintf(status, sizeof(status), "Not available in hardcore mode");
+  else if (_failed)
+    snprintf(status, sizeof(status), "Not available, the core can't save states");
+  else if (_mode == Mode::Preemptive && _frames != 0)
+    snprintf(status, sizeof(status), "Rolled back %u times", _rollbacks);
+  else
+    snprintf(status, sizeof(status), "Each frame of run-ahead runs the core once more");
+
+  db.addLabel(status, 51003, 0, y, WIDTH, 8);
+  y += LINE;
+
+  db.addButton("OK", IDOK, WIDTH - 55 - 50, y, 50, 14, true);
+  db.addButton("Cancel", IDCANCEL, WIDTH - 50, y, 50, 14, false);
+
+  if (db.show())
+  {
+    if ((Mode)mode != _mode || (unsigned)frames != _frames)
+    {
+      _mode = (Mode)mode;
+      _frames = (unsigned)frames;
+      _valid = _next = 0;
+
+      _logger->info(TAG "%s set to %u frames", s_getModeOptions(mode, NULL), _frames);
+    }
+  }
+}
@@ -0,0 +1,99 @@
+/*
+Copyright (C) 2018 Andre Leiradella
+
+This file is part of RALibretro.
+
+RALibretro is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RALibretro is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "components/Input.h"
+#include "components/Logger.h"
+
+#include "libretro/Core.h"
+
+#include <string>
+
+/* Hides the core's internal input lag by running frames ahead of the real one.
+ *
+ * In run-ahead mode each displayed frame runs the real frame with audio, saves its state, runs
+ * the look-ahead frames with the same input without audio, shows the last one and loads the
+ * state back.
+ *
+ * Preemptive frames instead save the state before every frame into a ring, and only when the
+ * input differs from the previous frame they go back to the state from N frames ago and replay
+ * the frames with the new input, as if it had been pressed back then.
+ *
+ * State buffers are allocated once and only grow, so there are no allocations per frame.
+ */
+class RunAhead
+{
+public:
+  enum class Mode
+  {
+    RunAhead,
+    Preemptive
+  };
+
+  enum
+  {
+    kMaxFrames = 6
+  };
+
+  bool init(Logger* logger, Input* input);
+  void destroy();
+
+  /* Called when a game is loaded to give cores that failed to save state another chance */
+  void reset();
+
+  /* Forgets the saved states, must be called when the core's state changes behind our back */
+  void invalidate() { _valid = 0; }
+
+  /* Run-ahead is disabled in hardcore mode, which doesn't allow loading states */
+  bool enabled(bool hardcore) const { return _frames != 0 && !_failed && !hardcore; }
+  unsigned frames() const { return _frames; }
+
+  /* Runs one frame with audio, showing the look-ahead frame if generateVideo is set */
+  void step(libretro::Core* core, bool generateVideo);
+
+  /* Number of times preemptive frames had to roll back */
+  unsigned rollbacks() const { return _rollbacks; }
+
+  std::string serialize();
+  void deserialize(const char* json);
+  void showDialog(bool hardcore);
+
+protected:
+  bool ensureStates(size_t size, unsigned count);
+  void* state(unsigned index) const { return (uint8_t*)_states + index * _capacity; }
+
+  void stepRunAhead(libretro::Core* core, bool generateVideo, size_t size);
+  void stepPreemptive(libretro::Core* core, bool generateVideo, size_t size);
+
+  Logger* _logger;
+  Input*  _input;
+
+  Mode     _mode;
+  unsigned _frames;
+  bool     _failed;
+
+  void*    _states;   /* _count states of _capacity bytes each */
+  size_t   _capacity;
+  unsigned _count;
+
+  unsigned _valid;    /* consecutive preemptive states saved in the ring */
+  unsigned _next;     /* ring slot for the state before the next frame */
+  unsigned _rollbacks;
+};
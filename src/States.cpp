@@ -19,6 +19,7 @@ along with RALibRetro.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "States.h"
 
+#include "Metrics.h"
 #include "Util.h"
 
 #include "libretro/Core.h"
@@ -38,6 +39,10 @@ along with RALibRetro.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <time.h>
 
+#include <chrono>
+#include <map>
+#include <memory>
+
 #define TAG "[SAV] "
 
 extern HWND g_mainWindow;
@@ -49,8 +54,24 @@ bool States::init(Logger* logger, Config* config, Video* video)
   _video = video;
   _core = NULL;
   _lastSave = 0;
+  _thumbnails.init();
 
-  return true;
+  return _worker.init(logger, "States");
+}
+
+void States::destroy()
+{
+  // readbacks still in flight queue the writes of their states
+  _video->flushReadbacks();
+  _worker.destroy();
+  _thumbnails.destroy();
+  resetSRAM();
+  freeStateBuffers();
+}
+
+void States::poll()
+{
+  _worker.poll();
 }
 
 void States::setGame(const std::string& gameFileName, int system, const std::string& coreName, libretro::Core* core)
@@ -60,13 +81,14 @@ void States::setGame(const std::string& gameFileName, int system, const std::str
   _coreName = coreName;
   _core = core;
 
-  _config->setSaveDirectory(buildPath(_sramPath));
+  // pending writes belong to the previous game
+  _video->flushReadbacks();
+  _worker.flush();
+  resetSRAM();
+  freeStateBuffers();
+  clearSlots();
 
-  if (_lastSaveData != NULL)
-  {
-    free(_lastSaveData);
-    _lastSaveData = NULL;
-  }
+  _config->setSaveDirectory(buildPath(_sramPath));
 }
 
 std::string States::buildPath(Path path) const
@@ -143,54 +165,147 @@ std::string States::getStatePath(unsigned ndx, Path path) const
   return statePath;
 }
 
-void States::saveState(const std::string& path)
+void States::initStateBuffers(libretro::Core* core)
 {
-  _logger->info(TAG "Saving state to %s", path.c_str());
+  const size_t size = core->serializeSize();
 
-  util::ensureDirectoryExists(util::directory(path));
+  if (size == 0)
+    return;
 
-  size_t size = _core->serializeSize();
-  void* data = malloc(size);
+  // one for the state being written and one for the next save
+  const StateBuffer first = acquireState(size);
+  const StateBuffer second = acquireState(size);
+  releaseState(first);
+  releaseState(second);
+}
+
+void States::freeStateBuffers()
+{
+  for (const auto& buffer : _stateBuffers)
+    free(buffer.data);
+
+  _stateBuffers.clear();
+  _stateCapacity = 0;
+}
+
+States::StateBuffer States::acquireState(size_t size)
+{
+  StateBuffer buffer = { NULL, 0 };
+
+  if (size == 0)
+    return buffer;
 
-  if (data == NULL)
+  if (size > _stateCapacity)
   {
-    _logger->error(TAG "Out of memory allocating %lu bytes for the game state", size);
-    return;
+    // buffers in use are freed when they're released, see releaseState
+    freeStateBuffers();
+
+    // some cores grow their states over time, leave some room so we don't reallocate every time
+    _stateCapacity = size + size / 4;
   }
 
-  if (!_core->serialize(data, size))
+  if (!_stateBuffers.empty())
   {
-    free(data);
-    return;
+    buffer = _stateBuffers.back();
+    _stateBuffers.pop_back();
+    return buffer;
   }
 
-  unsigned width, height, pitch;
-  enum retro_pixel_format format;
-  const void* pixels = _video->getFramebuffer(&width, &height, &pitch, &format);
+  buffer.data = malloc(_stateCapacity);
 
-  if (pixels == NULL)
+  if (buffer.data == NULL)
   {
-    free(data);
-    return;
+    _logger->error(TAG "Out of memory allocating %zu bytes for the game state", _stateCapacity);
+    return buffer;
   }
 
-  if (!util::saveFile(_logger, path.c_str(), data, size))
+  buffer.capacity = _stateCapacity;
+  return buffer;
+}
+
+void States::releaseState(const StateBuffer& buffer)
+{
+  if (buffer.data == NULL)
+    return;
+
+  if (buffer.capacity == _stateCapacity && _stateBuffers.size() < kMaxStateBuffers)
+    _stateBuffers.push_back(buffer);
+  else
+    free(buffer.data);
+}
+
+void States::saveState(const std::string& path, const Saved& saved)
+{
+  _logger->info(TAG "Saving state to %s", path.c_str());
+
+  const auto tStart = std::chrono::steady_clock::now();
+  size_t size = _core->serializeSize();
+  const StateBuffer buffer = acquireState(size);
+
+  if (buffer.data == NULL)
+    return;
+
+  if (!_core->serialize(buffer.data, size))
   {
-    free((void*)pixels);
-    free(data);
+    metrics::add(metrics::kStatesFailed);
+    releaseState(buffer);
     return;
   }
 
-  util::saveImage(_logger, path + ".png", pixels, width, height, pitch, format);
+  // the toolkit records the achievement progress now, so it matches the state just serialized
+  util::ensureDirectoryExists(util::directory(path));
   RA_OnSaveState(path.c_str());
 
-  free((void*)pixels);
-  free(data);
+  const int level = _compressionLevel;
+
+  // the screenshot arrives a frame or two later, without waiting for the GPU, and is shared by all
+  // states saved in the same frame
+  _video->readThumbnail([this, buffer, size, path, level, saved, tStart](const void* pixels, unsigned width, unsigned height, unsigned pitch, enum retro_pixel_format format) {
+    if (pixels == NULL)
+    {
+      releaseState(buffer);
+      return;
+    }
+
+    const void* data = buffer.data;
+    std::shared_ptr<Slot> slot = std::make_shared<Slot>();
+
+    // writing the files and encoding the PNG take longer than a frame, do them in the background
+    _worker.queue([this, path, data, size, pixels, width, height, pitch, format, level, slot](Logger* logger) {
+      const bool ok = level != 0 ? util::saveRzipFile(logger, path, data, size, level) : util::saveFile(logger, path.c_str(), data, size);
+
+      if (ok && _thumbnails.write(logger, path + ".png", pixels, width, height, pitch, format, ImageWriter::Compression::Fast))
+        slot->thumbnail = path + ".png";
+
+      // the slot's entry is refreshed from here so the menus never have to go to the disk
+      slot->exists = ok && util::fileInfo(path, &slot->size, &slot->time);
+
+      free((void*)pixels);
+      return ok;
+    }, [this, buffer, path, saved, slot, tStart](bool ok) {
+      releaseState(buffer);
+
+      if (!ok)
+      {
+        metrics::add(metrics::kStatesFailed);
+        return;
+      }
+
+      const auto tEnd = std::chrono::steady_clock::now();
+      metrics::set(metrics::kStateSaveMillis, std::chrono::duration_cast<std::chrono::milliseconds>(tEnd - tStart).count());
+      metrics::add(metrics::kStatesSaved);
+
+      updateSlot(path, *slot);
+
+      if (saved)
+        saved();
+    });
+  });
 }
 
-void States::saveState(unsigned ndx)
+void States::saveState(unsigned ndx, const Saved& saved)
 {
-  saveState(getStatePath(ndx));
+  saveState(getStatePath(ndx), saved);
 }
 
 bool States::loadState(const std::string& path)
@@ -201,24 +316,44 @@ bool States::loadState(const std::string& path)
     return false;
   }
 
+  // the state may still be on its way to the disk
+  _video->flushReadbacks();
+  _worker.flush();
+
+  // the core reads the state straight from the file's pages, there's no copy on the heap
   size_t size;
-  void* data = util::loadFile(_logger, path.c_str(), &size);
+  const void* mapped = util::mapFile(_logger, path, &size);
 
-  if (data == NULL)
+  if (mapped == NULL)
   {
     return false;
   }
 
-  if (memcmp(data, "#RZIPv", 6) == 0)
+  if (util::isRzip(mapped, size))
   {
-    _logger->error(TAG "Compressed save states not supported");
-    MessageBox(g_mainWindow, "Compressed save states not supported", "RALibRetro", MB_OK);
-    return false;
+    const size_t stateSize = util::rzipSize(mapped, size);
+    const StateBuffer buffer = acquireState(stateSize);
+
+    if (buffer.data == NULL || !util::decompressRzip(_logger, mapped, size, buffer.data, stateSize))
+    {
+      releaseState(buffer);
+      util::unmapFile(mapped);
+
+      MessageBox(g_mainWindow, "Could not decompress the save state", "RALibRetro", MB_OK);
+      return false;
+    }
+
+    _core->unserialize(buffer.data, stateSize);
+    releaseState(buffer);
+  }
+  else
+  {
+    _core->unserialize(mapped, size);
   }
 
-  _core->unserialize(data, size);
-  free(data);
+  util::unmapFile(mapped);
   RA_OnLoadState(path.c_str());
+  metrics::add(metrics::kStatesLoaded);
 
   unsigned width, height, pitch;
   enum retro_pixel_format format;
@@ -261,12 +396,85 @@ bool States::loadState(unsigned ndx)
   return loadState(getStatePath(ndx));
 }
 
-bool States::existsState(unsigned ndx)
+bool States::existsState(unsigned ndx) const
+{
+  return getSlot(ndx).exists;
+}
+
+const States::Slot& States::getSlot(unsigned ndx) const
+{
+  return _slots[ndx <= kSlots ? ndx : 0];
+}
+
+void States::clearSlots()
 {
-  std::string path = getStatePath(ndx);
-  return util::exists(path);
+  for (auto& slot : _slots)
+    slot = Slot();
 }
 
+/* file names on Windows match regardless of case, like Listings::exists below */
+struct CaseInsensitiveLess
+{
+  bool operator()(const std::string& a, const std::string& b) const
+  {
+    return strcasecmp(a.c_str(), b.c_str()) < 0;
+  }
+};
+
+void States::refreshSlots()
+{
+  clearSlots();
+
+  // all the slots are in the same directory
+  std::map<std::string, util::DirectoryEntry, CaseInsensitiveLess> files;
+
+  for (const auto& entry : util::listDirectory(util::directory(getStatePath(1))))
+    files[entry.name] = entry;
+
+  unsigned count = 0;
+
+  for (unsigned ndx = 1; ndx <= kSlots; ndx++)
+  {
+    const std::string path = getStatePath(ndx);
+    const auto found = files.find(util::fileNameWithExtension(path));
+
+    if (found == files.end())
+      continue;
+
+    Slot& slot = _slots[ndx];
+    slot.exists = true;
+    slot.size = found->second.size;
+    slot.time = found->second.time;
+
+    if (files.find(found->first + ".png") != files.end())
+      slot.thumbnail = path + ".png";
+
+    count++;
+  }
+
+  _logger->info(TAG "Found %u save states in %zu files", count, files.size());
+}
+
+void States::updateSlot(const std::string& path, const Slot& slot)
+{
+  for (unsigned ndx = 1; ndx <= kSlots; ndx++)
+  {
+    if (getStatePath(ndx) == path)
+    {
+      _slots[ndx] = slot;
+      break;
+    }
+  }
+}
+
+const int States::_compressionLevels[] =
+{
+  0,
+  1,
+  6,
+  9
+};
+
 const int States::_saveIntervals[] =
 {
   0,
@@ -329,10 +537,14 @@ void States::loadSRAM(libretro::Core* core)
         _logger->error(TAG "Save RAM size mismatch, wanted %lu, got %lu from disk", sramSize, fileSize);
       }
 
-      if (_saveInterval > 0)
-        _lastSaveData = data;
-      else
-        free(data);
+      // the periodic save doesn't have to write what's already on disk
+      if (_saveInterval > 0 && fileSize == sramSize)
+      {
+        hashSRAM(_sramHashes, data, sramSize);
+        _sramSize = sramSize;
+      }
+
+      free(data);
     }
   }
 
@@ -343,7 +555,9 @@ void States::saveSRAM(void* sramData, size_t sramSize)
 {
   std::string sramPath = getSRamPath();
   util::ensureDirectoryExists(util::directory(sramPath));
-  util::saveFile(_logger, sramPath, sramData, sramSize);
+
+  if (util::saveFileAtomic(_logger, sramPath, sramData, sramSize))
+    metrics::add(metrics::kSramSaves);
 }
 
 void States::saveSRAM(libretro::Core* core)
@@ -351,11 +565,56 @@ void States::saveSRAM(libretro::Core* core)
   size_t sramSize = core->getMemorySize(RETRO_MEMORY_SAVE_RAM);
   if (sramSize != 0)
   {
+    // a periodic save still in the queue must not land after this one
+    _worker.flush();
+
     void* sramData = core->getMemoryData(RETRO_MEMORY_SAVE_RAM);
     saveSRAM(sramData, sramSize);
   }
 }
 
+void States::hashSRAM(std::vector<uint64_t>& hashes, const void* sramData, size_t sramSize) const
+{
+  const uint8_t* data = (const uint8_t*)sramData;
+  hashes.resize((sramSize + kSramBlockSize - 1) / kSramBlockSize);
+
+  for (size_t block = 0; block < hashes.size(); block++)
+  {
+    const size_t start = block * kSramBlockSize;
+    const size_t end = start + kSramBlockSize < sramSize ? start + kSramBlockSize : sramSize;
+
+    // FNV-1a over 64-bit words, any change to a single word always changes the hash
+    uint64_t hash = 14695981039346656037ULL;
+    size_t i = start;
+
+    for (; i + 8 <= end; i += 8)
+    {
+      uint64_t word;
+      memcpy(&word, data + i, 8);
+      hash = (hash ^ word) * 1099511628211ULL;
+    }
+
+    for (; i < end; i++)
+      hash = (hash ^ data[i]) * 1099511628211ULL;
+
+    hashes[block] = hash;
+  }
+}
+
+void States::resetSRAM()
+{
+  for (auto& snapshot : _sramSnapshots)
+  {
+    free(snapshot.data);
+    snapshot.data = NULL;
+    snapshot.hashes.clear();
+    snapshot.writing = false;
+  }
+
+  _sramSize = 0;
+  _sramHashes.clear();
+}
+
 void States::periodicSaveSRAM(libretro::Core* core)
 {
   if (_saveInterval == 0)
@@ -367,16 +626,67 @@ void States::periodicSaveSRAM(libretro::Core* core)
     size_t sramSize = core->getMemorySize(RETRO_MEMORY_SAVE_RAM);
     if (sramSize != 0)
     {
-      void* data = core->getMemoryData(RETRO_MEMORY_SAVE_RAM);
-      if (_lastSaveData == NULL || memcmp(data, _lastSaveData, sramSize) != 0)
+      const uint8_t* data = (const uint8_t*)core->getMemoryData(RETRO_MEMORY_SAVE_RAM);
+
+      // both snapshots are still being written, try again on the next frame
+      const int index = !_sramSnapshots[0].writing ? 0 : !_sramSnapshots[1].writing ? 1 : -1;
+      if (index < 0)
+        return;
+
+      if (sramSize != _sramSize)
+      {
+        _worker.flush();
+        resetSRAM();
+        _sramSize = sramSize;
+      }
+
+      hashSRAM(_sramLive, data, sramSize);
+
+      if (_sramLive != _sramHashes)
       {
-        if (_lastSaveData == NULL)
-          _lastSaveData = malloc(sramSize);
+        SramSnapshot& snapshot = _sramSnapshots[index];
 
-        memcpy(_lastSaveData, data, sramSize);
+        if (snapshot.data == NULL)
+        {
+          snapshot.data = (uint8_t*)malloc(sramSize);
+
+          if (snapshot.data == NULL)
+          {
+            _logger->error(TAG "Out of memory allocating %zu bytes for the Save RAM", sramSize);
+            return;
+          }
+        }
+
+        // only bring the blocks that differ from what the snapshot had the last time it was written
+        for (size_t block = 0; block < _sramLive.size(); block++)
+        {
+          if (block >= snapshot.hashes.size() || snapshot.hashes[block] != _sramLive[block])
+          {
+            const size_t start = block * kSramBlockSize;
+            const size_t size = start + kSramBlockSize < sramSize ? kSramBlockSize : sramSize - start;
+            memcpy(snapshot.data + start, data + start, size);
+          }
+        }
 
-        // TODO: offload this to a background thread?
-        saveSRAM(_lastSaveData, sramSize);
+        snapshot.hashes = _sramLive;
+        snapshot.writing = true;
+        _sramHashes = _sramLive;
+
+        const std::string sramPath = getSRamPath();
+        const uint8_t* sramData = snapshot.data;
+
+        _worker.queue([sramPath, sramData, sramSize](Logger* logger) {
+          util::ensureDirectoryExists(util::directory(sramPath));
+          return util::saveFileAtomic(logger, sramPath, sramData, sramSize);
+        }, [this, index](bool ok) {
+          _sramSnapshots[index].writing = false;
+
+          // write everything again on the next interval
+          if (!ok)
+            _sramHashes.clear();
+          else
+            metrics::add(metrics::kSramSaves);
+        });
       }
     }
 
@@ -384,19 +694,55 @@ void States::periodicSaveSRAM(libretro::Core* core)
   }
 }
 
+/* Tells whether files exist with a listing per directory instead of a call per file. The candidate
+ * paths share a handful of directories, and each call is a round trip on network drives. */
+class Listings
+{
+public:
+  bool exists(const std::string& path)
+  {
+    const std::string directory = util::directory(path);
+    auto found = _directories.find(directory);
+
+    if (found == _directories.end())
+    {
+      std::vector<std::string> names;
+
+      for (const auto& entry : util::listDirectory(directory))
+        names.push_back(entry.name);
+
+      found = _directories.emplace(directory, names).first;
+    }
+
+    const std::string name = util::fileNameWithExtension(path);
+
+    for (const auto& entry : found->second)
+    {
+      if (strcasecmp(entry.c_str(), name.c_str()) == 0)
+        return true;
+    }
+
+    return false;
+  }
+
+protected:
+  std::map<std::string, std::vector<std::string>> _directories;
+};
+
 void States::migrateFiles()
 {
   Path testPath;
+  Listings listings;
 
   // if the sram file exists, don't move anything
   std::string sramPath = getSRamPath();
-  if (!util::exists(sramPath))
+  if (!listings.exists(sramPath))
   {
     testPath = _sramPath;
     for (unsigned i = 0; i < sizeof(_sramPaths) / sizeof(_sramPaths[0]); ++i)
     {
       std::string path = getSRamPath(_sramPaths[i]);
-      if (util::exists(path))
+      if (listings.exists(path))
       {
         testPath = _sramPaths[i];
         break;
@@ -421,24 +767,21 @@ void States::migrateFiles()
     }
   }
 
-  for (unsigned ndx = 1; ndx <= 10; ndx++)
+  for (unsigned ndx = 1; ndx <= kSlots; ndx++)
   {
     std::string statePath = getStatePath(ndx, _statePath);
-    if (util::exists(statePath))
+    if (listings.exists(statePath))
       return;
   }
 
   testPath = _statePath;
   for (unsigned i = 0; i < sizeof(_statePaths) / sizeof(_statePaths[0]); ++i)
   {
-    std::string statePath = buildPath(_statePaths[i]);
-    if (!util::exists(statePath))
-      continue;
-
-    for (unsigned ndx = 1; ndx <= 10; ndx++)
+    // a directory that doesn't exist lists no files, there's no need to check it first
+    for (unsigned ndx = 1; ndx <= kSlots; ndx++)
     {
-      statePath = getStatePath(ndx, _statePaths[i]);
-      if (util::exists(statePath))
+      std::string statePath = getStatePath(ndx, _statePaths[i]);
+      if (listings.exists(statePath))
       {
         testPath = _statePaths[i];
         break;
@@ -458,11 +801,11 @@ void States::migrateFiles()
       {
         util::ensureDirectoryExists(util::directory(getStatePath(1, _statePath)));
 
-        for (unsigned ndx = 1; ndx <= 10; ndx++)
+        for (unsigned ndx = 1; ndx <= kSlots; ndx++)
         {
           oldPath = getStatePath(ndx, testPath);
           newPath = getStatePath(ndx, _statePath);
-          if (util::exists(oldPath))
+          if (listings.exists(oldPath))
           {
             MoveFile(oldPath.c_str(), newPath.c_str());
 
@@ -505,6 +848,10 @@ std::string States::serializeSettings() const
   settings += std::to_string(_saveInterval);
   settings += ",";
 
+  settings += "\"compressionLevel\":";
+  settings += std::to_string(_compressionLevel);
+  settings += ",";
+
   settings += "\"sramPath\":\"";
   settings += encodePath(_sramPath);
   settings += "\",";
@@ -565,6 +912,12 @@ bool States::deserializeSettings(const char* json)
     {
       if (ud->key == "saveInterval")
         ud->self->_saveInterval = (int)strtoul(str, NULL, 10);
+      else if (ud->key == "compressionLevel")
+      {
+        const unsigned long level = strtoul(str, NULL, 10);
+        if (level <= 9)
+          ud->self->_compressionLevel = (int)level;
+      }
     }
 
     return 0;
@@ -632,6 +985,18 @@ public:
     return _pathOptions[option].c_str();
   }
 
+  const char* getCompressionOption(int option) const
+  {
+    switch (option)
+    {
+      case 0: return "None";
+      case 1: return "Fastest";
+      case 2: return "Balanced";
+      case 3: return "Smallest";
+      default: return NULL;
+    }
+  }
+
   const char* getIntervalOption(int option) const
   {
     if (option < 0 || option >= (int)(sizeof(_saveIntervals) / sizeof(_saveIntervals[0])))
@@ -674,6 +1039,12 @@ const char* s_getSaveIntervalOptions(int index, void* udata)
   return accessor.getIntervalOption(index);
 }
 
+const char* s_getCompressionOptions(int index, void* udata)
+{
+  StatesPathAccessor accessor;
+  return accessor.getCompressionOption(index);
+}
+
 void States::showDialog()
 {
   if (!_gameFileName.empty())
@@ -729,6 +1100,16 @@ void States::showDialog()
   db.addCombobox(51006, 65, y - 2, WIDTH - 65, 12, 140, s_getStatePathOptions, NULL, &statePath);
   y += LINE;
 
+  int compression = 0;
+  for (unsigned i = 0; i < sizeof(_compressionLevels) / sizeof(_compressionLevels[0]); ++i)
+  {
+    if (_compressionLevels[i] <= _compressionLevel)
+      compression = i;
+  }
+  db.addLabel("State Compression", 51007, 0, y, 60, 8);
+  db.addCombobox(51008, 65, y - 2, WIDTH - 65, 12, 80, s_getCompressionOptions, NULL, &compression);
+  y += LINE;
+
   db.addButton("OK", IDOK, WIDTH - 55 - 50, y, 50, 14, true);
   db.addButton("Cancel", IDCANCEL, WIDTH - 50, y, 50, 14, false);
 
@@ -737,5 +1118,6 @@ void States::showDialog()
     _saveInterval = _saveIntervals[saveInterval];
     _sramPath = _sramPaths[sramPath];
     _statePath = _statePaths[statePath];
+    _compressionLevel = _compressionLevels[compression];
   }
 }
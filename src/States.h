@@ -25,18 +25,32 @@ along with RALibRetro.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "libretro/Core.h"
 
+#include "ImageWriter.h"
+#include "Worker.h"
+
+#include <functional>
+#include <vector>
+
 class States
 {
 public:
+  typedef std::function<void()> Saved;
+
   bool init(Logger* logger, Config* config, Video* video);
+  void destroy();
 
   void setGame(const std::string& gameFileName, int system, const std::string& coreName, libretro::Core* core);
 
   std::string getSRamPath() const;
   std::string getStatePath(unsigned ndx) const;
 
-  void        saveState(const std::string& path);
-  void        saveState(unsigned ndx);
+  /* The state and the screenshot are captured right away and written in the background, saved
+   * is called from poll() once both files are on disk */
+  void        saveState(const std::string& path, const Saved& saved = nullptr);
+  void        saveState(unsigned ndx, const Saved& saved = nullptr);
+
+  /* Sizes the state buffer pool once the game is loaded and the core knows its state size */
+  void        initStateBuffers(libretro::Core* core);
   bool        loadState(const std::string& path);
   bool        loadState(unsigned ndx);
 
@@ -44,8 +58,26 @@ public:
   void        saveSRAM(libretro::Core* core);
   void        periodicSaveSRAM(libretro::Core* core);
 
+  /* Runs the completions of the background writes */
+  void        poll();
+
   void        migrateFiles();
-  bool        existsState(unsigned ndx);
+  bool        existsState(unsigned ndx) const;
+
+  /* What's known about a save slot's files */
+  struct Slot
+  {
+    bool        exists;
+    uint64_t    size;
+    time_t      time;
+    std::string thumbnail; /* empty if the state has no screenshot */
+  };
+
+  enum { kSlots = 10 };
+
+  /* Lists the slots' directory once and caches what it finds, saving to a slot updates its entry */
+  void        refreshSlots();
+  const Slot& getSlot(unsigned ndx) const;
 
   std::string serializeSettings() const;
   bool        deserializeSettings(const char* json);
@@ -67,19 +99,52 @@ protected:
   static const States::Path _sramPaths[];
   static const States::Path _statePaths[];
   static const int _saveIntervals[];
+  static const int _compressionLevels[];
 
   Logger* _logger;
   Config* _config;
   Video* _video;
+  Worker _worker;
+  ImageWriter _thumbnails; /* only used by the worker's jobs */
 
   std::string _gameFileName;
   int _system = 0;
   std::string _coreName;
   libretro::Core* _core = NULL;
   int _saveInterval = 0;
-  void* _lastSaveData = NULL;
+  int _compressionLevel = 0; /* zlib level for RZIP states, 0 writes them uncompressed */
   time_t _lastSave = 0;
 
+  /* Save RAM is hashed in blocks, only changed blocks are copied to the snapshot that gets
+   * written. There are two snapshots so one can be filled while the other is being written. */
+  enum { kSramBlockSize = 4096 };
+
+  struct SramSnapshot
+  {
+    uint8_t* data;
+    std::vector<uint64_t> hashes; /* what data holds */
+    bool writing;
+  };
+
+  /* State buffers are reused across saves and loads instead of being allocated every time */
+  enum { kMaxStateBuffers = 4 };
+
+  struct StateBuffer
+  {
+    void* data;
+    size_t capacity;
+  };
+
+  std::vector<StateBuffer> _stateBuffers; /* free buffers of _stateCapacity bytes */
+  size_t _stateCapacity = 0;
+
+  SramSnapshot _sramSnapshots[2] = {};
+  size_t _sramSize = 0;
+  std::vector<uint64_t> _sramHashes; /* what's on disk, or being written to it */
+  std::vector<uint64_t> _sramLive;
+
+  Slot _slots[kSlots + 1] = {}; /* slots start at 1 */
+
 private:
   std::string buildPath(Path path) const;
   static std::string encodePath(Path path);
@@ -89,4 +154,13 @@ private:
   std::string getStatePath(unsigned ndx, Path path) const;
 
   void saveSRAM(void* sramData, size_t sramSize);
+  StateBuffer acquireState(size_t size);
+  void releaseState(const StateBuffer& buffer);
+  void freeStateBuffers();
+
+  void updateSlot(const std::string& path, const Slot& slot);
+  void clearSlots();
+
+  void hashSRAM(std::vector<uint64_t>& hashes, const void* sramData, size_t sramSize) const;
+  void resetSRAM();
 };
@@ -0,0 +1,361 @@
+/*
+Copyright (C) 2018 Andre Leiradella
+
+This file is part of RALibretro.
+
+RALibretro is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RALibretro is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ThreadScheduling.h"
+
+#include "components/Dialog.h"
+#include "jsonsax/jsonsax.h"
+
+#include <mmsystem.h>
+
+#include <stdlib.h>
+
+#include <vector>
+
+#define TAG "[THR] "
+
+/* bits of _audioState under the generation */
+#define AUDIO_MMCSS 1
+#define AUDIO_PIN   2
+#define AUDIO_BITS  2
+
+/* avrt.dll is looked up at runtime like the other optional APIs */
+typedef HANDLE (WINAPI *AvSetMmThreadCharacteristicsWFunc)(LPCWSTR, LPDWORD);
+typedef BOOL (WINAPI *AvRevertMmThreadCharacteristicsFunc)(HANDLE);
+typedef BOOL (WINAPI *AvSetMmThreadPriorityFunc)(HANDLE, int);
+
+static AvSetMmThreadCharacteristicsWFunc s_avSetMmThreadCharacteristicsW;
+static AvRevertMmThreadCharacteristicsFunc s_avRevertMmThreadCharacteristics;
+static AvSetMmThreadPriorityFunc s_avSetMmThreadPriority;
+
+/* AVRT_PRIORITY_HIGH */
+#define MMCSS_PRIORITY_HIGH 1
+
+bool ThreadScheduling::init(Logger* logger)
+{
+  _logger = logger;
+  _gameLoaded = false;
+  _timerSet = false;
+  _emulationTask = NULL;
+  _audioState = 0;
+  _audioApplied = 0;
+  _audioTask = NULL;
+
+  HMODULE avrt = LoadLibraryA("avrt.dll");
+
+  if (avrt != NULL)
+  {
+    s_avSetMmThreadCharacteristicsW = (AvSetMmThreadCharacteristicsWFunc)GetProcAddress(avrt, "AvSetMmThreadCharacteristicsW");
+    s_avRevertMmThreadCharacteristics = (AvRevertMmThreadCharacteristicsFunc)GetProcAddress(avrt, "AvRevertMmThreadCharacteristics");
+    s_avSetMmThreadPriority = (AvSetMmThreadPriorityFunc)GetProcAddress(avrt, "AvSetMmThreadPriority");
+  }
+
+  if (s_avSetMmThreadCharacteristicsW == NULL || s_avRevertMmThreadCharacteristics == NULL)
+    _logger->warn(TAG "MMCSS is not available, the threads will only get their priority raised");
+
+  pickCores();
+  calibrate();
+  return true;
+}
+
+void ThreadScheduling::destroy()
+{
+  endGame();
+}
+
+void ThreadScheduling::pickCores()
+{
+  DWORD_PTR systemMask;
+  GetProcessAffinityMask(GetCurrentProcess(), &_processMask, &systemMask);
+
+  _emulationMask = _audioMask = 0;
+
+  DWORD length = 0;
+  GetLogicalProcessorInformation(NULL, &length);
+
+  std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> info(length / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+
+  if (info.empty() || !GetLogicalProcessorInformation(info.data(), &length))
+    return;
+
+  // the first logical processor of each physical core, so the threads never share a core with
+  // each other through hyperthreading
+  std::vector<DWORD_PTR> cores;
+
+  for (const auto& entry : info)
+  {
+    const DWORD_PTR mask = entry.ProcessorMask & _processMask;
+
+    if (entry.Relationship == RelationProcessorCore && mask != 0)
+      cores.push_back(mask & (~mask + 1));
+  }
+
+  // the first core gets most of the interrupts, and at least one core is left for everything else
+  if (cores.size() < 3)
+  {
+    _logger->info(TAG "%zu cores available, the threads won't be pinned", cores.size());
+    return;
+  }
+
+  _emulationMask = cores[cores.size() - 1];
+  _audioMask = cores[cores.size() - 2];
+
+  _logger->info(TAG "%zu cores available, emulation can be pinned to mask 0x%llx and audio to 0x%llx", cores.size(),
+    (unsigned long long)_emulationMask, (unsigned long long)_audioMask);
+}
+
+uint64_t ThreadScheduling::threadCycles() const
+{
+  ULONG64 cycles = 0;
+  QueryThreadCycleTime(GetCurrentThread(), &cycles);
+  return cycles;
+}
+
+void ThreadScheduling::calibrate()
+{
+  // a thread that is never preempted gets as many cycles as the counter runs at, the fastest of
+  // a few short spins is taken as that rate
+  LARGE_INTEGER frequency, start, now;
+  QueryPerformanceFrequency(&frequency);
+
+  _cyclesPerMicro = 0.0;
+
+  for (int i = 0; i < 5; i++)
+  {
+    QueryPerformanceCounter(&start);
+    const uint64_t cycles = threadCycles();
+
+    do
+    {
+      QueryPerformanceCounter(&now);
+    }
+    while (now.QuadPart - start.QuadPart < frequency.QuadPart / 1000);
+
+    const double micros = (double)(now.QuadPart - start.QuadPart) * 1e6 / (double)frequency.QuadPart;
+    const double rate = (double)(threadCycles() - cycles) / micros;
+
+    if (rate > _cyclesPerMicro)
+      _cyclesPerMicro = rate;
+  }
+
+  _logger->info(TAG "Thread cycle counter runs at %.0f MHz", _cyclesPerMicro);
+}
+
+void ThreadScheduling::beginGame()
+{
+  _gameLoaded = true;
+  apply();
+}
+
+void ThreadScheduling::endGame()
+{
+  _gameLoaded = false;
+  apply();
+}
+
+void ThreadScheduling::apply()
+{
+  const bool mmcss = _gameLoaded && _priority == Priority::Mmcss && s_avSetMmThreadCharacteristicsW != NULL;
+
+  if (mmcss && _emulationTask == NULL)
+  {
+    DWORD index = 0;
+    _emulationTask = s_avSetMmThreadCharacteristicsW(L"Games", &index);
+
+    if (_emulationTask == NULL)
+      _logger->error(TAG "AvSetMmThreadCharacteristics failed: %lu", GetLastError());
+    else if (s_avSetMmThreadPriority != NULL)
+      s_avSetMmThreadPriority(_emulationTask, MMCSS_PRIORITY_HIGH);
+  }
+  else if (!mmcss && _emulationTask != NULL)
+  {
+    s_avRevertMmThreadCharacteristics(_emulationTask);
+    _emulationTask = NULL;
+  }
+
+  // without MMCSS, raising the priority is the next best thing
+  const bool high = _gameLoaded && _priority != Priority::Normal && _emulationTask == NULL;
+  SetThreadPriority(GetCurrentThread(), high ? THREAD_PRIORITY_HIGHEST : THREAD_PRIORITY_NORMAL);
+
+  const bool pin = _gameLoaded && _pin && _emulationMask != 0;
+  SetThreadAffinityMask(GetCurrentThread(), pin ? _emulationMask : _processMask);
+
+  const bool timer = _gameLoaded && _timer;
+
+  if (timer != _timerSet)
+  {
+    if (timer)
+      timeBeginPeriod(1);
+    else
+      timeEndPeriod(1);
+
+    _timerSet = timer;
+  }
+
+  // the audio thread picks this up on its next callback
+  unsigned flags = 0;
+
+  if (mmcss)
+    flags |= AUDIO_MMCSS;
+
+  if (_gameLoaded && _pin && _audioMask != 0)
+    flags |= AUDIO_PIN;
+
+  const unsigned generation = (_audioState.load(std::memory_order_relaxed) >> AUDIO_BITS) + 1;
+  _audioState.store(generation << AUDIO_BITS | flags, std::memory_order_release);
+
+  if (_gameLoaded)
+  {
+    _logger->info(TAG "Emulation thread: %s priority%s%s", _emulationTask != NULL ? "MMCSS" : high ? "high" : "normal",
+      pin ? ", pinned" : "", timer ? ", 1 ms timer resolution" : "");
+  }
+}
+
+void ThreadScheduling::applyAudio(unsigned state)
+{
+  // runs on the audio thread, which must not log or take locks
+  const bool mmcss = (state & AUDIO_MMCSS) != 0;
+
+  if (mmcss && _audioTask == NULL)
+  {
+    DWORD index = 0;
+    _audioTask = s_avSetMmThreadCharacteristicsW(L"Pro Audio", &index);
+
+    if (_audioTask != NULL && s_avSetMmThreadPriority != NULL)
+      s_avSetMmThreadPriority(_audioTask, MMCSS_PRIORITY_HIGH);
+  }
+  else if (!mmcss && _audioTask != NULL)
+  {
+    s_avRevertMmThreadCharacteristics(_audioTask);
+    _audioTask = NULL;
+  }
+
+  SetThreadAffinityMask(GetCurrentThread(), (state & AUDIO_PIN) != 0 ? _audioMask : _processMask);
+  _audioApplied = state;
+}
+
+void ThreadScheduling::audioDeviceClosed()
+{
+  // the thread is gone and took its MMCSS registration with it, nothing runs the callback now
+  _audioApplied = 0;
+  _audioTask = NULL;
+}
+
+std::string ThreadScheduling::serializeSettings() const
+{
+  std::string json("{");
+
+  json.append("\"priority\":");
+  json.append(std::to_string((int)_priority));
+  json.append(",\"pin\":");
+  json.append(_pin ? "true" : "false");
+  json.append(",\"timerResolution\":");
+  json.append(_timer ? "true" : "false");
+
+  json.append("}");
+  return json;
+}
+
+bool ThreadScheduling::deserializeSettings(const char* json)
+{
+  struct Deserialize
+  {
+    ThreadScheduling* self;
+    std::string key;
+  };
+
+  Deserialize ud;
+  ud.self = this;
+
+  jsonsax_result_t res = jsonsax_parse((char*)json, &ud, [](void* udata, jsonsax_event_t event, const char* str, size_t num)
+  {
+    auto* ud = (Deserialize*)udata;
+
+    if (event == JSONSAX_KEY)
+    {
+      ud->key = std::string(str, num);
+    }
+    else if (event == JSONSAX_NUMBER && ud->key == "priority")
+    {
+      const long priority = strtol(str, NULL, 10);
+
+      if (priority >= (long)Priority::Normal && priority <= (long)Priority::Mmcss)
+        ud->self->_priority = (Priority)priority;
+    }
+    else if (event == JSONSAX_BOOLEAN)
+    {
+      if (ud->key == "pin")
+        ud->self->_pin = num != 0;
+      else if (ud->key == "timerResolution")
+        ud->self->_timer = num != 0;
+    }
+
+    return 0;
+  });
+
+  return (res == JSONSAX_OK);
+}
+
+static const char* s_getPriorityOptions(int index, void* udata)
+{
+  switch (index)
+  {
+    case 0: return "Normal";
+    case 1: return "High";
+    case 2: return "MMCSS (Games and Pro Audio)";
+    default: return NULL;
+  }
+}
+
+void ThreadScheduling::showDialog()
+{
+  const WORD WIDTH = 220;
+  const WORD LINE = 15;
+
+  Dialog db;
+  db.init("Thread Scheduling");
+
+  WORD y = 0;
+
+  int priority = (int)_priority;
+  db.addLabel("Priority", 51301, 0, y, 60, 8);
+  db.addCombobox(51302, 65, y - 2, WIDTH - 65, 12, 100, s_getPriorityOptions, NULL, &priority);
+  y += LINE;
+
+  bool pin = _pin;
+  db.addCheckbox(_emulationMask != 0 ? "Pin emulation and audio to cores of their own" : "Pin to cores (needs at least three cores)", 51303, 0, y, WIDTH, 8, &pin);
+  y += LINE;
+
+  bool timer = _timer;
+  db.addCheckbox("Use a 1 ms timer resolution while a game is loaded", 51304, 0, y, WIDTH, 8, &timer);
+  y += LINE;
+
+  db.addButton("OK", IDOK, WIDTH - 55 - 50, y, 50, 14, true);
+  db.addButton("Cancel", IDCANCEL, WIDTH - 50, y, 50, 14, false);
+
+  if (db.show())
+  {
+    _priority = (Priority)priority;
+    _pin = pin;
+    _timer = timer;
+
+    // the dialog runs on the emulation thread
+    apply();
+  }
+}
@@ -0,0 +1,105 @@
+/*
+Copyright (C) 2018 Andre Leiradella
+
+This file is part of RALibretro.
+
+RALibretro is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RALibretro is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "components/Logger.h"
+
+#include <atomic>
+#include <stdint.h>
+#include <string>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+/* How the emulation and audio threads are scheduled while a game is loaded.
+ *
+ * The emulation thread is the main thread. It can run at a raised priority, or be registered with
+ * MMCSS as a game, which also protects it from the system's background work. The audio callback
+ * runs on SDL's thread and registers it as pro audio. Both can be pinned to cores of their own,
+ * away from each other. The timer resolution goes to 1 ms while the game is loaded.
+ *
+ * The audio thread is only known from inside the callback, it applies the settings itself the
+ * next time it runs after they change.
+ */
+class ThreadScheduling
+{
+public:
+  enum class Priority
+  {
+    Normal,
+    High,
+    Mmcss
+  };
+
+  bool init(Logger* logger);
+  void destroy();
+
+  /* Called on the emulation thread when a game is loaded and unloaded */
+  void beginGame();
+  void endGame();
+
+  /* Called at the top of the audio callback, does nothing unless the settings changed */
+  inline void audioThread()
+  {
+    const unsigned state = _audioState.load(std::memory_order_acquire);
+
+    if (state != _audioApplied)
+      applyAudio(state);
+  }
+
+  /* Called once the audio device is closed, the next device's thread gets the settings again */
+  void audioDeviceClosed();
+
+  /* Cycles the calling thread ran for, the time it wasn't running is what it was preempted for */
+  uint64_t threadCycles() const;
+  uint32_t cyclesToMicros(uint64_t cycles) const { return _cyclesPerMicro > 0.0 ? (uint32_t)(cycles / _cyclesPerMicro) : 0; }
+
+  std::string serializeSettings() const;
+  bool        deserializeSettings(const char* json);
+
+  void        showDialog();
+
+protected:
+  void apply();
+  void applyAudio(unsigned state);
+  void pickCores();
+  void calibrate();
+
+  Logger* _logger;
+
+  Priority _priority = Priority::Normal;
+  bool     _pin = false;
+  bool     _timer = false;
+
+  bool      _gameLoaded = false;
+  bool      _timerSet = false;
+  HANDLE    _emulationTask = NULL;  /* MMCSS registration of the emulation thread */
+  DWORD_PTR _emulationMask = 0;     /* single cores to pin the threads to, 0 if there aren't enough */
+  DWORD_PTR _audioMask = 0;
+  DWORD_PTR _processMask = 0;
+  double    _cyclesPerMicro = 0.0;
+
+  /* What the audio thread should do, under a generation bumped whenever it changes */
+  std::atomic<unsigned> _audioState{0};
+
+  /* Only touched by the audio thread */
+  unsigned _audioApplied = 0;
+  HANDLE   _audioTask = NULL;
+};
@@ -19,12 +19,20 @@ along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "Util.h"
 
+#include "components/Pixels.h"
+
 #include <stdint.h>
 #include <sys/stat.h>
+#ifndef _WINDOWS
+#include <dirent.h>
+#endif
 #include <errno.h>
 #include <string.h>
 
+#include <algorithm>
+
 #ifndef NO_MINIZ
+#include <miniz.h>
 #include <miniz_zip.h>
 #endif
 
@@ -90,6 +98,82 @@ bool util::exists(const std::string& path)
   return util::fileTime(path) != 0;
 }
 
+bool util::fileInfo(const std::string& path, uint64_t* size, time_t* time)
+{
+#ifdef _WINDOWS
+  // the 64-bit version also gets the size of disc images larger than 2 GB right
+  std::wstring unicodePath = util::utf8ToUChar(path);
+
+  struct _stat64 filestat;
+  if (_wstat64(unicodePath.c_str(), &filestat) != 0)
+    return false;
+#else
+  struct stat filestat;
+  if (stat(path.c_str(), &filestat) != 0)
+    return false;
+#endif
+
+  *size = (uint64_t)filestat.st_size;
+  *time = filestat.st_mtime;
+  return true;
+}
+
+std::vector<util::DirectoryEntry> util::listDirectory(const std::string& path)
+{
+  std::vector<DirectoryEntry> entries;
+
+#ifdef _WINDOWS
+  // the listing already has the sizes and the times, there's no need to stat each file
+  std::wstring pattern = util::utf8ToUChar(path + "\\*");
+
+  WIN32_FIND_DATAW data;
+  HANDLE find = FindFirstFileW(pattern.c_str(), &data);
+
+  if (find == INVALID_HANDLE_VALUE)
+    return entries;
+
+  do
+  {
+    if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+      continue;
+
+    // FILETIMEs count 100 ns intervals since 1601
+    const uint64_t time = (uint64_t)data.ftLastWriteTime.dwHighDateTime << 32 | data.ftLastWriteTime.dwLowDateTime;
+
+    DirectoryEntry entry;
+    entry.name = util::ucharToUtf8(data.cFileName);
+    entry.size = (uint64_t)data.nFileSizeHigh << 32 | data.nFileSizeLow;
+    entry.time = (time_t)((time - 116444736000000000ULL) / 10000000ULL);
+    entries.push_back(entry);
+  } while (FindNextFileW(find, &data));
+
+  FindClose(find);
+#else
+  DIR* dir = opendir(path.c_str());
+
+  if (dir == NULL)
+    return entries;
+
+  while (const struct dirent* found = readdir(dir))
+  {
+    struct stat filestat;
+
+    if (stat((path + '/' + found->d_name).c_str(), &filestat) != 0 || !S_ISREG(filestat.st_mode))
+      continue;
+
+    DirectoryEntry entry;
+    entry.name = found->d_name;
+    entry.size = (uint64_t)filestat.st_size;
+    entry.time = filestat.st_mtime;
+    entries.push_back(entry);
+  }
+
+  closedir(dir);
+#endif
+
+  return entries;
+}
+
 FILE* util::openFile(Logger* logger, const std::string& path, const char* mode)
 {
   FILE* file;
@@ -186,59 +270,96 @@ void* util::loadFile(Logger* logger, const std::string& path, size_t* size)
 }
 
 #ifndef NO_MINIZ
-void* util::loadZippedFile(Logger* logger, const std::string& path, size_t* size, std::string& unzippedFileName)
+/* The file to load from the zip: the one with an extension in validExtensions ("a|b|c" like
+ * retro_system_info), the largest if several have one, or the only file in the zip. -1 if there
+ * isn't one, -2 if there are several files and none can be told apart. */
+static int findZippedFile(Logger* logger, mz_zip_archive* zip_archive, const std::string& path, const char* validExtensions)
 {
-  mz_bool status;
-  mz_zip_archive zip_archive;
-  mz_zip_archive_file_stat file_stat;
-  void* data;
-  int file_count;
+  const int file_count = (int)mz_zip_reader_get_num_files(zip_archive);
+  int found = -1, files = 0, onlyFile = -1;
+  mz_uint64 foundSize = 0;
 
-  memset(&zip_archive, 0, sizeof(zip_archive));
-
-  status = mz_zip_reader_init_file(&zip_archive, path.c_str(), 0);
-  if (!status)
+  for (int i = 0; i < file_count; i++)
   {
-    logger->error(TAG "Error opening \"%s\": %s", path.c_str(), strerror(errno));
-    return NULL;
+    mz_zip_archive_file_stat file_stat;
+
+    if (mz_zip_reader_is_file_a_directory(zip_archive, i) || !mz_zip_reader_file_stat(zip_archive, i, &file_stat))
+      continue;
+
+    files++;
+    onlyFile = i;
+
+    if (validExtensions == NULL || *validExtensions == '\0')
+      continue;
+
+    std::string extension = util::extension(file_stat.m_filename);
+    if (extension.empty())
+      continue;
+
+    extension = extension.substr(1);
+
+    for (const char* ptr = validExtensions; *ptr;)
+    {
+      const char* end = strchr(ptr, '|');
+      const size_t length = end ? (size_t)(end - ptr) : strlen(ptr);
+
+      if (length == extension.length() && strncasecmp(ptr, extension.c_str(), length) == 0)
+      {
+        if (found == -1 || file_stat.m_uncomp_size > foundSize)
+        {
+          found = i;
+          foundSize = file_stat.m_uncomp_size;
+        }
+
+        break;
+      }
+
+      ptr += length;
+      if (*ptr == '|')
+        ++ptr;
+    }
   }
 
-  file_count = mz_zip_reader_get_num_files(&zip_archive);
-  if (file_count == 0)
+  if (found != -1)
+    return found;
+
+  if (files == 0)
   {
-    mz_zip_reader_end(&zip_archive);
-    logger->error(TAG "Empty zip file \"%s\"", path.c_str());
-    return NULL;
+    logger->error(TAG "Zip file \"%s\" doesn't contain any files", path.c_str());
+    return -1;
   }
 
-  if (file_count > 1)
+  if (files > 1)
   {
-    mz_zip_reader_end(&zip_archive);
-    logger->error(TAG "Zip file \"%s\" contains %d files, determining which to open is not supported - returning entire zip file", path.c_str(), file_count);
-    return loadFile(logger, path, size);
+    logger->error(TAG "Zip file \"%s\" contains %d files and none has an extension the core supports", path.c_str(), files);
+    return -2;
   }
 
-  if (mz_zip_reader_is_file_a_directory(&zip_archive, 0))
+  return onlyFile;
+}
+
+/* reads the file found by findZippedFile into memory, or the whole zip if none could be picked */
+static void* readZippedFile(Logger* logger, mz_zip_archive* zip_archive, const std::string& path, int index, size_t* size, std::string& unzippedFileName)
+{
+  mz_zip_archive_file_stat file_stat;
+
+  if (index == -2)
   {
-    mz_zip_reader_end(&zip_archive);
-    logger->error(TAG "Zip file \"%s\" only contains a directory", path.c_str());
-    return NULL;
+    logger->error(TAG "Returning entire zip file \"%s\"", path.c_str());
+    return util::loadFile(logger, path, size);
   }
 
-  if (!mz_zip_reader_file_stat(&zip_archive, 0, &file_stat))
+  if (index < 0 || !mz_zip_reader_file_stat(zip_archive, index, &file_stat))
   {
-    mz_zip_reader_end(&zip_archive);
     logger->error(TAG "Error opening file in \"%s\"", path.c_str());
     return NULL;
   }
 
   *size = (size_t)file_stat.m_uncomp_size;
-  data = malloc(*size);
+  void* data = malloc(*size);
 
-  status = mz_zip_reader_extract_to_mem(&zip_archive, 0, data, *size, 0);
-  if (!status)
+  if (data == NULL || !mz_zip_reader_extract_to_mem(zip_archive, index, data, *size, 0))
   {
-    mz_zip_reader_end(&zip_archive);
     logger->error(TAG "Error decompressing file in \"%s\": %s", path.c_str(), strerror(errno));
     free(data);
     return NULL;
@@ -246,10 +367,138 @@ void* util::loadZippedFile(Logger* logger, const std::string& path, size_t* size
 
   unzippedFileName = file_stat.m_filename;
   logger->info(TAG "Read %zu bytes from \"%s\":\"%s\"", *size, path.c_str(), file_stat.m_filename);
+  return data;
+}
+
+void* util::loadZippedFile(Logger* logger, const std::string& path, size_t* size, std::string& unzippedFileName, const char* validExtensions)
+{
+  mz_zip_archive zip_archive;
+  memset(&zip_archive, 0, sizeof(zip_archive));
+
+  if (!mz_zip_reader_init_file(&zip_archive, path.c_str(), 0))
+  {
+    logger->error(TAG "Error opening \"%s\": %s", path.c_str(), strerror(errno));
+    return NULL;
+  }
+
+  const int index = findZippedFile(logger, &zip_archive, path, validExtensions);
+  void* data = readZippedFile(logger, &zip_archive, path, index, size, unzippedFileName);
   mz_zip_reader_end(&zip_archive);
   return data;
 }
 
+static size_t writeZippedChunk(void* opaque, mz_uint64 offset, const void* data, size_t size)
+{
+  (void)offset;
+  return fwrite(data, 1, size, (FILE*)opaque);
+}
+
+/* deletes the oldest files until the directory holds at most maximumSize bytes, except for keep */
+static void trimZipCache(Logger* logger, const std::string& cacheDirectory, uint64_t maximumSize, const std::string& keep)
+{
+  std::vector<util::DirectoryEntry> entries = util::listDirectory(util::directory(keep));
+  uint64_t total = 0;
+
+  for (const auto& entry : entries)
+    total += entry.size;
+
+  if (total <= maximumSize)
+    return;
+
+  std::sort(entries.begin(), entries.end(), [](const util::DirectoryEntry& a, const util::DirectoryEntry& b) {
+    return a.time < b.time;
+  });
+
+  for (const auto& entry : entries)
+  {
+    if (total <= maximumSize)
+      break;
+
+    const std::string path = cacheDirectory + entry.name;
+
+    if (path == keep)
+      continue;
+
+    util::deleteFile(path);
+    total -= entry.size;
+    logger->info(TAG "Deleted \"%s\" to keep the unzipped files under %llu bytes", path.c_str(), (unsigned long long)maximumSize);
+  }
+}
+
+std::string util::cacheZippedFile(Logger* logger, const std::string& path, const char* validExtensions, const std::string& cacheDirectory, size_t minimumSize, uint64_t maximumSize, std::string& unzippedFileName, void** data, size_t* size)
+{
+  mz_zip_archive zip_archive;
+  mz_zip_archive_file_stat file_stat;
+
+  memset(&zip_archive, 0, sizeof(zip_archive));
+  *data = NULL;
+
+  if (!mz_zip_reader_init_file(&zip_archive, path.c_str(), 0))
+  {
+    logger->error(TAG "Error opening \"%s\": %s", path.c_str(), strerror(errno));
+    return std::string();
+  }
+
+  /* small files, or files that can't be extracted to the disk, are read from the zip already open */
+  const int index = findZippedFile(logger, &zip_archive, path, validExtensions);
+  if (index < 0 || !mz_zip_reader_file_stat(&zip_archive, index, &file_stat) || file_stat.m_uncomp_size < minimumSize)
+  {
+    *data = readZippedFile(logger, &zip_archive, path, index, size, unzippedFileName);
+    mz_zip_reader_end(&zip_archive);
+    return std::string();
+  }
+
+  /* the zip's path tells apart files with the same name in different zips */
+  const std::string fullPath = util::fullPath(path);
+  char prefix[16];
+  snprintf(prefix, sizeof(prefix), "%08x_", (unsigned)mz_crc32(MZ_CRC32_INIT, (const mz_uint8*)fullPath.c_str(), fullPath.length()));
+
+  const std::string cachePath = cacheDirectory + prefix + util::sanitizeFileName(util::fileNameWithExtension(file_stat.m_filename));
+  unzippedFileName = file_stat.m_filename;
+
+  /* reuse the file extracted before while the zip hasn't changed since */
+  uint64_t cachedSize;
+  time_t cachedTime;
+
+  if (util::fileInfo(cachePath, &cachedSize, &cachedTime) && cachedSize == file_stat.m_uncomp_size &&
+      cachedTime >= util::fileTime(path))
+  {
+    mz_zip_reader_end(&zip_archive);
+    logger->info(TAG "Using \"%s\" extracted before from \"%s\"", cachePath.c_str(), path.c_str());
+    return cachePath;
+  }
+
+  /* inflate straight to the disk in chunks, the file is never whole in memory */
+  const std::string tempPath = cachePath + ".tmp";
+  FILE* file = util::openFile(logger, tempPath, "wb");
+
+  if (file == NULL)
+  {
+    *data = readZippedFile(logger, &zip_archive, path, index, size, unzippedFileName);
+    mz_zip_reader_end(&zip_archive);
+    return std::string();
+  }
+
+  const mz_bool status = mz_zip_reader_extract_to_callback(&zip_archive, index, writeZippedChunk, file, 0);
+  const bool closed = fclose(file) == 0;
+
+  if (!status || !closed || !util::replaceFile(logger, tempPath, cachePath))
+  {
+    logger->error(TAG "Error decompressing file in \"%s\" to the disk: %s", path.c_str(), strerror(errno));
+    util::deleteFile(tempPath);
+    *data = readZippedFile(logger, &zip_archive, path, index, size, unzippedFileName);
+    mz_zip_reader_end(&zip_archive);
+    return std::string();
+  }
+
+  mz_zip_reader_end(&zip_archive);
+  logger->info(TAG "Extracted %llu bytes from \"%s\":\"%s\" to \"%s\"", (unsigned long long)file_stat.m_uncomp_size,
+    path.c_str(), file_stat.m_filename, cachePath.c_str());
+
+  trimZipCache(logger, cacheDirectory, maximumSize, cachePath);
+  return cachePath;
+}
+
 bool util::unzipFile(Logger* logger, const std::string& zipPath, const std::string& archiveFileName, const std::string& unzippedPath)
 {
   mz_bool status;
@@ -278,6 +527,150 @@ bool util::unzipFile(Logger* logger, const std::string& zipPath, const std::stri
 
   return status;
 }
+
+/* RZIP is RetroArch's container for compressed states: a 20 byte header with the magic, the
+ * chunk size and the uncompressed size, followed by chunks each prefixed with its compressed size.
+ * Each chunk is a separate zlib stream. All values are little endian. */
+static const uint8_t s_rzipMagic[8] = { '#', 'R', 'Z', 'I', 'P', 'v', 1, '#' };
+static const size_t s_rzipHeaderSize = 20;
+static const uint32_t s_rzipChunkSize = 128 * 1024;
+
+static uint32_t readLE32(const uint8_t* data)
+{
+  return (uint32_t)data[0] | (uint32_t)data[1] << 8 | (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24;
+}
+
+static void writeLE32(uint8_t* data, uint32_t value)
+{
+  data[0] = (uint8_t)value;
+  data[1] = (uint8_t)(value >> 8);
+  data[2] = (uint8_t)(value >> 16);
+  data[3] = (uint8_t)(value >> 24);
+}
+
+bool util::isRzip(const void* data, size_t size)
+{
+  /* any version, we only know how to read version 1 but the caller should get a proper error */
+  return size >= 6 && memcmp(data, s_rzipMagic, 6) == 0;
+}
+
+size_t util::rzipSize(const void* data, size_t size)
+{
+  const uint8_t* bytes = (const uint8_t*)data;
+
+  if (size < s_rzipHeaderSize || memcmp(bytes, s_rzipMagic, sizeof(s_rzipMagic)) != 0)
+    return 0;
+
+  const uint64_t totalSize = (uint64_t)readLE32(bytes + 12) | (uint64_t)readLE32(bytes + 16) << 32;
+
+  if (readLE32(bytes + 8) == 0 || totalSize > SIZE_MAX)
+    return 0;
+
+  return (size_t)totalSize;
+}
+
+bool util::decompressRzip(Logger* logger, const void* data, size_t size, void* output, size_t outputSize)
+{
+  const uint8_t* bytes = (const uint8_t*)data;
+  const size_t totalSize = util::rzipSize(data, size);
+
+  if (totalSize == 0 || totalSize > outputSize)
+  {
+    logger->error(TAG "Unsupported RZIP version or invalid header");
+    return false;
+  }
+
+  const uint32_t chunkSize = readLE32(bytes + 8);
+
+  /* inflate each chunk straight into its place in the output */
+  const uint8_t* input = bytes + s_rzipHeaderSize;
+  const uint8_t* end = bytes + size;
+  size_t offset = 0;
+
+  while (offset < totalSize)
+  {
+    if (end - input < 4)
+      break;
+
+    const uint32_t compressedSize = readLE32(input);
+    input += 4;
+
+    if ((size_t)(end - input) < compressedSize)
+      break;
+
+    mz_ulong chunkOutputSize = (mz_ulong)(totalSize - offset < chunkSize ? totalSize - offset : chunkSize);
+
+    if (mz_uncompress((uint8_t*)output + offset, &chunkOutputSize, input, compressedSize) != MZ_OK)
+      break;
+
+    input += compressedSize;
+    offset += chunkOutputSize;
+  }
+
+  if (offset != totalSize)
+  {
+    logger->error(TAG "Corrupted RZIP data");
+    return false;
+  }
+
+  return true;
+}
+
+bool util::saveRzipFile(Logger* logger, const std::string& path, const void* data, size_t size, int level)
+{
+  FILE* file = util::openFile(logger, path, "wb");
+  if (file == NULL)
+  {
+    logger->error(TAG "Error creating file \"%s\": %s", path.c_str(), strerror(errno));
+    return false;
+  }
+
+  uint8_t header[s_rzipHeaderSize];
+  memcpy(header, s_rzipMagic, sizeof(s_rzipMagic));
+  writeLE32(header + 8, s_rzipChunkSize);
+  writeLE32(header + 12, (uint32_t)size);
+  writeLE32(header + 16, (uint32_t)((uint64_t)size >> 32));
+
+  /* one chunk is compressed at a time, so the buffer never grows beyond the bound of a chunk */
+  const mz_ulong bound = mz_compressBound(s_rzipChunkSize);
+  uint8_t* chunk = (uint8_t*)malloc(bound + 4);
+
+  if (chunk == NULL)
+  {
+    logger->error(TAG "Out of memory allocating %lu bytes to compress \"%s\"", (unsigned long)bound, path.c_str());
+    fclose(file);
+    return false;
+  }
+
+  bool ok = fwrite(header, 1, sizeof(header), file) == sizeof(header);
+  size_t written = sizeof(header);
+
+  for (size_t offset = 0; ok && offset < size; offset += s_rzipChunkSize)
+  {
+    const size_t inputSize = size - offset < s_rzipChunkSize ? size - offset : s_rzipChunkSize;
+    mz_ulong compressedSize = bound;
+
+    if (mz_compress2(chunk + 4, &compressedSize, (const uint8_t*)data + offset, (mz_ulong)inputSize, level) != MZ_OK)
+    {
+      logger->error(TAG "Error compressing \"%s\"", path.c_str());
+      ok = false;
+      break;
+    }
+
+    writeLE32(chunk, (uint32_t)compressedSize);
+    ok = fwrite(chunk, 1, compressedSize + 4, file) == compressedSize + 4;
+    written += compressedSize + 4;
+  }
+
+  if (!ok)
+    logger->error(TAG "Error writing file \"%s\": %s", path.c_str(), strerror(errno));
+  else
+    logger->info(TAG "Wrote %zu bytes (%zu uncompressed) to \"%s\"", written, size, path.c_str());
+
+  free(chunk);
+  fclose(file);
+  return ok;
+}
 #endif
 
 std::string util::loadFile(Logger* logger, const std::string& path)
@@ -321,6 +714,94 @@ bool util::saveFile(Logger* logger, const std::string& path, const void* data, s
   return true;
 }
 
+#ifdef _WINDOWS
+const void* util::mapFile(Logger* logger, const std::string& path, size_t* size)
+{
+  std::wstring unicodePath = util::utf8ToUChar(path);
+  HANDLE file = CreateFileW(unicodePath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+  if (file == INVALID_HANDLE_VALUE)
+  {
+    logger->error(TAG "Error opening \"%s\": %lu", path.c_str(), GetLastError());
+    return NULL;
+  }
+
+  LARGE_INTEGER fileSize;
+  if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0 || (uint64_t)fileSize.QuadPart > SIZE_MAX)
+  {
+    logger->error(TAG "Error mapping \"%s\": invalid size", path.c_str());
+    CloseHandle(file);
+    return NULL;
+  }
+
+  /* the view keeps the file alive, the handles aren't needed after it's created. It's copy on
+   * write, some cores patch the content they're given in place */
+  HANDLE mapping = CreateFileMappingW(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+  CloseHandle(file);
+
+  if (mapping == NULL)
+  {
+    logger->error(TAG "Error mapping \"%s\": %lu", path.c_str(), GetLastError());
+    return NULL;
+  }
+
+  const void* data = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+  CloseHandle(mapping);
+
+  if (data == NULL)
+  {
+    logger->error(TAG "Error mapping \"%s\": %lu", path.c_str(), GetLastError());
+    return NULL;
+  }
+
+  *size = (size_t)fileSize.QuadPart;
+  logger->info(TAG "Mapped %zu bytes from \"%s\"", *size, path.c_str());
+  return data;
+}
+
+void util::unmapFile(const void* data)
+{
+  UnmapViewOfFile(data);
+}
+#endif
+
+bool util::saveFileAtomic(Logger* logger, const std::string& path, const void* data, size_t size)
+{
+  const std::string tempPath = path + ".tmp";
+
+  if (!util::saveFile(logger, tempPath, data, size))
+  {
+    util::deleteFile(tempPath);
+    return false;
+  }
+
+  return util::replaceFile(logger, tempPath, path);
+}
+
+bool util::replaceFile(Logger* logger, const std::string& tempPath, const std::string& path)
+{
+#ifdef _WINDOWS
+  std::wstring unicodeTempPath = util::utf8ToUChar(tempPath);
+  std::wstring unicodePath = util::utf8ToUChar(path);
+
+  if (!MoveFileExW(unicodeTempPath.c_str(), unicodePath.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+  {
+    logger->error(TAG "Error replacing file \"%s\": %lu", path.c_str(), GetLastError());
+    util::deleteFile(tempPath);
+    return false;
+  }
+#else
+  if (rename(tempPath.c_str(), path.c_str()) != 0)
+  {
+    logger->error(TAG "Error replacing file \"%s\": %s", path.c_str(), strerror(errno));
+    util::deleteFile(tempPath);
+    return false;
+  }
+#endif
+
+  return true;
+}
+
 void util::deleteFile(const std::string& path)
 {
   if (isAsciiOnly(path))
@@ -337,7 +818,7 @@ void util::deleteFile(const std::string& path)
 }
 
 #ifndef _CONSOLE // don't include in RAHasher
-bool util::downloadFile(Logger* logger, const std::string& url, const std::string& path)
+bool util::downloadFile(Logger* logger, const std::string& url, const std::string& path, const std::atomic<bool>* cancel)
 {
   bool bSuccess = false;
   HINTERNET hSession = nullptr, hConnect = nullptr, hRequest = nullptr;
@@ -370,6 +851,9 @@ bool util::downloadFile(Logger* logger, const std::string& url, const std::strin
   }
   else
   {
+    // resolving, connecting, sending and each receive can block for this long, in milliseconds
+    WinHttpSetTimeouts(hSession, 10000, 10000, 10000, 10000);
+
     mbstowcs_s(&nTemp, wBuffer, sizeof(wBuffer) / sizeof(wBuffer[0]), hostName, pageStart - hostName);
     hConnect = WinHttpConnect(hSession, wBuffer, secure ? INTERNET_DEFAULT_HTTPS_PORT : INTERNET_DEFAULT_HTTP_PORT, 0);
 
@@ -420,6 +904,13 @@ bool util::downloadFile(Logger* logger, const std::string& url, const std::strin
             bSuccess = TRUE;
             while (availableBytes > 0)
             {
+              if (cancel != NULL && *cancel)
+              {
+                logger->info(TAG "Download of %s cancelled", url.c_str());
+                bSuccess = false;
+                break;
+              }
+
               const DWORD bytesToRead = availableBytes < 4096 ? availableBytes : 4096;
               sBuffer.resize(bytesToRead);
 
@@ -712,123 +1203,6 @@ std::string util::saveFileDialog(HWND hWnd, const std::string& extensionsFilter)
 }
 #endif
 
-const void* util::toRgb(Logger* logger, const void* data, unsigned width, unsigned height, unsigned pitch, enum retro_pixel_format format)
-{
-  void* pixels = malloc(width * height * 3);
-
-  if (pixels == NULL)
-  {
-    logger->error(TAG "Error allocating memory for the screenshot");
-    return NULL;
-  }
-
-  if (format == RETRO_PIXEL_FORMAT_RGB565)
-  {
-    logger->info(TAG "Pixel format is RGB565, converting to 24-bits RGB");
-
-    uint16_t* source_rgba5650 = (uint16_t*)data;
-    uint8_t* target_rgba8880 = (uint8_t*)pixels;
-
-    for (unsigned y = 0; y < height; y++)
-    {
-      uint8_t* row = (uint8_t*)source_rgba5650;
-
-      for (unsigned x = 0; x < width; x++)
-      {
-        uint16_t rgba5650 = *source_rgba5650++;
-
-        *target_rgba8880++ = (rgba5650 >> 11) * 255 / 31;
-        *target_rgba8880++ = ((rgba5650 >> 5) & 0x3f) * 255 / 63;
-        *target_rgba8880++ = (rgba5650 & 0x1f) * 255 / 31;
-      }
-
-      source_rgba5650 = (uint16_t*)(row + pitch);
-    }
-  }
-  else if (format == RETRO_PIXEL_FORMAT_0RGB1555)
-  {
-    logger->info(TAG "Pixel format is 0RGB1565, converting to 24-bits RGB");
-
-    uint16_t* source_argb1555 = (uint16_t*)data;
-    uint8_t* target_rgba8880 = (uint8_t*)pixels;
-
-    for (unsigned y = 0; y < height; y++)
-    {
-      uint8_t* row = (uint8_t*)source_argb1555;
-
-      for (unsigned x = 0; x < width; x++)
-      {
-        uint16_t argb1555 = *source_argb1555++;
-
-        *target_rgba8880++ = (argb1555 >> 10) * 255 / 31;
-        *target_rgba8880++ = ((argb1555 >> 5) & 0x1f) * 255 / 31;
-        *target_rgba8880++ = (argb1555 & 0x1f) * 255 / 31;
-      }
-
-      source_argb1555 = (uint16_t*)(row + pitch);
-    }
-  }
-  else if (format == RETRO_PIXEL_FORMAT_XRGB8888)
-  {
-    logger->info(TAG "Pixel format is XRGB8888, converting to 24-bits RGB");
-
-    uint32_t* source_argb8888 = (uint32_t*)data;
-    uint8_t* target_rgba8880 = (uint8_t*)pixels;
-
-    for (unsigned y = 0; y < height; y++)
-    {
-      uint8_t* row = (uint8_t*)source_argb8888;
-
-      for (unsigned x = 0; x < width; x++)
-      {
-        uint32_t argb8888 = *source_argb8888++;
-
-        *target_rgba8880++ = argb8888 >> 16;
-        *target_rgba8880++ = argb8888 >> 8;
-        *target_rgba8880++ = argb8888;
-      }
-
-      source_argb8888 = (uint32_t*)(row + pitch);
-    }
-  }
-  else
-  {
-    logger->error(TAG "Unknown pixel format");
-    free(pixels);
-    return NULL;
-  }
-
-  return pixels;
-}
-
-void util::saveImage(Logger* logger, const std::string& path, const void* data, unsigned width, unsigned height, unsigned pitch, enum retro_pixel_format format)
-{
-  const void* pixels = util::toRgb(logger, data, width, height, pitch, format);
-
-  if (pixels == NULL)
-  {
-    return;
-  }
-
-  int len;
-  unsigned char* png = stbi_write_png_to_mem((unsigned char*)pixels, 0, width, height, 3, &len);
-  if (png)
-  {
-    FILE* f = util::openFile(logger, path, "wb");
-    if (f)
-    {
-      fwrite(png, 1, len, f);
-      fclose(f);
-
-      logger->info(TAG "Wrote image %u x %u to %s", width, height, path.c_str());
-    }
-
-    STBIW_FREE(png);
-  }
-
-  free((void*)pixels);
-}
-
 void* util::fromRgb(Logger* logger, const void* data, unsigned width, unsigned height, unsigned* pitch, enum retro_pixel_format format)
 {
   void* pixels;
@@ -845,23 +1219,12 @@ void* util::fromRgb(Logger* logger, const void* data, unsigned width, unsigned h
       return NULL;
     }
 
-    uint8_t* source_rgb888 = (uint8_t*)data;
+    const uint8_t* source_rgb888 = (const uint8_t*)data;
     uint16_t* target_rgba5650 = (uint16_t*)pixels;
 
-    for (unsigned y = 0; y < height; y++)
+    for (unsigned y = 0; y < height; y++, source_rgb888 += *pitch, target_rgba5650 += width)
     {
-      uint8_t* row = source_rgb888;
-
-      for (unsigned x = 0; x < width; x++)
-      {
-        uint8_t r = *source_rgb888++ >> 3;
-        uint8_t g = *source_rgb888++ >> 2;
-        uint8_t b = *source_rgb888++ >> 3;
-
-        *target_rgba5650++ = r << 11 | g << 5 | b;
-      }
-
-      source_rgb888 = row + *pitch;
+      pixels::rgbToRgb565(target_rgba5650, source_rgb888, width);
     }
 
     *pitch = width * 2;
@@ -878,23 +1241,12 @@ void* util::fromRgb(Logger* logger, const void* data, unsigned width, unsigned h
       return NULL;
     }
 
-    uint8_t* source_rgb888 = (uint8_t*)data;
+    const uint8_t* source_rgb888 = (const uint8_t*)data;
     uint16_t* target_argb1555 = (uint16_t*)pixels;
 
-    for (unsigned y = 0; y < height; y++)
+    for (unsigned y = 0; y < height; y++, source_rgb888 += *pitch, target_argb1555 += width)
     {
-      uint8_t* row = source_rgb888;
-
-      for (unsigned x = 0; x < width; x++)
-      {
-        uint8_t r = *source_rgb888++ >> 3;
-        uint8_t g = *source_rgb888++ >> 3;
-        uint8_t b = *source_rgb888++ >> 3;
-
-        *target_argb1555++ = r << 10 | g << 5 | b;
-      }
-
-      source_rgb888 = row + *pitch;
+      pixels::rgbToArgb1555(target_argb1555, source_rgb888, width);
     }
 
     *pitch = width * 2;
@@ -22,7 +22,10 @@ along with RALibretro.  If not, see <http://www.gnu.org/licenses/>.
 #include "components/Logger.h"
 
 #include <stddef.h>
+#include <stdint.h>
+#include <atomic>
 #include <string>
+#include <vector>
 
 // _WINDOWS says we're building _for_ Windows
 #ifdef _WINDOWS
@@ -42,21 +45,62 @@ namespace util
 {
   time_t      fileTime(const std::string& path);
   bool        exists(const std::string& path);
+  /* Size and modification time, false if the file can't be found */
+  bool        fileInfo(const std::string& path, uint64_t* size, time_t* time);
+
+  struct DirectoryEntry
+  {
+    std::string name;
+    uint64_t    size;
+    time_t      time;
+  };
+
+  /* The files in the directory with their sizes and modification times, empty if the directory
+   * doesn't exist. On Windows they all come from a single listing instead of a call per file. */
+  std::vector<DirectoryEntry> listDirectory(const std::string& path);
 
   FILE*       openFile(Logger* logger, const std::string& path, const char* mode);
   std::string loadFile(Logger* logger, const std::string& path);
   void*       loadFile(Logger* logger, const std::string& path, size_t* size);
 
+#ifdef _WINDOWS
+  /* Copy on write view of the whole file, pages are only read from disk when they're accessed
+   * and writes never reach the file */
+  const void* mapFile(Logger* logger, const std::string& path, size_t* size);
+  void        unmapFile(const void* data);
+#endif
+
 #ifndef NO_MINIZ
-  void*       loadZippedFile(Logger* logger, const std::string& path, size_t* size, std::string& unzippedFileName);
+  /* Picks the file with an extension in validExtensions ("a|b|c", may be NULL) when the zip has
+   * several, returns the whole zip if none can be picked */
+  void*       loadZippedFile(Logger* logger, const std::string& path, size_t* size, std::string& unzippedFileName, const char* validExtensions = NULL);
+  /* Extracts the file loadZippedFile would pick into cacheDirectory in chunks, and returns its
+   * path. A file extracted before is used as is while it's newer than the zip, and the oldest ones
+   * are deleted once the directory holds more than maximumSize bytes. Files smaller than
+   * minimumSize aren't worth the disk space: for them, and for files that can't be written, it
+   * returns an empty string and puts what loadZippedFile would return in data, reading it from the
+   * zip already open. */
+  std::string cacheZippedFile(Logger* logger, const std::string& path, const char* validExtensions, const std::string& cacheDirectory, size_t minimumSize, uint64_t maximumSize, std::string& unzippedFileName, void** data, size_t* size);
   bool        unzipFile(Logger* logger, const std::string& zipPath, const std::string& archiveFileName, const std::string& unzippedPath);
+
+  /* RZIP compressed files, compatible with RetroArch's compressed save states */
+  bool        isRzip(const void* data, size_t size);
+  size_t      rzipSize(const void* data, size_t size); /* 0 if the header isn't valid */
+  bool        decompressRzip(Logger* logger, const void* data, size_t size, void* output, size_t outputSize);
+  bool        saveRzipFile(Logger* logger, const std::string& path, const void* data, size_t size, int level);
 #endif
 
   bool        saveFile(Logger* logger, const std::string& path, const void* data, size_t size);
+  /* Writes to a temporary file and renames it over path, so path is never left half written */
+  bool        saveFileAtomic(Logger* logger, const std::string& path, const void* data, size_t size);
+  /* Renames tempPath over path, deleting tempPath if it can't */
+  bool        replaceFile(Logger* logger, const std::string& tempPath, const std::string& path);
   void        deleteFile(const std::string& path);
 
 #ifndef _CONSOLE
-  bool        downloadFile(Logger* logger, const std::string& url, const std::string& path);
+  /* Gives up when the server doesn't answer within a few seconds, or between chunks once cancel,
+   * which may be NULL, is set from another thread */
+  bool        downloadFile(Logger* logger, const std::string& url, const std::string& path, const std::atomic<bool>* cancel = NULL);
 #endif
 
   std::string jsonEscape(const std::string& str);
@@ -80,8 +124,6 @@ namespace util
   std::string saveFileDialog(HWND hWnd, const std::string& extensionsFilter);
 #endif
 
-  const void* toRgb(Logger* logger, const void* data, unsigned width, unsigned height, unsigned pitch, enum retro_pixel_format format);
-  void        saveImage(Logger* logger, const std::string& path, const void* data, unsigned width, unsigned height, unsigned pitch, enum retro_pixel_format format);
   void*       fromRgb(Logger* logger, const void* data, unsigned width, unsigned height, unsigned* pitch, enum retro_pixel_format format);
   void*       loadImage(Logger* logger, const std::string& path, unsigned* width, unsigned* height, unsigned* pitch);
 
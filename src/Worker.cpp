@@ -0,0 +1,156 @@
+/*
+Copyright (C) 2018 Andre Leiradella
+
+This file is part of RALibretro.
+
+RALibretro is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RALibretro is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Worker.h"
+
+#define TAG "[WRK] "
+
+bool Worker::init(Logger* logger, const char* name)
+{
+  _logger = logger;
+  _running = false;
+  _quit = false;
+
+  _mutex = SDL_CreateMutex();
+
+  if (!_mutex)
+  {
+    _logger->error(TAG "SDL_CreateMutex: %s", SDL_GetError());
+    return false;
+  }
+
+  _queued = SDL_CreateCond();
+  _idle = SDL_CreateCond();
+
+  if (!_queued || !_idle)
+  {
+    _logger->error(TAG "SDL_CreateCond: %s", SDL_GetError());
+    goto error;
+  }
+
+  _thread = SDL_CreateThread(s_thread, name, this);
+
+  if (!_thread)
+  {
+    _logger->error(TAG "SDL_CreateThread: %s", SDL_GetError());
+    goto error;
+  }
+
+  return true;
+
+error:
+  if (_idle)
+    SDL_DestroyCond(_idle);
+
+  if (_queued)
+    SDL_DestroyCond(_queued);
+
+  SDL_DestroyMutex(_mutex);
+  return false;
+}
+
+void Worker::destroy()
+{
+  SDL_LockMutex(_mutex);
+  _quit = true;
+  SDL_CondSignal(_queued);
+  SDL_UnlockMutex(_mutex);
+
+  // the thread only quits when the queue is empty
+  SDL_WaitThread(_thread, NULL);
+  poll();
+
+  SDL_DestroyCond(_idle);
+  SDL_DestroyCond(_queued);
+  SDL_DestroyMutex(_mutex);
+}
+
+void Worker::queue(const Job& job, const Done& done)
+{
+  Entry entry;
+  entry.job = job;
+  entry.done = done;
+  entry.ok = false;
+
+  SDL_LockMutex(_mutex);
+  _jobs.push_back(entry);
+  SDL_CondSignal(_queued);
+  SDL_UnlockMutex(_mutex);
+}
+
+void Worker::poll()
+{
+  std::vector<Entry> finished;
+
+  SDL_LockMutex(_mutex);
+  finished.swap(_finished);
+  SDL_UnlockMutex(_mutex);
+
+  for (const auto& entry : finished)
+  {
+    if (entry.done)
+      entry.done(entry.ok);
+  }
+}
+
+void Worker::flush()
+{
+  SDL_LockMutex(_mutex);
+
+  while (!_jobs.empty() || _running)
+    SDL_CondWait(_idle, _mutex);
+
+  SDL_UnlockMutex(_mutex);
+
+  poll();
+}
+
+int Worker::s_thread(void* udata)
+{
+  return ((Worker*)udata)->run();
+}
+
+int Worker::run()
+{
+  SDL_LockMutex(_mutex);
+
+  for (;;)
+  {
+    while (_jobs.empty() && !_quit)
+      SDL_CondWait(_queued, _mutex);
+
+    if (_jobs.empty())
+      break;
+
+    Entry entry = _jobs.front();
+    _jobs.pop_front();
+    _running = true;
+    SDL_UnlockMutex(_mutex);
+
+    entry.ok = entry.job(_logger);
+
+    SDL_LockMutex(_mutex);
+    _running = false;
+    _finished.push_back(entry);
+    SDL_CondBroadcast(_idle);
+  }
+
+  SDL_UnlockMutex(_mutex);
+  return 0;
+}
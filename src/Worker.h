@@ -0,0 +1,78 @@
+/*
+Copyright (C) 2018 Andre Leiradella
+
+This file is part of RALibretro.
+
+RALibretro is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RALibretro is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "components/Logger.h"
+
+#include <SDL_mutex.h>
+#include <SDL_thread.h>
+
+#include <deque>
+#include <functional>
+#include <vector>
+
+/* Runs jobs on a background thread, one at a time and in the order they were queued.
+ *
+ * Jobs must not touch the core, GL or RAInterface. They get the logger given to init, which is
+ * thread safe. The completion of each job runs on the thread that calls poll() once the job has
+ * finished, with the job's result.
+ */
+class Worker
+{
+public:
+  typedef std::function<bool(Logger* logger)> Job;
+  typedef std::function<void(bool ok)> Done;
+
+  bool init(Logger* logger, const char* name);
+
+  /* Finishes all queued jobs and runs their completions */
+  void destroy();
+
+  void queue(const Job& job, const Done& done = nullptr);
+
+  /* Runs the completions of the finished jobs, must be called regularly from the main thread */
+  void poll();
+
+  /* Waits until all queued jobs are finished and runs their completions */
+  void flush();
+
+protected:
+  struct Entry
+  {
+    Job  job;
+    Done done;
+    bool ok;
+  };
+
+  static int s_thread(void* udata);
+  int run();
+
+  Logger* _logger;
+
+  SDL_Thread* _thread;
+  SDL_mutex*  _mutex;
+  SDL_cond*   _queued;
+  SDL_cond*   _idle;
+
+  std::deque<Entry>  _jobs;
+  std::vector<Entry> _finished;
+  bool _running;  /* a job was taken from the queue and is still running */
+  bool _quit;
+};
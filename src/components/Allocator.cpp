@@ -0,0 +1,137 @@
+/*
+Copyright (C) 2018 Andre Leiradella
+
+This file is part of RALibretro.
+
+RALibretro is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RALibretro is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Allocator.h"
+
+#include <stdlib.h>
+
+#define TAG "[ALC] "
+
+bool Allocator::init(libretro::LoggerComponent* logger, size_t blockSize)
+{
+  _logger = logger;
+  _blockSize = blockSize;
+  _current = _head = _used = _highWater = 0;
+  return true;
+}
+
+void Allocator::destroy()
+{
+  if (_highWater != 0)
+  {
+    _logger->info(TAG "High-water mark was %zu bytes", _highWater);
+  }
+
+  freeBlocks();
+}
+
+void Allocator::reset()
+{
+  if (_blocks.size() > 1)
+  {
+    size_t total = 0;
+
+    for (const auto& block : _blocks)
+    {
+      total += block.size;
+    }
+
+    freeBlocks();
+
+    if (!addBlock(total))
+    {
+      _logger->warn(TAG "Could not merge the blocks into one of %zu bytes", total);
+    }
+  }
+
+  _current = _head = _used = 0;
+}
+
+void* Allocator::allocate(size_t alignment, size_t numBytes)
+{
+  const size_t align_m1 = alignment - 1;
+
+  while (_current < _blocks.size())
+  {
+    const Block& block = _blocks[_current];
+    const uintptr_t address = (uintptr_t)(block.data + _head);
+    const size_t padding = ((address + align_m1) & ~(uintptr_t)align_m1) - address;
+
+    if (_head + padding <= block.size && numBytes <= block.size - _head - padding)
+    {
+      void* ptr = block.data + _head + padding;
+      _head += padding + numBytes;
+      _used += padding + numBytes;
+
+      if (_used > _highWater)
+      {
+        _highWater = _used;
+      }
+
+      return ptr;
+    }
+
+    // the rest of this block is lost until the next reset
+    _used += block.size - _head;
+    _current++;
+    _head = 0;
+  }
+
+  // requests bigger than the block size get a block of their own
+  size_t size = numBytes + align_m1;
+
+  if (size < _blockSize)
+  {
+    size = _blockSize;
+  }
+
+  if (!addBlock(size))
+  {
+    _logger->error(TAG "Out of memory allocating %zu bytes", numBytes);
+    return NULL;
+  }
+
+  _logger->debug(TAG "Added a block of %zu bytes, %zu blocks now", size, _blocks.size());
+  return allocate(alignment, numBytes);
+}
+
+bool Allocator::addBlock(size_t size)
+{
+  Block block;
+  block.data = (uint8_t*)malloc(size);
+  block.size = size;
+
+  if (block.data == NULL)
+  {
+    return false;
+  }
+
+  _blocks.push_back(block);
+  return true;
+}
+
+void Allocator::freeBlocks()
+{
+  for (const auto& block : _blocks)
+  {
+    free(block.data);
+  }
+
+  _blocks.clear();
+}
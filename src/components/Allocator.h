@@ -21,46 +21,43 @@ along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "libretro/Core.h"
 
-template<size_t N>
+#include <stdint.h>
+
+#include <vector>
+
+/* Arena for the data the core hands to the frontend, freed all at once by reset.
+ *
+ * It grows in blocks as needed. On reset, the blocks are merged into one as big as all of them
+ * together, so the next core that needs as much memory gets it without growing again.
+ */
 class Allocator: public libretro::AllocatorComponent
 {
 public:
-  inline bool init(libretro::LoggerComponent* logger)
-  {
-    _logger = logger;
-    _head = 0;
-    return true;
-  }
-
-  inline void destroy() {}
-
-  virtual void  reset() override
-  {
-    _head = 0;
-  }
-
-  virtual void* allocate(size_t alignment, size_t numBytes) override
-  {
-    size_t align_m1 = alignment - 1;
-    size_t ptr = (_head + align_m1) & ~align_m1;
+  bool init(libretro::LoggerComponent* logger, size_t blockSize = 64 * 1024);
+  void destroy();
 
-    if (numBytes <= (kBufferSize - ptr))
-    {
-      _head = ptr + numBytes;
-      return (void*)(_buffer + ptr);
-    }
+  virtual void  reset() override;
+  virtual void* allocate(size_t alignment, size_t numBytes) override;
 
-    _logger->printf(RETRO_LOG_ERROR, "Out of memory allocating %u bytes", numBytes);
-    return NULL;
-  }
+  /* Most bytes in use at the same time since init, padding included */
+  size_t highWater() const { return _highWater; }
 
 protected:
-  enum
+  struct Block
   {
-    kBufferSize = N
+    uint8_t* data;
+    size_t   size;
   };
 
+  bool   addBlock(size_t size);
+  void   freeBlocks();
+
   libretro::LoggerComponent* _logger;
-  uint8_t        _buffer[N];
-  size_t         _head;
+  size_t             _blockSize;
+
+  std::vector<Block> _blocks;
+  size_t             _current;  /* block being allocated from */
+  size_t             _head;     /* first free byte in the current block */
+  size_t             _used;     /* bytes in the blocks before the current one, and up to the head */
+  size_t             _highWater;
 };
@@ -19,12 +19,21 @@ along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "Audio.h"
 
+#include "Dialog.h"
+#include "Metrics.h"
+#include "Recorder.h"
+#include "jsonsax/jsonsax.h"
+
 #include <SDL_timer.h>
 #include <string.h>
 #include <math.h>
 
+#include <chrono>
+
 #define TAG "[AUD] "
 
+#ifdef AUDIO_FIFO_MUTEX
+
 bool Fifo::init(size_t size)
 {
   _mutex = SDL_CreateMutex();
@@ -33,16 +42,26 @@ bool Fifo::init(size_t size)
   {
     return false;
   }
+
+  _drained = SDL_CreateCond();
+
+  if (!_drained)
+  {
+    SDL_DestroyMutex(_mutex);
+    return false;
+  }
   
-  _buffer = (uint8_t*)malloc(size);
+  /* twice the size so reservations never wrap, see commit() */
+  _buffer = (uint8_t*)malloc(size * 2);
   
   if (_buffer == NULL)
   {
+    SDL_DestroyCond(_drained);
     SDL_DestroyMutex(_mutex);
     return false;
   }
   
-  _size = _avail = size;
+  _size = _limit = _avail = size;
   _first = _last = 0;
   return true;
 }
@@ -50,6 +69,7 @@ bool Fifo::init(size_t size)
 void Fifo::destroy()
 {
   ::free(_buffer);
+  SDL_DestroyCond(_drained);
   SDL_DestroyMutex(_mutex);
 }
 
@@ -79,6 +99,7 @@ void Fifo::read(void* data, size_t size)
   _first = (_first + size) % _size;
   _avail += size;
 
+  SDL_CondSignal(_drained);
   SDL_UnlockMutex(_mutex);
 }
 
@@ -105,6 +126,65 @@ void Fifo::write(const void* data, size_t size)
   SDL_UnlockMutex(_mutex);
 }
 
+void* Fifo::reserve(size_t size)
+{
+  /* the consumer never touches the free part of the buffer, so it's safe to fill it unlocked */
+  if (free() < size)
+  {
+    return NULL;
+  }
+
+  return _buffer + _last;
+}
+
+void Fifo::commit(size_t size)
+{
+  SDL_LockMutex(_mutex);
+
+  /* move whatever went past the end of the ring to its beginning */
+  if (_last + size > _size)
+  {
+    memcpy(_buffer, _buffer + _size, _last + size - _size);
+  }
+
+  _last = (_last + size) % _size;
+  _avail -= size;
+
+  SDL_UnlockMutex(_mutex);
+}
+
+bool Fifo::waitFree(size_t size, unsigned timeoutMs)
+{
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+
+  SDL_LockMutex(_mutex);
+
+  /* the space over the limit doesn't count as free */
+  while (_avail < size + (_size - _limit))
+  {
+    const auto now = std::chrono::steady_clock::now();
+
+    if (now >= deadline)
+    {
+      break;
+    }
+
+    const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count() + 1;
+    SDL_CondWaitTimeout(_drained, _mutex, (Uint32)remaining);
+  }
+
+  const bool ok = _avail >= size + (_size - _limit);
+  SDL_UnlockMutex(_mutex);
+  return ok;
+}
+
+void Fifo::setLimit(size_t limit)
+{
+  SDL_LockMutex(_mutex);
+  _limit = limit < _size ? limit : _size;
+  SDL_UnlockMutex(_mutex);
+}
+
 size_t Fifo::occupied()
 {
   size_t avail;
@@ -121,44 +201,278 @@ size_t Fifo::free()
   size_t avail;
 
   SDL_LockMutex(_mutex);
-  avail = _avail;
+  avail = _avail > _size - _limit ? _avail - (_size - _limit) : 0;
   SDL_UnlockMutex(_mutex);
 
   return avail;
 }
 
+#else
+
+bool Fifo::init(size_t size)
+{
+  /* round the capacity up to a power of two so positions can be masked instead of divided */
+  size_t capacity = 1;
+
+  while (capacity < size)
+  {
+    capacity <<= 1;
+  }
+
+  _waitMutex = SDL_CreateMutex();
+
+  if (!_waitMutex)
+  {
+    return false;
+  }
+
+  _drained = SDL_CreateCond();
+
+  if (!_drained)
+  {
+    SDL_DestroyMutex(_waitMutex);
+    return false;
+  }
+
+  _buffer = (uint8_t*)malloc(capacity * 2);
+
+  if (_buffer == NULL)
+  {
+    SDL_DestroyCond(_drained);
+    SDL_DestroyMutex(_waitMutex);
+    return false;
+  }
+
+  _size = capacity;
+  _mask = capacity - 1;
+  _limit.store(capacity, std::memory_order_relaxed);
+
+  _head.store(0, std::memory_order_relaxed);
+  _tail.store(0, std::memory_order_relaxed);
+  _flush.store(false, std::memory_order_relaxed);
+  _waiting.store(false, std::memory_order_release);
+  return true;
+}
+
+void Fifo::destroy()
+{
+  ::free(_buffer);
+  SDL_DestroyCond(_drained);
+  SDL_DestroyMutex(_waitMutex);
+}
+
+void Fifo::reset()
+{
+  /* the read position belongs to the consumer, ask it to drop everything on its next read */
+  _flush.store(true, std::memory_order_release);
+}
+
+void Fifo::read(void* data, size_t size)
+{
+  size_t head = _head.load(std::memory_order_relaxed);
+  const size_t tail = _tail.load(std::memory_order_acquire);
+
+  if (_flush.exchange(false, std::memory_order_acquire))
+  {
+    head = tail;
+  }
+
+  size_t count = tail - head;
+
+  if (count > size)
+  {
+    count = size;
+  }
+
+  const size_t offset = head & _mask;
+  size_t first = count;
+  size_t second = 0;
+
+  if (first > _size - offset)
+  {
+    first = _size - offset;
+    second = count - first;
+  }
+
+  memcpy(data, _buffer + offset, first);
+  memcpy((uint8_t*)data + first, _buffer, second);
+
+  if (count < size)
+  {
+    /* only happens if the FIFO was flushed after the caller checked occupied() */
+    memset((uint8_t*)data + count, 0, size - count);
+  }
+
+  _head.store(head + count, std::memory_order_seq_cst);
+
+  /* the mutex is only touched when the producer is actually parked in waitFree */
+  if (_waiting.load(std::memory_order_seq_cst))
+  {
+    SDL_LockMutex(_waitMutex);
+    SDL_CondSignal(_drained);
+    SDL_UnlockMutex(_waitMutex);
+  }
+}
+
+void Fifo::write(const void* data, size_t size)
+{
+  const size_t head = _head.load(std::memory_order_acquire);
+  const size_t tail = _tail.load(std::memory_order_relaxed);
+  const size_t avail = _size - (tail - head);
+
+  if (size > avail)
+  {
+    /* never overwrite unread data, drop what doesn't fit */
+    size = avail;
+  }
+
+  const size_t offset = tail & _mask;
+  size_t first = size;
+  size_t second = 0;
+
+  if (first > _size - offset)
+  {
+    first = _size - offset;
+    second = size - first;
+  }
+
+  memcpy(_buffer + offset, data, first);
+  memcpy(_buffer, (const uint8_t*)data + first, second);
+
+  _tail.store(tail + size, std::memory_order_release);
+}
+
+void* Fifo::reserve(size_t size)
+{
+  if (free() < size)
+  {
+    return NULL;
+  }
+
+  return _buffer + (_tail.load(std::memory_order_relaxed) & _mask);
+}
+
+void Fifo::commit(size_t size)
+{
+  const size_t tail = _tail.load(std::memory_order_relaxed);
+  const size_t offset = tail & _mask;
+
+  /* move whatever went past the end of the ring to its beginning, this is the only copy and
+   * only happens when the reservation straddles the end */
+  if (offset + size > _size)
+  {
+    memcpy(_buffer, _buffer + _size, offset + size - _size);
+  }
+
+  _tail.store(tail + size, std::memory_order_release);
+}
+
+bool Fifo::waitFree(size_t size, unsigned timeoutMs)
+{
+  if (free() >= size)
+  {
+    return true;
+  }
+
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+
+  SDL_LockMutex(_waitMutex);
+  _waiting.store(true, std::memory_order_seq_cst);
+
+  /* free() is re-checked with the mutex held, so a signal sent after the check can't be lost */
+  while (free() < size)
+  {
+    const auto now = std::chrono::steady_clock::now();
+
+    if (now >= deadline)
+    {
+      break;
+    }
+
+    const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count() + 1;
+    SDL_CondWaitTimeout(_drained, _waitMutex, (Uint32)remaining);
+  }
+
+  _waiting.store(false, std::memory_order_relaxed);
+  SDL_UnlockMutex(_waitMutex);
+
+  return free() >= size;
+}
+
+size_t Fifo::occupied()
+{
+  const size_t head = _head.load(std::memory_order_acquire);
+  const size_t tail = _tail.load(std::memory_order_acquire);
+
+  return tail - head;
+}
+
+size_t Fifo::free()
+{
+  const size_t limit = _limit.load(std::memory_order_relaxed);
+  const size_t used = occupied();
+
+  return used < limit ? limit - used : 0;
+}
+
+void Fifo::setLimit(size_t limit)
+{
+  _limit.store(limit < _size ? limit : _size, std::memory_order_relaxed);
+}
+
+#endif
+
 bool Audio::init(libretro::LoggerComponent* logger, double sample_rate, int channels, Fifo* fifo)
 {
   _coreRate = 0;
-  _resamplerLeft = NULL;
-  _resamplerRight = NULL;
+  _resampling = false;
+  _quality = Resampler::Quality::Medium;
 
   _logger = logger;
   _sampleRate = sample_rate;
   _channels = channels;
+  _recorder = NULL;
+  _stretching = _spliced = false;
 
   _currentRatio = 0.0;
   _originalRatio = 0.0;
 
+  _maxDeviation = 0.005;
+  _smoothedFill = 0.5;
+  _integral = 0.0;
+
   _fifo = fifo;
+  resetStats();
+
+  _deviceFrames = 0;
+  _lowLatency = _primed = _fastForwarding = false;
+  _underruns = _seenUnderruns = 0;
   return true;
 }
 
 void Audio::destroy()
 {
-  if (_resamplerLeft != NULL)
+  if (_coreRate != 0.0)
   {
-    speex_resampler_destroy(_resamplerLeft);
-    _resamplerLeft = NULL;
+    _logger->info(TAG "FIFO waits: %u (%.3f ms total, %.3f ms max), overflows: %u, underruns: %u, latency %.1f ms + %.1f ms device, rate %+.3f%%",
+      _stats.waits, _stats.waitMicros / 1000.0, _stats.maxWaitMicros / 1000.0, _stats.overflows, _stats.underruns, _stats.latencyMs,
+      deviceLatencyMs(), _stats.rateAdjust * 100.0);
+
+    resetStats();
   }
 
-  if (_resamplerRight != NULL)
+  if (_resampling)
   {
-    speex_resampler_destroy(_resamplerRight);
-    _resamplerRight = NULL;
+    _resampler.destroy();
+    _resampling = false;
   }
 }
 
+void Audio::resetStats()
+{
+  memset(&_stats, 0, sizeof(_stats));
+}
+
 bool Audio::setRate(double rate)
 {
   destroy();
@@ -166,188 +480,463 @@ bool Audio::setRate(double rate)
   _coreRate = rate;
   _currentRatio = _originalRatio = _sampleRate / _coreRate;
 
-  if (_sampleRate == _coreRate)
+  _smoothedFill = 0.5;
+  _integral = 0.0;
+
+  /* every game starts again from the smallest FIFO */
+  _primed = false;
+
+  if (_lowLatency)
+    _fifo->setLimit(0);
+
+  if (_sampleRate == _coreRate && _maxDeviation == 0.0)
   {
     _logger->info(TAG "Resampler not needed to convert from %f to %f", _coreRate, _sampleRate);
   }
   else
   {
-    int error;
-    _resamplerLeft = speex_resampler_init(1, _coreRate, _sampleRate, SPEEX_RESAMPLER_QUALITY_DEFAULT, &error);
-
-    if (_resamplerLeft == NULL)
-    {
-      _logger->error(TAG "speex_resampler_init: %s", speex_resampler_strerror(error));
-      return false;
-    }
-
-    _resamplerRight = speex_resampler_init(1, _coreRate, _sampleRate, SPEEX_RESAMPLER_QUALITY_DEFAULT, &error);
-    if (_resamplerRight == NULL)
+    if (!_resampler.init(_coreRate, _sampleRate, _quality))
     {
-      _logger->error(TAG "speex_resampler_init: %s", speex_resampler_strerror(error));
+      _logger->error(TAG "Error initializing the resampler to convert from %f to %f", _coreRate, _sampleRate);
       return false;
     }
 
-    _logger->info(TAG "Resampler initialized to convert from %f to %f", _coreRate, _sampleRate);
+    _resampling = true;
+    _logger->info(TAG "Resampler initialized to convert from %f to %f (%s, %u taps, %s)", _coreRate, _sampleRate,
+      Resampler::qualityName(_resampler.quality()), _resampler.taps(), Resampler::kernelName());
 
-    /* mimic interleaved support */
-    speex_resampler_set_input_stride(_resamplerLeft, 2);
-    speex_resampler_set_input_stride(_resamplerRight, 2);
-    speex_resampler_set_output_stride(_resamplerLeft, 2);
-    speex_resampler_set_output_stride(_resamplerRight, 2);
+    if (_maxDeviation != 0.0)
+      _logger->info(TAG "Dynamic rate control enabled, maximum deviation %.2f%%", _maxDeviation * 100.0);
   }
 
   return true;
 }
 
-void Audio::mix(const int16_t* samples, size_t frames)
+void Audio::updateRateControl()
 {
-  _logger->debug(TAG "Processing %zu audio frames", frames);
+  /* PI controller driving the FIFO towards half full. The fill level is smoothed first so the
+   * bursty consumption of the audio callback doesn't make the ratio jitter, and the ratio is
+   * slew limited so the resampler never sees a discontinuity. */
+  const double kSmoothing = 0.05;
+  const double kProportional = 0.5;
+  const double kIntegral = 0.002;
+  const double kMaxSlew = 0.00002;
 
-  size_t avail = _fifo->free();
-  size_t output_size;
-  int16_t* output;
-  spx_uint32_t out_len;
+  /* in low latency mode the FIFO is capped well below its size, the fill is relative to the cap */
+  const size_t limit = _fifo->limit();
+
+  if (limit == 0)
+    return;
+
+  const double fill = (double)_fifo->occupied() / (double)limit;
+  _smoothedFill += (fill - _smoothedFill) * kSmoothing;
+
+  const double error = 0.5 - _smoothedFill;
+  _integral += error * kIntegral;
+
+  /* anti-windup */
+  if (_integral > 1.0)
+    _integral = 1.0;
+  else if (_integral < -1.0)
+    _integral = -1.0;
 
-  if (_sampleRate == _coreRate)
+  double control = kProportional * error + _integral;
+
+  if (control > 1.0)
+    control = 1.0;
+  else if (control < -1.0)
+    control = -1.0;
+
+  const double target = _originalRatio * (1.0 + _maxDeviation * control);
+  const double maxStep = _originalRatio * kMaxSlew;
+  double delta = target - _currentRatio;
+
+  if (delta > maxStep)
+    delta = maxStep;
+  else if (delta < -maxStep)
+    delta = -maxStep;
+
+  if (delta != 0.0)
   {
-    /* no resampling needed */
-    output = (int16_t*)samples;
-    out_len = frames * 2;
+    _currentRatio += delta;
+    _resampler.setRate(_coreRate, _coreRate * _currentRatio);
   }
-  else
+
+  _stats.rateAdjust = _currentRatio / _originalRatio - 1.0;
+}
+
+void Audio::setDevice(unsigned frames, bool lowLatency)
+{
+  _deviceFrames = frames;
+  _lowLatency = lowLatency;
+  _primed = false;
+
+  /* in low latency mode mix raises the limit to what the batches need */
+  _fifo->setLimit(lowLatency ? 0 : _fifo->size());
+}
+
+void Audio::growLimit(size_t limit)
+{
+  _fifo->setLimit(limit);
+
+  /* what the controller integrated was relative to the old limit, it would keep pushing the
+   * ratio the same way long after the FIFO is where it should be */
+  _integral = 0.0;
+}
+
+void Audio::trackUnderruns(size_t needed)
+{
+  /* a batch is written all at once into a FIFO kept half full, anything less than two would
+   * always wait */
+  if (_lowLatency && _fifo->limit() < needed * 2)
+    growLimit(needed * 2);
+
+  const unsigned underruns = _underruns.load(std::memory_order_relaxed);
+
+  if (!_primed || _fastForwarding)
   {
-#if 0 /* adjusting the sample rate between resampling calls can cause clicking if sufficient data is still in the buffer from the previous resample */
-    /* adjust the audio input rate. */
-    const int    half_size = (int)_fifo->size() / 2;
-    const int    delta_mid = (int)avail - half_size;
-    const double direction = (double)delta_mid / (double)half_size;
-    const double rateControlDelta = 0.005;
-    const double adjust = 1.0 + rateControlDelta * direction;
+    /* the callback runs dry while the FIFO fills up for the first time, that's not an underrun */
+    _seenUnderruns = underruns;
+    _primed = !_fastForwarding && _fifo->occupied() >= _fifo->limit() / 2;
+    return;
+  }
 
-    _currentRatio = _originalRatio * adjust;
+  if (underruns == _seenUnderruns)
+    return;
 
-    if (_currentRatio != _originalRatio)
-      _logger->debug(TAG "Original ratio %f adjusted by %f to %f", _originalRatio, adjust, _currentRatio);
-#endif
+  _stats.underruns += underruns - _seenUnderruns;
+  metrics::add(metrics::kAudioUnderruns, underruns - _seenUnderruns);
+  _seenUnderruns = underruns;
 
-    /* allocate output buffer */
-    out_len = (spx_uint32_t)ceil(frames * 2 * _currentRatio);
-    out_len += (out_len & 1);  /* don't send incomplete frames */
+  if (_lowLatency && _fifo->limit() < _fifo->size())
+  {
+    growLimit(_fifo->limit() + _deviceFrames * _channels * sizeof(int16_t));
+
+    const double bytesPerSecond = _sampleRate * _channels * sizeof(int16_t);
+    _logger->info(TAG "Audio callback ran dry, FIFO grown to %.1f ms", _fifo->limit() * 1000.0 / bytesPerSecond);
+  }
+}
 
-    output_size = out_len * sizeof(int16_t);
-    output = (int16_t*)alloca(output_size);
+void Audio::setTimeStretch(bool enabled)
+{
+  _stretching = enabled;
+  _spliced = false;
+}
 
-    if (output == NULL)
-    {
-      _logger->error(TAG "Error allocating audio resampling output buffer");
-      return;
-    }
+void Audio::setFastForwarding(bool enabled)
+{
+  if (enabled == _fastForwarding)
+    return;
 
-    /* do the resampling */
-    spx_uint32_t in_frames = frames;
-    spx_uint32_t out_frames = out_len / 2;
-    _logger->debug(TAG "Resampling %u samples to %u", in_frames * 2, out_frames * 2);
+  _fastForwarding = enabled;
+  _primed = false;
+}
 
-    {
-      /* speex seems to have issues upsampling SNES (32KHz) properly without introducing static.
-       * This seems to be caused by whatever state is maintained between resampling calls. The
-       * interleaved resampler only remembers state for the last channel - using one resampler
-       * and calling speex_resampler_process_interleaved_int was creating static in the left
-       * channel. To address that, we use two resamplers (one for each channel) and let each keep
-       * their own state.
-       */
-      int error = speex_resampler_process_int(_resamplerLeft, 0, samples, &in_frames, output, &out_frames);
-      if (error == RESAMPLER_ERR_SUCCESS)
-      {
-        error = speex_resampler_process_int(_resamplerRight, 0, samples + 1, &in_frames, output + 1, &out_frames);
-        if (error == RESAMPLER_ERR_SUCCESS)
-        {
-          /* update with the actual number of frames created */
-          out_len = out_frames * 2;
-        }
-      }
+const int16_t* Audio::splice(const int16_t* samples, size_t frames)
+{
+  _grain.assign(samples, samples + frames * 2);
+
+  if (_spliced)
+  {
+    // the offset from the end of the previous batch fades out over the first frames
+    const size_t count = frames < kSpliceFrames ? frames : kSpliceFrames;
+    const int offset[2] = { _lastFrame[0] - _grain[0], _lastFrame[1] - _grain[1] };
 
-      if (error != RESAMPLER_ERR_SUCCESS)
+    for (size_t i = 0; i < count; i++)
+    {
+      for (size_t c = 0; c < 2; c++)
       {
-        memset(output, 0, output_size);
-        _logger->error(TAG "speex_resampler_process_interleaved_int: %s", speex_resampler_strerror(error));
+        int value = _grain[i * 2 + c] + offset[c] * (int)(count - i) / (int)count;
+        value = value < -32768 ? -32768 : value > 32767 ? 32767 : value;
+        _grain[i * 2 + c] = (int16_t)value;
       }
     }
   }
 
-  /* flush to FIFO queue */
-  output_size = out_len * sizeof(int16_t);
-  const size_t needed = out_len * _channels;
+  _lastFrame[0] = _grain[frames * 2 - 2];
+  _lastFrame[1] = _grain[frames * 2 - 1];
+  _spliced = true;
+
+  return _grain.data();
+}
+
+void Audio::mix(const int16_t* samples, size_t frames)
+{
+  _logger->debug(TAG "Processing %zu audio frames", frames);
+
+  if (_stretching && frames != 0)
+    samples = splice(samples, frames);
+
+  if (_resampling && _maxDeviation != 0.0)
+    updateRateControl();
+
+  /* reserve room for the stereo output in the FIFO, with room for the frame the resampler may
+   * still have pending, and for the channel expansion done in place before committing */
+  const size_t max_frames = _resampling ? (size_t)ceil(frames * _currentRatio) + 1 : frames;
+  const size_t frame_size = _channels * sizeof(int16_t);
+  const size_t needed = max_frames * (_channels > 2 ? _channels : 2) * sizeof(int16_t);
+
+  trackUnderruns(needed);
+
+  metrics::set(metrics::kAudioFifoBytes, _fifo->occupied());
+  metrics::set(metrics::kAudioFifoLimit, _fifo->limit());
+
+  size_t avail = _fifo->free();
   if (avail < needed)
   {
-    _logger->debug(TAG "Waiting for FIFO (need %zu bytes but only %zu available), sleeping", needed, avail);
+    _logger->debug(TAG "Waiting for FIFO (need %zu bytes but only %zu available)", needed, avail);
+
+    /* the audio callback wakes us up as soon as it drains the FIFO */
+    const unsigned MAX_WAIT = 250;
+    const auto tWaitStart = std::chrono::steady_clock::now();
+    const bool drained = _fifo->waitFree(needed, MAX_WAIT);
+    const auto tWaitEnd = std::chrono::steady_clock::now();
+    const uint64_t waited = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(tWaitEnd - tWaitStart).count();
+
+    _stats.waits++;
+    _stats.waitMicros += waited;
+
+    if (waited > _stats.maxWaitMicros)
+      _stats.maxWaitMicros = waited;
+
+    /* prevent infinite stall if the consumer stopped reading */
+    if (!drained)
+    {
+      _stats.overflows++;
+      _logger->warn(TAG "FIFO still full after %ums, flushing", MAX_WAIT);
+      _fifo->reset();
+    }
+  }
+
+  int16_t* output = (int16_t*)_fifo->reserve(needed);
+
+  if (output == NULL)
+  {
+    /* the FIFO is still being flushed, drop this batch */
+    _logger->debug(TAG "FIFO full, dropping %zu audio frames", frames);
 
-    const int MAX_WAIT = 250;
-    int tries = MAX_WAIT;
-    do {
-      SDL_Delay(1);
-      avail = _fifo->free();
-      if (avail >= needed)
-        break;
+    if (_resampling)
+    {
+      /* keep the resampler history continuous */
+      int16_t discard[64 * 2];
 
-      /* prevent infinite loop if fifo full */
-      if (--tries == 0)
+      for (size_t done = 0; done < frames; done += 64)
       {
-        _logger->warn(TAG "FIFO still full after %dms, flushing", MAX_WAIT);
-        _fifo->reset();
-        break;
+        const size_t count = frames - done < 64 ? frames - done : 64;
+        _resampler.process(samples + done * 2, count, discard, 64);
       }
-    } while (true);
+    }
+
+    return;
   }
 
-  if (_channels == 2)
+  size_t out_frames;
+
+  if (_resampling)
   {
-    /* input is 2 channels, output is 2 channels, just flush it */
-    _fifo->write(output, output_size);
+    /* resample both channels in one pass, straight into the FIFO */
+    const auto tResampleStart = std::chrono::steady_clock::now();
+    out_frames = _resampler.process(samples, frames, output, max_frames);
+    const auto tResampleEnd = std::chrono::steady_clock::now();
+
+    const double micros = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(tResampleEnd - tResampleStart).count() / 1000.0;
+    _stats.resampleMicros += (micros - _stats.resampleMicros) * 0.05;
+
+    _logger->debug(TAG "Resampled %zu samples to %zu", frames * 2, out_frames * 2);
   }
   else
   {
-    /* input is 2 channels, have to add silence for other channels */
-    int16_t* read = output;
-    int16_t* stop = output + out_len;
-    const size_t flush_frames = 64;
-    int16_t* expanded = (int16_t*)alloca(flush_frames * _channels * sizeof(int16_t));
-    int16_t* write = expanded;
-    int count = 0;
+    /* no resampling needed */
+    memcpy(output, samples, frames * 2 * sizeof(int16_t));
+    out_frames = frames;
+  }
+
+  if (_channels != 2)
+    expandChannels(output, out_frames);
+
+  if (_recorder != NULL && _recorder->recording())
+    _recorder->addAudio(output, out_frames);
+
+  _fifo->commit(out_frames * frame_size);
+
+  /* latency as seen by the samples just queued */
+  const double bytesPerSecond = _sampleRate * _channels * sizeof(int16_t);
+  const double latencyMs = _fifo->occupied() * 1000.0 / bytesPerSecond;
+  _stats.latencyMs += (latencyMs - _stats.latencyMs) * 0.05;
+
+  _logger->debug(TAG "Wrote %zu bytes to the FIFO", out_frames * frame_size);
+}
 
-    if (expanded == NULL)
+void Audio::expandChannels(int16_t* data, size_t frames)
+{
+  if (_channels == 1)
+  {
+    /* keep only the left channel, the output shrinks so walk forwards */
+    for (size_t i = 0; i < frames; i++)
+      data[i] = data[i * 2];
+  }
+  else
+  {
+    /* add silence for the other channels, the output grows so walk backwards */
+    const int channels = _channels;
+
+    for (size_t i = frames; i-- > 0;)
     {
-      _logger->error(TAG "Error allocating audio channel expansion buffer");
-      return;
+      const int16_t left = data[i * 2];
+      const int16_t right = data[i * 2 + 1];
+      int16_t* frame = data + i * channels;
+
+      frame[0] = left;
+      frame[1] = right;
+
+      for (int j = 2; j < channels; j++)
+        frame[j] = 0;
     }
+  }
+}
 
-    while (read < stop)
-    {
-      *write++ = *read++;
-      if (_channels > 1)
-      {
-        *write++ = *read++;
+std::string Audio::serialize()
+{
+  std::string json("{");
 
-        for (int i = 2; i < _channels; ++i)
-          *write++ = 0;
-      }
-      else
+  json.append("\"_maxDeviation\":");
+  json.append(std::to_string(_maxDeviation));
+  json.append(",");
+
+  json.append("\"_quality\":");
+  json.append(std::to_string((int)_quality));
+
+  json.append("}");
+  return json;
+}
+
+void Audio::deserialize(const char* json)
+{
+  struct Deserialize
+  {
+    Audio* self;
+    std::string key;
+  };
+
+  Deserialize ud;
+  ud.self = this;
+
+  jsonsax_parse(json, &ud, [](void* udata, jsonsax_event_t event, const char* str, size_t num) {
+    auto ud = (Deserialize*)udata;
+
+    if (event == JSONSAX_KEY)
+    {
+      ud->key = std::string(str, num);
+    }
+    else if (event == JSONSAX_NUMBER)
+    {
+      if (ud->key == "_maxDeviation")
       {
-        ++read;
+        const double value = strtod(str, NULL);
+        if (value >= 0.0 && value <= 0.05)
+          ud->self->_maxDeviation = value;
       }
-
-      if (++count == flush_frames)
+      else if (ud->key == "_quality")
       {
-        _fifo->write(expanded, flush_frames * _channels * sizeof(int16_t));
-        write = expanded;
-        count = 0;
+        const int value = (int)strtol(str, NULL, 10);
+        if (value >= (int)Resampler::Quality::Linear && value <= (int)Resampler::Quality::High)
+          ud->self->_quality = static_cast<Resampler::Quality>(value);
       }
     }
 
-    if (count > 0)
-      _fifo->write(expanded, count * _channels * sizeof(int16_t));
+    return 0;
+  });
+}
+
+static const double s_maxDeviations[] = { 0.0, 0.001, 0.0025, 0.005, 0.01, 0.02 };
+
+static const char* s_getMaxDeviationOptions(int index, void* udata)
+{
+  switch (index)
+  {
+    case 0: return "Off";
+    case 1: return "0.1%";
+    case 2: return "0.25%";
+    case 3: return "0.5%";
+    case 4: return "1%";
+    case 5: return "2%";
+    default: return NULL;
+  }
+}
+
+static const char* s_getQualityOptions(int index, void* udata)
+{
+  switch (index)
+  {
+    case 0: return "Fastest (linear)";
+    case 1: return "Fast (cubic)";
+    case 2: return "Low";
+    case 3: return "Medium";
+    case 4: return "High";
+    default: return NULL;
+  }
+}
+
+void Audio::showDialog()
+{
+  const WORD WIDTH = 160;
+  const WORD LINE = 15;
+
+  Dialog db;
+  db.init("Audio Settings");
+
+  WORD y = 0;
+
+  int deviation = 0;
+  for (int i = 0; i < (int)(sizeof(s_maxDeviations) / sizeof(s_maxDeviations[0])); i++)
+  {
+    if (s_maxDeviations[i] <= _maxDeviation)
+      deviation = i;
   }
 
-  _logger->debug(TAG "Wrote %zu bytes to the FIFO", needed);
+  db.addLabel("Rate control", 51001, 0, y, 60, 8);
+  db.addCombobox(51002, 65, y - 2, WIDTH - 65, 12, 100, s_getMaxDeviationOptions, NULL, &deviation);
+  y += LINE;
+
+  int quality = (int)_quality;
+  db.addLabel("Resampler quality", 51004, 0, y, 60, 8);
+  db.addCombobox(51005, 65, y - 2, WIDTH - 65, 12, 100, s_getQualityOptions, NULL, &quality);
+  y += LINE;
+
+  char latency[96];
+  if (_coreRate == 0.0)
+    snprintf(latency, sizeof(latency), "Latency: n/a");
+  else
+    snprintf(latency, sizeof(latency), "Latency: %.1f + %.1f ms (rate %+.3f%%, %u underruns)", _stats.latencyMs, deviceLatencyMs(),
+      _stats.rateAdjust * 100.0, _stats.underruns);
+
+  db.addLabel(latency, 51003, 0, y, WIDTH, 8);
+  y += LINE;
+
+  char cost[64];
+  if (!_resampling)
+    snprintf(cost, sizeof(cost), "Resampler cost: n/a");
+  else
+    snprintf(cost, sizeof(cost), "Resampler cost: %.1f us/frame (%s)", _stats.resampleMicros, Resampler::kernelName());
+
+  db.addLabel(cost, 51006, 0, y, WIDTH, 8);
+  y += LINE;
+
+  db.addButton("OK", IDOK, WIDTH - 55 - 50, y, 50, 14, true);
+  db.addButton("Cancel", IDCANCEL, WIDTH - 50, y, 50, 14, false);
+
+  if (db.show())
+  {
+    const double maxDeviation = s_maxDeviations[deviation];
+
+    if (maxDeviation != _maxDeviation || quality != (int)_quality)
+    {
+      _maxDeviation = maxDeviation;
+      _quality = static_cast<Resampler::Quality>(quality);
+
+      /* recreate the resampler so rate control can take over or let go of them */
+      if (_coreRate != 0.0)
+        setRate(_coreRate);
+    }
+  }
 }
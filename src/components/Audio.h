@@ -21,10 +21,19 @@ along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "libretro/Components.h"
 
-#include "speex/speex_resampler.h"
+#include "Resampler.h"
 
 #include <SDL_mutex.h>
 
+#include <atomic>
+#include <string>
+#include <vector>
+
+class Recorder;
+
+/* Define AUDIO_FIFO_MUTEX to use the original mutex-guarded FIFO instead of the lock-free ring. */
+#ifdef AUDIO_FIFO_MUTEX
+
 class Fifo
 {
 public:
@@ -35,20 +44,91 @@ public:
   void read(void* data, size_t size);
   void write(const void* data, size_t size);
 
+  /* Returns a contiguous region of size bytes at the write position to be filled in place, or
+   * NULL if there isn't enough free space. The data is only visible to read() after commit(),
+   * which may publish less than what was reserved. */
+  void* reserve(size_t size);
+  void commit(size_t size);
+
+  /* Blocks until at least size bytes are free or the timeout expires, returns false on timeout */
+  bool waitFree(size_t size, unsigned timeoutMs);
+
   inline size_t size() { return _size; }
 
+  /* Caps how much of the buffer the producer may fill, at most size(). free() and waitFree() only
+   * count the space under the limit, and rate control aims at filling half of it. */
+  void setLimit(size_t limit);
+  inline size_t limit() { return _limit; }
+
   size_t occupied();
   size_t free();
 
 protected:
   SDL_mutex* _mutex;
+  SDL_cond*  _drained;
   uint8_t*   _buffer;
   size_t     _size;
+  size_t     _limit;
   size_t     _avail;
   size_t     _first;
   size_t     _last;
 };
 
+#else
+
+/* Single-producer/single-consumer ring. Only the emulation thread may call write() and reset(),
+ * only the audio thread may call read(). occupied() and free() are safe from either side. */
+class Fifo
+{
+public:
+  bool init(size_t size);
+  void destroy();
+  void reset();
+
+  void read(void* data, size_t size);
+  void write(const void* data, size_t size);
+
+  /* Returns a contiguous region of size bytes at the write position to be filled in place, or
+   * NULL if there isn't enough free space. The data is only visible to read() after commit(),
+   * which may publish less than what was reserved. */
+  void* reserve(size_t size);
+  void commit(size_t size);
+
+  /* Blocks until at least size bytes are free or the timeout expires, returns false on timeout */
+  bool waitFree(size_t size, unsigned timeoutMs);
+
+  inline size_t size() { return _size; }
+
+  /* Caps how much of the buffer the producer may fill, at most size(). free() and waitFree() only
+   * count the space under the limit, and rate control aims at filling half of it. */
+  void setLimit(size_t limit);
+  inline size_t limit() { return _limit.load(std::memory_order_relaxed); }
+
+  size_t occupied();
+  size_t free();
+
+protected:
+  enum { kCacheLineSize = 64 };
+
+  /* read and write positions are free running, the buffer offset is (position & _mask). The
+   * buffer is allocated twice as big so reservations never wrap, see commit(). */
+  alignas(kCacheLineSize) std::atomic<size_t> _head;
+  alignas(kCacheLineSize) std::atomic<size_t> _tail;
+  alignas(kCacheLineSize) std::atomic<bool>   _flush;
+  std::atomic<bool>   _waiting;
+
+  alignas(kCacheLineSize) uint8_t* _buffer;
+  size_t   _size;
+  size_t   _mask;
+  std::atomic<size_t> _limit;
+
+  /* only used to park the producer in waitFree, never taken on the fast path */
+  SDL_mutex* _waitMutex;
+  SDL_cond*  _drained;
+};
+
+#endif
+
 class Audio: public libretro::AudioComponent
 {
 public:
@@ -58,6 +138,47 @@ public:
   virtual bool setRate(double rate) override;
   virtual void mix(const int16_t* samples, size_t frames) override;
 
+  struct Stats
+  {
+    unsigned waits;          /* number of times mix had to wait for the FIFO to drain */
+    unsigned overflows;      /* number of times the FIFO was flushed after a wait timed out */
+    uint64_t waitMicros;     /* total time spent waiting */
+    uint64_t maxWaitMicros;  /* longest single wait */
+    double   latencyMs;      /* smoothed FIFO latency */
+    double   rateAdjust;     /* current rate control adjustment, relative to the original ratio */
+    double   resampleMicros; /* smoothed time spent resampling per frame */
+    unsigned underruns;      /* number of times the audio callback found the FIFO short, once it had filled up */
+  };
+
+  const Stats& getStats() const { return _stats; }
+  void resetStats();
+
+  /* The device buffer holds frames of audio on top of the FIFO. In low latency mode the FIFO starts
+   * with room for two batches and grows by one device buffer each time the callback runs dry. */
+  void setDevice(unsigned frames, bool lowLatency);
+  double deviceLatencyMs() const { return _deviceFrames * 1000.0 / _sampleRate; }
+
+  /* Largest relative change dynamic rate control makes to the resampling ratio, 0 when it's off */
+  double maxDeviation() const { return _maxDeviation; }
+
+  /* Called by the audio callback when the FIFO didn't have enough for it */
+  void underrun() { _underruns.fetch_add(1, std::memory_order_relaxed); }
+
+  /* The audio written to the FIFO also goes to the recorder while it's recording */
+  void setRecorder(Recorder* recorder) { _recorder = recorder; }
+
+  /* Fast forward only plays the audio of some of the frames. While this is on, each batch is
+   * ramped from where the previous one ended so the jumps between them don't click. */
+  void setTimeStretch(bool enabled);
+
+  /* The FIFO runs dry while fast forwarding, the callback coming up short then doesn't count as
+   * an underrun, and it has to fill up again before they do */
+  void setFastForwarding(bool enabled);
+
+  std::string serialize();
+  void deserialize(const char* json);
+  void showDialog();
+
 protected:
   libretro::LoggerComponent* _logger;
 
@@ -65,10 +186,40 @@ protected:
   double _coreRate;
   int _channels;
 
+  void updateRateControl();
+  void growLimit(size_t limit);
+  void trackUnderruns(size_t needed);
+  void expandChannels(int16_t* data, size_t frames);
+  const int16_t* splice(const int16_t* samples, size_t frames);
+
   double _currentRatio;
   double _originalRatio;
-  SpeexResamplerState* _resamplerLeft;
-  SpeexResamplerState* _resamplerRight;
+
+  /* dynamic rate control, _maxDeviation == 0 disables it */
+  double _maxDeviation;
+  double _smoothedFill;
+  double _integral;
+
+  Resampler _resampler;
+  Resampler::Quality _quality;
+  bool _resampling;
 
   Fifo* _fifo;
+  Stats _stats;
+
+  unsigned _deviceFrames;
+  bool _lowLatency;
+  bool _primed;             /* the FIFO filled up since it was last emptied */
+  bool _fastForwarding;
+  std::atomic<unsigned> _underruns;
+  unsigned _seenUnderruns;
+
+  Recorder* _recorder;
+
+  enum { kSpliceFrames = 64 };
+
+  bool _stretching;
+  bool _spliced;            /* _lastFrame has the end of the previous batch */
+  int16_t _lastFrame[2];
+  std::vector<int16_t> _grain;
 };
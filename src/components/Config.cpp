@@ -34,6 +34,7 @@ along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
 bool Config::init(libretro::LoggerComponent* logger)
 {
   _logger = logger;
+  _getCalls = _updateCalls = 0;
 
 #ifdef _WINDOWS
   HMODULE hModule = GetModuleHandleW(NULL);
@@ -81,10 +82,18 @@ bool Config::init(libretro::LoggerComponent* logger)
   return true;
 }
 
+void Config::destroy()
+{
+  logPolling();
+}
+
 void Config::reset()
 {
+  logPolling();
+
   _variables.clear();
   _selections.clear();
+  _index.clear();
   _updated = false;
 }
 
@@ -156,6 +165,8 @@ void Config::setVariables(const struct retro_variable* variables, unsigned count
     _variables.push_back(var);
   }
 
+  buildIndex();
+  updateValues();
   _updated = true;
 }
 
@@ -226,19 +237,20 @@ void Config::setVariables(const struct retro_core_option_definition* options, un
     _variables.push_back(var);
   }
 
+  buildIndex();
+  updateValues();
   _updated = true;
 }
 
 void Config::setVariableDisplay(const struct retro_core_option_display* display)
 {
-  for (size_t i = 0; i < _variables.size(); i++)
+  Variable* var = findVariable(display->key);
+
+  if (var != NULL)
   {
-    if (_variables[i]._key == display->key)
-    {
-      _variables[i]._hidden = !display->visible;
-      _logger->info(TAG "Setting visibility on variable %s to %s", display->key, display->visible ? "visible" : "hidden");
-      return;
-    }
+    var->_hidden = !display->visible;
+    _logger->info(TAG "Setting visibility on variable %s to %s", display->key, display->visible ? "visible" : "hidden");
+    return;
   }
 
   _logger->info(TAG "Could not set visibility on unknown variable %s", display->key);
@@ -246,6 +258,8 @@ void Config::setVariableDisplay(const struct retro_core_option_display* display)
 
 bool Config::varUpdated()
 {
+  _updateCalls++;
+
   bool updated = _updated;
   _updated = false;
   return updated;
@@ -253,6 +267,22 @@ bool Config::varUpdated()
 
 const char* Config::getVariable(const char* variable)
 {
+  _getCalls++;
+
+  Variable* var = findVariable(variable);
+
+  if (var != NULL)
+  {
+    // cores may ask for the same variable every frame, only log it once
+    if (var->_lookups++ == 0)
+    {
+      _logger->info(TAG "Variable %s is \"%s\"", variable, var->_value);
+    }
+
+    return var->_value;
+  }
+
+  // not declared by the core, but it may have been in the core's settings
   const auto& found = _selections.find(variable);
 
   if (found != _selections.cend())
@@ -262,20 +292,134 @@ const char* Config::getVariable(const char* variable)
     return value;
   }
 
-  for (const auto& var : _variables)
+  _logger->error(TAG "Variable %s not found", variable);
+  return NULL;
+}
+
+uint32_t Config::hash(const char* key)
+{
+  // FNV-1a
+  uint32_t hash = 2166136261U;
+
+  while (*key != 0)
+  {
+    hash = (hash ^ (uint8_t)*key++) * 16777619U;
+  }
+
+  return hash;
+}
+
+void Config::buildIndex()
+{
+  // at most half full, so probes are short
+  size_t size = 16;
+
+  while (size < _variables.size() * 2)
+  {
+    size *= 2;
+  }
+
+  _index.assign(size, -1);
+
+  for (size_t i = 0; i < _variables.size(); i++)
   {
-    if (var._key == variable)
+    Variable& var = _variables[i];
+    var._hash = hash(var._key.c_str());
+    var._lookups = 0;
+
+    size_t slot = var._hash & (size - 1);
+
+    while (_index[slot] != -1)
     {
-      const char* value = var._options[var._selected].c_str();
-      _logger->warn(TAG "Variable %s not found in the selections, returning \"%s\"", variable, value);
-      return value;
+      slot = (slot + 1) & (size - 1);
+    }
+
+    _index[slot] = (int)i;
+  }
+}
+
+void Config::updateValues()
+{
+  for (auto& var : _variables)
+  {
+    const auto& found = _selections.find(var._key);
+
+    if (found != _selections.cend())
+    {
+      var._value = found->second.c_str();
+    }
+    else if (!var._options.empty())
+    {
+      var._value = var._options[var._selected].c_str();
+    }
+    else
+    {
+      var._value = NULL;
+    }
+  }
+}
+
+Config::Variable* Config::findVariable(const char* key)
+{
+  if (_index.empty())
+  {
+    return NULL;
+  }
+
+  const uint32_t keyHash = hash(key);
+  const size_t mask = _index.size() - 1;
+
+  for (size_t slot = keyHash & mask; _index[slot] != -1; slot = (slot + 1) & mask)
+  {
+    Variable& var = _variables[_index[slot]];
+
+    if (var._hash == keyHash && var._key == key)
+    {
+      return &var;
     }
   }
 
-  _logger->error(TAG "Variable %s not found", variable);
   return NULL;
 }
 
+void Config::logPolling()
+{
+  if (_getCalls == 0 && _updateCalls == 0)
+  {
+    _pollStart = std::chrono::steady_clock::now();
+    return;
+  }
+
+  const auto now = std::chrono::steady_clock::now();
+  double seconds = std::chrono::duration<double>(now - _pollStart).count();
+
+  if (seconds <= 0.0)
+  {
+    seconds = 1.0;
+  }
+
+  const Variable* most = NULL;
+
+  for (const auto& var : _variables)
+  {
+    if (most == NULL || var._lookups > most->_lookups)
+    {
+      most = &var;
+    }
+  }
+
+  _logger->info(TAG "Core asked for variables %u times (%.1f/s) and for updates %u times (%.1f/s)",
+    _getCalls, _getCalls / seconds, _updateCalls, _updateCalls / seconds);
+
+  if (most != NULL && most->_lookups != 0)
+  {
+    _logger->info(TAG "Most asked for variable was %s, %u times", most->_key.c_str(), most->_lookups);
+  }
+
+  _getCalls = _updateCalls = 0;
+  _pollStart = now;
+}
+
 std::string Config::serialize()
 {
   for (const auto& var : _variables)
@@ -288,6 +432,8 @@ std::string Config::serialize()
     }
   }
 
+  updateValues();
+
   std::string json("{");
   const char* comma = "";
 
@@ -355,6 +501,7 @@ void Config::deserialize(const char* json)
     }
   }
 
+  updateValues();
   _updated = true;
 }
 
@@ -485,6 +632,8 @@ void Config::showDialog(const std::string& coreName, Input& input)
         _selections[var._key] = var._options[var._selected];
       }
     }
+
+    updateValues();
   }
 }
 #endif
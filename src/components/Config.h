@@ -25,6 +25,9 @@ along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "libretro/Components.h"
 
+#include <stdint.h>
+
+#include <chrono>
 #include <map>
 #include <unordered_map>
 
@@ -32,7 +35,7 @@ class Config: public libretro::ConfigComponent
 {
 public:
   bool init(libretro::LoggerComponent* logger);
-  void destroy() {}
+  void destroy();
   void reset();
 
   virtual const char* getCoreAssetsDirectory() override;
@@ -79,8 +82,24 @@ protected:
 
     std::vector<std::string> _options;
     std::vector<std::string> _labels;
+
+    uint32_t    _hash;
+    const char* _value;    /* what getVariable returns, see updateValues */
+    unsigned    _lookups;
   };
 
+  static uint32_t hash(const char* key);
+
+  /* Builds _index, must be called when _variables change */
+  void buildIndex();
+
+  /* Points each variable's _value to its selection, must be called when _variables or
+   * _selections change as the pointers go into their strings */
+  void updateValues();
+
+  Variable* findVariable(const char* key);
+  void logPolling();
+
   static void initializeControllerVariable(Variable& variable, const char* name, const char* key, const std::map<std::string, unsigned>& names, unsigned selectedDevice);
 
   libretro::LoggerComponent* _logger;
@@ -94,6 +113,14 @@ protected:
   std::vector<Variable> _variables;
   std::unordered_map<std::string, std::string> _selections;
 
+  /* open addressing table with indices into _variables, -1 marks empty slots */
+  std::vector<int> _index;
+
+  /* how often the core polls, to find the cores that poll every frame */
+  unsigned _getCalls;
+  unsigned _updateCalls;
+  std::chrono::steady_clock::time_point _pollStart;
+
   bool _updated;
   bool _fastForwarding;
 
@@ -23,46 +23,114 @@ along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "jsonsax/jsonsax.h"
 
+#include <SDL_platform.h>
+
+#include <ctype.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <chrono>
+
 #define KEYBOARD_ID -1
 
 #define TAG "[INP] "
 
-static const char* s_gameControllerDB[] =
+/* Mappings are only registered with SDL when a joystick with their GUID is connected, parsing
+ * all of them took most of the startup. The table is sorted by GUID so it can be searched, the
+ * few entries that aren't for a GUID, like xinput, sort last and are registered up front. */
+static constexpr const char* s_gameControllerDB[] =
 {
   // Updated on 2020-06-20 (https://github.com/gabomdq/SDL_GameControllerDB)
   //
   //   to convert to .inl file, remove leading comments and everything not in the #Windows block,
-  //   then run this command to wrap each line in quotes:
+  //   then run this command to wrap each line in quotes and sort them by GUID:
   // 
-  //     sed 's/^/"/' GameControllerDB.txt | sed 's/,$/",/' > GameControllerDB.inl
+  //     sed 's/^/"/' GameControllerDB.txt | sed 's/,$/",/' | LC_ALL=C sort > GameControllerDB.inl
   //
   #include "GameControllerDB.inl"
-  // Some controllers I have around
+};
+
+// Some controllers I have around
+static const char* s_extraMappings[] =
+{
   "351212ab000000000000504944564944,NES30 Joystick,platform:Windows,x:b3,a:b2,b:b1,y:b0,back:b6,start:b7,leftshoulder:b4,rightshoulder:b5,leftx:a0,lefty:a1"
 };
 
+#define GUID_LENGTH 32
+
+static constexpr size_t s_gameControllerDBCount = sizeof(s_gameControllerDB) / sizeof(s_gameControllerDB[0]);
+
+static constexpr int compareGuid(const char* a, const char* b, unsigned i = 0)
+{
+  return i == GUID_LENGTH ? 0 : a[i] != b[i] ? (a[i] < b[i] ? -1 : 1) : compareGuid(a, b, i + 1);
+}
+
+static constexpr bool isSorted(size_t begin, size_t end)
+{
+  return end - begin < 2 || (isSorted(begin, (begin + end) / 2) && isSorted((begin + end) / 2, end)
+    && compareGuid(s_gameControllerDB[(begin + end) / 2 - 1], s_gameControllerDB[(begin + end) / 2]) < 0);
+}
+
+static_assert(isSorted(0, s_gameControllerDBCount), "GameControllerDB.inl must be sorted by GUID");
+
+static bool isGuid(const char* mapping)
+{
+  for (unsigned i = 0; i < GUID_LENGTH; i++)
+  {
+    if (!isxdigit((unsigned char)mapping[i]))
+      return false;
+  }
+
+  return mapping[GUID_LENGTH] == ',';
+}
+
+static const char* findMapping(const char* guid)
+{
+  size_t begin = 0, end = s_gameControllerDBCount;
+
+  while (begin < end)
+  {
+    const size_t middle = begin + (end - begin) / 2;
+    const int cmp = compareGuid(s_gameControllerDB[middle], guid);
+
+    if (cmp == 0)
+      return s_gameControllerDB[middle];
+    else if (cmp < 0)
+      begin = middle + 1;
+    else
+      end = middle;
+  }
+
+  for (size_t i = 0; i < sizeof(s_extraMappings) / sizeof(s_extraMappings[0]); i++)
+  {
+    if (compareGuid(s_extraMappings[i], guid) == 0)
+      return s_extraMappings[i];
+  }
+
+  return NULL;
+}
+
 bool Input::init(libretro::LoggerComponent* logger)
 {
   _logger = logger;
+  _movie = NULL;
+  _override = NULL;
+  _eventTimestamp = _pressTimestamp = 0;
 
   reset();
 
-  // Add controller mappings
-  for (size_t i = 0; i < sizeof(s_gameControllerDB) / sizeof(s_gameControllerDB[0]); i++ )
-  {
-    SDL_GameControllerAddMapping(s_gameControllerDB[i]);
-  }
-  _logger->debug(TAG "Loaded %d controller mappings", sizeof(s_gameControllerDB) / sizeof(s_gameControllerDB[0]));
+  const auto start = std::chrono::steady_clock::now();
+  _mappingsRegistered = 0;
 
-  if (util::exists("GameControllerDB.txt"))
+  // mappings that aren't for a GUID apply to any matching device, they can't wait
+  for (size_t i = s_gameControllerDBCount; i > 0 && !isGuid(s_gameControllerDB[i - 1]); i--)
   {
-    int result = SDL_GameControllerAddMappingsFromFile("GameControllerDB.txt");
-    if (result > 0)
-      _logger->info(TAG "Loaded %d additional controller mappings from file", result);
-    else if (result < 0)
-      _logger->info(TAG "Error processing GameControllerDB.txt: %s", SDL_GetError());
+    if (SDL_GameControllerAddMapping(s_gameControllerDB[i - 1]) >= 0)
+      _mappingsRegistered++;
   }
 
+  loadMappingsFile("GameControllerDB.txt");
+
   // Add the keyboard controller
   Pad keyb;
   memset(&keyb, 0, sizeof(keyb));
@@ -84,9 +152,80 @@ bool Input::init(libretro::LoggerComponent* logger)
     addController(i);
   }
 
+  const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+  _logger->info(TAG "Controllers initialized in %.2f ms, %u mappings registered", elapsed.count() / 1000.0, _mappingsRegistered);
   return true;
 }
 
+void Input::loadMappingsFile(const char* path)
+{
+  _fileMappings.clear();
+
+  if (!util::exists(path))
+    return;
+
+  FILE* file = fopen(path, "r");
+
+  if (file == NULL)
+  {
+    _logger->info(TAG "Error processing %s", path);
+    return;
+  }
+
+  // keep the lines for this platform, like SDL_GameControllerAddMappingsFromFile does
+  const std::string platform = std::string("platform:") + SDL_GetPlatform();
+  char line[4096];
+
+  while (fgets(line, sizeof(line), file) != NULL)
+  {
+    std::string mapping = line;
+
+    while (!mapping.empty() && (mapping.back() == '\n' || mapping.back() == '\r'))
+      mapping.pop_back();
+
+    if (mapping.empty() || mapping[0] == '#')
+      continue;
+
+    if (mapping.find("platform:") != std::string::npos && mapping.find(platform) == std::string::npos)
+      continue;
+
+    if (isGuid(mapping.c_str()))
+    {
+      _fileMappings.push_back(mapping);
+    }
+    else if (SDL_GameControllerAddMapping(mapping.c_str()) >= 0)
+    {
+      _mappingsRegistered++;
+    }
+  }
+
+  fclose(file);
+
+  std::sort(_fileMappings.begin(), _fileMappings.end());
+  _logger->info(TAG "Loaded %u additional controller mappings from %s", (unsigned)_fileMappings.size(), path);
+}
+
+void Input::registerMapping(int which)
+{
+  char guid[GUID_LENGTH + 1];
+  SDL_JoystickGetGUIDString(SDL_JoystickGetDeviceGUID(which), guid, sizeof(guid));
+
+  // the file is added last so it overrides the embedded mappings, as it did before
+  const char* mapping = findMapping(guid);
+
+  const auto found = std::lower_bound(_fileMappings.begin(), _fileMappings.end(), guid,
+    [](const std::string& line, const char* key) { return compareGuid(line.c_str(), key) < 0; });
+
+  if (found != _fileMappings.end() && compareGuid(found->c_str(), guid) == 0)
+    mapping = found->c_str();
+
+  if (mapping != NULL && SDL_GameControllerAddMapping(mapping) >= 0)
+  {
+    _mappingsRegistered++;
+    _logger->debug(TAG "Registered the mapping for %s", guid);
+  }
+}
+
 void Input::reset()
 {
   _descriptors.clear();
@@ -94,6 +233,9 @@ void Input::reset()
   _ports = 0;
   _updated = false;
 
+  _historyCount = 0;
+  _historyNext = 0;
+
   ControllerInfo none;
   none._description = "None";
   none._id = RETRO_DEVICE_NONE;
@@ -120,12 +262,15 @@ void Input::reset()
   }
 
   memset(&_mouse, 0, sizeof(_mouse));
+  memset(&_snapshot, 0, sizeof(_snapshot));
 
   _keyboard._keys.fill(false);
 }
 
 SDL_JoystickID Input::addController(int which)
 {
+  registerMapping(which);
+
   if (SDL_IsGameController(which))
   {
     Pad pad;
@@ -261,9 +406,16 @@ void Input::buttonEvent(int port, Button button, bool pressed)
   }
 
   if (pressed)
+  {
     _info[port][_devices[port]]._state |= (1 << rbutton);
+
+    if (_pressTimestamp == 0)
+      _pressTimestamp = _eventTimestamp;
+  }
   else
+  {
     _info[port][_devices[port]]._state &= ~(1 << rbutton);
+  }
 }
 
 void Input::axisEvent(int port, Axis axis, int16_t value)
@@ -286,7 +438,9 @@ void Input::processEvent(const SDL_Event* event, KeyBinds* keyBinds)
 {
   switch (event->type)
   {
+  case SDL_JOYDEVICEADDED:
   case SDL_CONTROLLERDEVICEADDED:
+    // joysticks only become controllers once their mapping is registered
     addController(event, keyBinds);
     break;
 
@@ -532,7 +686,53 @@ unsigned Input::getController(unsigned port)
 void Input::poll()
 {
   // Events are polled in the main event loop, and arrive in this class via
-  // the processEvent method
+  // the processEvent method. What the core reads until the next poll is
+  // latched here, so it doesn't matter how many times it reads it
+  static_assert((int)Movie::kMaxPorts == (int)kMaxPorts, "movie frames must hold all ports");
+
+  if (_latePoll)
+    _latePoll();
+
+  Movie::Frame& frame = _snapshot._frame;
+  int16_t pressed = 0;
+
+  // netplay and a movie that's playing override the joypads
+  const bool playing = _override == NULL && _movie != NULL && _movie->mode() == Movie::Mode::Playing && _movie->playFrame(&frame);
+
+  if (_override != NULL)
+  {
+    frame = *_override;
+  }
+  else if (!playing)
+  {
+    Movie::Frame live;
+    getLiveFrame(&live);
+
+    for (unsigned port = 0; port < kMaxPorts; port++)
+      pressed |= live.state[port] & ~frame.state[port];
+
+    frame = live;
+
+    if (_movie != NULL)
+      _movie->recordFrame(frame);
+  }
+
+  if (pressed != 0 && _pressTimestamp != 0 && _pressLatched)
+    _pressLatched(_pressTimestamp);
+
+  _pressTimestamp = 0;
+
+  for (unsigned id = 0; id < kMouseIds; id++)
+    _snapshot._mouse[id] = _mouse._button[id];
+
+  _snapshot._mouse[RETRO_DEVICE_ID_MOUSE_X] = (int16_t)(_mouse._absolute_x - _mouse._previous_x);
+  _snapshot._mouse[RETRO_DEVICE_ID_MOUSE_Y] = (int16_t)(_mouse._absolute_y - _mouse._previous_y);
+  _mouse._previous_x = _mouse._absolute_x;
+  _mouse._previous_y = _mouse._absolute_y;
+
+  _snapshot._pointer[RETRO_DEVICE_ID_POINTER_X] = _mouse._relative_x;
+  _snapshot._pointer[RETRO_DEVICE_ID_POINTER_Y] = _mouse._relative_y;
+  _snapshot._pointer[RETRO_DEVICE_ID_POINTER_PRESSED] = _mouse._button[RETRO_DEVICE_ID_MOUSE_LEFT];
 }
 
 int16_t Input::read(unsigned port, unsigned device, unsigned index, unsigned id)
@@ -543,39 +743,18 @@ int16_t Input::read(unsigned port, unsigned device, unsigned index, unsigned id)
     {
       case RETRO_DEVICE_JOYPAD:
         if (id == RETRO_DEVICE_ID_JOYPAD_MASK)
-          return _info[port][_devices[port]]._state;
+          return _snapshot._frame.state[port];
 
-        return (_info[port][_devices[port]]._state >> id) & 1;
+        return (_snapshot._frame.state[port] >> id) & 1;
 
       case RETRO_DEVICE_ANALOG:
-        return _info[port][_devices[port]]._axis[index << 1 | id];
+        return (index << 1 | id) < Movie::kAxes ? _snapshot._frame.axis[port][index << 1 | id] : 0;
 
       case RETRO_DEVICE_MOUSE:
-        switch (id)
-        {
-          case RETRO_DEVICE_ID_MOUSE_X:
-          {
-            int delta = (_mouse._absolute_x - _mouse._previous_x);
-            _mouse._previous_x = _mouse._absolute_x;
-            return (int16_t)delta;
-          }
-          case RETRO_DEVICE_ID_MOUSE_Y:
-          {
-            int delta = (_mouse._absolute_y - _mouse._previous_y);
-            _mouse._previous_y = _mouse._absolute_y;
-            return (int16_t)delta;
-          }
-          default: return _mouse._button[id];
-        }
+        return id < kMouseIds ? _snapshot._mouse[id] : 0;
 
       case RETRO_DEVICE_POINTER:
-        switch (id)
-        {
-          case RETRO_DEVICE_ID_POINTER_X: return _mouse._relative_x;
-          case RETRO_DEVICE_ID_POINTER_Y: return _mouse._relative_y;
-          case RETRO_DEVICE_ID_POINTER_PRESSED: return _mouse._button[RETRO_DEVICE_ID_MOUSE_LEFT];
-          default: break;
-        }
+        return id < kPointerIds ? _snapshot._pointer[id] : 0;
 
       case RETRO_DEVICE_KEYBOARD:
         return id < RETROK_LAST ? static_cast<int16_t>(_keyboard._keys[id]) : 0;
@@ -585,6 +764,64 @@ int16_t Input::read(unsigned port, unsigned device, unsigned index, unsigned id)
   return 0;
 }
 
+void Input::getLiveFrame(Movie::Frame* frame) const
+{
+  for (unsigned port = 0; port < kMaxPorts; port++)
+  {
+    const ControllerInfo& info = _info[port][_devices[port]];
+
+    frame->state[port] = info._state;
+    memcpy(frame->axis[port], info._axis, sizeof(info._axis));
+  }
+}
+
+void Input::getFrameState(FrameState* frame) const
+{
+  for (unsigned port = 0; port < kMaxPorts; port++)
+  {
+    const ControllerInfo& info = _info[port][_devices[port]];
+
+    frame->_state[port] = info._state;
+    memcpy(frame->_axis[port], info._axis, sizeof(info._axis));
+  }
+}
+
+void Input::recordFrame()
+{
+  getFrameState(&_history[_historyNext]);
+  _historyNext = (_historyNext + 1) % kHistoryFrames;
+
+  if (_historyCount < kHistoryFrames)
+    _historyCount++;
+}
+
+bool Input::changedSince(unsigned framesAgo, int axisThreshold) const
+{
+  if (framesAgo == 0 || framesAgo > _historyCount)
+    return true;
+
+  FrameState current;
+  getFrameState(&current);
+
+  const FrameState& previous = _history[(_historyNext + kHistoryFrames - framesAgo) % kHistoryFrames];
+
+  for (unsigned port = 0; port < kMaxPorts; port++)
+  {
+    if (current._state[port] != previous._state[port])
+      return true;
+
+    for (unsigned axis = 0; axis < 4; axis++)
+    {
+      const int delta = current._axis[port][axis] - previous._axis[port][axis];
+
+      if (delta > axisThreshold || delta < -axisThreshold)
+        return true;
+    }
+  }
+
+  return false;
+}
+
 KeyBinds::Binding Input::captureButtonPress()
 {
   KeyBinds::Binding desc = { 0, 0, KeyBinds::Binding::Type::None, 0 };
@@ -23,8 +23,12 @@ along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "Dialog.h"
 #include "KeyBinds.h"
+#include "Movie.h"
 
+#include <functional>
 #include <map>
+#include <string>
+#include <vector>
 
 #include <SDL_events.h>
 #include <SDL_haptic.h>
@@ -92,8 +96,31 @@ public:
 
   virtual void    poll() override;
   virtual int16_t read(unsigned port, unsigned device, unsigned index, unsigned id) override;
+
+  // Keeps a short per-frame history of the joypad and analog state of all ports
+  void recordFrame();
+  // Tells if the current state differs from the one recorded framesAgo frames ago (1 is the
+  // last recorded frame); axes only count as changed if they moved more than axisThreshold
+  bool changedSince(unsigned framesAgo, int axisThreshold) const;
   float getJoystickSensitivity(int joystickId);
 
+  // Records the input to, or plays it from, the movie when it's recording or playing
+  void setMovie(Movie* movie) { _movie = movie; }
+
+  // Joypads the core gets instead of the real ones while it's set, used by netplay
+  void setOverride(const Movie::Frame* frame) { _override = frame; }
+  // The joypad and analog state of all ports as the controllers have it now
+  void getLiveFrame(Movie::Frame* frame) const;
+
+  // Called at the start of poll to process the events that arrived since the last time they
+  // were, so the core gets the latest input instead of the one from the top of the frame
+  void setLatePoll(const std::function<void()>& pump) { _latePoll = pump; }
+
+  // SDL timestamp of the event being handled, a button pressed by it remembers it
+  void setEventTimestamp(uint32_t ticks) { _eventTimestamp = ticks; }
+  // Called by poll with the timestamp of the first button pressed since the last poll
+  void setPressLatched(const std::function<void(uint32_t ticks)>& latched) { _pressLatched = latched; }
+
   std::string serialize();
   void deserialize(const char* json);
 
@@ -147,9 +174,30 @@ protected:
 
   enum
   {
-    kMaxPorts = 8
+    kMaxPorts = 8,
+    kHistoryFrames = 8,
+    kMouseIds = 16,  // RETRO_DEVICE_ID_MOUSE_*, the size of MouseInfo::_button
+    kPointerIds = RETRO_DEVICE_ID_POINTER_PRESSED + 1
+  };
+
+  // What read returns until the next poll
+  struct Snapshot
+  {
+    Movie::Frame _frame;                 // joypad masks and analog values of all ports
+    int16_t      _mouse[kMouseIds];      // the deltas since the last poll, then the buttons
+    int16_t      _pointer[kPointerIds];
   };
 
+  struct FrameState
+  {
+    int16_t _state[kMaxPorts];
+    int16_t _axis[kMaxPorts][4];
+  };
+
+  void getFrameState(FrameState* frame) const;
+
+  void loadMappingsFile(const char* path);
+  void registerMapping(int which);
   SDL_JoystickID addController(int which);
   void addController(const SDL_Event* event, KeyBinds* keyBinds);
   void removeController(const SDL_Event* event);
@@ -166,10 +214,27 @@ protected:
 
   std::map<SDL_JoystickID, SDL_JoystickGUID> _joystickGUIDs;
 
+  /* lines from GameControllerDB.txt sorted by GUID, registered like the embedded ones */
+  std::vector<std::string>    _fileMappings;
+  unsigned                    _mappingsRegistered;
+
   uint64_t                    _ports;
   std::vector<ControllerInfo> _info[kMaxPorts];
   MouseInfo                   _mouse;
   KeyboardInfo                _keyboard;
 
   int _devices[kMaxPorts];
+
+  FrameState _history[kHistoryFrames];
+  unsigned   _historyCount;
+  unsigned   _historyNext;
+
+  Movie*              _movie;
+  const Movie::Frame* _override;
+  Snapshot            _snapshot;
+
+  std::function<void()>         _latePoll;
+  std::function<void(uint32_t)> _pressLatched;
+  uint32_t                      _eventTimestamp;
+  uint32_t                      _pressTimestamp;  // first press since the last poll, 0 if none
 };
@@ -20,21 +20,76 @@ along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
 #include "Logger.h"
 
 #include <memory.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+static const char* levelName(enum retro_log_level level)
+{
+  switch (level)
+  {
+  case RETRO_LOG_DEBUG: return "DEBUG";
+  case RETRO_LOG_INFO:  return "INFO ";
+  case RETRO_LOG_WARN:  return "WARN ";
+  case RETRO_LOG_ERROR: return "ERROR";
+  case RETRO_LOG_DUMMY: return "DUMMY";
+  }
+
+  return "?";
+}
 
 bool Logger::init()
 {
-  // Do compile-time checks for the line and buffer sizes.
+  // Do compile-time checks for the line and ring sizes.
   char check_line_size[RING_LOG_MAX_LINE_SIZE <= 65535 ? 1 : -1];
-  char check_buffer_size[RING_LOG_MAX_BUFFER_SIZE >= RING_LOG_MAX_LINE_SIZE + 3 ? 1 : -1];
+  char check_record_size[RING_LOG_RECORD_SIZE <= RING_LOG_MAX_LINE_SIZE ? 1 : -1];
+  char check_records[(RING_LOG_RECORDS & (RING_LOG_RECORDS - 1)) == 0 ? 1 : -1];
+  char check_pending_lines[(RING_LOG_PENDING_LINES & (RING_LOG_PENDING_LINES - 1)) == 0 ? 1 : -1];
   
   (void)check_line_size;
-  (void)check_buffer_size;
+  (void)check_record_size;
+  (void)check_records;
+  (void)check_pending_lines;
+
+  _start = std::chrono::steady_clock::now();
+
+  for (unsigned i = 0; i < RING_LOG_RECORDS; i++)
+  {
+    _slots[i].sequence = 0;
+  }
+
+  _count = 0;
+
+  _owner = currentThread();
+
+  for (unsigned i = 0; i < RING_LOG_PENDING_LINES; i++)
+  {
+    _pending[i].sequence = i;
+  }
 
-  _avail = RING_LOG_MAX_BUFFER_SIZE;
-  _first = _last = 0;
+  _pendingHead = 0;
+  _pendingTail = 0;
+  _dropped = 0;
 
 #ifdef LOG_TO_FILE
   _file = fopen("log.txt", "w");
+  _fileQuit = false;
+  _fileMutex = SDL_CreateMutex();
+  _fileCond = SDL_CreateCond();
+  _flusher = NULL;
+
+  if (_file != NULL && _fileMutex != NULL && _fileCond != NULL)
+  {
+    _flusher = SDL_CreateThread(s_flusher, "Logger", this);
+  }
 #endif
 
 #ifndef NDEBUG
@@ -46,13 +101,103 @@ bool Logger::init()
 
 void Logger::destroy()
 {
+  flush();
+
 #ifdef LOG_TO_FILE
-  fclose(_file);
+  if (_flusher != NULL)
+  {
+    SDL_LockMutex(_fileMutex);
+    _fileQuit = true;
+    SDL_CondSignal(_fileCond);
+    SDL_UnlockMutex(_fileMutex);
+
+    SDL_WaitThread(_flusher, NULL);
+    _flusher = NULL;
+  }
+
+  if (_file != NULL)
+  {
+    // whatever the flusher couldn't take
+    fwrite(_fileBuffer.c_str(), 1, _fileBuffer.length(), _file);
+    fclose(_file);
+    _file = NULL;
+  }
+
+  _fileBuffer.clear();
+
+  if (_fileCond != NULL)
+  {
+    SDL_DestroyCond(_fileCond);
+    _fileCond = NULL;
+  }
+
+  if (_fileMutex != NULL)
+  {
+    SDL_DestroyMutex(_fileMutex);
+    _fileMutex = NULL;
+  }
 #endif
 }
 
 void Logger::vprintf(enum retro_log_level level, const char* fmt, va_list args)
 {
+  // Filter before formatting, cores call this directly.
+  if (!logLevel(level))
+  {
+    return;
+  }
+
+#if defined(NDEBUG) || !defined(LOG_TO_FILE)
+  // Debug messages only go to the log file, and only in debug builds.
+  if (level == RETRO_LOG_DEBUG)
+  {
+    return;
+  }
+#endif
+
+  const unsigned long thread = currentThread();
+
+  if (thread != _owner)
+  {
+    // Take a slot, format the line in it and publish it. The slot's sequence tells if it's free
+    // (equal to the position), or full (one past it) and waiting for the owner.
+    unsigned pos = _pendingHead.load(std::memory_order_relaxed);
+    Pending* slot;
+
+    for (;;)
+    {
+      slot = &_pending[pos & (RING_LOG_PENDING_LINES - 1)];
+      const int diff = (int)(slot->sequence.load(std::memory_order_acquire) - pos);
+
+      if (diff == 0)
+      {
+        if (_pendingHead.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+        {
+          break;
+        }
+      }
+      else if (diff < 0)
+      {
+        _dropped++;
+        return;
+      }
+      else
+      {
+        pos = _pendingHead.load(std::memory_order_relaxed);
+      }
+    }
+
+    slot->time = now();
+    slot->thread = thread;
+    slot->level = level;
+    vsnprintf(slot->line, sizeof(slot->line), fmt, args);
+    slot->sequence.store(pos + 1, std::memory_order_release);
+    return;
+  }
+
+  // Keep the lines in order as much as we can.
+  flush();
+
   char line[RING_LOG_MAX_LINE_SIZE];
   size_t length = vsnprintf(line, sizeof(line), fmt, args);
 
@@ -62,54 +207,75 @@ void Logger::vprintf(enum retro_log_level level, const char* fmt, va_list args)
     line[length - 1] = line[length - 2] = line[length - 3] = '.';
   }
 
-  while (length > 0 && line[length - 1] == '\n')
+  commit(level, now(), thread, line, length);
+}
+
+void Logger::flush()
+{
+  for (;;)
   {
-    line[--length] = 0;
+    Pending* slot = &_pending[_pendingTail & (RING_LOG_PENDING_LINES - 1)];
+
+    if (slot->sequence.load(std::memory_order_acquire) != _pendingTail + 1)
+    {
+      break;
+    }
+
+    commit(slot->level, slot->time, slot->thread, slot->line, strlen(slot->line));
+    slot->sequence.store(_pendingTail + RING_LOG_PENDING_LINES, std::memory_order_release);
+    _pendingTail++;
   }
 
-  const char* desc = "?";
+  const unsigned dropped = _dropped.exchange(0);
 
-  switch (level)
+  if (dropped != 0)
   {
-  case RETRO_LOG_DEBUG: desc = "DEBUG"; break;
-  case RETRO_LOG_INFO:  desc = "INFO "; break;
-  case RETRO_LOG_WARN:  desc = "WARN "; break;
-  case RETRO_LOG_ERROR: desc = "ERROR"; break;
-  case RETRO_LOG_DUMMY: desc = "DUMMY"; break;
+    char line[64];
+    commit(RETRO_LOG_WARN, now(), _owner, line, snprintf(line, sizeof(line), "%u lines from other threads were dropped", dropped));
   }
+}
 
-  // Do not log debug messages to the internal buffer and the console.
+void Logger::commit(enum retro_log_level level, uint64_t time, unsigned long thread, const char* text, size_t length)
+{
+  char line[RING_LOG_MAX_LINE_SIZE];
+  memcpy(line, text, length);
+  line[length] = 0;
+
+  while (length > 0 && line[length - 1] == '\n')
+  {
+    line[--length] = 0;
+  }
+
+  const char* desc = levelName(level);
+
+  // Do not log debug messages to the ring and the console.
   if (level != RETRO_LOG_DEBUG)
   {
-    // Log to the internal buffer.
+    // Log to the ring. Only this thread writes to it, the sequence is odd while the record is
+    // changing and tells readers which line the record holds once it's even.
+    const uint64_t count = _count.load(std::memory_order_relaxed);
+    Slot* slot = &_slots[count & (RING_LOG_RECORDS - 1)];
 
-    if (length > sizeof(line))
-    {
-      // Line size too small, truncated. Consider increasing the array size.
-      length = sizeof(line);
-    }
+    slot->sequence.store(count * 2 + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
 
-    length += 3; // Add one byte for the level and two bytes for the length.
-    unsigned char meta[3];
+    slot->record.time = time;
+    slot->record.thread = thread;
+    slot->record.level = level;
 
-    if (length > _avail)
+    if (length < sizeof(slot->record.line))
     {
-      do
-      {
-        // Remove content until we have enough space.
-        read(meta, 3);
-        skip(meta[1] | meta[2] << 8); // Little endian.
-      } while (length > _avail);
+      memcpy(slot->record.line, line, length + 1);
+    }
+    else
+    {
+      const size_t size = sizeof(slot->record.line);
+      memcpy(slot->record.line, line, size - 4);
+      memcpy(slot->record.line + size - 4, "...", 4);
     }
 
-    length -= 3;
-
-    meta[0] = level;
-    meta[1] = length & 0xff;
-    meta[2] = (unsigned char)(length >> 8);
-
-    write(meta, 3);
-    write(line, length);
+    slot->sequence.store(count * 2 + 2, std::memory_order_release);
+    _count.store(count + 1, std::memory_order_release);
 
     // Log to the console.
 
@@ -119,22 +285,85 @@ void Logger::vprintf(enum retro_log_level level, const char* fmt, va_list args)
 
 #ifdef LOG_TO_FILE
   // Log to the log file.
-  fprintf(_file, "[%s] %s\n", desc, line);
-#ifndef NDEBUG
-  fflush(_file);
+  if (_flusher != NULL)
+  {
+    SDL_LockMutex(_fileMutex);
+    _fileBuffer.append("[").append(desc).append("] ").append(line).append("\n");
+    SDL_CondSignal(_fileCond);
+    SDL_UnlockMutex(_fileMutex);
+  }
+  else if (_file != NULL)
+  {
+    fprintf(_file, "[%s] %s\n", desc, line);
+  }
+#else
+  (void)time;
+  (void)thread;
 #endif
+}
+
+uint64_t Logger::now() const
+{
+  return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _start).count();
+}
+
+unsigned long Logger::currentThread()
+{
+#ifdef _WIN32
+  return (unsigned long)GetCurrentThreadId();
+#else
+  return (unsigned long)pthread_self();
 #endif
 }
 
+#ifdef LOG_TO_FILE
+int Logger::s_flusher(void* udata)
+{
+  return ((Logger*)udata)->flusher();
+}
+
+int Logger::flusher()
+{
+  std::string lines;
+
+  SDL_LockMutex(_fileMutex);
+
+  for (;;)
+  {
+    while (_fileBuffer.empty() && !_fileQuit)
+    {
+      SDL_CondWait(_fileCond, _fileMutex);
+    }
+
+    if (_fileBuffer.empty())
+    {
+      break;
+    }
+
+    lines.swap(_fileBuffer);
+    SDL_UnlockMutex(_fileMutex);
+
+    fwrite(lines.c_str(), 1, lines.length(), _file);
+    fflush(_file);
+    lines.clear();
+
+    SDL_LockMutex(_fileMutex);
+  }
+
+  SDL_UnlockMutex(_fileMutex);
+  return 0;
+}
+#endif
+
 std::string Logger::contents() const
 {
   struct Iterator
   {
-    static bool iterator(enum retro_log_level level, const char* line, void* ud)
+    static bool iterator(const Record& record, void* ud)
     {
       std::string* buffer = (std::string*)ud;
 
-      switch (level)
+      switch (record.level)
       {
         case RETRO_LOG_DEBUG: *buffer += "[DEBUG] "; break;
         case RETRO_LOG_INFO:  *buffer += "[INFO] "; break;
@@ -143,7 +372,7 @@ std::string Logger::contents() const
         case RETRO_LOG_DUMMY: *buffer += "[DUMMY] "; break;
       }
 
-      *buffer += line;
+      *buffer += record.line;
       *buffer += "\r\n";
 
       return true;
@@ -155,80 +384,95 @@ std::string Logger::contents() const
   return buffer;
 }
 
-void Logger::iterate(Iterator iterator, void* ud) const
+bool Logger::dump(const char* path) const
 {
-  size_t pos = _first;
-  
-  while (pos != _last)
-  {
-    char line[RING_LOG_MAX_LINE_SIZE + 1];
-    unsigned char meta[3];
-    pos = peek(pos, meta, 3);
-    
-    enum retro_log_level level = (enum retro_log_level)meta[0];
-    size_t length = meta[1] | meta[2] << 8;
-    pos = peek(pos, line, length);
-    line[length] = 0;
-    
-    if (!iterator(level, line, ud))
-    {
-      return;
-    }
-  }
-}
+  // stdio allocates its buffers, each line is formatted on the stack and written unbuffered
+#ifdef _WIN32
+  HANDLE file = CreateFileA(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
 
-void Logger::write(const void* data, size_t size)
-{
-  size_t first = size;
-  size_t second = 0;
-  
-  if (first > RING_LOG_MAX_BUFFER_SIZE - _last)
+  if (file == INVALID_HANDLE_VALUE)
   {
-    first = RING_LOG_MAX_BUFFER_SIZE - _last;
-    second = size - first;
+    return false;
   }
-  
-  char* dest = _buffer + _last;
-  memcpy(dest, data, first);
-  memcpy(_buffer, (char*)data + first, second);
-  
-  _last = (_last + size) % RING_LOG_MAX_BUFFER_SIZE;
-  _avail -= size;
-}
+#else
+  int file = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
 
-void Logger::read(void* data, size_t size)
-{
-  size_t first = size;
-  size_t second = 0;
-  
-  if (first > RING_LOG_MAX_BUFFER_SIZE - _first)
+  if (file < 0)
   {
-    first = RING_LOG_MAX_BUFFER_SIZE - _first;
-    second = size - first;
+    return false;
   }
-  
-  char* src = _buffer + _first;
-  memcpy(data, src, first);
-  memcpy((char*)data + first, _buffer, second);
-  
-  _first = (_first + size) % RING_LOG_MAX_BUFFER_SIZE;
-  _avail += size;
+#endif
+
+  struct Iterator
+  {
+    static bool iterator(const Record& record, void* ud)
+    {
+      char line[RING_LOG_RECORD_SIZE + 64];
+      int length = snprintf(line, sizeof(line), "%10.3f %08lx [%s] %s\n", record.time / 1000000.0, record.thread, levelName(record.level), record.line);
+
+      if (length < 0)
+      {
+        return true;
+      }
+
+      if ((size_t)length >= sizeof(line))
+      {
+        length = sizeof(line) - 1;
+        line[length - 1] = '\n';
+      }
+
+#ifdef _WIN32
+      DWORD written;
+      WriteFile(*(HANDLE*)ud, line, (DWORD)length, &written, NULL);
+#else
+      (void)!write(*(int*)ud, line, (size_t)length);
+#endif
+      return true;
+    }
+  };
+
+  iterate(Iterator::iterator, &file);
+
+#ifdef _WIN32
+  CloseHandle(file);
+#else
+  close(file);
+#endif
+
+  return true;
 }
 
-size_t Logger::peek(size_t pos, void* data, size_t size) const
+void Logger::iterate(Iterator iterator, void* ud) const
 {
-  size_t first = size;
-  size_t second = 0;
-  
-  if (first > RING_LOG_MAX_BUFFER_SIZE - pos)
+  const uint64_t count = _count.load(std::memory_order_acquire);
+  uint64_t index = count > RING_LOG_RECORDS ? count - RING_LOG_RECORDS : 0;
+
+  for (; index < count; index++)
   {
-    first = RING_LOG_MAX_BUFFER_SIZE - pos;
-    second = size - first;
+    const Slot* slot = &_slots[index & (RING_LOG_RECORDS - 1)];
+    const uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+
+    // the record was overwritten since we looked at the count
+    if (sequence != index * 2 + 2)
+    {
+      continue;
+    }
+
+    Record record;
+    memcpy(&record, &slot->record, sizeof(record));
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    // and while we copied it
+    if (slot->sequence.load(std::memory_order_relaxed) != sequence)
+    {
+      continue;
+    }
+
+    record.line[sizeof(record.line) - 1] = 0;
+
+    if (!iterator(record, ud))
+    {
+      return;
+    }
   }
-  
-  const char* src = _buffer + pos;
-  memcpy(data, src, first);
-  memcpy((char*)data + first, _buffer, second);
-  
-  return (pos + size) % RING_LOG_MAX_BUFFER_SIZE;
 }
@@ -21,50 +21,117 @@ along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "libretro/Components.h"
 
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
 #ifdef LOG_TO_FILE
 #include <stdio.h>
+
+#include <SDL_mutex.h>
+#include <SDL_thread.h>
 #endif
 
-// Must be at most 65535
+// Longest line that is formatted, must be at most 65535
 #ifndef RING_LOG_MAX_LINE_SIZE
 #define RING_LOG_MAX_LINE_SIZE 1024
 #endif
 
-// Must be at least MAX_LINE_SIZE + 3
-#ifndef RING_LOG_MAX_BUFFER_SIZE
-#define RING_LOG_MAX_BUFFER_SIZE 65536
+// Lines kept in the ring, must be a power of 2
+#ifndef RING_LOG_RECORDS
+#define RING_LOG_RECORDS 512
 #endif
 
+// Bytes of each line kept in the ring, longer lines are truncated there but not in the log file
+#ifndef RING_LOG_RECORD_SIZE
+#define RING_LOG_RECORD_SIZE 256
+#endif
+
+// Lines other threads can log before the main thread takes them, must be a power of 2
+#ifndef RING_LOG_PENDING_LINES
+#define RING_LOG_PENDING_LINES 16
+#endif
+
+/* Lines are filtered by level before they're formatted. Only the thread that called init writes
+ * to the ring and the console. Other threads, like the audio callback, hand their lines over
+ * through a lock free queue and never block, lines are dropped if the queue is full. With
+ * LOG_TO_FILE, a background thread writes the file.
+ *
+ * The ring has a fixed number of records. Each one is guarded by a sequence number, so any thread
+ * can read the ring while lines are being logged and only sees whole records.
+ */
 class Logger: public libretro::LoggerComponent
 {
 public:
+  struct Record
+  {
+    uint64_t             time;    /* microseconds since init */
+    unsigned long        thread;
+    enum retro_log_level level;
+    char                 line[RING_LOG_RECORD_SIZE];
+  };
+
   bool init();
   void destroy();
 
   virtual void vprintf(enum retro_log_level level, const char* fmt, va_list args) override;
 
+  /* Writes the lines logged by other threads, must be called regularly from the main thread */
+  void flush();
+
   std::string contents() const;
+
+  /* Writes the ring with times and threads to path, safe to use from any thread and from crash
+   * handlers as it doesn't allocate */
+  bool dump(const char* path) const;
   
-  typedef bool (*Iterator)(enum retro_log_level level, const char* line, void* ud);
+  /* Calls iterator with a copy of each record in the ring, from the oldest */
+  typedef bool (*Iterator)(const Record& record, void* ud);
   void iterate(Iterator iterator, void* ud) const;
 
 protected:
-  void   write(const void* data, size_t size);
-  void   read(void* data, size_t size);
-  size_t peek(size_t pos, void* data, size_t size) const;
-  
-  inline void skip(size_t size)
+  struct Slot
   {
-    _first = (_first + size) % RING_LOG_MAX_BUFFER_SIZE;
-    _avail += size;
-  }
-  
-  char   _buffer[RING_LOG_MAX_BUFFER_SIZE];
-  size_t _avail;
-  size_t _first;
-  size_t _last;
+    std::atomic<uint64_t> sequence;  /* odd while the record is written */
+    Record                record;
+  };
+
+  struct Pending
+  {
+    std::atomic<unsigned> sequence;
+    uint64_t              time;
+    unsigned long         thread;
+    enum retro_log_level  level;
+    char                  line[RING_LOG_MAX_LINE_SIZE];
+  };
+
+  void commit(enum retro_log_level level, uint64_t time, unsigned long thread, const char* line, size_t length);
+  uint64_t now() const;
+
+  static unsigned long currentThread();
+
+  std::chrono::steady_clock::time_point _start;
+
+  Slot                  _slots[RING_LOG_RECORDS];
+  std::atomic<uint64_t> _count;  /* records written since init */
+
+  unsigned long         _owner;
+  Pending               _pending[RING_LOG_PENDING_LINES];
+  std::atomic<unsigned> _pendingHead;
+  unsigned              _pendingTail;  /* only touched by the owner */
+  std::atomic<unsigned> _dropped;
 
 #ifdef LOG_TO_FILE
-  FILE* _file;
+  static int s_flusher(void* udata);
+  int flusher();
+
+  FILE*       _file;
+  SDL_Thread* _flusher;
+  SDL_mutex*  _fileMutex;
+  SDL_cond*   _fileCond;
+  std::string _fileBuffer;  /* lines waiting to be written to the file */
+  bool        _fileQuit;
 #endif
 };
@@ -0,0 +1,352 @@
+/*
+Copyright (C) 2018 Andre Leiradella
+
+This file is part of RALibretro.
+
+RALibretro is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RALibretro is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Pixels.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PIXELS_SSE2
+#include <emmintrin.h>
+#endif
+
+void pixels::reference::rgb565ToRgb(uint8_t* rgb, const uint16_t* pixels, size_t count)
+{
+  for (size_t x = 0; x < count; x++)
+  {
+    uint16_t rgba5650 = *pixels++;
+
+    *rgb++ = (rgba5650 >> 11) * 255 / 31;
+    *rgb++ = ((rgba5650 >> 5) & 0x3f) * 255 / 63;
+    *rgb++ = (rgba5650 & 0x1f) * 255 / 31;
+  }
+}
+
+void pixels::reference::argb1555ToRgb(uint8_t* rgb, const uint16_t* pixels, size_t count)
+{
+  for (size_t x = 0; x < count; x++)
+  {
+    uint16_t argb1555 = *pixels++;
+
+    *rgb++ = (argb1555 >> 10) * 255 / 31;
+    *rgb++ = ((argb1555 >> 5) & 0x1f) * 255 / 31;
+    *rgb++ = (argb1555 & 0x1f) * 255 / 31;
+  }
+}
+
+void pixels::reference::xrgb8888ToRgb(uint8_t* rgb, const uint32_t* pixels, size_t count)
+{
+  for (size_t x = 0; x < count; x++)
+  {
+    uint32_t argb8888 = *pixels++;
+
+    *rgb++ = argb8888 >> 16;
+    *rgb++ = argb8888 >> 8;
+    *rgb++ = argb8888;
+  }
+}
+
+void pixels::reference::rgbToRgb565(uint16_t* pixels, const uint8_t* rgb, size_t count)
+{
+  for (size_t x = 0; x < count; x++)
+  {
+    uint8_t r = *rgb++ >> 3;
+    uint8_t g = *rgb++ >> 2;
+    uint8_t b = *rgb++ >> 3;
+
+    *pixels++ = r << 11 | g << 5 | b;
+  }
+}
+
+void pixels::reference::rgbToArgb1555(uint16_t* pixels, const uint8_t* rgb, size_t count)
+{
+  for (size_t x = 0; x < count; x++)
+  {
+    uint8_t r = *rgb++ >> 3;
+    uint8_t g = *rgb++ >> 3;
+    uint8_t b = *rgb++ >> 3;
+
+    *pixels++ = r << 10 | g << 5 | b;
+  }
+}
+
+/* Expansion tables, 64 entries for the 5-bit channels too because of 0RGB1555's red */
+static const struct Tables
+{
+  uint8_t expand5[64];
+  uint8_t expand6[64];
+
+  Tables()
+  {
+    for (unsigned i = 0; i < 64; i++)
+    {
+      expand5[i] = (uint8_t)(i * 255 / 31);
+      expand6[i] = (uint8_t)(i * 255 / 63);
+    }
+  }
+}
+s_tables;
+
+static void scalarRgb565ToRgb(uint8_t* rgb, const uint16_t* pixels, size_t count)
+{
+  for (size_t x = 0; x < count; x++, rgb += 3)
+  {
+    const unsigned v = pixels[x];
+
+    rgb[0] = s_tables.expand5[v >> 11];
+    rgb[1] = s_tables.expand6[(v >> 5) & 0x3f];
+    rgb[2] = s_tables.expand5[v & 0x1f];
+  }
+}
+
+static void scalarArgb1555ToRgb(uint8_t* rgb, const uint16_t* pixels, size_t count)
+{
+  for (size_t x = 0; x < count; x++, rgb += 3)
+  {
+    const unsigned v = pixels[x];
+
+    rgb[0] = s_tables.expand5[v >> 10];
+    rgb[1] = s_tables.expand5[(v >> 5) & 0x1f];
+    rgb[2] = s_tables.expand5[v & 0x1f];
+  }
+}
+
+static void scalarXrgb8888ToRgb(uint8_t* rgb, const uint32_t* pixels, size_t count)
+{
+  for (size_t x = 0; x < count; x++, rgb += 3)
+  {
+    const uint32_t v = pixels[x];
+
+    rgb[0] = (uint8_t)(v >> 16);
+    rgb[1] = (uint8_t)(v >> 8);
+    rgb[2] = (uint8_t)v;
+  }
+}
+
+static void scalarRgbToRgb565(uint16_t* pixels, const uint8_t* rgb, size_t count)
+{
+  for (size_t x = 0; x < count; x++, rgb += 3)
+    pixels[x] = (uint16_t)((rgb[0] >> 3) << 11 | (rgb[1] >> 2) << 5 | rgb[2] >> 3);
+}
+
+static void scalarRgbToArgb1555(uint16_t* pixels, const uint8_t* rgb, size_t count)
+{
+  for (size_t x = 0; x < count; x++, rgb += 3)
+    pixels[x] = (uint16_t)((rgb[0] >> 3) << 10 | (rgb[1] >> 3) << 5 | rgb[2] >> 3);
+}
+
+#if defined(PIXELS_SSE2)
+
+/* x * 255 / 31 == (x * 16847) >> 11 and x * 255 / 63 == (x * 4145) >> 10 for all x in [0, 63].
+ * The products don't fit in 16 bits, so they're put together from their high and low halves. */
+static inline __m128i expand5(__m128i x)
+{
+  const __m128i k = _mm_set1_epi16(16847);
+  return _mm_or_si128(_mm_slli_epi16(_mm_mulhi_epu16(x, k), 5), _mm_srli_epi16(_mm_mullo_epi16(x, k), 11));
+}
+
+static inline __m128i expand6(__m128i x)
+{
+  const __m128i k = _mm_set1_epi16(4145);
+  return _mm_or_si128(_mm_slli_epi16(_mm_mulhi_epu16(x, k), 6), _mm_srli_epi16(_mm_mullo_epi16(x, k), 10));
+}
+
+/* Four 0x00BBGGRR pixels to 12 bytes of RGB at the start of the result */
+static inline __m128i compact(__m128i v)
+{
+  const __m128i low = _mm_set_epi32(0, 0x00ffffff, 0, 0x00ffffff);
+  const __m128i high = _mm_set_epi32(0x00ffffff, 0, 0x00ffffff, 0);
+  const __m128i bytes0to5 = _mm_set_epi32(0, 0, 0x0000ffff, -1);
+  const __m128i bytes6to11 = _mm_set_epi32(0, -1, (int)0xffff0000, 0);
+
+  const __m128i t = _mm_or_si128(_mm_and_si128(v, low), _mm_srli_epi64(_mm_and_si128(v, high), 8));
+  return _mm_or_si128(_mm_and_si128(t, bytes0to5), _mm_and_si128(_mm_srli_si128(t, 2), bytes6to11));
+}
+
+/* 12 bytes of RGB at the start of rgb to four 0x00BBGGRR pixels */
+static inline __m128i expand(__m128i t)
+{
+  const __m128i bytes0to5 = _mm_set_epi32(0, 0, 0x0000ffff, -1);
+  const __m128i bytes8to13 = _mm_set_epi32(0x0000ffff, -1, 0, 0);
+  const __m128i low = _mm_set_epi32(0, 0x00ffffff, 0, 0x00ffffff);
+  const __m128i high = _mm_set_epi32(0x00ffffff, 0, 0x00ffffff, 0);
+
+  const __m128i u = _mm_or_si128(_mm_and_si128(t, bytes0to5), _mm_and_si128(_mm_slli_si128(t, 2), bytes8to13));
+  return _mm_or_si128(_mm_and_si128(u, low), _mm_and_si128(_mm_slli_epi64(u, 8), high));
+}
+
+/* Packs the low 16 bits of each 32-bit lane, packs_epi32 saturates so they're sign extended first */
+static inline __m128i pack(__m128i lo, __m128i hi)
+{
+  lo = _mm_srai_epi32(_mm_slli_epi32(lo, 16), 16);
+  hi = _mm_srai_epi32(_mm_slli_epi32(hi, 16), 16);
+  return _mm_packs_epi32(lo, hi);
+}
+
+/* Writes eight pixels, with r, g and b already expanded to 8 bits in 16-bit lanes. The stores
+ * write four bytes past the 24 bytes of the pixels, callers must have two more pixels left. */
+static inline void storeRgb(uint8_t* rgb, __m128i r, __m128i g, __m128i b)
+{
+  const __m128i mask = _mm_set1_epi16(0xff);
+  const __m128i rg = _mm_or_si128(_mm_and_si128(r, mask), _mm_slli_epi16(g, 8));
+
+  _mm_storeu_si128((__m128i*)rgb, compact(_mm_unpacklo_epi16(rg, b)));
+  _mm_storeu_si128((__m128i*)(rgb + 12), compact(_mm_unpackhi_epi16(rg, b)));
+}
+
+void pixels::rgb565ToRgb(uint8_t* rgb, const uint16_t* pixels, size_t count)
+{
+  const __m128i mask5 = _mm_set1_epi16(0x1f);
+  const __m128i mask6 = _mm_set1_epi16(0x3f);
+  size_t x = 0;
+
+  for (; x + 10 <= count; x += 8, rgb += 24)
+  {
+    const __m128i v = _mm_loadu_si128((const __m128i*)(pixels + x));
+
+    const __m128i r = expand5(_mm_srli_epi16(v, 11));
+    const __m128i g = expand6(_mm_and_si128(_mm_srli_epi16(v, 5), mask6));
+    const __m128i b = expand5(_mm_and_si128(v, mask5));
+
+    storeRgb(rgb, r, g, b);
+  }
+
+  scalarRgb565ToRgb(rgb, pixels + x, count - x);
+}
+
+void pixels::argb1555ToRgb(uint8_t* rgb, const uint16_t* pixels, size_t count)
+{
+  const __m128i mask5 = _mm_set1_epi16(0x1f);
+  size_t x = 0;
+
+  for (; x + 10 <= count; x += 8, rgb += 24)
+  {
+    const __m128i v = _mm_loadu_si128((const __m128i*)(pixels + x));
+
+    const __m128i r = expand5(_mm_srli_epi16(v, 10));
+    const __m128i g = expand5(_mm_and_si128(_mm_srli_epi16(v, 5), mask5));
+    const __m128i b = expand5(_mm_and_si128(v, mask5));
+
+    storeRgb(rgb, r, g, b);
+  }
+
+  scalarArgb1555ToRgb(rgb, pixels + x, count - x);
+}
+
+void pixels::xrgb8888ToRgb(uint8_t* rgb, const uint32_t* pixels, size_t count)
+{
+  const __m128i mask8 = _mm_set1_epi32(0xff);
+  const __m128i mask16 = _mm_set1_epi32(0xff00);
+  size_t x = 0;
+
+  for (; x + 10 <= count; x += 8, rgb += 24)
+  {
+    __m128i v0 = _mm_loadu_si128((const __m128i*)(pixels + x));
+    __m128i v1 = _mm_loadu_si128((const __m128i*)(pixels + x + 4));
+
+    /* 0xXXRRGGBB -> 0x00BBGGRR */
+    v0 = _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_srli_epi32(v0, 16), mask8), _mm_and_si128(v0, mask16)), _mm_slli_epi32(_mm_and_si128(v0, mask8), 16));
+    v1 = _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_srli_epi32(v1, 16), mask8), _mm_and_si128(v1, mask16)), _mm_slli_epi32(_mm_and_si128(v1, mask8), 16));
+
+    _mm_storeu_si128((__m128i*)rgb, compact(v0));
+    _mm_storeu_si128((__m128i*)(rgb + 12), compact(v1));
+  }
+
+  scalarXrgb8888ToRgb(rgb, pixels + x, count - x);
+}
+
+void pixels::rgbToRgb565(uint16_t* pixels, const uint8_t* rgb, size_t count)
+{
+  const __m128i maskR = _mm_set1_epi32(0xf8);
+  const __m128i maskG = _mm_set1_epi32(0x7e0);
+  const __m128i maskB = _mm_set1_epi32(0x1f);
+  size_t x = 0;
+
+  /* the second load reads four bytes past the 24 bytes of the pixels */
+  for (; x + 10 <= count; x += 8, rgb += 24)
+  {
+    const __m128i d0 = expand(_mm_loadu_si128((const __m128i*)rgb));
+    const __m128i d1 = expand(_mm_loadu_si128((const __m128i*)(rgb + 12)));
+
+    const __m128i p0 = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(_mm_and_si128(d0, maskR), 8), _mm_and_si128(_mm_srli_epi32(d0, 5), maskG)), _mm_and_si128(_mm_srli_epi32(d0, 19), maskB));
+    const __m128i p1 = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(_mm_and_si128(d1, maskR), 8), _mm_and_si128(_mm_srli_epi32(d1, 5), maskG)), _mm_and_si128(_mm_srli_epi32(d1, 19), maskB));
+
+    _mm_storeu_si128((__m128i*)(pixels + x), pack(p0, p1));
+  }
+
+  scalarRgbToRgb565(pixels + x, rgb, count - x);
+}
+
+void pixels::rgbToArgb1555(uint16_t* pixels, const uint8_t* rgb, size_t count)
+{
+  const __m128i maskR = _mm_set1_epi32(0xf8);
+  const __m128i maskG = _mm_set1_epi32(0x3e0);
+  const __m128i maskB = _mm_set1_epi32(0x1f);
+  size_t x = 0;
+
+  for (; x + 10 <= count; x += 8, rgb += 24)
+  {
+    const __m128i d0 = expand(_mm_loadu_si128((const __m128i*)rgb));
+    const __m128i d1 = expand(_mm_loadu_si128((const __m128i*)(rgb + 12)));
+
+    const __m128i p0 = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(_mm_and_si128(d0, maskR), 7), _mm_and_si128(_mm_srli_epi32(d0, 6), maskG)), _mm_and_si128(_mm_srli_epi32(d0, 19), maskB));
+    const __m128i p1 = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(_mm_and_si128(d1, maskR), 7), _mm_and_si128(_mm_srli_epi32(d1, 6), maskG)), _mm_and_si128(_mm_srli_epi32(d1, 19), maskB));
+
+    _mm_storeu_si128((__m128i*)(pixels + x), pack(p0, p1));
+  }
+
+  scalarRgbToArgb1555(pixels + x, rgb, count - x);
+}
+
+const char* pixels::kernelName()
+{
+  return "SSE2";
+}
+
+#else
+
+void pixels::rgb565ToRgb(uint8_t* rgb, const uint16_t* pixels, size_t count)
+{
+  scalarRgb565ToRgb(rgb, pixels, count);
+}
+
+void pixels::argb1555ToRgb(uint8_t* rgb, const uint16_t* pixels, size_t count)
+{
+  scalarArgb1555ToRgb(rgb, pixels, count);
+}
+
+void pixels::xrgb8888ToRgb(uint8_t* rgb, const uint32_t* pixels, size_t count)
+{
+  scalarXrgb8888ToRgb(rgb, pixels, count);
+}
+
+void pixels::rgbToRgb565(uint16_t* pixels, const uint8_t* rgb, size_t count)
+{
+  scalarRgbToRgb565(pixels, rgb, count);
+}
+
+void pixels::rgbToArgb1555(uint16_t* pixels, const uint8_t* rgb, size_t count)
+{
+  scalarRgbToArgb1555(pixels, rgb, count);
+}
+
+const char* pixels::kernelName()
+{
+  return "scalar (lookup tables)";
+}
+
+#endif
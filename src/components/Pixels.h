@@ -0,0 +1,53 @@
+/*
+Copyright (C) 2018 Andre Leiradella
+
+This file is part of RALibretro.
+
+RALibretro is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RALibretro is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Converts rows of pixels between the core's pixel formats and 24-bits RGB, used for screenshots
+ * and for the images saved along with states.
+ *
+ * The results are exactly the ones of the original loops, kept in pixels::reference: channels are
+ * expanded with x * 255 / 31 and x * 255 / 63, and reduced by dropping the low bits. For 0RGB1555,
+ * the unused top bit goes into the red expansion and the result is truncated to 8 bits.
+ */
+namespace pixels
+{
+  void rgb565ToRgb(uint8_t* rgb, const uint16_t* pixels, size_t count);
+  void argb1555ToRgb(uint8_t* rgb, const uint16_t* pixels, size_t count);
+  void xrgb8888ToRgb(uint8_t* rgb, const uint32_t* pixels, size_t count);
+
+  void rgbToRgb565(uint16_t* pixels, const uint8_t* rgb, size_t count);
+  void rgbToArgb1555(uint16_t* pixels, const uint8_t* rgb, size_t count);
+
+  /* Name of the conversion kernels selected at compile time */
+  const char* kernelName();
+
+  namespace reference
+  {
+    void rgb565ToRgb(uint8_t* rgb, const uint16_t* pixels, size_t count);
+    void argb1555ToRgb(uint8_t* rgb, const uint16_t* pixels, size_t count);
+    void xrgb8888ToRgb(uint8_t* rgb, const uint32_t* pixels, size_t count);
+
+    void rgbToRgb565(uint16_t* pixels, const uint8_t* rgb, size_t count);
+    void rgbToArgb1555(uint16_t* pixels, const uint8_t* rgb, size_t count);
+  }
+}
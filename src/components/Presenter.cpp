@@ -0,0 +1,262 @@
+/*
+Copyright (C) 2018 Andre Leiradella
+
+This file is part of RALibretro.
+
+RALibretro is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RALibretro is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Presenter.h"
+
+#include <string.h>
+
+#define TAG "[PRS] "
+
+bool Presenter::init(Logger* logger, VideoContext* ctx, const Present& present)
+{
+  _logger = logger;
+  _ctx = ctx;
+  _present = present;
+
+  for (unsigned i = 0; i < 3; i++)
+  {
+    _frames[i].width = _frames[i].height = 0;
+    _frames[i].pitch = 0;
+  }
+
+  _filling = 0;
+  _ready = 1;
+  _presenting = 2;
+  _fresh = false;
+
+  _thread = NULL;
+  _quit = _suspended = _idle = false;
+  _suspends = 0;
+
+  _mutex = SDL_CreateMutex();
+
+  if (!_mutex)
+  {
+    _logger->error(TAG "SDL_CreateMutex: %s", SDL_GetError());
+    return false;
+  }
+
+  _wake = SDL_CreateCond();
+  _parked = SDL_CreateCond();
+
+  if (!_wake || !_parked)
+  {
+    _logger->error(TAG "SDL_CreateCond: %s", SDL_GetError());
+
+    if (_parked)
+      SDL_DestroyCond(_parked);
+
+    if (_wake)
+      SDL_DestroyCond(_wake);
+
+    SDL_DestroyMutex(_mutex);
+    return false;
+  }
+
+  return true;
+}
+
+void Presenter::destroy()
+{
+  stop();
+
+  SDL_DestroyCond(_parked);
+  SDL_DestroyCond(_wake);
+  SDL_DestroyMutex(_mutex);
+}
+
+bool Presenter::start()
+{
+  if (_thread != NULL)
+    return true;
+
+  // whoever suspended us is using the context
+  if (_suspends != 0)
+    return false;
+
+  _fresh = false;
+  _quit = _suspended = _idle = false;
+
+  _ctx->releaseCurrent();
+  _thread = SDL_CreateThread(s_thread, "Presenter", this);
+
+  if (_thread == NULL)
+  {
+    _logger->error(TAG "SDL_CreateThread: %s", SDL_GetError());
+    _ctx->makeCurrent();
+    return false;
+  }
+
+  _logger->info(TAG "Presenting frames on a separate thread");
+  return true;
+}
+
+void Presenter::stop()
+{
+  if (_thread == NULL)
+    return;
+
+  SDL_LockMutex(_mutex);
+  _quit = true;
+  SDL_CondSignal(_wake);
+  SDL_UnlockMutex(_mutex);
+
+  // the thread presents the pending frame before quitting
+  SDL_WaitThread(_thread, NULL);
+  _thread = NULL;
+
+  // if we're suspended the context is already here
+  if (_suspends == 0 && !_ctx->makeCurrent())
+    _logger->error(TAG "Could not get the OpenGL context back: %s", SDL_GetError());
+
+  poll();
+  _logger->info(TAG "Presenting frames on the main thread");
+}
+
+void Presenter::submit(const void* data, unsigned width, unsigned height, size_t pitch)
+{
+  Frame* frame = &_frames[_filling];
+  const size_t size = pitch * height;
+
+  if (frame->pixels.size() < size)
+    frame->pixels.resize(size);
+
+  memcpy(frame->pixels.data(), data, size);
+  frame->width = width;
+  frame->height = height;
+  frame->pitch = pitch;
+
+  SDL_LockMutex(_mutex);
+  const unsigned ready = _ready;
+  _ready = _filling;
+  _filling = ready;
+  _fresh = true;
+  SDL_CondSignal(_wake);
+  SDL_UnlockMutex(_mutex);
+}
+
+void Presenter::suspend()
+{
+  if (_suspends++ != 0 || _thread == NULL)
+    return;
+
+  SDL_LockMutex(_mutex);
+  _suspended = true;
+  SDL_CondSignal(_wake);
+
+  while (!_idle)
+    SDL_CondWait(_parked, _mutex);
+
+  SDL_UnlockMutex(_mutex);
+
+  if (!_ctx->makeCurrent())
+    _logger->error(TAG "Could not take the OpenGL context: %s", SDL_GetError());
+}
+
+void Presenter::resume()
+{
+  if (--_suspends != 0 || _thread == NULL)
+    return;
+
+  _ctx->releaseCurrent();
+
+  SDL_LockMutex(_mutex);
+  _suspended = false;
+  SDL_CondSignal(_wake);
+  SDL_UnlockMutex(_mutex);
+}
+
+int Presenter::s_thread(void* udata)
+{
+  return ((Presenter*)udata)->run();
+}
+
+int Presenter::run()
+{
+  if (!_ctx->makeCurrent())
+  {
+    _logger->error(TAG "Could not take the OpenGL context: %s", SDL_GetError());
+
+    // nobody will present, but suspend and stop still work
+    SDL_LockMutex(_mutex);
+    _idle = true;
+    SDL_CondBroadcast(_parked);
+
+    while (!_quit)
+      SDL_CondWait(_wake, _mutex);
+
+    SDL_UnlockMutex(_mutex);
+    return 0;
+  }
+
+  SDL_LockMutex(_mutex);
+
+  for (;;)
+  {
+    while (!_fresh && !_quit && !_suspended)
+      SDL_CondWait(_wake, _mutex);
+
+    // present the last frame before doing anything else, so it's in the texture for screenshots
+    // and states
+    if (_fresh)
+    {
+      const unsigned presenting = _presenting;
+      _presenting = _ready;
+      _ready = presenting;
+      _fresh = false;
+      SDL_UnlockMutex(_mutex);
+
+      const Frame* frame = &_frames[_presenting];
+      _present(frame->pixels.data(), frame->width, frame->height, frame->pitch);
+
+      SDL_LockMutex(_mutex);
+      continue;
+    }
+
+    if (_quit)
+      break;
+
+    // give the context away until resumed
+    _ctx->releaseCurrent();
+    _idle = true;
+    SDL_CondBroadcast(_parked);
+
+    while (_suspended && !_quit)
+      SDL_CondWait(_wake, _mutex);
+
+    _idle = false;
+
+    if (_quit)
+    {
+      SDL_UnlockMutex(_mutex);
+      return 0;
+    }
+
+    SDL_UnlockMutex(_mutex);
+
+    if (!_ctx->makeCurrent())
+      _logger->error(TAG "Could not take the OpenGL context back: %s", SDL_GetError());
+
+    SDL_LockMutex(_mutex);
+  }
+
+  SDL_UnlockMutex(_mutex);
+  _ctx->releaseCurrent();
+  return 0;
+}
@@ -0,0 +1,103 @@
+/*
+Copyright (C) 2018 Andre Leiradella
+
+This file is part of RALibretro.
+
+RALibretro is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RALibretro is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "Logger.h"
+#include "VideoContext.h"
+
+#include <SDL_mutex.h>
+#include <SDL_thread.h>
+
+#include <stdint.h>
+#include <functional>
+#include <vector>
+
+/* Presents software rendered frames on a thread of its own, so the emulation never waits for the
+ * swap.
+ *
+ * Frames are copied into one of three buffers: one is being filled by submit, one has the most
+ * recent complete frame, and one is being presented. submit() never waits, if the thread is still
+ * busy the newest frame replaces the one that wasn't presented yet.
+ *
+ * The thread owns the OpenGL context while it runs. Everything else that needs the context must
+ * happen between suspend() and resume(), which present any pending frame and then hand the
+ * context to the calling thread. Calls nest, and do nothing when the thread isn't running.
+ */
+class Presenter
+{
+public:
+  typedef std::function<void(const void* pixels, unsigned width, unsigned height, size_t pitch)> Present;
+
+  bool init(Logger* logger, VideoContext* ctx, const Present& present);
+  void destroy();
+
+  /* Moves the context to the presenting thread, must be called from the thread that has it */
+  bool start();
+  void stop();
+  bool running() const { return _thread != NULL; }
+
+  void submit(const void* data, unsigned width, unsigned height, size_t pitch);
+
+  void suspend();
+  void resume();
+
+  /* Keeps the context for the scope it's declared in */
+  class Suspend
+  {
+  public:
+    Suspend(Presenter* presenter) : _presenter(presenter) { _presenter->suspend(); }
+    ~Suspend() { _presenter->resume(); }
+
+  protected:
+    Presenter* _presenter;
+  };
+
+protected:
+  struct Frame
+  {
+    std::vector<uint8_t> pixels;
+    unsigned width;
+    unsigned height;
+    size_t   pitch;
+  };
+
+  static int s_thread(void* udata);
+  int run();
+
+  Logger*       _logger;  /* thread safe, the presenting thread logs through it too */
+  VideoContext* _ctx;
+  Present       _present;
+
+  Frame    _frames[3];
+  unsigned _filling;     /* only touched by submit */
+  unsigned _ready;       /* most recent frame, new if _fresh is set */
+  unsigned _presenting;  /* only touched by the thread */
+  bool     _fresh;
+
+  SDL_Thread* _thread;
+  SDL_mutex*  _mutex;
+  SDL_cond*   _wake;
+  SDL_cond*   _parked;
+
+  bool     _quit;
+  bool     _suspended;  /* the thread was asked to give the context away */
+  bool     _idle;       /* the thread gave the context away */
+  unsigned _suspends;   /* nesting of suspend calls, only touched by the owner */
+};
@@ -0,0 +1,423 @@
+/*
+Copyright (C) 2018 Andre Leiradella
+
+This file is part of RALibretro.
+
+RALibretro is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RALibretro is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Resampler.h"
+
+#include <string.h>
+#include <math.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RESAMPLER_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define RESAMPLER_NEON
+#include <arm_neon.h>
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/* Computes the left and right dot products of taps interleaved frames against a coefficient row.
+ * taps is always a multiple of 8. */
+#if defined(RESAMPLER_SSE2)
+
+static void dotProduct(const int16_t* frames, const int16_t* row, unsigned taps, int32_t sums[2])
+{
+  __m128i acc0 = _mm_setzero_si128();
+  __m128i acc1 = _mm_setzero_si128();
+
+  for (unsigned j = 0; j < taps; j += 8)
+  {
+    /* L0 R0 L1 R1 L2 R2 L3 R3 -> L0 L1 R0 R1 L2 L3 R2 R3 */
+    __m128i s0 = _mm_loadu_si128((const __m128i*)(frames + j * 2));
+    __m128i s1 = _mm_loadu_si128((const __m128i*)(frames + j * 2 + 8));
+    s0 = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s0, _MM_SHUFFLE(3, 1, 2, 0)), _MM_SHUFFLE(3, 1, 2, 0));
+    s1 = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s1, _MM_SHUFFLE(3, 1, 2, 0)), _MM_SHUFFLE(3, 1, 2, 0));
+
+    /* c0 .. c7 -> c0 c1 c0 c1 c2 c3 c2 c3 and c4 c5 c4 c5 c6 c7 c6 c7 */
+    const __m128i c = _mm_loadu_si128((const __m128i*)(row + j));
+
+    /* lanes are L0*c0+L1*c1, R0*c0+R1*c1, L2*c2+L3*c3, R2*c2+R3*c3, two independent chains */
+    acc0 = _mm_add_epi32(acc0, _mm_madd_epi16(s0, _mm_unpacklo_epi32(c, c)));
+    acc1 = _mm_add_epi32(acc1, _mm_madd_epi16(s1, _mm_unpackhi_epi32(c, c)));
+  }
+
+  acc0 = _mm_add_epi32(acc0, acc1);
+  acc0 = _mm_add_epi32(acc0, _mm_srli_si128(acc0, 8));
+
+  sums[0] = _mm_cvtsi128_si32(acc0);
+  sums[1] = _mm_cvtsi128_si32(_mm_srli_si128(acc0, 4));
+}
+
+const char* Resampler::kernelName()
+{
+  return "SSE2";
+}
+
+#elif defined(RESAMPLER_NEON)
+
+static inline int32_t horizontalSum(int32x4_t v)
+{
+  int32x2_t sum = vadd_s32(vget_low_s32(v), vget_high_s32(v));
+  return vget_lane_s32(vpadd_s32(sum, sum), 0);
+}
+
+static void dotProduct(const int16_t* frames, const int16_t* row, unsigned taps, int32_t sums[2])
+{
+  int32x4_t left = vdupq_n_s32(0);
+  int32x4_t right = vdupq_n_s32(0);
+
+  for (unsigned j = 0; j < taps; j += 8)
+  {
+    /* vld2 deinterleaves the left and right channels for free */
+    const int16x8x2_t s = vld2q_s16(frames + j * 2);
+    const int16x8_t c = vld1q_s16(row + j);
+
+    left = vmlal_s16(left, vget_low_s16(s.val[0]), vget_low_s16(c));
+    right = vmlal_s16(right, vget_low_s16(s.val[1]), vget_low_s16(c));
+    left = vmlal_s16(left, vget_high_s16(s.val[0]), vget_high_s16(c));
+    right = vmlal_s16(right, vget_high_s16(s.val[1]), vget_high_s16(c));
+  }
+
+  sums[0] = horizontalSum(left);
+  sums[1] = horizontalSum(right);
+}
+
+const char* Resampler::kernelName()
+{
+  return "NEON";
+}
+
+#else
+
+static void dotProduct(const int16_t* frames, const int16_t* row, unsigned taps, int32_t sums[2])
+{
+  int32_t left = 0, right = 0;
+
+  for (unsigned j = 0; j < taps; j++)
+  {
+    left += frames[j * 2] * row[j];
+    right += frames[j * 2 + 1] * row[j];
+  }
+
+  sums[0] = left;
+  sums[1] = right;
+}
+
+const char* Resampler::kernelName()
+{
+  return "scalar";
+}
+
+#endif
+
+static double besselI0(double x)
+{
+  double sum = 1.0;
+  double term = 1.0;
+
+  for (int k = 1; k < 32; k++)
+  {
+    const double t = x / (2.0 * k);
+    term *= t * t;
+    sum += term;
+
+    if (term < sum * 1e-12)
+      break;
+  }
+
+  return sum;
+}
+
+static inline int16_t saturate(int32_t value)
+{
+  return value < -32768 ? -32768 : (value > 32767 ? 32767 : (int16_t)value);
+}
+
+const char* Resampler::qualityName(Quality quality)
+{
+  switch (quality)
+  {
+    case Quality::Linear: return "linear";
+    case Quality::Cubic:  return "cubic";
+    case Quality::Low:    return "sinc low";
+    case Quality::Medium: return "sinc medium";
+    case Quality::High:   return "sinc high";
+    default:              return "unknown";
+  }
+}
+
+bool Resampler::init(double inRate, double outRate, Quality quality)
+{
+  if (inRate <= 0.0 || outRate <= 0.0)
+  {
+    return false;
+  }
+
+  _quality = quality;
+
+  switch (quality)
+  {
+    case Quality::Linear:
+      _taps = 2;
+      std::vector<int16_t>().swap(_table);
+      break;
+
+    case Quality::Cubic:
+      _taps = 4;
+      std::vector<int16_t>().swap(_table);
+      break;
+
+    case Quality::Low:
+      if (!initTable(inRate, outRate, 16))
+        return false;
+      break;
+
+    default:
+    case Quality::Medium:
+      _quality = Quality::Medium;
+      if (!initTable(inRate, outRate, 48))
+        return false;
+      break;
+
+    case Quality::High:
+      if (!initTable(inRate, outRate, 128))
+        return false;
+      break;
+  }
+
+  _buffer.assign((_taps - 1) * 2, 0);
+  _frames = _taps - 1;
+  _position = 0;
+  _phase = 0;
+
+  setRate(inRate, outRate);
+  return true;
+}
+
+bool Resampler::initTable(double inRate, double outRate, unsigned taps)
+{
+  if (taps < 4)
+  {
+    return false;
+  }
+
+  /* when downsampling the cutoff moves below the output Nyquist and the filter has to get
+   * longer to keep the same transition band */
+  const double ratio = outRate / inRate;
+  double cutoff = 0.95;
+
+  if (ratio < 1.0)
+  {
+    cutoff *= ratio;
+    taps = (unsigned)ceil(taps / ratio);
+  }
+
+  taps = (taps + 7) & ~7U;
+
+  if (taps > 1024)
+  {
+    taps = 1024;
+  }
+
+  _taps = taps;
+  _phaseBits = kMaxPhaseBits;
+
+  while (_phaseBits > 7 && ((1U << _phaseBits) + 1) * taps * sizeof(int16_t) > kMaxTableBytes)
+  {
+    _phaseBits--;
+  }
+
+  const unsigned phases = 1U << _phaseBits;
+  _table.resize((phases + 1) * taps);
+
+  const double kBeta = 8.0;
+  const double half = taps / 2.0;
+  const double norm = besselI0(kBeta);
+  std::vector<double> row(taps);
+
+  for (unsigned p = 0; p <= phases; p++)
+  {
+    /* tap j multiplies the frame at (output position - taps / 2 + 1 + j - phase) */
+    const double frac = (double)p / phases;
+    double sum = 0.0;
+
+    for (unsigned j = 0; j < taps; j++)
+    {
+      const double x = (double)j - (half - 1.0) - frac;
+      const double t = x / half;
+      double value = 0.0;
+
+      if (t > -1.0 && t < 1.0)
+      {
+        const double arg = M_PI * cutoff * x;
+        const double sinc = x == 0.0 ? 1.0 : sin(arg) / arg;
+        value = cutoff * sinc * besselI0(kBeta * sqrt(1.0 - t * t)) / norm;
+      }
+
+      row[j] = value;
+      sum += value;
+    }
+
+    /* normalize each phase for unity gain at DC */
+    int16_t* coeffs = &_table[p * taps];
+
+    for (unsigned j = 0; j < taps; j++)
+    {
+      coeffs[j] = saturate((int32_t)floor(row[j] / sum * 32768.0 + 0.5));
+    }
+  }
+
+  return true;
+}
+
+void Resampler::destroy()
+{
+  std::vector<int16_t>().swap(_table);
+  std::vector<int16_t>().swap(_buffer);
+}
+
+void Resampler::setRate(double inRate, double outRate)
+{
+  _step = (uint64_t)(inRate / outRate * 4294967296.0 + 0.5);
+}
+
+size_t Resampler::process(const int16_t* input, size_t inFrames, int16_t* output, size_t outFrames)
+{
+  /* queue the input after the history, this is the only copy of the input samples */
+  if (_buffer.size() < (_frames + inFrames) * 2)
+  {
+    _buffer.resize((_frames + inFrames) * 2);
+  }
+
+  memcpy(&_buffer[_frames * 2], input, inFrames * 2 * sizeof(int16_t));
+  _frames += inFrames;
+
+  size_t produced;
+
+  switch (_quality)
+  {
+    case Quality::Linear: produced = processLinear(output, outFrames); break;
+    case Quality::Cubic:  produced = processCubic(output, outFrames); break;
+    default:              produced = processSinc(output, outFrames); break;
+  }
+
+  /* drop the frames that are no longer needed, keeping the history */
+  if (_position >= _frames)
+  {
+    _position -= _frames;
+    _frames = 0;
+  }
+  else if (_position != 0)
+  {
+    memmove(&_buffer[0], &_buffer[_position * 2], (_frames - _position) * 2 * sizeof(int16_t));
+    _frames -= _position;
+    _position = 0;
+  }
+
+  return produced;
+}
+
+size_t Resampler::processSinc(int16_t* output, size_t outFrames)
+{
+  const unsigned taps = _taps;
+  const unsigned shift = 32 - _phaseBits;
+  const int16_t* table = _table.data();
+  const int16_t* frames = _buffer.data();
+  size_t produced = 0;
+
+  while (produced < outFrames && _position + taps <= _frames)
+  {
+    /* the nearest phase, the table has a row for a phase of 1 so this never goes past the end */
+    const uint32_t row = (uint32_t)(((uint64_t)_phase + (1U << (shift - 1))) >> shift);
+
+    int32_t sums[2];
+    dotProduct(frames + _position * 2, table + row * taps, taps, sums);
+
+    output[produced * 2] = saturate((sums[0] + 16384) >> 15);
+    output[produced * 2 + 1] = saturate((sums[1] + 16384) >> 15);
+    produced++;
+
+    const uint64_t next = (uint64_t)_phase + _step;
+    _position += (size_t)(next >> 32);
+    _phase = (uint32_t)next;
+  }
+
+  return produced;
+}
+
+size_t Resampler::processLinear(int16_t* output, size_t outFrames)
+{
+  const int16_t* frames = _buffer.data();
+  size_t produced = 0;
+
+  while (produced < outFrames && _position + 2 <= _frames)
+  {
+    const int16_t* x = frames + _position * 2;
+    const int32_t frac = (int32_t)(_phase >> 17); /* Q15 */
+
+    output[produced * 2] = (int16_t)(x[0] + (((x[2] - x[0]) * frac) >> 15));
+    output[produced * 2 + 1] = (int16_t)(x[1] + (((x[3] - x[1]) * frac) >> 15));
+    produced++;
+
+    const uint64_t next = (uint64_t)_phase + _step;
+    _position += (size_t)(next >> 32);
+    _phase = (uint32_t)next;
+  }
+
+  return produced;
+}
+
+static inline int16_t catmullRom(int32_t x0, int32_t x1, int32_t x2, int32_t x3, int64_t t)
+{
+  /* t is Q15, evaluated in Horner form with 64-bit intermediates */
+  const int64_t a = -x0 + 3 * x1 - 3 * x2 + x3;
+  const int64_t b = 2 * x0 - 5 * x1 + 4 * x2 - x3;
+  const int64_t c = -x0 + x2;
+
+  int64_t value = (a * t) >> 15;
+  value = ((value + b) * t) >> 15;
+  value = ((value + c) * t) >> 15;
+  value = (value >> 1) + x1;
+
+  return saturate((int32_t)value);
+}
+
+size_t Resampler::processCubic(int16_t* output, size_t outFrames)
+{
+  const int16_t* frames = _buffer.data();
+  size_t produced = 0;
+
+  while (produced < outFrames && _position + 4 <= _frames)
+  {
+    const int16_t* x = frames + _position * 2;
+    const int64_t t = _phase >> 17; /* Q15 */
+
+    output[produced * 2] = catmullRom(x[0], x[2], x[4], x[6], t);
+    output[produced * 2 + 1] = catmullRom(x[1], x[3], x[5], x[7], t);
+    produced++;
+
+    const uint64_t next = (uint64_t)_phase + _step;
+    _position += (size_t)(next >> 32);
+    _phase = (uint32_t)next;
+  }
+
+  return produced;
+}
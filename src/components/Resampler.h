@@ -0,0 +1,92 @@
+/*
+Copyright (C) 2018 Andre Leiradella
+
+This file is part of RALibretro.
+
+RALibretro is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RALibretro is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <vector>
+
+/* Polyphase windowed-sinc resampler for interleaved stereo 16-bit samples.
+ *
+ * speex had issues upsampling SNES (32KHz) without introducing static when both channels went
+ * through one interleaved state, which is why we used to run two strided mono resamplers. Here
+ * both channels are filtered in the same pass with the same coefficients, but the history is
+ * kept interleaved so each channel still only ever sees its own previous samples.
+ */
+class Resampler
+{
+public:
+  enum class Quality
+  {
+    Linear,  /* no filtering at all, just interpolates between neighbours */
+    Cubic,   /* Catmull-Rom over four neighbours */
+    Low,     /* 16 taps */
+    Medium,  /* 48 taps */
+    High     /* 128 taps */
+  };
+
+  bool init(double inRate, double outRate, Quality quality);
+  void destroy();
+
+  /* Changes the ratio without touching the filter or the history, used by rate control */
+  void setRate(double inRate, double outRate);
+
+  /* Consumes all input frames, returns the number of frames written to output. Input that
+   * couldn't be turned into output because outFrames was too small is kept for the next call. */
+  size_t process(const int16_t* input, size_t inFrames, int16_t* output, size_t outFrames);
+
+  unsigned taps() const { return _taps; }
+  Quality quality() const { return _quality; }
+
+  static const char* qualityName(Quality quality);
+
+  /* Name of the inner product kernel selected at compile time */
+  static const char* kernelName();
+
+protected:
+  enum
+  {
+    /* each output frame uses the nearest of 4096 phases, close to what interpolating between
+     * 128 phases gives, with half the multiplications */
+    kMaxPhaseBits = 12,
+
+    /* long filters get fewer phases to keep the table from growing past this */
+    kMaxTableBytes = 1024 * 1024
+  };
+
+  bool initTable(double inRate, double outRate, unsigned taps);
+
+  size_t processSinc(int16_t* output, size_t outFrames);
+  size_t processLinear(int16_t* output, size_t outFrames);
+  size_t processCubic(int16_t* output, size_t outFrames);
+
+  Quality _quality;
+
+  std::vector<int16_t> _table;  /* (2^_phaseBits + 1) rows of _taps Q15 coefficients, sinc qualities only */
+  std::vector<int16_t> _buffer; /* pending interleaved frames, starting with _taps - 1 frames of history */
+
+  unsigned _taps;
+  unsigned _phaseBits;
+  size_t   _frames;   /* frames in _buffer */
+  size_t   _position; /* first frame in the window of the next output frame */
+  uint32_t _phase;    /* fractional part of the position, Q32 */
+  uint64_t _step;     /* input frames per output frame, Q32 */
+};
@@ -0,0 +1,834 @@
+/*
+Copyright (C) 2018 Andre Leiradella
+
+This file is part of RALibretro.
+
+RALibretro is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RALibretro is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ShaderChain.h"
+#include "GlUtil.h"
+
+#include "Util.h"
+
+#include <map>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TAG "[SHD] "
+
+const char* const ShaderChain::s_attributes[2] = {"VertexCoord", "TexCoord"};
+
+bool ShaderChain::init(Logger* logger)
+{
+  _logger = logger;
+
+  _vertexArray = _vertexBuffer = 0;
+  _textureWidth = _textureHeight = 0;
+  _outputWidth = _outputHeight = 0;
+  _historySize = _historyHead = 0;
+  _viewportScaled = false;
+  _frameCount = 0;
+  _queryIndex = 0;
+
+  for (unsigned i = 0; i < kMaxHistory; i++)
+    _history[i].framebuffer = _history[i].texture = 0;
+
+  static const char* vertexShader =
+    "attribute vec2 VertexCoord;\n"
+    "attribute vec2 TexCoord;\n"
+    "varying vec2 v_uv;\n"
+    "void main() {\n"
+    "  v_uv = TexCoord;\n"
+    "  gl_Position = vec4(VertexCoord, 0.0, 1.0);\n"
+    "}";
+
+  static const char* fragmentShader =
+    "varying vec2 v_uv;\n"
+    "uniform sampler2D Texture;\n"
+    "void main() {\n"
+    "  gl_FragColor = texture2D(Texture, v_uv);\n"
+    "}";
+
+  _copyProgram = GlUtil::createProgram(vertexShader, fragmentShader, s_attributes, 2);
+
+  if (_copyProgram == 0)
+    return false;
+
+  _copyTexture = Gl::getUniformLocation(_copyProgram, "Texture");
+
+  // the core's vertex array, if any, must not be touched, so we need our own
+  if (Gl::getVersion() >= 300)
+    Gl::genVertexArray(1, &_vertexArray);
+
+  Gl::genBuffers(1, &_vertexBuffer);
+
+  _timed = Gl::supportsTimerQuery();
+  return Gl::ok();
+}
+
+void ShaderChain::destroy()
+{
+  unload();
+
+  if (_vertexArray != 0)
+  {
+    Gl::deleteVertexArrays(1, &_vertexArray);
+    _vertexArray = 0;
+  }
+
+  if (_vertexBuffer != 0)
+  {
+    Gl::deleteBuffers(1, &_vertexBuffer);
+    _vertexBuffer = 0;
+  }
+
+  if (_copyProgram != 0)
+  {
+    Gl::deleteProgram(_copyProgram);
+    _copyProgram = 0;
+  }
+}
+
+static std::string trim(const std::string& str)
+{
+  size_t first = str.find_first_not_of(" \t\r\n");
+  size_t last = str.find_last_not_of(" \t\r\n");
+
+  if (first == std::string::npos)
+    return "";
+
+  std::string value = str.substr(first, last - first + 1);
+
+  if (value.length() >= 2 && value[0] == '"' && value[value.length() - 1] == '"')
+    value = value.substr(1, value.length() - 2);
+
+  return value;
+}
+
+static bool isTrue(const std::string& value)
+{
+  return value == "true" || value == "1";
+}
+
+static bool parseScaleType(const std::string& value, int* type)
+{
+  if (value == "source")
+    *type = 0;
+  else if (value == "viewport")
+    *type = 1;
+  else if (value == "absolute")
+    *type = 2;
+  else
+    return false;
+
+  return true;
+}
+
+bool ShaderChain::load(const std::string& path)
+{
+  std::string contents = util::loadFile(_logger, path);
+
+  if (contents.empty())
+    return false;
+
+  std::map<std::string, std::string> values;
+  size_t pos = 0;
+
+  while (pos < contents.length())
+  {
+    size_t eol = contents.find('\n', pos);
+
+    if (eol == std::string::npos)
+      eol = contents.length();
+
+    const std::string line = trim(contents.substr(pos, eol - pos));
+    pos = eol + 1;
+
+    if (line.empty() || line[0] == '#')
+      continue;
+
+    const size_t equal = line.find('=');
+
+    if (equal != std::string::npos)
+      values[trim(line.substr(0, equal))] = trim(line.substr(equal + 1));
+  }
+
+  const unsigned count = (unsigned)strtoul(values["shaders"].c_str(), NULL, 10);
+
+  if (count == 0)
+  {
+    _logger->error(TAG "No shaders in preset %s", path.c_str());
+    return false;
+  }
+
+  std::vector<Pass> passes(count);
+  bool ok = true;
+  unsigned loaded = 0;
+
+  for (unsigned i = 0; i < count && ok; i++)
+  {
+    const std::string index = std::to_string(i);
+    Pass* pass = &passes[i];
+
+    std::string shader = values["shader" + index];
+
+    if (shader.empty())
+    {
+      _logger->error(TAG "Pass %u has no shader in preset %s", i, path.c_str());
+      ok = false;
+      break;
+    }
+
+    // shader paths are relative to the preset
+    for (auto& ch : shader)
+    {
+#ifdef _WIN32
+      if (ch == '/')
+        ch = '\\';
+#else
+      if (ch == '\\')
+        ch = '/';
+#endif
+    }
+
+    const bool absolute = shader[0] == '/' || shader[0] == '\\' || (shader.length() > 1 && shader[1] == ':');
+    const std::string shaderPath = absolute ? shader : util::replaceFileName(path, shader.c_str());
+
+    int typeX = 0, typeY = 0;
+    const std::string type = values["scale_type" + index];
+
+    // passes without a scale type are the size of their input
+    if (!type.empty() && !parseScaleType(type, &typeX))
+      _logger->warn(TAG "Unknown scale type \"%s\" in pass %u", type.c_str(), i);
+
+    typeY = typeX;
+
+    if (values.count("scale_type_x" + index) != 0)
+      parseScaleType(values["scale_type_x" + index], &typeX);
+
+    if (values.count("scale_type_y" + index) != 0)
+      parseScaleType(values["scale_type_y" + index], &typeY);
+
+    pass->typeX = (ScaleType)typeX;
+    pass->typeY = (ScaleType)typeY;
+
+    const std::string scale = values["scale" + index];
+    pass->scaleX = pass->scaleY = scale.empty() ? 1.0f : (float)atof(scale.c_str());
+
+    if (values.count("scale_x" + index) != 0)
+      pass->scaleX = (float)atof(values["scale_x" + index].c_str());
+
+    if (values.count("scale_y" + index) != 0)
+      pass->scaleY = (float)atof(values["scale_y" + index].c_str());
+
+    if (pass->scaleX <= 0.0f || pass->scaleY <= 0.0f)
+      pass->scaleX = pass->scaleY = 1.0f;
+
+    pass->filter = -1;
+
+    if (values.count("filter_linear" + index) != 0)
+      pass->filter = isTrue(values["filter_linear" + index]) ? 1 : 0;
+
+    pass->frameCountMod = (unsigned)strtoul(values["frame_count_mod" + index].c_str(), NULL, 10);
+
+    ok = loadPass(pass, shaderPath);
+
+    if (ok)
+      loaded++;
+  }
+
+  if (!ok)
+  {
+    for (unsigned i = 0; i < loaded; i++)
+      destroyPass(&passes[i]);
+
+    _logger->error(TAG "Could not load preset %s", path.c_str());
+    return false;
+  }
+
+  unload();
+
+  _passes.swap(passes);
+  _path = path;
+
+  // the history is as deep as the deepest PrevNTexture used
+  _historySize = 0;
+  _viewportScaled = false;
+
+  for (size_t i = 0; i + 1 < _passes.size(); i++)
+    _viewportScaled = _viewportScaled || _passes[i].typeX == kScaleViewport || _passes[i].typeY == kScaleViewport;
+
+  for (const auto& pass : _passes)
+  {
+    for (unsigned i = 0; i < kMaxHistory; i++)
+    {
+      if (pass.prevTexture[i].location != -1 && i + 1 > _historySize)
+        _historySize = i + 1;
+    }
+  }
+
+  _logger->info(TAG "Loaded %u shader passes from %s, %u frames of history", count, path.c_str(), _historySize);
+  return true;
+}
+
+bool ShaderChain::loadPass(Pass* pass, const std::string& path)
+{
+  pass->name = util::fileNameWithExtension(path);
+  pass->program = 0;
+  pass->framebuffer = pass->target = 0;
+  pass->targetWidth = pass->targetHeight = 0;
+  pass->gpuNanos = 0;
+  pass->gpuSamples = 0;
+  pass->timing = false;
+
+  for (unsigned i = 0; i < kQueries; i++)
+  {
+    pass->queries[i] = 0;
+    pass->pending[i] = false;
+  }
+
+  const std::string source = util::loadFile(_logger, path);
+
+  if (source.empty())
+    return false;
+
+  // both stages come from the same file, the #version line must stay first
+  std::string header, body;
+  const size_t start = source.find_first_not_of(" \t\r\n");
+
+  if (start != std::string::npos && source.compare(start, 8, "#version") == 0)
+  {
+    const size_t eol = source.find('\n', start);
+    header = source.substr(0, eol == std::string::npos ? source.length() : eol + 1);
+    body = eol == std::string::npos ? "" : source.substr(eol + 1);
+  }
+  else
+  {
+    body = source;
+  }
+
+  const std::string vertexShader = header + "#define VERTEX\n" + body;
+  const std::string fragmentShader = header + "#define FRAGMENT\n" + body;
+
+  pass->program = GlUtil::createProgram(vertexShader.c_str(), fragmentShader.c_str(), s_attributes, 2);
+
+  if (pass->program == 0)
+  {
+    _logger->error(TAG "Could not compile %s", path.c_str());
+    return false;
+  }
+
+  findUniforms(pass);
+
+  if (_timed)
+    Gl::genQueries(kQueries, pass->queries);
+
+  _logger->debug(TAG "Compiled %s", path.c_str());
+  return true;
+}
+
+void ShaderChain::findUniforms(Pass* pass)
+{
+  char prevNames[kMaxHistory][16];
+  Uniform* uniforms[16 + kMaxHistory];
+  const char* names[16 + kMaxHistory];
+  unsigned count = 0;
+
+#define UNIFORM(field, name) do { uniforms[count] = &pass->field; names[count++] = name; } while (0)
+  UNIFORM(mvp, "MVPMatrix");
+  UNIFORM(frameCount, "FrameCount");
+  UNIFORM(frameDirection, "FrameDirection");
+  UNIFORM(texture, "Texture");
+  UNIFORM(inputSize, "InputSize");
+  UNIFORM(textureSize, "TextureSize");
+  UNIFORM(outputSize, "OutputSize");
+  UNIFORM(origTexture, "OrigTexture");
+  UNIFORM(origInputSize, "OrigInputSize");
+  UNIFORM(origTextureSize, "OrigTextureSize");
+#undef UNIFORM
+
+  for (unsigned i = 0; i < kMaxHistory; i++)
+  {
+    if (i == 0)
+      snprintf(prevNames[i], sizeof(prevNames[i]), "PrevTexture");
+    else
+      snprintf(prevNames[i], sizeof(prevNames[i]), "Prev%uTexture", i);
+
+    uniforms[count] = &pass->prevTexture[i];
+    names[count++] = prevNames[i];
+  }
+
+  for (unsigned i = 0; i < count; i++)
+  {
+    uniforms[i]->location = -1;
+    uniforms[i]->type = 0;
+  }
+
+  // go through the uniforms the shader actually uses, their types are needed to know which
+  // glUniform call each one accepts
+  GLint active = 0;
+  Gl::getProgramiv(pass->program, GL_ACTIVE_UNIFORMS, &active);
+
+  for (GLint i = 0; i < active; i++)
+  {
+    char name[64];
+    GLsizei length = 0;
+    GLint size;
+    GLenum type;
+    Gl::getActiveUniform(pass->program, (GLuint)i, sizeof(name), &length, &size, &type, name);
+
+    for (unsigned j = 0; j < count; j++)
+    {
+      if (strcmp(name, names[j]) == 0)
+      {
+        uniforms[j]->location = Gl::getUniformLocation(pass->program, name);
+        uniforms[j]->type = type;
+        break;
+      }
+    }
+  }
+}
+
+void ShaderChain::destroyPass(Pass* pass)
+{
+  if (pass->queries[0] != 0)
+    Gl::deleteQueries(kQueries, pass->queries);
+
+  if (pass->framebuffer != 0)
+    Gl::deleteFramebuffers(1, &pass->framebuffer);
+
+  if (pass->target != 0)
+    Gl::deleteTextures(1, &pass->target);
+
+  if (pass->program != 0)
+    Gl::deleteProgram(pass->program);
+
+  pass->program = pass->framebuffer = pass->target = 0;
+  pass->queries[0] = 0;
+}
+
+void ShaderChain::unload()
+{
+  if (_passes.empty())
+    return;
+
+  for (size_t i = 0; i < _passes.size(); i++)
+  {
+    const Pass& pass = _passes[i];
+
+    if (pass.gpuSamples != 0)
+      _logger->info(TAG "Pass %u (%s) took %.3f ms of GPU time on average", (unsigned)i, pass.name.c_str(), pass.gpuNanos / 1e6 / pass.gpuSamples);
+  }
+
+  destroyTargets();
+
+  for (auto& pass : _passes)
+    destroyPass(&pass);
+
+  _passes.clear();
+  _path.clear();
+  _historySize = 0;
+}
+
+void ShaderChain::destroyTargets()
+{
+  for (auto& pass : _passes)
+  {
+    if (pass.framebuffer != 0)
+      Gl::deleteFramebuffers(1, &pass.framebuffer);
+
+    if (pass.target != 0)
+      Gl::deleteTextures(1, &pass.target);
+
+    pass.framebuffer = pass.target = 0;
+    pass.targetWidth = pass.targetHeight = 0;
+  }
+
+  for (unsigned i = 0; i < kMaxHistory; i++)
+  {
+    if (_history[i].framebuffer != 0)
+      Gl::deleteFramebuffers(1, &_history[i].framebuffer);
+
+    if (_history[i].texture != 0)
+      Gl::deleteTextures(1, &_history[i].texture);
+
+    _history[i].framebuffer = _history[i].texture = 0;
+  }
+
+  _textureWidth = _textureHeight = 0;
+}
+
+static GLuint createTarget(unsigned width, unsigned height, GLuint* texture)
+{
+  *texture = GlUtil::createTexture(width, height, GL_RGBA, GL_RGBA, GL_UNSIGNED_BYTE, GL_NEAREST);
+
+  if (*texture == 0)
+    return 0;
+
+  GLuint renderbuffer;
+  GLuint framebuffer = GlUtil::createFramebuffer(&renderbuffer, width, height, *texture, false, false);
+
+  if (framebuffer == 0)
+  {
+    Gl::deleteTextures(1, texture);
+    *texture = 0;
+  }
+
+  return framebuffer;
+}
+
+static unsigned scaledSize(int type, float scale, unsigned source, unsigned output)
+{
+  float size;
+
+  switch (type)
+  {
+  case 1:  size = output * scale; break;
+  case 2:  size = scale; break;
+  default: size = source * scale; break;
+  }
+
+  return size < 1.0f ? 1 : (unsigned)(size + 0.5f);
+}
+
+bool ShaderChain::ensureTargets(unsigned textureWidth, unsigned textureHeight, unsigned outputWidth, unsigned outputHeight)
+{
+  if (_passes.empty())
+    return true;
+
+  // the last pass always needs the current output size, but only passes scaled to the viewport
+  // need new framebuffers when it changes
+  const bool outputChanged = outputWidth != _outputWidth || outputHeight != _outputHeight;
+  _outputWidth = outputWidth;
+  _outputHeight = outputHeight;
+
+  if (textureWidth == _textureWidth && textureHeight == _textureHeight && !(outputChanged && _viewportScaled))
+    return true;
+
+  destroyTargets();
+
+  unsigned width = textureWidth;
+  unsigned height = textureHeight;
+
+  for (size_t i = 0; i + 1 < _passes.size(); i++)
+  {
+    Pass* pass = &_passes[i];
+
+    pass->targetWidth = scaledSize(pass->typeX, pass->scaleX, width, outputWidth);
+    pass->targetHeight = scaledSize(pass->typeY, pass->scaleY, height, outputHeight);
+    pass->framebuffer = createTarget(pass->targetWidth, pass->targetHeight, &pass->target);
+
+    if (pass->framebuffer == 0)
+    {
+      _logger->error(TAG "Could not create a %u x %u framebuffer for pass %u", pass->targetWidth, pass->targetHeight, (unsigned)i);
+      destroyTargets();
+      return false;
+    }
+
+    width = pass->targetWidth;
+    height = pass->targetHeight;
+  }
+
+  for (unsigned i = 0; i < _historySize; i++)
+  {
+    _history[i].framebuffer = createTarget(textureWidth, textureHeight, &_history[i].texture);
+
+    if (_history[i].framebuffer == 0)
+    {
+      _logger->error(TAG "Could not create a %u x %u framebuffer for the frame history", textureWidth, textureHeight);
+      destroyTargets();
+      return false;
+    }
+  }
+
+  _textureWidth = textureWidth;
+  _textureHeight = textureHeight;
+  _historyHead = 0;
+
+  _logger->debug(TAG "Framebuffers created for a %u x %u texture and a %u x %u output", textureWidth, textureHeight, outputWidth, outputHeight);
+  return true;
+}
+
+void ShaderChain::finalScale(float* scaleX, float* scaleY) const
+{
+  // a pass scaled from its source keeps the proportion of the image in the texture, any other
+  // is drawn over its whole framebuffer
+  for (size_t i = 0; i + 1 < _passes.size(); i++)
+  {
+    if (_passes[i].typeX != kScaleSource)
+      *scaleX = 1.0f;
+
+    if (_passes[i].typeY != kScaleSource)
+      *scaleY = 1.0f;
+  }
+}
+
+void ShaderChain::setInteger(const Uniform& uniform, int value)
+{
+  if (uniform.location == -1)
+    return;
+
+  // setting a uniform with the wrong type is an error
+  if (uniform.type == GL_FLOAT)
+    Gl::uniform1f(uniform.location, (GLfloat)value);
+  else if (uniform.type == GL_INT || uniform.type == GL_SAMPLER_2D)
+    Gl::uniform1i(uniform.location, value);
+}
+
+void ShaderChain::setSize(const Uniform& uniform, unsigned width, unsigned height)
+{
+  if (uniform.location != -1 && uniform.type == GL_FLOAT_VEC2)
+    Gl::uniform2f(uniform.location, (GLfloat)width, (GLfloat)height);
+}
+
+void ShaderChain::bindTexture(const Uniform& uniform, unsigned unit, GLuint texture)
+{
+  if (uniform.location == -1 || uniform.type != GL_SAMPLER_2D)
+    return;
+
+  Gl::activeTexture(GL_TEXTURE0 + unit);
+  Gl::bindTexture(GL_TEXTURE_2D, texture);
+  Gl::uniform1i(uniform.location, unit);
+}
+
+void ShaderChain::setUniforms(const Pass& pass, GLuint texture, unsigned textureWidth, unsigned textureHeight, unsigned width, unsigned height, unsigned outputWidth, unsigned outputHeight)
+{
+  static const GLfloat identity[16] = {
+    1.0f, 0.0f, 0.0f, 0.0f,
+    0.0f, 1.0f, 0.0f, 0.0f,
+    0.0f, 0.0f, 1.0f, 0.0f,
+    0.0f, 0.0f, 0.0f, 1.0f
+  };
+
+  // the quads are already in clip space
+  if (pass.mvp.location != -1 && pass.mvp.type == GL_FLOAT_MAT4)
+    Gl::uniformMatrix4fv(pass.mvp.location, 1, GL_FALSE, identity);
+
+  setInteger(pass.frameCount, (int)(pass.frameCountMod != 0 ? _frameCount % pass.frameCountMod : _frameCount));
+  setInteger(pass.frameDirection, 1);
+
+  setSize(pass.inputSize, width, height);
+  setSize(pass.textureSize, textureWidth, textureHeight);
+  setSize(pass.outputSize, outputWidth, outputHeight);
+
+  // unit 0 is the input, which is already bound
+  setInteger(pass.texture, 0);
+  setSize(pass.origInputSize, _originalWidth, _originalHeight);
+  setSize(pass.origTextureSize, _textureWidth, _textureHeight);
+  bindTexture(pass.origTexture, 1, _original);
+
+  for (unsigned i = 0; i < _historySize; i++)
+  {
+    const unsigned slot = (_historyHead + _historySize - i) % _historySize;
+    bindTexture(pass.prevTexture[i], 2 + i, _history[slot].texture);
+  }
+
+  Gl::activeTexture(GL_TEXTURE0);
+}
+
+void ShaderChain::drawQuad(float u, float v)
+{
+  const GLfloat vertices[] = {
+    -1.0f, -1.0f, 0.0f, 0.0f,
+    -1.0f,  1.0f, 0.0f,    v,
+     1.0f, -1.0f,    u, 0.0f,
+     1.0f,  1.0f,    u,    v
+  };
+
+  if (_vertexArray != 0)
+    Gl::bindVertexArray(_vertexArray);
+
+  Gl::bindBuffer(GL_ARRAY_BUFFER, _vertexBuffer);
+  Gl::bufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STREAM_DRAW);
+
+  Gl::enableVertexAttribArray(kPositionAttribute);
+  Gl::vertexAttribPointer(kPositionAttribute, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), (const GLvoid*)0);
+  Gl::enableVertexAttribArray(kTexCoordAttribute);
+  Gl::vertexAttribPointer(kTexCoordAttribute, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), (const GLvoid*)(2 * sizeof(GLfloat)));
+
+  Gl::drawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+  if (_vertexArray != 0)
+    Gl::bindVertexArray(0);
+}
+
+void ShaderChain::begin(GLuint texture, unsigned textureWidth, unsigned textureHeight, unsigned width, unsigned height, bool linear, bool newFrame)
+{
+  _original = texture;
+  _originalWidth = width;
+  _originalHeight = height;
+  _newFrame = newFrame;
+
+  if (newFrame)
+    _queryIndex = (_queryIndex + 1) % kQueries;
+
+  GLuint input = texture;
+  unsigned inputTextureWidth = textureWidth, inputTextureHeight = textureHeight;
+  unsigned inputWidth = width, inputHeight = height;
+
+  for (size_t i = 0; i < _passes.size(); i++)
+  {
+    Pass* pass = &_passes[i];
+    const bool last = i + 1 == _passes.size();
+
+    collectQueries(pass);
+
+    Gl::activeTexture(GL_TEXTURE0);
+    Gl::bindTexture(GL_TEXTURE_2D, input);
+
+    const GLint filter = (pass->filter < 0 ? linear : pass->filter != 0) ? GL_LINEAR : GL_NEAREST;
+    Gl::texParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+    Gl::texParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+
+    Gl::useProgram(pass->program);
+
+    if (last)
+    {
+      // the caller draws the last pass on the screen
+      setUniforms(*pass, input, inputTextureWidth, inputTextureHeight, inputWidth, inputHeight, _outputWidth, _outputHeight);
+      beginQuery(pass);
+      return;
+    }
+
+    const unsigned outputWidth = pass->typeX == kScaleSource ? scaledSize(kScaleSource, pass->scaleX, inputWidth, 0) : pass->targetWidth;
+    const unsigned outputHeight = pass->typeY == kScaleSource ? scaledSize(kScaleSource, pass->scaleY, inputHeight, 0) : pass->targetHeight;
+
+    setUniforms(*pass, input, inputTextureWidth, inputTextureHeight, inputWidth, inputHeight, outputWidth, outputHeight);
+
+    Gl::bindFramebuffer(GL_FRAMEBUFFER, pass->framebuffer);
+    Gl::viewport(0, 0, outputWidth, outputHeight);
+
+    beginQuery(pass);
+    drawQuad((float)inputWidth / (float)inputTextureWidth, (float)inputHeight / (float)inputTextureHeight);
+    endQuery(pass);
+
+    input = pass->target;
+    inputTextureWidth = pass->targetWidth;
+    inputTextureHeight = pass->targetHeight;
+    inputWidth = outputWidth < pass->targetWidth ? outputWidth : pass->targetWidth;
+    inputHeight = outputHeight < pass->targetHeight ? outputHeight : pass->targetHeight;
+  }
+}
+
+void ShaderChain::end(GLuint texture, bool linear)
+{
+  if (_passes.empty())
+    return;
+
+  endQuery(&_passes.back());
+
+  // keep a copy of the frame for the passes that read the previous ones
+  if (_newFrame && _historySize != 0)
+  {
+    _historyHead = (_historyHead + 1) % _historySize;
+
+    Gl::bindFramebuffer(GL_FRAMEBUFFER, _history[_historyHead].framebuffer);
+    Gl::viewport(0, 0, _textureWidth, _textureHeight);
+
+    Gl::useProgram(_copyProgram);
+    Gl::activeTexture(GL_TEXTURE0);
+    Gl::bindTexture(GL_TEXTURE_2D, texture);
+    Gl::texParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    Gl::texParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    Gl::uniform1i(_copyTexture, 0);
+
+    drawQuad(1.0f, 1.0f);
+
+    Gl::bindFramebuffer(GL_FRAMEBUFFER, 0);
+  }
+
+  if (_newFrame)
+    _frameCount++;
+
+  for (unsigned i = 1; i < 2 + _historySize; i++)
+  {
+    Gl::activeTexture(GL_TEXTURE0 + i);
+    Gl::bindTexture(GL_TEXTURE_2D, 0);
+  }
+
+  const GLint filter = linear ? GL_LINEAR : GL_NEAREST;
+  Gl::activeTexture(GL_TEXTURE0);
+  Gl::bindTexture(GL_TEXTURE_2D, texture);
+  Gl::texParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+  Gl::texParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+  Gl::bindTexture(GL_TEXTURE_2D, 0);
+}
+
+void ShaderChain::beginQuery(Pass* pass)
+{
+  pass->timing = false;
+
+  // don't reuse a query whose result hasn't been read yet
+  if (!_timed || pass->pending[_queryIndex])
+    return;
+
+  Gl::beginQuery(GL_TIME_ELAPSED, pass->queries[_queryIndex]);
+  pass->timing = true;
+}
+
+void ShaderChain::endQuery(Pass* pass)
+{
+  if (!pass->timing)
+    return;
+
+  Gl::endQuery(GL_TIME_ELAPSED);
+  pass->pending[_queryIndex] = true;
+  pass->timing = false;
+}
+
+void ShaderChain::collectQueries(Pass* pass)
+{
+  for (unsigned i = 0; i < kQueries; i++)
+  {
+    if (!pass->pending[i])
+      continue;
+
+    GLint available = 0;
+    Gl::getQueryObjectiv(pass->queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+
+    if (available)
+    {
+      GLuint64 nanos = 0;
+      Gl::getQueryObjectui64v(pass->queries[i], GL_QUERY_RESULT, &nanos);
+
+      pass->gpuNanos += nanos;
+      pass->gpuSamples++;
+      pass->pending[i] = false;
+    }
+  }
+}
+
+std::string ShaderChain::report() const
+{
+  if (!_timed)
+    return "";
+
+  std::string text;
+
+  for (size_t i = 0; i < _passes.size(); i++)
+  {
+    const Pass& pass = _passes[i];
+    const double ms = pass.gpuSamples != 0 ? pass.gpuNanos / 1e6 / pass.gpuSamples : 0.0;
+
+    char line[256];
+    snprintf(line, sizeof(line), "Pass %u (%s): %.3f ms\r\n", (unsigned)i, pass.name.c_str(), ms);
+    text.append(line);
+  }
+
+  return text;
+}
@@ -0,0 +1,179 @@
+/*
+Copyright (C) 2018 Andre Leiradella
+
+This file is part of RALibretro.
+
+RALibretro is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RALibretro is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "Logger.h"
+#include "Gl.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/* Post-processing passes loaded from a RetroArch GLSL preset (.glslp).
+ *
+ * Every pass but the last renders into its own framebuffer, the last one is drawn by Video on the
+ * screen with its vertex setup, so rotation and aspect ratio work the same with or without
+ * shaders. The last pass' scale is ignored for that reason.
+ *
+ * Framebuffers are only reallocated when the size of the core's texture changes, which happens
+ * when the core sets a new geometry, or when the window is resized if a pass is scaled to it.
+ * Frames that are smaller than the texture only use part of the framebuffers, like they do with
+ * the texture.
+ *
+ * Shaders follow the libretro GLSL conventions: a single file with VERTEX and FRAGMENT sections,
+ * the VertexCoord and TexCoord attributes, and the Texture, MVPMatrix, FrameCount, FrameDirection,
+ * InputSize, TextureSize, OutputSize, OrigTexture and PrevTexture to Prev6Texture uniforms.
+ */
+class ShaderChain
+{
+public:
+  enum
+  {
+    kPositionAttribute = 0,
+    kTexCoordAttribute = 1,
+    kMaxHistory = 7
+  };
+
+  /* Attribute names bound to kPositionAttribute and kTexCoordAttribute */
+  static const char* const s_attributes[2];
+
+  bool init(Logger* logger);
+  void destroy();
+
+  /* Replaces the passes with the ones in the preset, the current ones are kept on errors */
+  bool load(const std::string& path);
+  void unload();
+
+  bool empty() const { return _passes.empty(); }
+  const std::string& path() const { return _path; }
+
+  /* Makes sure the framebuffers fit the core's texture and the area of the window showing it */
+  bool ensureTargets(unsigned textureWidth, unsigned textureHeight, unsigned outputWidth, unsigned outputHeight);
+
+  /* How much of the texture read by the last pass has the image, given how much of the core's
+   * texture has it */
+  void finalScale(float* scaleX, float* scaleY) const;
+
+  /* Runs all passes but the last into their framebuffers, then leaves the last pass' program,
+   * uniforms and input ready for the caller to draw the final quad. newFrame is false when the
+   * same frame is drawn again, so the frame count and the history don't advance. */
+  void begin(GLuint texture, unsigned textureWidth, unsigned textureHeight, unsigned width, unsigned height, bool linear, bool newFrame);
+
+  /* Called after the final quad was drawn, restores the core's texture filter */
+  void end(GLuint texture, bool linear);
+
+  /* Average GPU time of each pass, empty if the driver can't measure it */
+  std::string report() const;
+
+protected:
+  enum ScaleType
+  {
+    kScaleSource,
+    kScaleViewport,
+    kScaleAbsolute
+  };
+
+  enum
+  {
+    kQueries = 4  /* timer queries per pass, results are read a few frames later */
+  };
+
+  struct Uniform
+  {
+    GLint  location;
+    GLenum type;
+  };
+
+  struct Pass
+  {
+    std::string name;
+    GLuint      program;
+
+    ScaleType typeX, typeY;
+    float     scaleX, scaleY;
+    int       filter;     /* -1 when the preset doesn't say, uses the video setting */
+    unsigned  frameCountMod;
+
+    Uniform mvp, frameCount, frameDirection;
+    Uniform texture, inputSize, textureSize, outputSize;
+    Uniform origTexture, origInputSize, origTextureSize;
+    Uniform prevTexture[kMaxHistory];
+
+    /* where it renders to, all zero for the last pass */
+    GLuint   framebuffer;
+    GLuint   target;
+    unsigned targetWidth, targetHeight;
+
+    GLuint   queries[kQueries];
+    bool     pending[kQueries];
+    bool     timing;
+    uint64_t gpuNanos;
+    unsigned gpuSamples;
+  };
+
+  struct Frame
+  {
+    GLuint   framebuffer;
+    GLuint   texture;
+  };
+
+  bool loadPass(Pass* pass, const std::string& path);
+  void destroyPass(Pass* pass);
+  void destroyTargets();
+  void findUniforms(Pass* pass);
+
+  static void setInteger(const Uniform& uniform, int value);
+  static void setSize(const Uniform& uniform, unsigned width, unsigned height);
+  static void bindTexture(const Uniform& uniform, unsigned unit, GLuint texture);
+
+  void setUniforms(const Pass& pass, GLuint texture, unsigned textureWidth, unsigned textureHeight, unsigned width, unsigned height, unsigned outputWidth, unsigned outputHeight);
+  void drawQuad(float u, float v);
+
+  void beginQuery(Pass* pass);
+  void endQuery(Pass* pass);
+  void collectQueries(Pass* pass);
+
+  Logger* _logger;
+
+  std::string       _path;
+  std::vector<Pass> _passes;
+
+  GLuint   _copyProgram; /* copies the core's texture into the history */
+  GLint    _copyTexture;
+  GLuint   _vertexArray;
+  GLuint   _vertexBuffer;
+
+  unsigned _textureWidth, _textureHeight;  /* zero when the framebuffers aren't allocated */
+  unsigned _outputWidth, _outputHeight;
+  bool     _viewportScaled;
+
+  /* the core's frame being drawn */
+  GLuint   _original;
+  unsigned _originalWidth, _originalHeight;
+  bool     _newFrame;
+
+  Frame    _history[kMaxHistory];
+  unsigned _historySize;  /* frames kept, the most any pass reads */
+  unsigned _historyHead;  /* slot with the most recent frame */
+
+  unsigned _frameCount;
+  unsigned _queryIndex;
+  bool     _timed;
+};
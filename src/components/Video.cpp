@@ -22,34 +22,76 @@ along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
 #include "GlUtil.h"
 
 #include "Dialog.h"
+#include "Metrics.h"
+#include "Recorder.h"
+#include "Util.h"
 #include "jsonsax/jsonsax.h"
 
 #include <SDL_render.h>
+#include <SDL_timer.h>
 
 #include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
 
 #define TAG "[VID] "
 
-bool Video::init(libretro::LoggerComponent* logger, libretro::VideoContextComponent *ctx, Config* config)
+bool Video::init(Logger* logger, VideoContext* ctx, Config* config)
 {
   _logger = logger;
   _ctx = ctx;
   _config = config;
+  _recorder = NULL;
+
+  // frames are uploaded and drawn by the presenter when it runs
+  bool ok = _presenter.init(logger, ctx, [this](const void* data, unsigned width, unsigned height, size_t pitch) {
+    upload(data, width, height, pitch);
+    present(true);
+  });
+
+  if (!ok)
+    return false;
 
   _enabled = true;
+  _frameDuped = false;
+  _damaged = false;
 
   _pixelFormat = RETRO_PIXEL_FORMAT_UNKNOWN;
   _windowWidth = _windowHeight = 0;
   _textureWidth = _textureHeight = 0;
   _viewWidth = _viewHeight = 0;
+  _outputWidth = _outputHeight = 0;
+  _texScaleX = _texScaleY = 0.0f;
 
   _vertexArray = _vertexBuffer = 0;
   _texture = 0;
+  _texturesCreated = _texturesReused = _framebuffersCreated = _filterChanges = 0;
   _rotation = Rotation::None;
   _rotationHandler = NULL;
 
   _preserveAspect = false;
   _linearFilter = false;
+  _framePacing = FramePacing::Adaptive;
+  _threadedPresentation = false;
+
+  _uploadMicros = 0;
+  _flashTicks = 0;
+  _latencyCount = 0;
+  _latencyTotal = _latencyMax = 0;
+
+  for (unsigned i = 0; i < kUploadBuffers; i++)
+    _uploadBuffers[i] = 0;
+
+  _uploadIndex = 0;
+  _uploadAsync = false;
+
+  _frameCount = 0;
+  _thumbnail.framebuffer = _thumbnail.renderBuffer = 0;
+  _thumbnail.width = _thumbnail.height = 0;
+  _thumbnail.frame = 0;
+  _thumbnail.valid = false;
 
   _program = createProgram(&_posAttribute, &_uvAttribute, &_texUniform);
 
@@ -57,23 +99,42 @@ bool Video::init(libretro::LoggerComponent* logger, libretro::VideoContextCompon
   _hw.frameBuffer = _hw.renderBuffer = 0;
   _hw.callback = nullptr;
 
-  if (!Gl::ok())
+  if (!Gl::ok() || _program == 0 || !_shaders.init(_logger))
   {
     destroy();
     return false;
   }
 
+  if (Gl::supportsMapBuffer())
+  {
+    Gl::genBuffers(kUploadBuffers, _uploadBuffers);
+    _uploadAsync = Gl::ok();
+  }
+
+  _logger->info(TAG "Frames are uploaded %s", _uploadAsync ? "through pixel buffers" : "directly");
   return true;
 }
 
 void Video::destroy()
 {
+  // gets the context back
+  _presenter.stop();
+
+  flushReadbacks();
+  destroyThumbnail();
+  _shaders.destroy();
+
   if (_texture != 0)
   {
     Gl::deleteTextures(1, &_texture);
     _texture = 0;
   }
 
+  for (const auto& pooled : _texturePool)
+    Gl::deleteTextures(1, &pooled.texture);
+
+  _texturePool.clear();
+
   if (_vertexArray != 0)
   {
     Gl::deleteVertexArrays(1, &_vertexArray);
@@ -86,6 +147,22 @@ void Video::destroy()
     _vertexBuffer = 0;
   }
 
+  if (_uploadBuffers[0] != 0)
+  {
+    Gl::deleteBuffers(kUploadBuffers, _uploadBuffers);
+
+    for (unsigned i = 0; i < kUploadBuffers; i++)
+      _uploadBuffers[i] = 0;
+  }
+
+  if (!_readbackBuffers.empty())
+  {
+    Gl::deleteBuffers((GLsizei)_readbackBuffers.size(), _readbackBuffers.data());
+    _readbackBuffers.clear();
+  }
+
+  _uploadAsync = false;
+
   if (_program != 0)
   {
     Gl::deleteProgram(_program);
@@ -103,6 +180,8 @@ void Video::destroy()
     Gl::deleteRenderbuffers(1, &_hw.renderBuffer);
     _hw.renderBuffer = 0;
   }
+
+  _presenter.destroy();
 }
 
 void Video::setEnabled(bool enabled)
@@ -112,6 +191,8 @@ void Video::setEnabled(bool enabled)
 
 void Video::clear()
 {
+  Presenter::Suspend suspend(&_presenter);
+
   if (_hw.frameBuffer != 0)
   {
     Gl::bindFramebuffer(GL_FRAMEBUFFER, _hw.frameBuffer);
@@ -130,32 +211,121 @@ void Video::draw(bool force)
 {
   if (_texture != 0 && (force || _enabled))
   {
-    Gl::bindFramebuffer(GL_FRAMEBUFFER, 0);
-    Gl::viewport(0, 0, _windowWidth, _windowHeight);
-    Gl::clearColor(0.0, 0.0, 0.0, 1.0);
-    Gl::clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    Presenter::Suspend suspend(&_presenter);
 
-    Gl::useProgram(_program);
+    // a forced draw shows the same frame again
+    present(!force);
+  }
+}
 
-    Gl::bindVertexArray(_vertexArray);
+void Video::present(bool newFrame)
+{
+  // the core may have changed anything since the last frame
+  if (_hw.enabled)
+    Gl::resetState();
 
-    Gl::activeTexture(GL_TEXTURE0);
-    Gl::bindTexture(GL_TEXTURE_2D, _texture);
-    Gl::uniform1i(_texUniform, 0);
+  // cleared before drawing, damage reported while this frame is drawn makes the next one redraw
+  _damaged.store(false, std::memory_order_relaxed);
+
+  // the test pattern replaces the frame the press went into
+  const uint32_t flash = newFrame ? _flashTicks.exchange(0) : 0;
+
+  bool shaders = flash == 0 && !_shaders.empty();
+
+  if (shaders && !_shaders.ensureTargets(_textureWidth, _textureHeight, _outputWidth, _outputHeight))
+  {
+    _logger->error(TAG "Could not create the framebuffers for %s, shaders disabled", _shaderPreset.c_str());
+    _shaders.unload();
+    _shaderPreset.clear();
+    shaders = false;
+
+    // the final quad goes back to reading the core's texture directly
+    ensureView(_viewWidth, _viewHeight, _windowWidth, _windowHeight, _preserveAspect, _rotation);
+  }
+
+  if (shaders)
+    _shaders.begin(_texture, _textureWidth, _textureHeight, _viewWidth, _viewHeight, _linearFilter, newFrame);
+
+  Gl::bindFramebuffer(GL_FRAMEBUFFER, 0);
+  Gl::viewport(0, 0, _windowWidth, _windowHeight);
+  const GLclampf clear = flash != 0 ? 1.0f : 0.0f;
+  Gl::clearColor(clear, clear, clear, 1.0);
+  Gl::clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+  if (flash == 0)
+  {
+    // the bindings are cached, when nothing else ran they're all still in place
+    if (!shaders)
+    {
+      Gl::useProgram(_program);
+
+      Gl::activeTexture(GL_TEXTURE0);
+      Gl::bindTexture(GL_TEXTURE_2D, _texture);
+    }
+
+    bindVertices();
 
     Gl::drawArrays(GL_TRIANGLE_STRIP, 0, 4);
+  }
+
+  if (shaders)
+    _shaders.end(_texture, _linearFilter);
 
+  // leave nothing of ours bound for the core
+  if (_hw.enabled)
+  {
     Gl::bindTexture(GL_TEXTURE_2D, 0);
     Gl::bindVertexArray(0);
     Gl::useProgram(0);
+  }
+
+  // release builds only check for errors here
+  Gl::pollErrors();
+
+  _ctx->swapBuffers();
+
+  if (flash != 0)
+  {
+    const uint32_t latency = SDL_GetTicks() - flash;
+
+    _latencyCount++;
+    _latencyTotal += latency;
 
-    _ctx->swapBuffers();
+    if (latency > _latencyMax)
+      _latencyMax = latency;
+
+    _logger->info(TAG "Input to present took %u ms", latency);
   }
 }
 
+void Video::logLatency()
+{
+  const unsigned count = _latencyCount.exchange(0);
+  const uint32_t total = _latencyTotal.exchange(0);
+  const uint32_t max = _latencyMax.exchange(0);
+
+  if (count != 0)
+    _logger->info(TAG "Input to present: %u presses, %.1f ms on average, %u ms at most", count, (double)total / count, max);
+}
+
+void Video::logTextures()
+{
+  _logger->info(TAG "Textures: %u created, %u reused, %u hardware render framebuffers, %u filter changes", _texturesCreated,
+    _texturesReused, _framebuffersCreated, _filterChanges);
+
+  _texturesCreated = _texturesReused = _framebuffersCreated = _filterChanges = 0;
+}
+
 bool Video::setGeometry(unsigned width, unsigned height, unsigned maxWidth, unsigned maxHeight, float aspect, enum retro_pixel_format pixelFormat, const struct retro_hw_render_callback* hwRenderCallback)
 {
   bool hardwareRender = hwRenderCallback != nullptr;
+
+  // hardware rendered cores draw into the context from this thread
+  if (hardwareRender)
+    _presenter.stop();
+
+  Presenter::Suspend suspend(&_presenter);
+
   if (!hardwareRender && _hw.enabled)
     postHwRenderReset();
 
@@ -176,53 +346,84 @@ bool Video::setGeometry(unsigned width, unsigned height, unsigned maxWidth, unsi
 
   _aspect = aspect;
 
+  // the preset comes with the core's settings, but is only compiled once there's a game
+  if (_shaders.path() != _shaderPreset)
+  {
+    if (_shaderPreset.empty())
+      _shaders.unload();
+    else
+      _shaders.load(_shaderPreset);
+  }
+
   _logger->debug(TAG "Geometry set to %u x %u (max %u x %u) (1:%f)", width, height, maxWidth, maxHeight, aspect);
   return true;
 }
 
 void Video::refresh(const void* data, unsigned width, unsigned height, size_t pitch)
 {
+  // the frame was just rendered, our cached bindings may not be the current ones anymore
+  if (_hw.enabled)
+    Gl::resetState();
+
+  _frameDuped = (data == NULL);
+  metrics::add(metrics::kVideoFrames);
+
+  if (data != NULL)
+    _frameCount++;
+  else
+    metrics::add(metrics::kVideoFramesDuped);
+
   if (data == NULL)
   {
-    _logger->debug(TAG "Refresh not performed, data is NULL");
+    // the previous frame is still on the screen, there's nothing to present unless something
+    // painted over it
+    if (_damaged.load(std::memory_order_relaxed) && _enabled)
+    {
+      _logger->debug(TAG "Duped frame drawn again, the window was damaged");
+      draw(true);
+    }
+    else
+    {
+      _logger->debug(TAG "Refresh not performed, data is NULL");
+    }
   }
   else if (data != RETRO_HW_FRAME_BUFFER_VALID)
   {
-    Gl::bindTexture(GL_TEXTURE_2D, _texture);
+    if (_threadedPresentation && !_hw.enabled && !_presenter.running())
+      _presenter.start();
 
-    unsigned rowLength = pitch;
-    switch (_pixelFormat)
+    if (_presenter.running())
     {
-    case RETRO_PIXEL_FORMAT_XRGB8888: rowLength /= 4; break;
-    case RETRO_PIXEL_FORMAT_RGB565:   // fallthrough
-    case RETRO_PIXEL_FORMAT_0RGB1555: // fallthrough
-    default:                          rowLength /= 2; break;
-    }
+      // the quad only changes with the frame size, everything else waits for the next frame
+      if (width != _viewWidth || height != _viewHeight)
+      {
+        Presenter::Suspend suspend(&_presenter);
+        ensureView(width, height, _windowWidth, _windowHeight, _preserveAspect, _rotation);
+      }
 
-    Gl::pixelStorei(GL_UNPACK_ROW_LENGTH, rowLength);
-    switch (_pixelFormat)
+      if (_enabled)
+      {
+        // only the copy out of the core's buffer happens here
+        const auto tUploadStart = std::chrono::steady_clock::now();
+        _presenter.submit(data, width, height, pitch);
+        const auto tUploadEnd = std::chrono::steady_clock::now();
+        const auto uploadMicros = std::chrono::duration_cast<std::chrono::microseconds>(tUploadEnd - tUploadStart).count();
+        _uploadMicros += (uint64_t)uploadMicros;
+        metrics::add(metrics::kVideoUploadMicros, uploadMicros);
+      }
+    }
+    else
     {
-    case RETRO_PIXEL_FORMAT_XRGB8888:
-      Gl::texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, data);
-      break;
-      
-    case RETRO_PIXEL_FORMAT_RGB565:
-      Gl::texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, data);
-      break;
-      
-    case RETRO_PIXEL_FORMAT_0RGB1555:
-    default:
-      Gl::texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_SHORT_1_5_5_5_REV, data);
-      break;
+      const auto tUploadStart = std::chrono::steady_clock::now();
+      upload(data, width, height, pitch);
+      const auto tUploadEnd = std::chrono::steady_clock::now();
+      const auto uploadMicros = std::chrono::duration_cast<std::chrono::microseconds>(tUploadEnd - tUploadStart).count();
+      _uploadMicros += (uint64_t)uploadMicros;
+      metrics::add(metrics::kVideoUploadMicros, uploadMicros);
+
+      ensureView(width, height, _windowWidth, _windowHeight, _preserveAspect, _rotation);
+      draw();
     }
-
-    Gl::pixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-    Gl::bindTexture(GL_TEXTURE_2D, 0);
-
-    _logger->debug(TAG "Texture refreshed with %u x %u pixels", width, height);
-
-    ensureView(width, height, _windowWidth, _windowHeight, _preserveAspect, _rotation);
-    draw();
   }
   else if (_hw.enabled && data == RETRO_HW_FRAME_BUFFER_VALID)
   {
@@ -230,6 +431,107 @@ void Video::refresh(const void* data, unsigned width, unsigned height, size_t pi
     ensureView(width, height, _windowWidth, _windowHeight, _preserveAspect, _rotation);
     draw();
   }
+
+  if (_recorder != NULL && _recorder->recording())
+    record(data, width, height, pitch);
+}
+
+void Video::record(const void* data, unsigned width, unsigned height, size_t pitch)
+{
+  if (data != RETRO_HW_FRAME_BUFFER_VALID)
+  {
+    // software frames are copied straight from the core's buffer
+    _recorder->addFrame(data, width, height, pitch, _pixelFormat);
+    return;
+  }
+
+  // hardware frames arrive a frame or two later, in order, without waiting for the GPU
+  const Readback done = [this](const void* pixels, unsigned width, unsigned height, unsigned pitch, enum retro_pixel_format format) {
+    if (_recorder->recording())
+      _recorder->addFrame(pixels, width, height, pitch, format);
+
+    free((void*)pixels);
+  };
+
+  // the presenting thread never runs for hardware rendered cores, the context is already ours
+  if (Gl::supportsMapBuffer() && Gl::supportsSync())
+    queueReadback(done);
+  else
+    readFramebuffer(done);
+}
+
+void Video::upload(const void* data, unsigned width, unsigned height, size_t pitch)
+{
+  // draw binds the texture to the same unit, so it's kept bound
+  Gl::activeTexture(GL_TEXTURE0);
+  Gl::bindTexture(GL_TEXTURE_2D, _texture);
+
+  unsigned rowLength = pitch;
+  switch (_pixelFormat)
+  {
+  case RETRO_PIXEL_FORMAT_XRGB8888: rowLength /= 4; break;
+  case RETRO_PIXEL_FORMAT_RGB565:   // fallthrough
+  case RETRO_PIXEL_FORMAT_0RGB1555: // fallthrough
+  default:                          rowLength /= 2; break;
+  }
+
+  // with a pixel buffer bound, the texture update only schedules a copy from it
+  const void* pixels = stageUpload(data, pitch * height);
+
+  Gl::pixelStorei(GL_UNPACK_ROW_LENGTH, rowLength);
+  switch (_pixelFormat)
+  {
+  case RETRO_PIXEL_FORMAT_XRGB8888:
+    Gl::texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, pixels);
+    break;
+    
+  case RETRO_PIXEL_FORMAT_RGB565:
+    Gl::texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, pixels);
+    break;
+    
+  case RETRO_PIXEL_FORMAT_0RGB1555:
+  default:
+    Gl::texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_SHORT_1_5_5_5_REV, pixels);
+    break;
+  }
+
+  Gl::pixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+
+  if (pixels != data)
+    Gl::bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+  _logger->debug(TAG "Texture refreshed with %u x %u pixels", width, height);
+}
+
+const void* Video::stageUpload(const void* data, size_t size)
+{
+  if (!_uploadAsync)
+    return data;
+
+  // the buffer used a few frames ago is most likely done with, and orphaning it makes sure we
+  // don't wait on it if it isn't
+  const GLuint buffer = _uploadBuffers[_uploadIndex];
+  _uploadIndex = (_uploadIndex + 1) % kUploadBuffers;
+
+  Gl::bindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+  Gl::bufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+
+  void* mapped = Gl::mapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+
+  if (mapped != NULL)
+  {
+    memcpy(mapped, data, size);
+
+    if (Gl::unmapBuffer(GL_PIXEL_UNPACK_BUFFER))
+      return NULL; /* offset zero in the bound buffer */
+  }
+
+  // the driver can't do it, go back to uploading straight from the core's buffer
+  _logger->warn(TAG "Could not map a pixel buffer, uploading frames directly");
+  _uploadAsync = false;
+
+  Gl::bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  return data;
 }
 
 bool Video::supportsContext(enum retro_hw_context_type type)
@@ -265,6 +567,7 @@ void Video::showMessage(const char* msg, unsigned frames)
 
 void Video::windowResized(unsigned width, unsigned height)
 {
+  Presenter::Suspend suspend(&_presenter);
   Gl::viewport(0, 0, width, height);
   ensureView(_viewWidth, _viewHeight, width, height, _preserveAspect, _rotation);
   draw(true);
@@ -299,16 +602,20 @@ void Video::getFramebufferSize(unsigned* width, unsigned* height, enum retro_pix
 
 static void verticalFlipRawTexture(uint8_t *data, unsigned height, unsigned pitch)
 {
-  uint8_t *swapSpace = (uint8_t*)malloc(pitch);
+  uint8_t swapSpace[256];
   for (uint8_t *top = data, *bottom = (data + ((height - 1) * pitch));
     top < bottom;
     top += pitch, bottom -= pitch)
   {
-    memcpy(swapSpace, top, pitch);
-    memcpy(top, bottom, pitch);
-    memcpy(bottom, swapSpace, pitch);
+    // swap the rows in pieces, there's no need for a row-sized buffer
+    for (unsigned x = 0; x < pitch; x += sizeof(swapSpace))
+    {
+      const unsigned count = pitch - x < sizeof(swapSpace) ? pitch - x : sizeof(swapSpace);
+      memcpy(swapSpace, top + x, count);
+      memcpy(top + x, bottom + x, count);
+      memcpy(bottom + x, swapSpace, count);
+    }
   }
-  free(swapSpace);
 }
 
 const void* Video::getFramebuffer(unsigned* width, unsigned* height, unsigned* pitch, enum retro_pixel_format* format)
@@ -321,6 +628,7 @@ const void* Video::getFramebuffer(unsigned* width, unsigned* height, unsigned* p
     return NULL;
   }
 
+  Presenter::Suspend suspend(&_presenter);
   Gl::bindTexture(GL_TEXTURE_2D, _texture);
 
   switch (_pixelFormat)
@@ -350,10 +658,338 @@ const void* Video::getFramebuffer(unsigned* width, unsigned* height, unsigned* p
   return pixels;
 }
 
+void Video::readFramebuffer(const Readback& done)
+{
+  if (!Gl::supportsMapBuffer() || !Gl::supportsSync())
+  {
+    unsigned width, height, pitch;
+    enum retro_pixel_format format;
+    const void* pixels = getFramebuffer(&width, &height, &pitch, &format);
+    done(pixels, width, height, pitch, format);
+    return;
+  }
+
+  Presenter::Suspend suspend(&_presenter);
+  queueReadback(done);
+}
+
+GLuint Video::readbackBuffer()
+{
+  GLuint buffer;
+
+  if (_readbackBuffers.empty())
+  {
+    Gl::genBuffers(1, &buffer);
+  }
+  else
+  {
+    buffer = _readbackBuffers.back();
+    _readbackBuffers.pop_back();
+  }
+
+  return buffer;
+}
+
+void Video::queueReadback(const Readback& done)
+{
+  const unsigned bpp = _pixelFormat == RETRO_PIXEL_FORMAT_XRGB8888 ? 4 : 2;
+
+  PendingReadback pending;
+  pending.width = _viewWidth;
+  pending.height = _viewHeight;
+  pending.pitch = _textureWidth * bpp;
+  pending.format = _pixelFormat;
+  pending.flip = _hw.enabled && _hw.callback->bottom_left_origin;
+  pending.frames = 0;
+  pending.done = done;
+
+  // with a pixel buffer bound, reading the texture only schedules a copy into it
+  pending.buffer = readbackBuffer();
+  Gl::bindBuffer(GL_PIXEL_PACK_BUFFER, pending.buffer);
+  Gl::bufferData(GL_PIXEL_PACK_BUFFER, _textureWidth * _textureHeight * bpp, NULL, GL_STREAM_READ);
+  Gl::bindTexture(GL_TEXTURE_2D, _texture);
+
+  switch (_pixelFormat)
+  {
+  case RETRO_PIXEL_FORMAT_XRGB8888:
+    Gl::getTexImage(GL_TEXTURE_2D, 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, NULL);
+    break;
+    
+  case RETRO_PIXEL_FORMAT_RGB565:
+    Gl::getTexImage(GL_TEXTURE_2D, 0, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, NULL);
+    break;
+    
+  case RETRO_PIXEL_FORMAT_0RGB1555:
+  default:
+    Gl::getTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_SHORT_1_5_5_5_REV, NULL);
+    break;
+  }
+
+  Gl::bindTexture(GL_TEXTURE_2D, 0);
+  Gl::bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  pending.fence = Gl::fenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  _readbacks.push_back(pending);
+}
+
+bool Video::collectReadback(const PendingReadback& pending, bool wait)
+{
+  // when waiting, a fence that doesn't signal within a second won't block us forever, mapping the
+  // buffer waits for the copy anyway
+  const GLuint64 timeout = wait ? 1000000000ULL : 0;
+
+  if (Gl::clientWaitSync(pending.fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout) == GL_TIMEOUT_EXPIRED && !wait)
+    return false;
+
+  Gl::deleteSync(pending.fence);
+
+  const size_t size = (size_t)pending.pitch * pending.height;
+  uint8_t* pixels = (uint8_t*)malloc(size);
+
+  Gl::bindBuffer(GL_PIXEL_PACK_BUFFER, pending.buffer);
+  const uint8_t* mapped = (const uint8_t*)Gl::mapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+
+  if (pixels != NULL && mapped != NULL)
+  {
+    // flip the rows while copying them out if the core renders bottom up
+    if (pending.flip)
+    {
+      for (unsigned y = 0; y < pending.height; y++)
+        memcpy(pixels + y * pending.pitch, mapped + (pending.height - 1 - y) * pending.pitch, pending.pitch);
+    }
+    else
+    {
+      memcpy(pixels, mapped, size);
+    }
+  }
+  else
+  {
+    _logger->error(TAG "Could not read the framebuffer back");
+    free(pixels);
+    pixels = NULL;
+  }
+
+  if (mapped != NULL)
+    Gl::unmapBuffer(GL_PIXEL_PACK_BUFFER);
+
+  Gl::bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  if (_readbackBuffers.size() < kReadbackBuffers)
+    _readbackBuffers.push_back(pending.buffer);
+  else
+    Gl::deleteBuffers(1, &pending.buffer);
+
+  pending.done(pixels, pending.width, pending.height, pending.pitch, pending.format);
+  return true;
+}
+
+void Video::readThumbnail(const Readback& done)
+{
+  // software rendered frames are small already, and their thumbnails are loaded back with the
+  // states
+  if (!_hw.enabled || !Gl::supportsMapBuffer() || !Gl::supportsSync())
+  {
+    readFramebuffer(done);
+    return;
+  }
+
+  if (_thumbnail.frame == _frameCount)
+  {
+    if (_thumbnail.valid)
+    {
+      void* pixels = malloc(_thumbnail.pixels.size());
+
+      if (pixels != NULL)
+        memcpy(pixels, _thumbnail.pixels.data(), _thumbnail.pixels.size());
+
+      done(pixels, _thumbnail.width, _thumbnail.height, _thumbnail.width * 4, RETRO_PIXEL_FORMAT_XRGB8888);
+      return;
+    }
+
+    if (!_thumbnail.waiting.empty())
+    {
+      // the frame is being read already
+      _thumbnail.waiting.push_back(done);
+      return;
+    }
+  }
+
+  // keep the size of the view, loading a state only puts its thumbnail back if the widths match
+  const unsigned width = _viewWidth, height = _viewHeight;
+
+  Presenter::Suspend suspend(&_presenter);
+
+  if (width == 0 || height == 0 || !ensureThumbnail(width, height))
+  {
+    // whoever waits for an older frame would never be called back otherwise
+    std::vector<Readback> waiting;
+    waiting.swap(_thumbnail.waiting);
+    waiting.push_back(done);
+
+    for (const auto& callback : waiting)
+      readFramebuffer(callback);
+
+    return;
+  }
+
+  _thumbnail.frame = _frameCount;
+  _thumbnail.valid = false;
+  _thumbnail.waiting.push_back(done);
+
+  PendingReadback pending;
+  pending.width = width;
+  pending.height = height;
+  pending.pitch = width * 4;
+  pending.format = RETRO_PIXEL_FORMAT_XRGB8888;
+  pending.flip = false;
+  pending.frames = 0;
+
+  const unsigned frame = _frameCount;
+  pending.done = [this, frame](const void* pixels, unsigned width, unsigned height, unsigned pitch, enum retro_pixel_format format) {
+    // a newer frame may have been asked for in the meantime
+    if (frame == _thumbnail.frame)
+      thumbnailRead(pixels, width, height, pitch);
+
+    free((void*)pixels);
+  };
+
+  // convert on the GPU, flipping the rows of cores that render bottom up
+  const bool flip = _hw.callback->bottom_left_origin;
+
+  Gl::bindFramebuffer(GL_READ_FRAMEBUFFER, _hw.frameBuffer);
+  Gl::bindFramebuffer(GL_DRAW_FRAMEBUFFER, _thumbnail.framebuffer);
+  Gl::blitFramebuffer(0, 0, width, height, 0, flip ? height : 0, width, flip ? 0 : height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+  Gl::bindFramebuffer(GL_FRAMEBUFFER, _thumbnail.framebuffer);
+  pending.buffer = readbackBuffer();
+  Gl::bindBuffer(GL_PIXEL_PACK_BUFFER, pending.buffer);
+  Gl::bufferData(GL_PIXEL_PACK_BUFFER, pending.pitch * height, NULL, GL_STREAM_READ);
+  Gl::readPixels(0, 0, width, height, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, NULL);
+  Gl::bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  Gl::bindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  pending.fence = Gl::fenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  _readbacks.push_back(pending);
+}
+
+void Video::thumbnailRead(const void* pixels, unsigned width, unsigned height, unsigned pitch)
+{
+  std::vector<Readback> waiting;
+  waiting.swap(_thumbnail.waiting);
+
+  if (pixels != NULL)
+  {
+    const uint8_t* p = (const uint8_t*)pixels;
+    _thumbnail.pixels.assign(p, p + pitch * height);
+    _thumbnail.valid = true;
+  }
+
+  // everyone gets a copy of their own
+  for (const auto& done : waiting)
+  {
+    void* copy = NULL;
+
+    if (pixels != NULL)
+    {
+      copy = malloc(pitch * height);
+
+      if (copy != NULL)
+        memcpy(copy, pixels, pitch * height);
+    }
+
+    done(copy, width, height, pitch, RETRO_PIXEL_FORMAT_XRGB8888);
+  }
+}
+
+bool Video::ensureThumbnail(unsigned width, unsigned height)
+{
+  if (_thumbnail.framebuffer != 0 && _thumbnail.width == width && _thumbnail.height == height)
+    return true;
+
+  destroyThumbnail();
+
+  Gl::genRenderbuffers(1, &_thumbnail.renderBuffer);
+  Gl::bindRenderbuffer(GL_RENDERBUFFER, _thumbnail.renderBuffer);
+  Gl::renderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+  Gl::bindRenderbuffer(GL_RENDERBUFFER, 0);
+
+  Gl::genFramebuffers(1, &_thumbnail.framebuffer);
+  Gl::bindFramebuffer(GL_FRAMEBUFFER, _thumbnail.framebuffer);
+  Gl::framebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, _thumbnail.renderBuffer);
+
+  const bool complete = Gl::checkFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+  Gl::bindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  if (!complete)
+  {
+    _logger->error(TAG "Could not create the thumbnail framebuffer %u x %u", width, height);
+    destroyThumbnail();
+    return false;
+  }
+
+  _thumbnail.width = width;
+  _thumbnail.height = height;
+  return true;
+}
+
+void Video::destroyThumbnail()
+{
+  if (_thumbnail.framebuffer != 0)
+  {
+    Gl::deleteFramebuffers(1, &_thumbnail.framebuffer);
+    _thumbnail.framebuffer = 0;
+  }
+
+  if (_thumbnail.renderBuffer != 0)
+  {
+    Gl::deleteRenderbuffers(1, &_thumbnail.renderBuffer);
+    _thumbnail.renderBuffer = 0;
+  }
+
+  _thumbnail.width = _thumbnail.height = 0;
+}
+
+void Video::pollReadbacks()
+{
+  if (_readbacks.empty())
+    return;
+
+  Presenter::Suspend suspend(&_presenter);
+
+  // fences signal in order, so stop at the first one that isn't done
+  while (!_readbacks.empty())
+  {
+    PendingReadback& pending = _readbacks.front();
+
+    if (!collectReadback(pending, ++pending.frames >= 3))
+      break;
+
+    _readbacks.pop_front();
+  }
+}
+
+void Video::flushReadbacks()
+{
+  if (_readbacks.empty())
+    return;
+
+  Presenter::Suspend suspend(&_presenter);
+
+  while (!_readbacks.empty())
+  {
+    collectReadback(_readbacks.front(), true);
+    _readbacks.pop_front();
+  }
+}
+
 void Video::setFramebuffer(void* pixels, unsigned width, unsigned height, unsigned pitch)
 {
+  Presenter::Suspend suspend(&_presenter);
   auto p = (uint8_t*)pixels;
 
+  // the thumbnail of the previous frame is no good anymore
+  _frameCount++;
+
   if (_hw.enabled && _hw.callback->bottom_left_origin)
     verticalFlipRawTexture(p, height, pitch);
 
@@ -390,6 +1026,21 @@ void Video::setFramebuffer(void* pixels, unsigned width, unsigned height, unsign
   draw(true);
 }
 
+bool Video::setShaderPreset(const std::string& path)
+{
+  Presenter::Suspend suspend(&_presenter);
+  if (path.empty())
+    _shaders.unload();
+  else if (!_shaders.load(path))
+    return false;
+
+  _shaderPreset = path;
+
+  // the last pass may read a texture with a different proportion of it used
+  ensureView(_viewWidth, _viewHeight, _windowWidth, _windowHeight, _preserveAspect, _rotation);
+  return true;
+}
+
 std::string Video::serialize()
 {
   std::string json("{");
@@ -400,6 +1051,19 @@ std::string Video::serialize()
 
   json.append("\"_linearFilter\":");
   json.append(_linearFilter ? "true" : "false");
+  json.append(",");
+
+  json.append("\"_framePacing\":");
+  json.append(std::to_string((int)_framePacing));
+  json.append(",");
+
+  json.append("\"_threadedPresentation\":");
+  json.append(_threadedPresentation ? "true" : "false");
+  json.append(",");
+
+  json.append("\"_shaderPreset\":\"");
+  json.append(util::jsonEscape(_shaderPreset));
+  json.append("\"");
 
   json.append("}");
   return json;
@@ -433,6 +1097,26 @@ void Video::deserialize(const char* json)
       {
         ud->self->_linearFilter = num != 0;
       }
+      if (ud->key == "_threadedPresentation")
+      {
+        ud->self->_threadedPresentation = num != 0;
+      }
+    }
+    else if (event == JSONSAX_STRING)
+    {
+      if (ud->key == "_shaderPreset")
+      {
+        ud->self->_shaderPreset = util::jsonUnescape(std::string(str, num));
+      }
+    }
+    else if (event == JSONSAX_NUMBER)
+    {
+      if (ud->key == "_framePacing")
+      {
+        const long value = strtol(str, NULL, 10);
+        if (value >= 0 && value <= (long)FramePacing::Variable)
+          ud->self->_framePacing = (FramePacing)value;
+      }
     }
 
     return 0;
@@ -451,11 +1135,26 @@ static const char* s_getRotateOptions(int index, void* udata)
   }
 }
 
+static const char* s_getFramePacingOptions(int index, void* udata)
+{
+  switch (index)
+  {
+    case 0: return "Vsync";
+    case 1: return "Precise timer";
+    case 2: return "Lock to display";
+    case 3: return "Variable refresh";
+    default: return NULL;
+  }
+}
+
 void Video::showDialog()
 {
   const WORD WIDTH = 140;
   const WORD LINE = 15;
 
+  // the dialog may read the shader timings and change the view
+  Presenter::Suspend suspend(&_presenter);
+
   Dialog db;
   db.init("Video Settings");
 
@@ -474,6 +1173,34 @@ void Video::showDialog()
   db.addCombobox(51004, 55, y - 2, WIDTH - 55, 12, 100, s_getRotateOptions, NULL, &rotation);
   y += LINE;
 
+  int framePacing = (int)_framePacing;
+  db.addLabel("Frame Pacing", 51005, 0, y, 50, 8);
+  db.addCombobox(51006, 55, y - 2, WIDTH - 55, 12, 100, s_getFramePacingOptions, NULL, &framePacing);
+  y += LINE;
+
+  char shaderPreset[1024];
+  snprintf(shaderPreset, sizeof(shaderPreset), "%s", _shaderPreset.c_str());
+  db.addLabel("Shader Preset", 51007, 0, y, 50, 8);
+  db.addEditbox(51008, 55, y - 2, WIDTH - 55, 12, 1, shaderPreset, sizeof(shaderPreset), false);
+  y += LINE;
+
+  std::string report;
+  if (_shaders.empty())
+    report = "No shaders";
+  else
+  {
+    report = _shaders.report();
+    if (report.empty())
+      report = "GPU times not available";
+  }
+
+  db.addEditbox(51009, 0, y, WIDTH, LINE, 4, (char*)report.c_str(), 0, true);
+  y += LINE * 4;
+
+  bool threadedPresentation = _threadedPresentation;
+  db.addCheckbox("Present on a separate thread", 51010, 0, y, WIDTH - 10, 8, &threadedPresentation);
+  y += LINE;
+
   db.addButton("OK", IDOK, WIDTH - 55 - 50, y, 50, 14, true);
   db.addButton("Cancel", IDCANCEL, WIDTH - 50, y, 50, 14, false);
 
@@ -481,11 +1208,71 @@ void Video::showDialog()
   {
     ensureFramebuffer(_textureWidth, _textureHeight, _pixelFormat, linearFilter);
     ensureView(_viewWidth, _viewHeight, _windowWidth, _windowHeight, preserveAspect, static_cast<Rotation>(rotation));
+    _framePacing = static_cast<FramePacing>(framePacing);
+
+    // the presenter is started by the next software rendered frame
+    _threadedPresentation = threadedPresentation;
+    if (!_threadedPresentation)
+      _presenter.stop();
+
+    if (_shaderPreset != shaderPreset && !setShaderPreset(shaderPreset))
+      _logger->error(TAG "Could not load the shader preset %s", shaderPreset);
   }
 }
 
+bool Video::probeVariableRefresh(double refreshRate)
+{
+  if (refreshRate <= 0.0 || _texture == 0)
+    return false;
+
+  Presenter::Suspend suspend(&_presenter);
+
+  const int interval = SDL_GL_GetSwapInterval();
+
+  if (SDL_GL_SetSwapInterval(1) != 0)
+    return false;
+
+  typedef std::chrono::steady_clock Clock;
+  const double period = 1.0 / refreshRate;
+  const auto delay = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(period * 1.5));
+
+  // finishing makes the swap wait for the image to be on the screen, instead of only queueing it
+  for (unsigned i = 0; i < 3; i++)
+  {
+    present(false);
+    Gl::finish();
+  }
+
+  const unsigned frames = 8;
+  double elapsed = 0.0;
+  auto last = Clock::now();
+
+  for (unsigned i = 0; i < frames; i++)
+  {
+    // a fixed refresh display shows the frame on the second vblank, a variable one right away
+    while (Clock::now() - last < delay)
+      ;
+
+    present(false);
+    Gl::finish();
+
+    const auto now = Clock::now();
+    elapsed += std::chrono::duration<double>(now - last).count();
+    last = now;
+  }
+
+  SDL_GL_SetSwapInterval(interval);
+
+  const double periods = elapsed / frames / period;
+  const bool variable = periods < 1.75;
+
+  _logger->info(TAG "Frames presented 1.5 refresh periods apart took %.2f periods, %s refresh", periods, variable ? "variable" : "fixed");
+  return variable;
+}
+
 void Video::setRotation(Rotation rotation)
 {
+  Presenter::Suspend suspend(&_presenter);
   ensureView(_viewWidth, _viewHeight, _windowWidth, _windowHeight, _preserveAspect, rotation);
 }
 
@@ -507,12 +1294,22 @@ GLuint Video::createProgram(GLint* pos, GLint* uv, GLint* tex)
     "  gl_FragColor = texture2D(u_tex, v_uv);\n"
     "}";
   
-  GLuint program = GlUtil::createProgram(vertexShader, fragmentShader);
+  // same locations as the shader passes, so the last pass can draw with our vertices
+  static const char* attributes[] = {"a_pos", "a_uv"};
+  GLuint program = GlUtil::createProgram(vertexShader, fragmentShader, attributes, 2);
+
+  if (program == 0)
+    return 0;
 
   *pos = Gl::getAttribLocation(program, "a_pos");
   *uv = Gl::getAttribLocation(program, "a_uv");
   *tex = Gl::getUniformLocation(program, "u_tex");
 
+  // the texture is always in unit 0, the sampler never has to be set again
+  Gl::useProgram(program);
+  Gl::uniform1i(*tex, 0);
+  Gl::useProgram(0);
+
   return program;
 }
 
@@ -556,10 +1353,23 @@ bool Video::ensureVertexArray(unsigned windowWidth, unsigned windowHeight, float
 
     winScaleX = (float)w / (float)windowWidth;
     winScaleY = (float)h / (float)windowHeight;
+
+    _outputWidth = w;
+    _outputHeight = h;
   }
   else
   {
     winScaleX = winScaleY = 1.0f;
+
+    _outputWidth = windowWidth;
+    _outputHeight = windowHeight;
+  }
+
+  if (_rotation == Rotation::Ninety || _rotation == Rotation::TwoSeventy)
+  {
+    const unsigned width = _outputWidth;
+    _outputWidth = _outputHeight;
+    _outputHeight = width;
   }
 
   if (_hw.enabled && _hw.callback->bottom_left_origin)
@@ -595,50 +1405,59 @@ bool Video::ensureVertexArray(unsigned windowWidth, unsigned windowHeight, float
     { winScaleX,  winScaleY,      0.0f,      0.0f}
   };
 
-  if (_vertexArray != 0)
+  const VertexData* vertexData;
+
+  switch (_rotation)
   {
-    Gl::deleteVertexArrays(1, &_vertexArray);
-    _vertexArray = 0;
+    default:                    vertexData = vertexData0; break;
+    case Rotation::Ninety:      vertexData = vertexData90; break;
+    case Rotation::OneEighty:   vertexData = vertexData180; break;
+    case Rotation::TwoSeventy:  vertexData = vertexData270; break;
   }
 
-  if (_hw.enabled)
+  // the vertex format never changes, the buffer and the vertex array are only created once and
+  // the four vertices rewritten when the view changes. Core profile contexts can't draw without
+  // a vertex array bound, so there's one whenever the context has them, not only for hardware
+  // rendering cores
+  bool created = false;
+
+  if (_vertexArray == 0 && Gl::getVersion() >= 300)
   {
     Gl::genVertexArray(1, &_vertexArray);
     if (_vertexArray == 0)
       return false;
-    Gl::bindVertexArray(_vertexArray);
+    created = true;
   }
 
-  if (_vertexBuffer != 0)
-    Gl::deleteBuffers(1, &_vertexBuffer);
+  if (_vertexArray != 0)
+    Gl::bindVertexArray(_vertexArray);
 
-  Gl::genBuffers(1, &_vertexBuffer);
   if (_vertexBuffer == 0)
-    return false;
+  {
+    Gl::genBuffers(1, &_vertexBuffer);
+    if (_vertexBuffer == 0)
+      return false;
+    created = true;
+  }
+
   Gl::bindBuffer(GL_ARRAY_BUFFER, _vertexBuffer);
 
-  switch (_rotation)
+  if (created)
   {
-    default:
-      Gl::bufferData(GL_ARRAY_BUFFER, sizeof(vertexData0), vertexData0, GL_STATIC_DRAW);
-      break;
-    case Rotation::Ninety:
-      Gl::bufferData(GL_ARRAY_BUFFER, sizeof(vertexData90), vertexData90, GL_STATIC_DRAW);
-      break;
-    case Rotation::OneEighty:
-      Gl::bufferData(GL_ARRAY_BUFFER, sizeof(vertexData180), vertexData180, GL_STATIC_DRAW);
-      break;
-    case Rotation::TwoSeventy:
-      Gl::bufferData(GL_ARRAY_BUFFER, sizeof(vertexData270), vertexData270, GL_STATIC_DRAW);
-      break;
-  }
+    Gl::bufferData(GL_ARRAY_BUFFER, sizeof(vertexData0), vertexData, GL_STATIC_DRAW);
 
-  Gl::enableVertexAttribArray(pos);
-  Gl::vertexAttribPointer(pos, 2, GL_FLOAT, GL_FALSE, sizeof(VertexData), (const GLvoid*)offsetof(VertexData, x));
-  Gl::enableVertexAttribArray(uv);
-  Gl::vertexAttribPointer(uv, 2, GL_FLOAT, GL_FALSE, sizeof(VertexData), (const GLvoid*)offsetof(VertexData, u));
+    Gl::enableVertexAttribArray(pos);
+    Gl::vertexAttribPointer(pos, 2, GL_FLOAT, GL_FALSE, sizeof(VertexData), (const GLvoid*)offsetof(VertexData, x));
+    Gl::enableVertexAttribArray(uv);
+    Gl::vertexAttribPointer(uv, 2, GL_FLOAT, GL_FALSE, sizeof(VertexData), (const GLvoid*)offsetof(VertexData, u));
+  }
+  else
+  {
+    Gl::bufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertexData0), vertexData);
+  }
 
-  Gl::bindVertexArray(0);
+  if (_vertexArray != 0)
+    Gl::bindVertexArray(0);
   
   _logger->debug(TAG "Vertices updated with window scale %f x %f and texture scale %f x %f", winScaleX, winScaleY, texScaleX, texScaleY);
   return true;
@@ -674,30 +1493,128 @@ GLuint Video::createTexture(unsigned width, unsigned height, retro_pixel_format
   return texture;
 }
 
+GLuint Video::acquireTexture(unsigned width, unsigned height, retro_pixel_format pixelFormat, bool linear)
+{
+  for (auto it = _texturePool.begin(); it != _texturePool.end(); ++it)
+  {
+    if (it->format != pixelFormat)
+      continue;
+
+    GLuint texture = it->texture;
+
+    if (it->width >= width && it->height >= height)
+    {
+      _textureWidth = it->width;
+      _textureHeight = it->height;
+      _texturePool.erase(it);
+      _texturesReused++;
+
+      // the filter may have changed while it was in the pool
+      Gl::bindTexture(GL_TEXTURE_2D, texture);
+      const GLint filter = linear ? GL_LINEAR : GL_NEAREST;
+      Gl::texParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+      Gl::texParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+
+      _logger->debug(TAG "Texture reused with dimensions %u x %u", _textureWidth, _textureHeight);
+      return texture;
+    }
+
+    // too small, it would only be replaced by a bigger one later
+    width = width > it->width ? width : it->width;
+    height = height > it->height ? height : it->height;
+    Gl::deleteTextures(1, &texture);
+    _texturePool.erase(it);
+    break;
+  }
+
+  GLuint texture = createTexture(width, height, pixelFormat, linear);
+
+  if (texture != 0)
+  {
+    _textureWidth = width;
+    _textureHeight = height;
+    _texturesCreated++;
+  }
+
+  return texture;
+}
+
+void Video::releaseTexture()
+{
+  PooledTexture pooled;
+  pooled.texture = _texture;
+  pooled.width = _textureWidth;
+  pooled.height = _textureHeight;
+  pooled.format = _pixelFormat;
+  _texturePool.push_back(pooled);
+
+  _texture = 0;
+}
+
+void Video::setFilter(bool linear)
+{
+  if (linear == _linearFilter)
+    return;
+
+  _linearFilter = linear;
+
+  if (_texture != 0)
+  {
+    // the filter is a parameter of the texture, like the shader chain sets it for each pass
+    const GLint filter = linear ? GL_LINEAR : GL_NEAREST;
+    Gl::bindTexture(GL_TEXTURE_2D, _texture);
+    Gl::texParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+    Gl::texParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+    _filterChanges++;
+  }
+}
+
 bool Video::ensureFramebuffer(unsigned width, unsigned height, retro_pixel_format pixelFormat, bool linearFilter)
 {
-  const bool hwEnabled = (_hw.frameBuffer != 0);
-  if (_texture == 0
-    || (_hw.enabled != hwEnabled)
-    || width > _textureWidth || height > _textureHeight
-    || pixelFormat != _pixelFormat
-    || linearFilter != _linearFilter)
+  setFilter(linearFilter);
+
+  const bool grow = width > _textureWidth || height > _textureHeight;
+
+  if (_texture == 0 || grow || pixelFormat != _pixelFormat)
   {
-    if (_texture != 0)
+    if (_texture != 0 && pixelFormat == _pixelFormat)
+    {
+      // keep the largest size seen in each dimension, so a core alternating between a wide and a
+      // tall mode, like interlaced and progressive ones, only grows the texture the first time
+      width = width > _textureWidth ? width : _textureWidth;
+      height = height > _textureHeight ? height : _textureHeight;
       Gl::deleteTextures(1, &_texture);
+      _texture = 0;
+    }
+    else if (_texture != 0)
+    {
+      releaseTexture();
+    }
 
-    _texture = createTexture(width, height, pixelFormat, linearFilter);
+    _texture = acquireTexture(width, height, pixelFormat, _linearFilter);
     if (_texture == 0)
     {
       _logger->error(TAG " ensure framebuffer: failed to create texture %u x %u (%d)", width, height, pixelFormat);
       return false;
     }
 
-    _textureWidth = width;
-    _textureHeight = height;
     _pixelFormat = pixelFormat;
-    _linearFilter = linearFilter;
 
+    // the framebuffer renders to the texture, it goes with it
+    if (_hw.frameBuffer != 0)
+    {
+      Gl::deleteRenderbuffers(1, &_hw.renderBuffer);
+      Gl::deleteFramebuffers(1, &_hw.frameBuffer);
+      _hw.renderBuffer = _hw.frameBuffer = 0;
+    }
+
+    // force the view to be updated as well
+    _viewWidth = _viewHeight = 0;
+  }
+
+  // switching to and from hardware rendering only needs the framebuffer
+  if (_hw.enabled != (_hw.frameBuffer != 0))
+  {
     if (_hw.frameBuffer != 0)
     {
       Gl::deleteRenderbuffers(1, &_hw.renderBuffer);
@@ -707,15 +1624,16 @@ bool Video::ensureFramebuffer(unsigned width, unsigned height, retro_pixel_forma
 
     if (_hw.enabled)
     {
-      _hw.frameBuffer = GlUtil::createFramebuffer(&_hw.renderBuffer, width, height, _texture, _hw.callback->depth, _hw.callback->stencil);
+      _hw.frameBuffer = GlUtil::createFramebuffer(&_hw.renderBuffer, _textureWidth, _textureHeight, _texture, _hw.callback->depth, _hw.callback->stencil);
       if (_hw.frameBuffer == 0)
       {
-        _logger->error(TAG " ensure framebuffer: failed to create hardware render framebuffer %u x %u", width, height);
+        _logger->error(TAG " ensure framebuffer: failed to create hardware render framebuffer %u x %u", _textureWidth, _textureHeight);
         return false;
       }
+
+      _framebuffersCreated++;
     }
 
-    // force the view to be updated as well
     _viewWidth = _viewHeight = 0;
   }
 
@@ -731,10 +1649,15 @@ bool Video::ensureView(unsigned width, unsigned height, unsigned windowWidth, un
     return true;
   }
 
+  float texScaleX = (float)width / (float)_textureWidth;
+  float texScaleY = (float)height / (float)_textureHeight;
+  _shaders.finalScale(&texScaleX, &texScaleY);
+
   if (width != _viewWidth || height != _viewHeight
     || windowWidth != _windowWidth || windowHeight != _windowHeight
     || preserveAspect != _preserveAspect
-    || rotation != _rotation)
+    || rotation != _rotation
+    || texScaleX != _texScaleX || texScaleY != _texScaleY)
   {
     _preserveAspect = preserveAspect;
 
@@ -745,9 +1668,6 @@ bool Video::ensureView(unsigned width, unsigned height, unsigned windowWidth, un
       _rotation = rotation;
     }
 
-    float texScaleX = (float)width / (float)_textureWidth;
-    float texScaleY = (float)height / (float)_textureHeight;
-
     if (!ensureVertexArray(windowWidth, windowHeight, texScaleX, texScaleY, _posAttribute, _uvAttribute))
     {
       _logger->error(TAG " failed to ensure view: %u x %u", width, height);
@@ -756,6 +1676,8 @@ bool Video::ensureView(unsigned width, unsigned height, unsigned windowWidth, un
 
     _viewWidth = width;
     _viewHeight = height;
+    _texScaleX = texScaleX;
+    _texScaleY = texScaleY;
 
     _windowWidth = windowWidth;
     _windowHeight = windowHeight;
@@ -764,12 +1686,33 @@ bool Video::ensureView(unsigned width, unsigned height, unsigned windowWidth, un
   return true;
 }
 
+void Video::bindVertices() const
+{
+  if (_vertexArray != 0)
+  {
+    Gl::bindVertexArray(_vertexArray);
+    return;
+  }
+
+  // contexts older than 3.0 have no vertex arrays, the attributes are global state there, which
+  // only the shader passes change
+  if (_shaders.empty())
+    return;
+
+  Gl::bindBuffer(GL_ARRAY_BUFFER, _vertexBuffer);
+  Gl::enableVertexAttribArray(_posAttribute);
+  Gl::vertexAttribPointer(_posAttribute, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (const GLvoid*)0);
+  Gl::enableVertexAttribArray(_uvAttribute);
+  Gl::vertexAttribPointer(_uvAttribute, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (const GLvoid*)(2 * sizeof(float)));
+}
+
 void Video::postHwRenderReset() const
 {
   // when hardware rendering, the core may leave behind OpenGL
   // state that interferes with our own software rendering
 
   Gl::getError();  // clear the error flag, it's not ours
+  Gl::resetState();
 
   Gl::disable(GL_SCISSOR_TEST);
   Gl::disable(GL_DEPTH_TEST);
@@ -21,14 +21,33 @@ along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "libretro/Components.h"
 #include "Config.h"
+#include "Logger.h"
+#include "Presenter.h"
+#include "ShaderChain.h"
+#include "VideoContext.h"
 #include "Gl.h"
 
 #include <SDL_opengl.h>
 
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <vector>
+
+class Recorder;
+
 class Video: public libretro::VideoComponent
 {
 public:
-  bool init(libretro::LoggerComponent* logger, libretro::VideoContextComponent* ctx, Config* config);
+  enum class FramePacing
+  {
+    Adaptive, /* vsync, skipping frames and turning vsync off when we can't keep up */
+    Timer,    /* precise timer at the core's frame rate */
+    Display,  /* precise timer locked to the measured display refresh when it's close enough */
+    Variable  /* precise timer at the core's frame rate with vsync on, for G-Sync and FreeSync */
+  };
+
+  bool init(Logger* logger, VideoContext* ctx, Config* config);
   void destroy();
 
   virtual void setEnabled(bool enabled) override;
@@ -48,8 +67,24 @@ public:
   void windowResized(unsigned width, unsigned height);
   void getFramebufferSize(unsigned* width, unsigned* height, enum retro_pixel_format* format);
   const void* getFramebuffer(unsigned* width, unsigned* height, unsigned* pitch, enum retro_pixel_format* format);
+
+  /* Reads the framebuffer without waiting for the GPU. The callback gets a copy that it must free(),
+   * or NULL on errors, from pollReadbacks() a frame or two later. It's called right away if the
+   * driver can't read asynchronously. */
+  typedef std::function<void(const void* pixels, unsigned width, unsigned height, unsigned pitch, enum retro_pixel_format format)> Readback;
+  void readFramebuffer(const Readback& done);
+
+  /* Like readFramebuffer, but hardware rendered frames are converted to XRGB8888 on the GPU
+   * first, and read only once per frame */
+  void readThumbnail(const Readback& done);
+  void pollReadbacks();
+  void flushReadbacks();
   void setFramebuffer(void* pixels, unsigned width, unsigned height, unsigned pitch);
 
+  /* Loads a RetroArch GLSL preset, an empty path goes back to drawing the frame as is */
+  bool setShaderPreset(const std::string& path);
+  const std::string& getShaderPreset() const { return _shaderPreset; }
+
   std::string serialize();
   void deserialize(const char* json);
   void showDialog();
@@ -60,6 +95,35 @@ public:
   unsigned getViewWidth() const { return _viewWidth; }
   unsigned getViewHeight() const { return _viewHeight; }
 
+  FramePacing getFramePacing() const { return _framePacing; }
+
+  /* Presents the current frame a few times with vsync on, later than the display's refresh
+   * period, and tells if the display waited for them instead of showing them on the next
+   * vblank. Takes a few frames. */
+  bool probeVariableRefresh(double refreshRate);
+
+  /* Total time spent uploading software rendered frames to the texture */
+  uint64_t getUploadMicros() const { return _uploadMicros; }
+
+  /* True if the core repeated its previous frame in the last refresh, nothing was presented */
+  bool frameDuped() const { return _frameDuped; }
+
+  /* The window must be painted again, duped frames are drawn instead of skipped until it is */
+  void damage() { _damaged.store(true, std::memory_order_relaxed); }
+
+  /* Latency test pattern: the next frame presented is all white, and the time from the input
+   * event's SDL timestamp to the end of its swap is measured. A camera or a photodiode on the
+   * screen gives the rest of the way to the photons. */
+  void flash(uint32_t ticks) { _flashTicks = ticks; }
+  /* Logs the measurements since the last call and starts over */
+  void logLatency();
+
+  /* Logs how many textures and framebuffers were created since the last call and starts over */
+  void logTextures();
+
+  /* Every frame the core renders goes to the recorder while it's recording */
+  void setRecorder(Recorder* recorder) { _recorder = recorder; }
+
   void setRotation(Rotation rotation) override;
   Rotation getRotation() const override { return _rotation; }
 
@@ -70,15 +134,45 @@ protected:
   GLuint createProgram(GLint* pos, GLint* uv, GLint* tex);
   bool ensureVertexArray(unsigned windowWidth, unsigned windowHeight, float texScaleX, float texScaleY, GLint pos, GLint uv);
   GLuint createTexture(unsigned width, unsigned height, retro_pixel_format pixelFormat, bool linear);
+  GLuint acquireTexture(unsigned width, unsigned height, retro_pixel_format pixelFormat, bool linear);
+  void releaseTexture();
+  void setFilter(bool linear);
   bool ensureFramebuffer(unsigned width, unsigned height, retro_pixel_format pixelFormat, bool linearFilter);
   bool ensureView(unsigned width, unsigned height, unsigned windowWidth, unsigned windowHeight, bool preserveAspect, Rotation rotation);
+  void upload(const void* data, unsigned width, unsigned height, size_t pitch);
+  void present(bool newFrame);
+  void bindVertices() const;
   void postHwRenderReset() const;
+  void record(const void* data, unsigned width, unsigned height, size_t pitch);
+  const void* stageUpload(const void* data, size_t size);
+
+  struct PendingReadback
+  {
+    GLuint             buffer;
+    GLsync             fence;
+    unsigned           width;
+    unsigned           height;
+    unsigned           pitch;
+    retro_pixel_format format;
+    bool               flip;
+    unsigned           frames; /* polls since it was requested */
+    Readback           done;
+  };
+
+  GLuint readbackBuffer();
+  void queueReadback(const Readback& done);
+  bool collectReadback(const PendingReadback& pending, bool wait);
+  bool ensureThumbnail(unsigned width, unsigned height);
+  void destroyThumbnail();
+  void thumbnailRead(const void* pixels, unsigned width, unsigned height, unsigned pitch);
 
   libretro::LoggerComponent* _logger;
-  libretro::VideoContextComponent* _ctx;
+  VideoContext* _ctx;
   Config* _config;
 
   bool                    _enabled;
+  bool                    _frameDuped;
+  std::atomic<bool>       _damaged;   /* set from window events, read by the presenter thread */
 
   GLuint                  _program;
   GLint                   _posAttribute;
@@ -88,12 +182,32 @@ protected:
   GLuint                  _vertexBuffer;
   GLuint                  _texture;
 
+  /* textures of the other pixel formats, so a core switching back doesn't create them again */
+  struct PooledTexture
+  {
+    GLuint             texture;
+    unsigned           width;
+    unsigned           height;
+    retro_pixel_format format;
+  };
+
+  std::vector<PooledTexture> _texturePool;
+
+  unsigned                _texturesCreated;
+  unsigned                _texturesReused;
+  unsigned                _framebuffersCreated;
+  unsigned                _filterChanges;
+
   unsigned                _windowWidth;
   unsigned                _windowHeight;
   unsigned                _textureWidth;
   unsigned                _textureHeight;
   unsigned                _viewWidth;
   unsigned                _viewHeight;
+  unsigned                _outputWidth;  /* area of the window showing the frame, before rotation */
+  unsigned                _outputHeight;
+  float                   _texScaleX;
+  float                   _texScaleY;
   enum retro_pixel_format _pixelFormat;
   float                   _aspect;
   Rotation                _rotation;
@@ -101,6 +215,54 @@ protected:
 
   bool                    _preserveAspect;
   bool                    _linearFilter;
+  FramePacing             _framePacing;
+  bool                    _threadedPresentation;
+
+  uint64_t                _uploadMicros;
+
+  Recorder*               _recorder;
+
+  /* written by whichever thread presents */
+  std::atomic<uint32_t>   _flashTicks;
+  std::atomic<unsigned>   _latencyCount;
+  std::atomic<uint32_t>   _latencyTotal;
+  std::atomic<uint32_t>   _latencyMax;
+
+  /* software frames are copied into a ring of pixel buffers, so the copy to the texture happens
+   * asynchronously instead of inside the core's video callback */
+  enum { kUploadBuffers = 3 };
+  GLuint                  _uploadBuffers[kUploadBuffers];
+  unsigned                _uploadIndex;
+  bool                    _uploadAsync;
+
+  std::deque<PendingReadback> _readbacks;
+
+  /* pixel buffers of the readbacks already collected, reused so recording hardware rendered
+   * frames doesn't create one every frame */
+  enum { kReadbackBuffers = 4 };
+  std::vector<GLuint>     _readbackBuffers;
+
+  /* frames put in the texture, tells if the thumbnail is still the one on the screen */
+  unsigned                _frameCount;
+
+  struct
+  {
+    GLuint                framebuffer;
+    GLuint                renderBuffer;
+    unsigned              width;
+    unsigned              height;
+    unsigned              frame;    /* _frameCount when it was read */
+    bool                  valid;    /* the pixels are there, otherwise it's being read */
+    std::vector<uint8_t>  pixels;
+    std::vector<Readback> waiting;
+  }                       _thumbnail;
+
+  ShaderChain             _shaders;
+  std::string             _shaderPreset;
+
+  /* software rendered frames are uploaded and drawn on another thread when
+   * _threadedPresentation is set, everything else using the context suspends it first */
+  Presenter               _presenter;
 
   struct {
     bool enabled;
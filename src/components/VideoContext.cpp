@@ -19,10 +19,15 @@ along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "VideoContext.h"
 
+#include <chrono>
+
 bool VideoContext::init(libretro::LoggerComponent* logger, SDL_Window* window)
 {
   _logger = logger;
   _window = window;
+  _context = SDL_GL_GetCurrentContext();
+  _thread = SDL_ThreadID();
+  _swapMicros = 0;
 
   return true;
 }
@@ -33,5 +38,21 @@ void VideoContext::destroy()
 
 void VideoContext::swapBuffers()
 {
+  const auto tSwapStart = std::chrono::steady_clock::now();
   SDL_GL_SwapWindow(_window);
+  const auto tSwapEnd = std::chrono::steady_clock::now();
+
+  if (SDL_ThreadID() == _thread)
+    _swapMicros += (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(tSwapEnd - tSwapStart).count();
+}
+
+bool VideoContext::makeCurrent()
+{
+  // may be called from any thread, leave logging the error to the caller
+  return SDL_GL_MakeCurrent(_window, _context) == 0;
+}
+
+void VideoContext::releaseCurrent()
+{
+  SDL_GL_MakeCurrent(_window, NULL);
 }
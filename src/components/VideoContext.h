@@ -31,7 +31,19 @@ public:
 
   virtual void swapBuffers() override;
 
+  /* Makes the OpenGL context current on the calling thread, or releases it so another thread
+   * can make it current */
+  bool makeCurrent();
+  void releaseCurrent();
+
+  /* Total time the thread that created the context spent in swapBuffers, including the wait for
+   * vsync. Swaps done by other threads don't hold the emulation back so they're not counted. */
+  uint64_t getSwapMicros() const { return _swapMicros; }
+
 private:
   libretro::LoggerComponent* _logger;
   SDL_Window* _window;
+  SDL_GLContext _context;
+  SDL_threadID _thread;
+  uint64_t _swapMicros;
 };
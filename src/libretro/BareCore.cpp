@@ -45,6 +45,17 @@ bool libretro::BareCore::load(libretro::LoggerComponent* logger, const char* pat
 {
   _logger = logger;
 
+  if (_handle != NULL)
+  {
+    if (_path == path)
+    {
+      _logger->info(TAG "Core %s is still loaded", path);
+      return true;
+    }
+
+    destroy();
+  }
+
   _logger->info(TAG "Loading core %s", path);
 
   _handle = dynlib_open(path);
@@ -66,6 +77,7 @@ bool libretro::BareCore::load(libretro::LoggerComponent* logger, const char* pat
     if (_handle != NULL)
     {
       dynlib_close(_handle);
+      _handle = NULL;
     }
 
     return false;
@@ -97,6 +109,8 @@ bool libretro::BareCore::load(libretro::LoggerComponent* logger, const char* pat
   CORE_DLSYM(_getMemoryData, "retro_get_memory_data");
   CORE_DLSYM(_getMemorySize, "retro_get_memory_size");
 
+  _path = path;
+
   _logger->info(TAG "Core successfully loaded");
   return true;
 }
@@ -111,6 +125,11 @@ bool libretro::BareCore::load(libretro::LoggerComponent* logger, const char* pat
 
 void libretro::BareCore::destroy()
 {
+  if (_handle == NULL)
+  {
+    return;
+  }
+
   CORE_DLSYM(_init);
   CORE_DLSYM(_deinit);
   CORE_DLSYM(_apiVersion);
@@ -138,6 +157,8 @@ void libretro::BareCore::destroy()
   CORE_DLSYM(_getMemorySize);
 
   dynlib_close(_handle);
+  _handle = NULL;
+  _path.clear();
 
   _logger->info(TAG "Core destroyed");
 }
@@ -28,6 +28,8 @@ SOFTWARE.
 #include "Components.h"
 #include "dynlib/dynlib.h"
 
+#include <string>
+
 namespace libretro
 {
   /**
@@ -42,12 +44,18 @@ namespace libretro
   class BareCore
   {
   public:
-    // Loads a core specified by its file path.
+    BareCore() : _handle(NULL) {}
+
+    // Loads a core specified by its file path. A core that is still loaded
+    // from the same path is kept as is.
     bool load(libretro::LoggerComponent* logger, const char* path);
     
     // Unloads the core from memory.
     void destroy();
 
+    // Tells if the core's module is in memory.
+    bool loaded() const { return _handle != NULL; }
+
     // All the remaining methods map 1:1 to the libretro API.
     void     init() const;
     void     deinit() const;
@@ -78,6 +86,7 @@ namespace libretro
   protected:
     libretro::LoggerComponent* _logger;
     dynlib_t _handle;
+    std::string _path;
 
     void     (*_init)();
     void     (*_deinit)();
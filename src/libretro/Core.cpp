@@ -24,13 +24,24 @@ SOFTWARE.
 
 #include "Core.h"
 
+#include "Metrics.h"
 #include "Util.h"
 
 #include <stdlib.h>
 #include <string.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
 #ifdef _WINDOWS
 #include <RA_Interface.h>
+
+#include "FileCache.h"
+
+#include <io.h>
 #endif
 
 #define SAMPLE_COUNT 8192
@@ -39,9 +50,57 @@ SOFTWARE.
 
 /* Some libretro callbacks need access to the other frontend elements that are stored
  * in the core instance (like _input). Since we can't pass pointers through libretro,
- * keep a global pointer to the current core object (there should be only one).
+ * the callbacks look the instance up. With a single instance, which is what the
+ * application has, that's s_instance and nothing else is involved. When more than one
+ * exists, each call into a core marks its instance as the current one on the calling
+ * thread, and callbacks made from other threads the core started go to the instance
+ * initialized last.
+ *
+ * Two instances can only run side by side if they don't share the core's module, the
+ * callbacks are set once per module and most cores keep their state in globals.
+ *
+ * Instances are created and destroyed on the main thread while cores may call back from their
+ * own threads. The list is only changed under s_instancesMutex, and the callbacks only read the
+ * instance and the count, which are atomic so they don't take the lock for every sample.
  */
-static libretro::Core* s_instance = NULL;
+static std::atomic<libretro::Core*> s_instance(NULL);
+static std::atomic<size_t> s_instanceCount(0);
+static std::vector<libretro::Core*> s_instances;
+static std::mutex s_instancesMutex;
+static thread_local libretro::Core* s_current = NULL;
+
+static inline libretro::Core* currentInstance()
+{
+  if (s_instanceCount.load(std::memory_order_relaxed) <= 1)
+    return s_instance.load(std::memory_order_acquire);
+
+  libretro::Core* core = s_current;
+  return core != NULL ? core : s_instance.load(std::memory_order_acquire);
+}
+
+namespace
+{
+  // Marks the instance as the current one while it calls into its core
+  class Enter
+  {
+  public:
+    explicit Enter(libretro::Core* core) : _previous(s_current), _set(s_instanceCount.load(std::memory_order_relaxed) > 1)
+    {
+      if (_set)
+        s_current = core;
+    }
+
+    ~Enter()
+    {
+      if (_set)
+        s_current = _previous;
+    }
+
+  protected:
+    libretro::Core* _previous;
+    bool            _set;
+  };
+}
 
 namespace
 {
@@ -281,7 +340,15 @@ bool libretro::Core::init(const Components* components)
   _input        = &s_input;
   _allocator    = &s_allocator;
 
-  s_instance    = this;
+  {
+    std::lock_guard<std::mutex> lock(s_instancesMutex);
+
+    if (std::find(s_instances.begin(), s_instances.end(), this) == s_instances.end())
+      s_instances.push_back(this);
+
+    s_instance.store(this, std::memory_order_release);
+    s_instanceCount.store(s_instances.size(), std::memory_order_relaxed);
+  }
 
   if (components != NULL)
   {
@@ -318,8 +385,10 @@ bool libretro::Core::loadCore(const char* core_path)
   return true;
 }
 
-bool libretro::Core::loadGame(const char* game_path, void* data, size_t size)
+bool libretro::Core::loadGame(const char* game_path, const void* data, size_t size)
 {
+  Enter enter(this);
+
   if (game_path == NULL)
   {
     _logger->error(TAG "Can't load game data without a ROM path");
@@ -358,6 +427,7 @@ bool libretro::Core::loadGame(const char* game_path, void* data, size_t size)
   }
   
   _gameLoaded = true;
+  _memoryMapVersion++;
   return true;
   
 error:
@@ -367,8 +437,10 @@ error:
   return false;
 }
 
-void libretro::Core::destroy()
+void libretro::Core::destroy(bool keepLoaded)
 {
+  Enter enter(this);
+
   if (_gameLoaded)
   {
     _core.unloadGame();
@@ -377,12 +449,47 @@ void libretro::Core::destroy()
   _diskControlInterface = NULL;
 
   _core.deinit();
-  _core.destroy();
+
+  logEnvStats();
+
+  if (!keepLoaded)
+  {
+    _core.destroy();
+  }
+
   reset();
 }
 
+void libretro::Core::release()
+{
+  _core.destroy();
+}
+
+libretro::Core::~Core()
+{
+  std::lock_guard<std::mutex> lock(s_instancesMutex);
+  const auto found = std::find(s_instances.begin(), s_instances.end(), this);
+
+  if (found == s_instances.end())
+    return;
+
+  s_instances.erase(found);
+  s_instanceCount.store(s_instances.size(), std::memory_order_relaxed);
+
+  if (s_instance.load(std::memory_order_relaxed) == this)
+    s_instance.store(s_instances.empty() ? NULL : s_instances.back(), std::memory_order_release);
+}
+
+void libretro::Core::unloadGame()
+{
+  Enter enter(this);
+  _core.unloadGame();
+}
+
 void libretro::Core::step(bool generateVideo, bool generateAudio)
 {
+  Enter enter(this);
+
   if (_input->ctrlUpdated())
   {
     for (unsigned i = 0; i < _controllerInfoCount; i++)
@@ -417,41 +524,50 @@ unsigned libretro::Core::getApiVersion()
 
 unsigned libretro::Core::getRegion()
 {
+  Enter enter(this);
   return _core.getRegion();
 }
 
 void* libretro::Core::getMemoryData(unsigned id)
 {
+  Enter enter(this);
   return _core.getMemoryData(id);
 }
 
 size_t libretro::Core::getMemorySize(unsigned id)
 {
+  Enter enter(this);
   return _core.getMemorySize(id);
 }
 
 void libretro::Core::resetGame()
 {
+  Enter enter(this);
   _core.reset();
 }
 
 size_t libretro::Core::serializeSize()
 {
+  Enter enter(this);
   return _core.serializeSize();
 }
 
 bool libretro::Core::serialize(void* data, size_t size)
 {
+  Enter enter(this);
   return _core.serialize(data, size);
 }
 
 bool libretro::Core::unserialize(const void* data, size_t size)
 {
+  Enter enter(this);
   return _core.unserialize(data, size);
 }
 
 bool libretro::Core::initCore()
 {
+  Enter enter(this);
+
   struct retro_system_info system_info;
   _core.getSystemInfo(&system_info);
 
@@ -553,7 +669,13 @@ void libretro::Core::reset()
   _ports = NULL;
   _diskControlInterface = NULL;
   memset(&_memoryMap, 0, sizeof(_memoryMap));
+  _memoryMapVersion = 0;
+  _memoryMapBoundaryCount = 0;
+  _memoryMapBoundaries = NULL;
+  _memoryMapFirst = NULL;
+  _memoryMapCandidates = NULL;
   memset(&_calls, 0, sizeof(_calls));
+  memset(&_envStats, 0, sizeof(_envStats));
 }
 
 const char* libretro::Core::getLibretroPath() const
@@ -600,12 +722,16 @@ bool libretro::Core::setMessage(const struct retro_message* data)
 
 void libretro::Core::setTrayOpen(bool open)
 {
+  Enter enter(this);
+
   if (_diskControlInterface)
     _diskControlInterface->set_eject_state(open);
 }
 
 void libretro::Core::setCurrentDiscIndex(unsigned index)
 {
+  Enter enter(this);
+
   if (_diskControlInterface)
     _diskControlInterface->set_image_index(index);
 }
@@ -811,13 +937,16 @@ bool libretro::Core::getCoreAssetsDirectory(const char** data) const
 bool libretro::Core::getSaveDirectory(const char** data) const
 {
   *data = _config->getSaveDirectory();
+#ifdef _WINDOWS
   util::ensureDirectoryExists(*data);
+#endif
   return true;
 }
 
 bool libretro::Core::setSystemAVInfo(const struct retro_system_av_info* data)
 {
   _systemAVInfo = *data;
+  _memoryMapVersion++;
 
   _logger->debug(TAG "retro_system_av_info");
 
@@ -1020,6 +1149,7 @@ bool libretro::Core::setControllerInfo(const struct retro_controller_info* data)
 
 bool libretro::Core::setMemoryMaps(const struct retro_memory_map* data)
 {
+  _memoryMapVersion++;
   _memoryMap.num_descriptors = data->num_descriptors;
   struct retro_memory_descriptor* descriptors = alloc<struct retro_memory_descriptor>(data->num_descriptors);
 
@@ -1050,6 +1180,7 @@ bool libretro::Core::setMemoryMaps(const struct retro_memory_map* data)
   }
 
   preprocessMemoryDescriptors(descriptors, _memoryMap.num_descriptors);
+  indexMemoryMap();
 
   _logger->debug(TAG "retro_memory_map");
   _logger->debug(TAG "  ndx flags  ptr      offset   start    select   disconn  len      addrspace");
@@ -1108,6 +1239,122 @@ bool libretro::Core::setMemoryMaps(const struct retro_memory_map* data)
   return true;
 }
 
+void libretro::Core::indexMemoryMap()
+{
+  /* a descriptor can only match addresses in [start, start + len), the select bits only narrow
+   * that down, so the address space is split at every start and end and each interval gets the
+   * descriptors that cover it, in the order of the map so the first match still wins */
+  const struct retro_memory_descriptor* descriptors = _memoryMap.descriptors;
+  const unsigned count = _memoryMap.num_descriptors;
+
+  _memoryMapBoundaryCount = 0;
+
+  size_t* boundaries = alloc<size_t>(count * 2);
+
+  if (boundaries == NULL)
+  {
+    return;
+  }
+
+  size_t numBoundaries = 0;
+
+  for (unsigned i = 0; i < count; i++)
+  {
+    if (descriptors[i].len != 0)
+    {
+      boundaries[numBoundaries++] = descriptors[i].start;
+      boundaries[numBoundaries++] = descriptors[i].start + descriptors[i].len;
+    }
+  }
+
+  std::sort(boundaries, boundaries + numBoundaries);
+  numBoundaries = std::unique(boundaries, boundaries + numBoundaries) - boundaries;
+
+  if (numBoundaries < 2)
+  {
+    return;
+  }
+
+  unsigned* first = alloc<unsigned>(numBoundaries);
+
+  if (first == NULL)
+  {
+    return;
+  }
+
+  unsigned total = 0;
+
+  for (size_t j = 0; j < numBoundaries - 1; j++)
+  {
+    first[j] = total;
+
+    for (unsigned i = 0; i < count; i++)
+    {
+      if (boundaries[j] - descriptors[i].start < descriptors[i].len)
+      {
+        total++;
+      }
+    }
+  }
+
+  first[numBoundaries - 1] = total;
+
+  unsigned* candidates = alloc<unsigned>(total);
+
+  if (candidates == NULL && total != 0)
+  {
+    return;
+  }
+
+  for (size_t j = 0, k = 0; j < numBoundaries - 1; j++)
+  {
+    for (unsigned i = 0; i < count; i++)
+    {
+      if (boundaries[j] - descriptors[i].start < descriptors[i].len)
+      {
+        candidates[k++] = i;
+      }
+    }
+  }
+
+  _memoryMapBoundaries = boundaries;
+  _memoryMapFirst = first;
+  _memoryMapCandidates = candidates;
+  _memoryMapBoundaryCount = numBoundaries;
+
+  _logger->debug(TAG "Indexed %u memory descriptors in %zu intervals", count, numBoundaries - 1);
+}
+
+const struct retro_memory_descriptor* libretro::Core::getMemoryDescriptor(size_t address) const
+{
+  if (_memoryMapBoundaryCount == 0)
+  {
+    return NULL;
+  }
+
+  const size_t* end = _memoryMapBoundaries + _memoryMapBoundaryCount;
+  const size_t* bound = std::upper_bound((const size_t*)_memoryMapBoundaries, end, address);
+
+  if (bound == _memoryMapBoundaries || bound == end)
+  {
+    return NULL;
+  }
+
+  const size_t interval = bound - _memoryMapBoundaries - 1;
+
+  for (unsigned k = _memoryMapFirst[interval]; k < _memoryMapFirst[interval + 1]; k++)
+  {
+    const struct retro_memory_descriptor* desc = _memoryMap.descriptors + _memoryMapCandidates[k];
+
+    if (((desc->start ^ address) & desc->select) == 0)
+    {
+      return desc;
+    }
+  }
+
+  return NULL;
+}
+
 bool libretro::Core::setGeometry(const struct retro_game_geometry* data)
 {
   _systemAVInfo.geometry.base_width = data->base_width;
@@ -1203,6 +1450,205 @@ bool libretro::Core::setCoreOptionsDisplay(const struct retro_core_option_displa
   return true;
 }
 
+#ifdef _WINDOWS
+/* Files opened only for reading go through the file cache the hasher fills, so a disc image is
+ * read from the disk once when the game is loaded. Files opened for writing are plain stdio
+ * files, and drop what was cached for them. Console builds don't link the cache and leave cores
+ * to their own I/O. */
+struct retro_vfs_file_handle
+{
+  std::string path;
+  CachedFile* cached;   /* not NULL if the file is read only */
+  FILE*       file;     /* not NULL if the file can be written */
+  int64_t     position; /* read position of cached files */
+};
+
+static const char* RETRO_CALLCONV s_vfsGetPath(struct retro_vfs_file_handle* stream)
+{
+  return stream->path.c_str();
+}
+
+static struct retro_vfs_file_handle* RETRO_CALLCONV s_vfsOpen(const char* path, unsigned mode, unsigned hints)
+{
+  retro_vfs_file_handle* stream = new retro_vfs_file_handle;
+  stream->path = path;
+  stream->cached = NULL;
+  stream->file = NULL;
+  stream->position = 0;
+
+  if ((mode & RETRO_VFS_FILE_ACCESS_READ_WRITE) == RETRO_VFS_FILE_ACCESS_READ)
+  {
+    // only 64-bit builds have the address space to map what the core reads all the time
+    const bool map = sizeof(void*) > 4 && (hints & RETRO_VFS_FILE_ACCESS_HINT_FREQUENT_ACCESS) != 0;
+    stream->cached = fileCacheOpen(path, map);
+  }
+  else if ((mode & RETRO_VFS_FILE_ACCESS_UPDATE_EXISTING) != 0)
+  {
+    stream->file = fileCacheOpenWrite(path, "r+b");
+  }
+  else
+  {
+    stream->file = fileCacheOpenWrite(path, (mode & RETRO_VFS_FILE_ACCESS_READ) != 0 ? "w+b" : "wb");
+  }
+
+  if (stream->cached == NULL && stream->file == NULL)
+  {
+    delete stream;
+    return NULL;
+  }
+
+  return stream;
+}
+
+static int RETRO_CALLCONV s_vfsClose(struct retro_vfs_file_handle* stream)
+{
+  int res = 0;
+
+  if (stream->cached != NULL)
+  {
+    fileCacheClose(stream->cached);
+  }
+  else
+  {
+    res = fclose(stream->file) == 0 ? 0 : -1;
+    fileCacheInvalidate(stream->path.c_str());
+  }
+
+  delete stream;
+  return res;
+}
+
+static int64_t RETRO_CALLCONV s_vfsSize(struct retro_vfs_file_handle* stream)
+{
+  if (stream->cached != NULL)
+    return (int64_t)fileCacheSize(stream->cached);
+
+  const int64_t position = _ftelli64(stream->file);
+
+  if (position < 0 || _fseeki64(stream->file, 0, SEEK_END) != 0)
+    return -1;
+
+  const int64_t size = _ftelli64(stream->file);
+  _fseeki64(stream->file, position, SEEK_SET);
+  return size;
+}
+
+static int64_t RETRO_CALLCONV s_vfsTruncate(struct retro_vfs_file_handle* stream, int64_t length)
+{
+  if (stream->file == NULL || fflush(stream->file) != 0)
+    return -1;
+
+  return _chsize_s(_fileno(stream->file), length) == 0 ? 0 : -1;
+}
+
+static int64_t RETRO_CALLCONV s_vfsTell(struct retro_vfs_file_handle* stream)
+{
+  return stream->cached != NULL ? stream->position : _ftelli64(stream->file);
+}
+
+static int64_t RETRO_CALLCONV s_vfsSeek(struct retro_vfs_file_handle* stream, int64_t offset, int seek_position)
+{
+  if (stream->file != NULL)
+  {
+    static const int origins[] = {SEEK_SET, SEEK_CUR, SEEK_END};
+
+    if (seek_position < 0 || seek_position > 2 || _fseeki64(stream->file, offset, origins[seek_position]) != 0)
+      return -1;
+
+    return _ftelli64(stream->file);
+  }
+
+  int64_t position;
+
+  switch (seek_position)
+  {
+    case RETRO_VFS_SEEK_POSITION_START:   position = offset; break;
+    case RETRO_VFS_SEEK_POSITION_CURRENT: position = stream->position + offset; break;
+    case RETRO_VFS_SEEK_POSITION_END:     position = (int64_t)fileCacheSize(stream->cached) + offset; break;
+    default:                              return -1;
+  }
+
+  if (position < 0)
+    return -1;
+
+  stream->position = position;
+  return position;
+}
+
+static int64_t RETRO_CALLCONV s_vfsRead(struct retro_vfs_file_handle* stream, void* s, uint64_t len)
+{
+  if (stream->file != NULL)
+  {
+    const size_t numRead = fread(s, 1, (size_t)len, stream->file);
+    return numRead == 0 && ferror(stream->file) ? -1 : (int64_t)numRead;
+  }
+
+  const size_t numRead = fileCacheRead(stream->cached, (uint64_t)stream->position, s, (size_t)len);
+  stream->position += numRead;
+  return (int64_t)numRead;
+}
+
+static int64_t RETRO_CALLCONV s_vfsWrite(struct retro_vfs_file_handle* stream, const void* s, uint64_t len)
+{
+  if (stream->file == NULL)
+    return -1;
+
+  const size_t numWritten = fwrite(s, 1, (size_t)len, stream->file);
+  return numWritten == 0 && len != 0 ? -1 : (int64_t)numWritten;
+}
+
+static int RETRO_CALLCONV s_vfsFlush(struct retro_vfs_file_handle* stream)
+{
+  if (stream->file == NULL)
+    return 0;
+
+  return fflush(stream->file) == 0 ? 0 : -1;
+}
+
+static int RETRO_CALLCONV s_vfsRemove(const char* path)
+{
+  fileCacheInvalidate(path);
+
+  const std::wstring unicodePath = util::utf8ToUChar(path);
+  return DeleteFileW(unicodePath.c_str()) ? 0 : -1;
+}
+
+static int RETRO_CALLCONV s_vfsRename(const char* old_path, const char* new_path)
+{
+  fileCacheInvalidate(old_path);
+  fileCacheInvalidate(new_path);
+
+  const std::wstring unicodeOldPath = util::utf8ToUChar(old_path);
+  const std::wstring unicodeNewPath = util::utf8ToUChar(new_path);
+  return MoveFileExW(unicodeOldPath.c_str(), unicodeNewPath.c_str(), MOVEFILE_REPLACE_EXISTING) ? 0 : -1;
+}
+#endif
+
+bool libretro::Core::getVfsInterface(struct retro_vfs_interface_info* data)
+{
+#ifdef _WINDOWS
+  // v3 adds directory listing and stat, which the disc cores don't need
+  static struct retro_vfs_interface vfs =
+  {
+    s_vfsGetPath, s_vfsOpen, s_vfsClose, s_vfsSize, s_vfsTell, s_vfsSeek, s_vfsRead, s_vfsWrite, s_vfsFlush,
+    s_vfsRemove, s_vfsRename, s_vfsTruncate
+  };
+
+  if (data->required_interface_version > 2)
+  {
+    _logger->warn(TAG "Core wants VFS v%u, only v2 is supported", data->required_interface_version);
+    return false;
+  }
+
+  data->required_interface_version = 2;
+  data->iface = &vfs;
+  return true;
+#else
+  (void)data;
+  return false;
+#endif
+}
+
 static void getEnvName(char* name, size_t size, unsigned cmd)
 {
   static const char* names[] =
@@ -1280,7 +1726,113 @@ static void getEnvName(char* name, size_t size, unsigned cmd)
   }
 }
 
+const libretro::Core::HotEnv* libretro::Core::getHotEnv()
+{
+  struct Table
+  {
+    HotEnv entries[kEnvCommands];
+
+    Table()
+    {
+      memset(entries, 0, sizeof(entries));
+
+      add(RETRO_ENVIRONMENT_GET_CAN_DUPE, [](Core* self, void* data) { return self->getCanDupe((bool*)data); });
+      add(RETRO_ENVIRONMENT_GET_VARIABLE, [](Core* self, void* data) { return self->getVariable((struct retro_variable*)data); });
+      add(RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE, [](Core* self, void* data) { return self->getVariableUpdate((bool*)data); });
+      add(RETRO_ENVIRONMENT_GET_INPUT_BITMASKS, [](Core* self, void* data) { return self->getInputBitmasks((bool*)data); });
+      add(RETRO_ENVIRONMENT_GET_FASTFORWARDING, [](Core* self, void* data) { return self->getFastForwarding((bool*)data); });
+    }
+
+    void add(unsigned cmd, bool (*handler)(Core* self, void* data))
+    {
+      HotEnv* entry = &entries[cmd & ~RETRO_ENVIRONMENT_EXPERIMENTAL];
+      entry->cmd = cmd;
+      entry->handler = handler;
+    }
+  };
+
+  static const Table table;
+  return table.entries;
+}
+
 bool libretro::Core::environmentCallback(unsigned cmd, void* data)
+{
+  const unsigned index = cmd & ~RETRO_ENVIRONMENT_EXPERIMENTAL;
+  metrics::add(metrics::kCoreEnvironmentCalls);
+
+  if (index >= kEnvCommands)
+  {
+    return dispatchEnvironment(cmd, data);
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  const HotEnv* hot = &getHotEnv()[index];
+  bool ret;
+
+  // the hot commands skip the logging, they'd flood the log
+  if (hot->handler != NULL && hot->cmd == cmd)
+  {
+    ret = hot->handler(this, data);
+  }
+  else
+  {
+    ret = dispatchEnvironment(cmd, data);
+  }
+
+  EnvStats* stats = &_envStats[index];
+  stats->calls++;
+  stats->nanos += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+  return ret;
+}
+
+std::string libretro::Core::getEnvReport() const
+{
+  std::vector<unsigned> order;
+
+  for (unsigned i = 0; i < kEnvCommands; i++)
+  {
+    if (_envStats[i].calls != 0)
+      order.push_back(i);
+  }
+
+  std::sort(order.begin(), order.end(), [this](unsigned a, unsigned b) {
+    return _envStats[a].nanos > _envStats[b].nanos;
+  });
+
+  std::string report = "command,calls,total_us,average_ns\n";
+  char name[128];
+  char line[256];
+
+  for (unsigned i : order)
+  {
+    const EnvStats* stats = &_envStats[i];
+    getEnvName(name, sizeof(name), i);
+
+    snprintf(line, sizeof(line), "\"%s\",%llu,%.1f,%.0f\n", name, (unsigned long long)stats->calls,
+      stats->nanos / 1000.0, (double)stats->nanos / stats->calls);
+    report.append(line);
+  }
+
+  return report;
+}
+
+void libretro::Core::logEnvStats() const
+{
+  uint64_t calls = 0, nanos = 0;
+
+  for (unsigned i = 0; i < kEnvCommands; i++)
+  {
+    calls += _envStats[i].calls;
+    nanos += _envStats[i].nanos;
+  }
+
+  if (calls != 0)
+  {
+    _logger->info(TAG "%llu environment calls took %.3f ms", (unsigned long long)calls, nanos / 1e6);
+  }
+}
+
+bool libretro::Core::dispatchEnvironment(unsigned cmd, void* data)
 {
   bool ret;
   char name[128];
@@ -1362,6 +1914,10 @@ bool libretro::Core::environmentCallback(unsigned cmd, void* data)
     ret = getLogInterface((struct retro_log_callback*)data);
     break;
 
+  case RETRO_ENVIRONMENT_GET_VFS_INTERFACE:
+    ret = getVfsInterface((struct retro_vfs_interface_info*)data);
+    break;
+
   case RETRO_ENVIRONMENT_GET_CORE_ASSETS_DIRECTORY:
     ret = getCoreAssetsDirectory((const char**)data);
     break;
@@ -1427,6 +1983,8 @@ bool libretro::Core::environmentCallback(unsigned cmd, void* data)
     break;
 
   default:
+    metrics::add(metrics::kCoreUnsupportedCalls);
+
     /* we don't care about private events */
     if (cmd & RETRO_ENVIRONMENT_PRIVATE)
       return false;
@@ -1520,61 +2078,65 @@ void libretro::Core::logCallback(enum retro_log_level level, const char *fmt, va
 
 bool libretro::Core::s_environmentCallback(unsigned cmd, void* data)
 {
-  if (s_instance)
-    return s_instance->environmentCallback(cmd, data);
+  libretro::Core* core = currentInstance();
+
+  if (core)
+    return core->environmentCallback(cmd, data);
 
   return false;
 }
 
 void libretro::Core::s_videoRefreshCallback(const void* data, unsigned width, unsigned height, size_t pitch)
 {
-  s_instance->videoRefreshCallback(data, width, height, pitch);
+  currentInstance()->videoRefreshCallback(data, width, height, pitch);
 }
 
 size_t libretro::Core::s_audioSampleBatchCallback(const int16_t* data, size_t frames)
 {
-  return s_instance->audioSampleBatchCallback(data, frames);
+  return currentInstance()->audioSampleBatchCallback(data, frames);
 }
 
 void libretro::Core::s_audioSampleCallback(int16_t left, int16_t right)
 {
-  s_instance->audioSampleCallback(left, right);
+  currentInstance()->audioSampleCallback(left, right);
 }
 
 int16_t libretro::Core::s_inputStateCallback(unsigned port, unsigned device, unsigned index, unsigned id)
 {
-  return s_instance->inputStateCallback(port, device, index, id);
+  return currentInstance()->inputStateCallback(port, device, index, id);
 }
 
 void libretro::Core::s_inputPollCallback()
 {
-  s_instance->inputPollCallback();
+  currentInstance()->inputPollCallback();
 }
 
 uintptr_t libretro::Core::s_getCurrentFramebuffer()
 {
-  return s_instance->getCurrentFramebuffer();
+  return currentInstance()->getCurrentFramebuffer();
 }
 
 retro_proc_address_t libretro::Core::s_getProcAddress(const char* symbol)
 {
-  return s_instance->getProcAddress(symbol);
+  return currentInstance()->getProcAddress(symbol);
 }
 
 void libretro::Core::s_logCallback(enum retro_log_level level, const char *fmt, ...)
 {
-  if (!s_instance)
+  libretro::Core* core = currentInstance();
+
+  if (!core)
     return;
 
   va_list args;
   va_start(args, fmt);
-  s_instance->_logger->vprintf(level, fmt, args);
+  core->_logger->vprintf(level, fmt, args);
   va_end(args);
 }
 
 bool libretro::Core::s_setRumbleCallback(unsigned port, enum retro_rumble_effect effect, uint16_t strength)
 {
-  return s_instance->setRumble(port, effect, strength);
+  return currentInstance()->setRumble(port, effect, strength);
 }
 
 bool libretro::Core::setRumble(unsigned port, enum retro_rumble_effect effect, uint16_t strength)
@@ -28,6 +28,9 @@ SOFTWARE.
 #include "Components.h"
 
 #include <stdarg.h>
+#include <stdint.h>
+
+#include <string>
 
 namespace libretro
 {
@@ -37,12 +40,20 @@ namespace libretro
   class Core
   {
   public:
+    ~Core();
+
     bool init(const Components* components);
     bool loadCore(const char* core_path);
     bool initCore();
-    bool loadGame(const char* game_path, void* data, size_t size);
+    bool loadGame(const char* game_path, const void* data, size_t size);
 
-    void destroy();
+    /* keepLoaded only calls retro_deinit and leaves the core's module in
+     * memory, so loading the same core again only has to call retro_init */
+    void destroy(bool keepLoaded = false);
+
+    /* Unloads a core left in memory by destroy(true), must not be called while
+     * a core is in use */
+    void release();
     
     void step(bool generateVideo, bool generateAudio);
 
@@ -60,7 +71,7 @@ namespace libretro
     inline bool                    getNeedsHardwareRender() const { return _needsHardwareRender; }
     inline bool                    getSupportsNoGame()      const { return _supportsNoGame; }
     inline bool                    getSupportAchievements() const { return _supportAchievements; }
-    inline void                    unloadGame()                   { _core.unloadGame(); }
+    void                           unloadGame();
     inline bool                    gameLoaded()             const { return _gameLoaded; }
 
     inline unsigned                getNumDiscs()            const { return (_diskControlInterface != NULL) ? _diskControlInterface->get_num_images() : 0; }
@@ -106,8 +117,40 @@ namespace libretro
     {
       return &_memoryMap;
     }
+
+    /* Descriptor that maps the address, the first one in the map if more than one does */
+    const struct retro_memory_descriptor* getMemoryDescriptor(size_t address) const;
+
+    /* Changes whenever the core may have moved its memory around */
+    inline unsigned getMemoryMapVersion() const
+    {
+      return _memoryMapVersion;
+    }
+
+    /* Environment calls made by the core since it was loaded, as CSV with the commands that
+     * took the most time first */
+    std::string getEnvReport() const;
     
   protected:
+    enum { kEnvCommands = 128 };
+
+    struct EnvStats
+    {
+      uint64_t calls;
+      uint64_t nanos;
+    };
+
+    /* Commands that cores may send every frame, called without going through the switch */
+    struct HotEnv
+    {
+      unsigned cmd;
+      bool (*handler)(Core* self, void* data);
+    };
+
+    static const HotEnv* getHotEnv();
+    bool dispatchEnvironment(unsigned cmd, void* data);
+    void logEnvStats() const;
+
     // Initialization
     bool initAV();
     void reset();
@@ -149,6 +192,7 @@ namespace libretro
     bool setSubsystemInfo(const struct retro_subsystem_info* data);
     bool setControllerInfo(const struct retro_controller_info* data);
     bool setMemoryMaps(const struct retro_memory_map* data);
+    void indexMemoryMap();
     bool setGeometry(const struct retro_game_geometry* data);
     bool getUsername(const char** data) const;
     bool getLanguage(unsigned* data) const;
@@ -159,6 +203,7 @@ namespace libretro
     bool setCoreOptions(const struct retro_core_option_definition* data);
     bool setCoreOptionsIntl(const struct retro_core_options_intl* data);
     bool setCoreOptionsDisplay(const struct retro_core_option_display* data);
+    bool getVfsInterface(struct retro_vfs_interface_info* data);
 
     // Callbacks
     bool                 environmentCallback(unsigned cmd, void* data);
@@ -172,7 +217,7 @@ namespace libretro
     void                 logCallback(enum retro_log_level level, const char *fmt, va_list args);
     bool                 setRumble(unsigned port, enum retro_rumble_effect effect, uint16_t strength);
 
-    // Static callbacks that use s_instance to call into the core's implementation
+    // Static callbacks that look up the instance to call into the core's implementation
     static bool                 s_environmentCallback(unsigned cmd, void* data);
     static void                 s_videoRefreshCallback(const void* data, unsigned width, unsigned height, size_t pitch);
     static size_t               s_audioSampleBatchCallback(const int16_t* data, size_t frames);
@@ -224,7 +269,13 @@ namespace libretro
     const struct retro_disk_control_callback* _diskControlInterface;
 
     struct retro_memory_map         _memoryMap;
+    unsigned                        _memoryMapVersion;
+    size_t                          _memoryMapBoundaryCount;
+    size_t*                         _memoryMapBoundaries;   /* sorted starts and ends of the descriptors */
+    unsigned*                       _memoryMapFirst;        /* first candidate of each interval between boundaries */
+    unsigned*                       _memoryMapCandidates;   /* descriptors covering each interval */
 
-    uint8_t                         _calls[128 / 8];
+    uint8_t                         _calls[kEnvCommands / 8];
+    EnvStats                        _envStats[kEnvCommands];
   };
 }
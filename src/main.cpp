@@ -59,13 +59,26 @@ void loadROM(const char* path)
   app.loadGame(path);
 }
 
+// where the log is written when the application crashes
+#define CRASH_LOG "crash.log"
+
 extern "C" void abort_handler(int signal_number)
 {
   app.logger().error("[APP] abort() called");
+  app.logger().dump(CRASH_LOG);
   app.unloadCore();
   app.destroy();
 }
 
+#if defined(MINGW) || defined(__MINGW32__) || defined(__MINGW64__)
+static LONG WINAPI crash_handler(EXCEPTION_POINTERS* info)
+{
+  app.logger().error("[APP] Unhandled exception %08X", (unsigned)info->ExceptionRecord->ExceptionCode);
+  app.logger().dump(CRASH_LOG);
+  return EXCEPTION_CONTINUE_SEARCH;
+}
+#endif
+
 int main(int argc, char* argv[])
 {
   signal(SIGABRT, &abort_handler);
@@ -75,6 +88,7 @@ int main(int argc, char* argv[])
   if (ok)
   {
 #if defined(MINGW) || defined(__MINGW32__) || defined(__MINGW64__)
+    SetUnhandledExceptionFilter(crash_handler);
     app.run();
 #else
     __try
@@ -84,6 +98,7 @@ int main(int argc, char* argv[])
     __except (EXCEPTION_EXECUTE_HANDLER)
     {
       app.logger().error("[APP] Unhandled exception %08X", GetExceptionCode());
+      app.logger().dump(CRASH_LOG);
     }
 #endif
 
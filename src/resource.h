@@ -88,3 +88,24 @@ along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
 #define IDM_INPUT_CONTROLLER_2                  40015
 #define IDM_MANAGE_CORES                        40016
 #define IDM_SAVING_CONFIG                       40017
+#define IDM_AUDIO_CONFIG                        40018
+#define IDM_FRAME_TIMING_OVERLAY                40019
+#define IDM_FRAME_TIMING_EXPORT                 40020
+#define IDM_RUNAHEAD_CONFIG                     40021
+#define IDM_REWIND_CONFIG                       40022
+#define IDM_MEMORY_SNAPSHOT                     40023
+#define IDM_MEMORY_SEARCH                       40024
+#define IDM_KEEP_CORES_LOADED                   40025
+#define IDM_PRELOAD_CORES                       40026
+#define IDM_RECORD_MOVIE                        40027
+#define IDM_PLAY_MOVIE                          40028
+#define IDM_STOP_MOVIE                          40029
+#define IDM_LATE_INPUT                          40030
+#define IDM_LATENCY_TEST                        40031
+#define IDM_ENV_CALLS_EXPORT                    40032
+#define IDM_NETPLAY_CONFIG                      40033
+#define IDM_RECORD_VIDEO                        40034
+#define IDM_STOP_VIDEO                          40035
+#define IDM_TURBO_CONFIG                        40036
+#define IDM_THREADS_CONFIG                      40037
+#define IDM_LOW_LATENCY_AUDIO                   40038